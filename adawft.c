@@ -25,15 +25,30 @@
 #include <sys/stat.h>		// for mkdir()
 #include <assert.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include "types.h"
 #include "face_new.h"
 #include "adawft.h"
 #include "bytes.h"
 #include "bmp.h"
+#include "pool.h"
+#include "rle.h"
+#include "hash.h"
+#include "cache.h"
+#include "deflate.h"
+#include "png.h"
+#include "qoi.h"
+#include "output.h"
+#include "archive.h"
 #include "dump.h"
+#include "face.h"
+#include "render.h"
+#include "process.h"
+#include "batch.h"
+#include "pack.h"
+#include "server.h"
 #include "strutil.h"
-#include "cjson/cJSON.h"
 
 
 //----------------------------------------------------------------------------
@@ -57,16 +72,6 @@ static const ApiVerInfo API_VER_INFO[] = {
 };
 
 
-//----------------------------------------------------------------------------
-//  PRINT OFFSET, WIDTH, HEIGHT ARRAY TO STRING
-//----------------------------------------------------------------------------
-void printOwh(OffsetWidthHeight * owh, size_t count, const char * name) {
-	for(size_t i=0; i<count; i++) {
-		dprintf(3, "%s[%zu]    0x%08X, %3u, %3u\n", name, i, owh[i].offset, owh[i].width, owh[i].height);
-	}
-}
-
-
 //----------------------------------------------------------------------------
 //  NULLCHECK - check for null errors (e.g. out of memory)
 //----------------------------------------------------------------------------
@@ -86,16 +91,104 @@ void nullcheck(void * ptr, ...) {
 }
 
 
+
+//----------------------------------------------------------------------------
+//  CLIENTARGS - pass the command line options a request uses on to the server
+//----------------------------------------------------------------------------
+#ifndef WINDOWS
+static void clientArgs(char * buf, size_t bufSize, ServeOp op, const ProcessOptions * opt, u32 width, u32 height, u32 image) {
+	int len = snprintf(buf, bufSize, "format=%s\n", dumpFormatStr(opt->format));
+	if(op == SERVE_RENDER) {
+		const RenderState * rs = &opt->renderState;
+		snprintf(&buf[len], bufSize - (size_t)len, "time=%lld\nsteps=%d\nhr=%d\nbattery=%d\nkcal=%d\nweather=%d\n",
+			(long long)opt->renderTime, rs->steps, rs->heartRate, rs->battery, rs->kcal, rs->weather);
+	} else if(op == SERVE_CONVERT && width != 0 && height != 0) {
+		snprintf(&buf[len], bufSize - (size_t)len, "width=%u\nheight=%u\n", width, height);
+	} else if(op == SERVE_IMAGE) {
+		snprintf(&buf[len], bufSize - (size_t)len, "image=%u\n", image);
+	}
+}
+#endif
+
+
+//----------------------------------------------------------------------------
+//  PROCESSBATCH - process many faces in one go, each dumped to its own folder
+//----------------------------------------------------------------------------
+static int processBatch(const FileList * inputs, const char * folderName, const ProcessOptions * opt) {
+	if(inputs->count == 0) {
+		dprintf(0, "ERROR: No input files found.\n");
+		return 1;
+	}
+	if((opt->dump || opt->render) && !outputArchiving()) {
+		d_mkdir(folderName, 0777);		// may already exist
+	}
+
+	// The thread pool and its workers carry over from one face to the next
+	size_t failed = 0;
+	char faceFolder[1024];
+	for(size_t i=0; i<inputs->count; i++) {
+		dprintf(1, "[%zu/%zu] %s\n", i+1, inputs->count, inputs->paths[i]);
+		int len = snprintf(faceFolder, sizeof(faceFolder), "%s%s%s", folderName, DIR_SEPERATOR, inputs->outNames[i]);
+		if(len < 0 || (size_t)len >= sizeof(faceFolder)) {
+			dprintf(0, "ERROR: Output path too long for %s\n", inputs->paths[i]);
+			failed++;
+			continue;
+		}
+		if((opt->dump || opt->render) && !outputArchiving()) {
+			d_mkdir(faceFolder, 0777);
+		}
+		if(processFace(inputs->paths[i], faceFolder, opt) != 0) {
+			failed++;
+		}
+	}
+
+	dprintf(0, "Batch: %zu face(s) processed, %zu failed.\n", inputs->count, failed);
+	return failed ? 1 : 0;
+}
+
+
 //----------------------------------------------------------------------------
 //  MAIN
 //----------------------------------------------------------------------------
 int main(int argc, char * argv[]) {
 	char * fileName = "";
 	char * folderName = "dump";
-	Format format = FMT_BMP;
-	bool dump = false;
+	ProcessOptions opt;
+	opt.format = FMT_BMP;
+	opt.dump = false;
+	opt.link = false;
+	opt.cache = NULL;
+	const char * cacheFolder = NULL;
+	const char * archiveName = NULL;
+	char archiveDefault[1100];
+	Archive * archive = NULL;
+	opt.render = false;
+	opt.renderName = "render.bmp";
+	renderStateInit(&opt.renderState);
+	opt.renderTime = time(NULL);
+	opt.frames = 1;
+	opt.frameStep = 1;
+	opt.video = false;
 	bool showHelp = false;
+	bool ioStats = false;
 	bool fileNameSet = false;
+	bool batch = false;
+	bool pack = false;
+	const char * packFolder = NULL;
+	RleMode packMode = RLE_BEST;
+	const char * serveSocket = NULL;
+	const char * clientSocket = NULL;
+	ServeOp clientOp = SERVE_INDEX;
+	const char * clientOutName = "-";
+	OutFile * clientOut = NULL;
+	u32 clientWidth = 0;
+	u32 clientImage = 0;
+	u32 clientHeight = 0;
+	FileList * inputs = newFileList();
+	if(inputs == NULL) {
+		dprintf(0, "ERROR: Out of memory\n");
+		return 1;
+	}
 
 	// check byte order
 	if(!systemIsLittleEndian()) {
@@ -117,13 +210,20 @@ int main(int argc, char * argv[]) {
 	// read command-line parameters
 	for(int i=1; i<argc; i++) {
 		if(streq(argv[i], "--bin")) {
-			format = FMT_BIN;
+			opt.format = FMT_BIN;
 		} else if(streq(argv[i], "--raw")) {
-			format = FMT_RAW;
+			opt.format = FMT_RAW;
 		} else if(streq(argv[i], "--bmp")) {
-			format = FMT_BMP;
+			opt.format = FMT_BMP;
+		} else if(streq(argv[i], "--qoi")) {
+			opt.format = FMT_QOI;
+		} else if(streq(argv[i], "--png")) {
+			opt.format = FMT_PNG;
+		} else if(streqn(argv[i], "--png-level=", 12)) {
+			opt.format = FMT_PNG;
+			setDefaultPngLevel(atoi(&argv[i][12]));
 		} else if(streqn(argv[i], "--dump", 6)) {
-			dump = true;
+			opt.dump = true;
 			if(strlen(argv[i]) >= 8 && argv[i][6] == '=') {
 				folderName = &argv[i][7];
 			}
@@ -132,7 +232,93 @@ int main(int argc, char * argv[]) {
 			if(strlen(argv[i]) >= 9 && argv[i][7] == '=') {
 				DEBUG_LEVEL = atoi(&argv[i][8]);
 			}
-		}else if(streqn(argv[i], "--help", 6)) {
+		} else if(streqn(argv[i], "--pack", 6)) {
+			pack = true;
+			if(strlen(argv[i]) >= 8 && argv[i][6] == '=') {
+				packFolder = &argv[i][7];
+			}
+		} else if(streqn(argv[i], "--archive", 9)) {
+			opt.dump = true;
+			archiveName = "";
+			if(strlen(argv[i]) >= 11 && argv[i][9] == '=') {
+				archiveName = &argv[i][10];
+			}
+		} else if(streqn(argv[i], "--cache=", 8)) {
+			cacheFolder = &argv[i][8];
+		} else if(streq(argv[i], "--prealloc")) {
+			setOutputPreallocate(true);
+		} else if(streq(argv[i], "--io-stats")) {
+			ioStats = true;
+		} else if(streq(argv[i], "--link")) {
+			opt.link = true;
+		} else if(streq(argv[i], "--fast")) {
+			packMode = RLE_FAST;
+		} else if(streq(argv[i], "--batch")) {
+			batch = true;
+		} else if(streqn(argv[i], "--threads=", 10)) {
+			unsigned threads;
+			if(readUnsigned(&argv[i][10], POOL_MAX_THREADS, &threads)) {
+				setDefaultPoolThreads(threads);
+			} else {
+				dprintf(0, "ERROR: --threads must be a number from 0 to %u\n", POOL_MAX_THREADS);
+				showHelp = true;
+			}
+		} else if(streqn(argv[i], "--render", 8)) {
+			opt.render = true;
+			if(strlen(argv[i]) >= 10 && argv[i][8] == '=') {
+				opt.renderName = &argv[i][9];
+			}
+		} else if(streqn(argv[i], "--time=", 7)) {
+			time_t t;
+			if(parseTime(&argv[i][7], &t) != 0) {
+				dprintf(0, "ERROR: Can't read time: %s\n", &argv[i][7]);
+				showHelp = true;
+			} else {
+				renderStateSetTime(&opt.renderState, t);
+				opt.renderTime = t;
+			}
+		} else if(streqn(argv[i], "--frames=", 9)) {
+			opt.render = true;
+			opt.frames = (unsigned)atoi(&argv[i][9]);
+			if(opt.frames < 1) {
+				opt.frames = 1;
+			}
+		} else if(streqn(argv[i], "--step=", 7)) {
+			opt.frameStep = atoi(&argv[i][7]);
+		} else if(streq(argv[i], "--video")) {
+			opt.video = true;
+		} else if(streqn(argv[i], "--steps=", 8)) {
+			opt.renderState.steps = atoi(&argv[i][8]);
+		} else if(streqn(argv[i], "--hr=", 5)) {
+			opt.renderState.heartRate = atoi(&argv[i][5]);
+		} else if(streqn(argv[i], "--battery=", 10)) {
+			opt.renderState.battery = atoi(&argv[i][10]);
+		} else if(streqn(argv[i], "--kcal=", 7)) {
+			opt.renderState.kcal = atoi(&argv[i][7]);
+		} else if(streqn(argv[i], "--weather=", 10)) {
+			opt.renderState.weather = atoi(&argv[i][10]);
+		} else if(streqn(argv[i], "--serve=", 8)) {
+			serveSocket = &argv[i][8];
+		} else if(streqn(argv[i], "--client=", 9)) {
+			clientSocket = &argv[i][9];
+		} else if(streqn(argv[i], "--request=", 10)) {
+			int op = serveOpFromStr(&argv[i][10]);
+			if(op < 0) {
+				dprintf(0, "ERROR: Unknown request: %s\n", &argv[i][10]);
+				showHelp = true;
+			} else {
+				clientOp = (ServeOp)op;
+			}
+		} else if(streqn(argv[i], "--out=", 6)) {
+			clientOutName = &argv[i][6];
+		} else if(streqn(argv[i], "--size=", 7)) {
+			if(sscanf(&argv[i][7], "%ux%u", &clientWidth, &clientHeight) != 2) {
+				dprintf(0, "ERROR: Can't read size: %s\n", &argv[i][7]);
+				showHelp = true;
+			}
+		} else if(streqn(argv[i], "--image=", 8)) {
+			clientImage = (u32)atoi(&argv[i][8]);
+		} else if(streqn(argv[i], "--help", 6)) {
 			showHelp = true;
 		} else if(streqn(argv[i], "--", 2)) {
 			dprintf(0, "ERROR: Unknown option: %s\n", argv[i]);
@@ -142,337 +328,184 @@ int main(int argc, char * argv[]) {
 			if(!fileNameSet) {
 				fileName = argv[i];
 				fileNameSet = true;
-			} else {
-				dprintf(0, "WARNING: Ignored unknown parameter: %s\n", argv[i]);
+			} else if(!batch) {
+				dprintf(0, "WARNING: Ignored unknown parameter: %s (use --batch for multiple files)\n", argv[i]);
 			}
 		}
 	}
 
+	// In batch mode every non-option parameter is an input: a file, a folder, or '-' for a list on stdin
+	for(int i=1; batch && i<argc; i++) {
+		if(streqn(argv[i], "--", 2)) {
+			continue;
+		}
+		int errors = streq(argv[i], "-") ? fileListAddStream(inputs, stdin) : fileListAddPath(inputs, argv[i]);
+		if(errors) {
+			dprintf(0, "WARNING: %d problem(s) adding input %s\n", errors, argv[i]);
+		}
+	}
+
+	// Everything dumped goes into one archive. On stdout, the archive takes stdout over before
+	// anything is printed, and messages go to stderr instead.
+	if(archiveName != NULL && !pack && argc >= 2 && !showHelp) {
+		if(archiveName[0] == '\0') {
+			snprintf(archiveDefault, sizeof(archiveDefault), "%s.tar", folderName);
+			archiveName = archiveDefault;
+		}
+		archive = newArchive(archiveName);
+		if(archive == NULL) {
+			inputs = deleteFileList(inputs);
+			return 1;
+		}
+		setOutputArchive(archive, folderName);
+	}
+
+	// The client's reply can go to stdout in the same way
+	if(clientSocket != NULL && argc >= 2 && !showHelp) {
+		clientOut = streq(clientOutName, "-") ? outputOpenStdout() : outputOpen(clientOutName, 0);
+		if(clientOut == NULL) {
+			dprintf(0, "ERROR: Can't open %s for writing.\n", clientOutName);
+			inputs = deleteFileList(inputs);
+			return 1;
+		}
+	}
+
 	// display basic program header
     dprintf(1, "\n%s\n\n","adawft: Alternate Da Watch Face Tool for MO YOUNG / DA FIT binary watch face files.");
  
 	// display help
     if(argc<2 || showHelp) {
-		dprintf(0, "Usage:   %s [OPTIONS] FILENAME\n\n",basename);
+		inputs = deleteFileList(inputs);
+		dprintf(0, "Usage:   %s [OPTIONS] FILENAME\n",basename);
+		dprintf(0, "         %s --batch [OPTIONS] FILE|FOLDER|- ...\n",basename);
+		dprintf(0, "         %s --pack[=FOLDERNAME] [--fast] FILENAME\n",basename);
+		dprintf(0, "         %s --serve=SOCKET [OPTIONS]\n",basename);
+		dprintf(0, "         %s --client=SOCKET --request=OP [--out=FILE] [OPTIONS] FILENAME\n\n",basename);
 		dprintf(0, "%s\n","  OPTIONS");
 		dprintf(0, "%s\n","    --dump=FOLDERNAME    Dump data to folder. Folder name defaults to 'dump'.");
 		dprintf(0, "%s\n","    --bmp                When dumping, dump BMP (windows bitmap) files. Default.");
 		dprintf(0, "%s\n","    --raw                When dumping, dump raw (decompressed raw bitmap) files.");
+		dprintf(0, "%s\n","    --png                When dumping, dump PNG files.");
+		dprintf(0, "%s\n","    --png-level=N        PNG compression effort, 0 (none, fastest) to 9 (smallest). Default 6.");
+		dprintf(0, "%s\n","    --qoi                When dumping, dump QOI (quite OK image) files. Fast, and keeps alpha.");
 		dprintf(0, "%s\n","    --bin                When dumping, dump binary (rle compressed) files.");
+		dprintf(0, "%s\n","    --link               When dumping, make an image identical to one already dumped a hard");
+		dprintf(0, "%s\n","                         link to it instead of writing it again.");
+		dprintf(0, "%s\n","    --archive[=FILENAME] Dump everything into one tar file instead of the dump folder, which");
+		dprintf(0, "%s\n","                         only names the files inside it. Defaults to FOLDERNAME.tar; '-' for stdout.");
+		dprintf(0, "%s\n","    --cache=FOLDERNAME   Keep converted images in this folder, and reuse them in later runs.");
+		dprintf(0, "%s\n","    --prealloc           Reserve space for large output files before writing them.");
+		dprintf(0, "%s\n","    --io-stats           Report how many files were written, and how long each took.");
+		dprintf(0, "%s\n","    --batch              Process many faces. Inputs may be files, folders (searched recursively),");
+		dprintf(0, "%s\n","                         or '-' to read a list of paths from stdin. Each face is dumped to");
+		dprintf(0, "%s\n","                         its own folder inside the dump folder.");
+		dprintf(0, "%s\n","    --render[=FILENAME]  Render the face to a BMP in the dump folder. Defaults to 'render.bmp'.");
+		dprintf(0, "%s\n","    --time=TIME          Time to render: 'YYYY-MM-DD HH:MM[:SS]', 'HH:MM[:SS]' or seconds since");
+		dprintf(0, "%s\n","                         1970. Local time. Defaults to now.");
+		dprintf(0, "%s\n","    --steps=N --hr=N --battery=N --kcal=N --weather=N");
+		dprintf(0, "%s\n","                         Sensor values to render. Weather is the icon number.");
+		dprintf(0, "%s\n","    --frames=N           Render N frames, starting at --time, as FILENAME_0000.bmp etc.");
+		dprintf(0, "%s\n","    --step=SECONDS       Time between frames. Defaults to 1 (a second hand sweep).");
+		dprintf(0, "%s\n","    --video              Write the frames to one raw video file, FILENAME.bgra, instead.");
+		dprintf(0, "%s\n","    --pack[=FOLDERNAME]  Build FILENAME from watchface.json and the images (bmp, qoi, raw or bin)");
+		dprintf(0, "%s\n","                         in the folder. Folder name defaults to the dump folder.");
+		dprintf(0, "%s\n","    --fast               When packing, compress quickly instead of as small as possible.");
+		dprintf(0, "%s\n","    --serve=SOCKET       Run as a server on a Unix domain socket until stopped, answering index,");
+		dprintf(0, "%s\n","                         dump, render, convert and image requests in memory. Uses --cache and --link.");
+		dprintf(0, "%s\n","    --client=SOCKET      Send FILENAME to a server. The format, --time and sensor values go with it.");
+		dprintf(0, "%s\n","    --request=OP         What the client asks for: index (JSON, the default), dump (a tar, as");
+		dprintf(0, "%s\n","                         --archive), render (an image), convert (an image file to --FORMAT) or");
+		dprintf(0, "%s\n","                         image (one image of the face, decoding no others).");
+		dprintf(0, "%s\n","    --out=FILE           Where the client writes the reply. Defaults to stdout.");
+		dprintf(0, "%s\n","    --size=WxH           For convert, FILENAME is RLE compressed data (as from --bin) of this size.");
+		dprintf(0, "%s\n","    --image=N            For image, which one: 0 (the default) is the preview, then header order.");
+		dprintf(0, "%s\n","    --threads=N          Number of threads used for decoding. Defaults to all cores.");
 		dprintf(0, "%s\n","    --debug=LEVEL        Print more debug info. Range 0 to 3.");
 		dprintf(0, "%s\n","  FILENAME               Binary watch face file for input.");
 		dprintf(0, "\n");
 		return 0;
     }
 
-	// Open the binary input file
-	Bytes * bytes = newBytesFromFile(fileName);
-	if(bytes == NULL) {
-		dprintf(0, "ERROR: Failed to read file into memory.\n");
-		return 1;
-	}
-
-	u8 * fileData = bytes->data;
-	size_t fileSize = bytes->size;
-
-	// Check file size
-	if(fileSize < sizeof(FaceHeaderN)) {
-		dprintf(0, "ERROR: File is less than the header size (%zu bytes)!\n", sizeof(FaceHeaderN));
-		deleteBytes(bytes);
-		return 1;
-	}
-
-	// Load header struct from file
-	FaceHeaderN * h = (FaceHeaderN *)&fileData[0];		// interpret it directly
-
-	// Print header info	
-	dprintf(2, "apiVer          %u\n", h->apiVer);
-	dprintf(2, "unknown         0x%04X\n", h->unknown);
-	dprintf(2, "previewOffset   0x%04X\n", h->previewOffset);
-	dprintf(2, "previewWidth    %u\n", h->previewWidth);
-	dprintf(2, "previewHeight   %u\n", h->previewHeight);
-	dprintf(2, "dhOffset        0x%04X\n", h->dhOffset);
-	dprintf(2, "bhOffset        0x%04X\n", h->bhOffset);
-	
-	// Create JSON structure to hold all the data
-	cJSON * cj = cJSON_CreateObject();
-	nullcheck(cj);
-	cJSON_AddStringToObject(cj, "type_str", "extrathunder watchface");
-	cJSON_AddNumberToObject(cj, "rev", 0);
-	cJSON_AddNumberToObject(cj, "tpls", 0);
-	cJSON_AddNumberToObject(cj, "api_ver", h->apiVer);
-	cJSON_AddNumberToObject(cj, "unknown", h->unknown);
-	//cJSON_AddNumberToObject(cj, "preview_offset", h->previewOffset);
-	//cJSON_AddNumberToObject(cj, "preview_w", h->previewWidth);
-	//cJSON_AddNumberToObject(cj, "preview_h", h->previewHeight);
-	cJSON * cjpreview = cJSON_AddObjectToObject(cj, "preview_img_data");
-	cJSON * cjdigits = cJSON_AddArrayToObject(cj, "digits");
-	cJSON * cjelements = cJSON_AddArrayToObject(cj, "elements");
-	nullcheck(cjpreview, cjdigits, cjelements);
-
-	// Create a buffer for storing the dump filenames
-	char dfnBuf[1024];
-	char fnBuf[32];
-	snprintf(dfnBuf, sizeof(dfnBuf), "%s%s", folderName, DIR_SEPERATOR);
-	size_t baseSize = strlen(dfnBuf);
-	if(baseSize + 32 >= sizeof(dfnBuf)) {
-		dprintf(0, "ERROR: dfnBuf too small!\n");
-		deleteBytes(bytes);
-		return 1;
-	}
-
-	// Save the preview image
-	if (dump) {
-		sprintf(fnBuf, "preview.%s", dumpFormatStr(format));
-		sprintf(&dfnBuf[baseSize], "%s", fnBuf);
-		dumpImage(dfnBuf, &fileData[h->previewOffset], h->previewWidth, h->previewHeight, format);
-		cJSON_AddNumberToObject(cjpreview, "w", h->previewWidth);
-		cJSON_AddNumberToObject(cjpreview, "h", h->previewHeight);
-		cJSON_AddStringToObject(cjpreview, "file_name", fnBuf);
+	// The cache is shared by every face in a batch
+	if(cacheFolder != NULL && (opt.dump || batch || serveSocket != NULL)) {
+		opt.cache = newImageCache(cacheFolder);
+		if(opt.cache == NULL) {
+			inputs = deleteFileList(inputs);
+			return 1;
+		}
 	}
 
-	u16 digitsCounter = 0;			// A counter to count digit sets
-	u16 imageCounter = 0;			// A counter to count images
-	char sbuf[32];					// Buffer for temporary string data
-
-	// First we check the digits headers. They come before the background header
-
-	size_t offset = h->dhOffset;	// Usually 0x10
-	
-	// Read the introduction to the digit section 0x0101
-	u16 digitSectionStart = get_u16(&fileData[offset]);
-	if(digitSectionStart != 0x0101) {
-		dprintf(0, "WARNING: Unknown start to digits section 0x%04X\n", digitSectionStart);
-	}
-	offset += 2;
-	
-	while((offset < h->bhOffset) && (h->dhOffset != 0)) {	// while we are in the digits section, and the digits section actually exists
-		DigitsHeader * dh = (DigitsHeader *)&fileData[offset];
-		dprintf(2, "@ 0x%08zX  DigitsHeader (%u)\n", offset, dh->digitSet);
-		sprintf(sbuf, "digit[%u].owh", dh->digitSet);
-		printOwh(&dh->owh[0], 10, sbuf);					// print all the details
-		if(dump) {
-			cJSON * digits = cJSON_CreateObject();
-			cJSON * arr = cJSON_AddArrayToObject(digits, "img_data");
-			cJSON_AddNumberToObject(digits, "unknown", dh->unknown);
-			for(size_t i=0; i<10; i++) {
-				sprintf(fnBuf, "digit_%u_%zu.%s", dh->digitSet, i, dumpFormatStr(format));
-				sprintf(&dfnBuf[baseSize], "%s", fnBuf);
-				dumpImage(dfnBuf, &fileData[dh->owh[i].offset], dh->owh[i].width, dh->owh[i].height, format);
-				cJSON * obj = cJSON_CreateObject();
-				cJSON_AddNumberToObject(obj, "w", dh->owh[i].width);
-				cJSON_AddNumberToObject(obj, "h", dh->owh[i].height);
-				cJSON_AddStringToObject(obj, "file_name", fnBuf);
-				cJSON_AddItemToArray(arr, obj);
+	// Process the face(s)
+	int rval = 0;
+	if(pack) {
+		Bytes * b = packFace(packFolder ? packFolder : folderName, packMode);
+		if(b == NULL || saveBytesToFile(b, fileName) != 0) {
+			dprintf(0, "ERROR: Failed to pack %s\n", fileName);
+			rval = 1;
+		}
+		deleteBytes(b);
+	} else if(serveSocket != NULL || clientSocket != NULL) {
+#ifndef WINDOWS
+		if(serveSocket != NULL) {
+			ServeOptions so = { opt.cache, opt.link };
+			Server * server = newServer(serveSocket, &so);
+			if(server == NULL) {
+				rval = 1;
+			} else {
+				serverStopOnSignals(server);
+				rval = serverRun(server);
+				server = deleteServer(server);
 			}
-			cJSON_AddItemToArray(cjdigits, digits);
+		} else {
+			char args[256];
+			clientArgs(args, sizeof(args), clientOp, &opt, clientWidth, clientHeight, clientImage);
+			rval = serveClient(clientSocket, clientOp, args, fileName, clientOut);
 		}
-		offset += sizeof(DigitsHeader);
-		digitsCounter++;
+#else
+		dprintf(0, "ERROR: --serve and --client aren't available on Windows.\n");
+		rval = 1;
+#endif
+	} else if(!batch) {
+		if(opt.render && !outputArchiving()) {
+			d_mkdir(folderName, 0777);		// may already exist
+		}
+		rval = processFace(fileName, folderName, &opt);
+	} else {
+		rval = processBatch(inputs, folderName, &opt);
 	}
 
-	// Now we check the rest of the headers
-
-	offset = h->bhOffset;
-	bool more = true;
-	while(more) {
-		u8 one = fileData[offset];
-		u8 e_type = fileData[offset+1];
-		if(one==0) {
-			// End of header section
-			dprintf(2, "@ 0x%08zX  00 (End of headers)\n", offset);
-			offset += 2;
-			more = false;
-			break;
-		}
-		switch(e_type) {
-			case 0x00:
-				// ImageHeader for images (including the background)
-				ImageHeader * imageh = (ImageHeader *)&fileData[offset];
-				if(offset == h->bhOffset) {
-					dprintf(2, "@ 0x%08zX  ImageHeader (Background)\n", offset);
-				} else {
-					dprintf(2, "@ 0x%08zX  ImageHeader\n", offset);
-				}
-				sprintf(fnBuf, "image_%u.%s", imageCounter++, dumpFormatStr(format));
-				dprintf(3, "imageh.one     0x%02X\n", imageh->one);
-				dprintf(3, "imageh.xy      %3u, %3u\n", imageh->xy.x, imageh->xy.y);
-				dprintf(3, "imageh.owh     0x%08X, %3u, %3u\n", imageh->offset, imageh->width, imageh->height);					
-				if(dump) {
-					sprintf(&dfnBuf[baseSize], "%s", fnBuf);
-					dumpImage(dfnBuf, &fileData[imageh->offset], imageh->width, imageh->height, format);
-					cJSON * cjimg = cJSON_CreateObject();
-					//cJSON_AddNumberToObject(cjimg, "e_type", imageh->e_type);
-					cJSON_AddStringToObject(cjimg, "e_type", "image");
-					cJSON_AddNumberToObject(cjimg, "x", imageh->xy.x);
-					cJSON_AddNumberToObject(cjimg, "y", imageh->xy.y);
-					cJSON * cjimgdata = cJSON_CreateObject();
-					cJSON_AddNumberToObject(cjimgdata, "w", imageh->width);
-					cJSON_AddNumberToObject(cjimgdata, "h", imageh->height);
-					cJSON_AddStringToObject(cjimgdata, "file_name", fnBuf);
-					cJSON_AddItemToObject(cjimg, "img_data", cjimgdata);
-					cJSON_AddItemToArray(cjelements, cjimg);
-				}				
-				offset += sizeof(ImageHeader);
-				break;
-			case 0x02:
-				// TimeHeader
-				dprintf(2, "@ 0x%08zX  TimeHeader\n", offset);
-				TimeHeader * time = (TimeHeader *)&fileData[offset];
-				dprintf(3, "                digitSet: %u %u %u %u\n", time->digitSet[0], time->digitSet[1], time->digitSet[2], time->digitSet[3]);
-				if(dump) {
-					cJSON * cjtime = cJSON_CreateObject();
-					//cJSON_AddNumberToObject(cjtime, "e_type", time->e_type);
-					cJSON_AddStringToObject(cjtime, "e_type", "time_num");
-					int iArr[4] = { time->digitSet[0], time->digitSet[1], time->digitSet[2], time->digitSet[3] };
-					cJSON * cjarr = cJSON_CreateIntArray(iArr, 4);
-					cJSON_AddItemToObject(cjtime, "digit_sets", cjarr);
-					cjarr = cJSON_CreateArray();
-					for(int i=0; i<4; i++) {
-						cJSON * xy = cJSON_CreateObject();
-						cJSON_AddNumberToObject(xy, "x", time->xy[i].x);
-						cJSON_AddNumberToObject(xy, "y", time->xy[i].y);
-						cJSON_AddItemToArray(cjarr, xy);
-					}
-					cJSON_AddItemToObject(cjtime, "xys", cjarr);
-					int unkArr[12];
-					for(int i=0; i<12; i++) {
-						unkArr[i] = time->unknown[i];
-					}
-					cjarr = cJSON_CreateIntArray(unkArr, 12);
-					cJSON_AddItemToObject(cjtime, "unknown", cjarr);
-					cJSON_AddItemToArray(cjelements, cjtime);				
-				}								
-				offset += sizeof(TimeHeader);
-				break;				
-			case 0x04:
-				// DayNameHeader
-				dprintf(2, "@ 0x%08zX  DayNameHeader\n", offset);
-				DayNameHeader * dname = (DayNameHeader *)&fileData[offset];
-				if(dump) {
-					for(size_t i=0; i<7; i++) {
-						sprintf(&dfnBuf[baseSize], "dayname_%u_%zu.%s", dname->subtype, i, dumpFormatStr(format));
-						dumpImage(dfnBuf, &fileData[dname->owh[i].offset], dname->owh[i].width, dname->owh[i].height, format);
-					}
-				}				
-				offset += sizeof(DayNameHeader);
-				break;
-			case 0x05:
-				// BatteryFillHeader
-				dprintf(2, "@ 0x%08zX  BatteryFillHeader\n", offset);
-				BatteryFillHeader * batteryFill = (BatteryFillHeader *)&fileData[offset];
-				if(dump) {
-					sprintf(&dfnBuf[baseSize], "batteryfill_%u_.%s", 0, dumpFormatStr(format));
-					dumpImage(dfnBuf, &fileData[batteryFill->owh.offset], batteryFill->owh.width, batteryFill->owh.height, format);
-					sprintf(&dfnBuf[baseSize], "batteryfill_%u_.%s", 1, dumpFormatStr(format));
-					dumpImage(dfnBuf, &fileData[batteryFill->owh1.offset], batteryFill->owh1.width, batteryFill->owh1.height, format);
-					sprintf(&dfnBuf[baseSize], "batteryfill_%u_.%s", 2, dumpFormatStr(format));
-					dumpImage(dfnBuf, &fileData[batteryFill->owh2.offset], batteryFill->owh2.width, batteryFill->owh2.height, format);
-				}
-				offset += sizeof(BatteryFillHeader);
-				break;
-			case 0x06:
-				// HeartRateNumHeader
-				dprintf(2, "@ 0x%08zX  HeartRateNumHeader\n", offset);
-				HeartRateNumHeader * hrn = (HeartRateNumHeader *)&fileData[offset];
-				dprintf(3, "                digitSet: %u, justification: %u\n", hrn->digitSet, hrn->justification);
-				offset += sizeof(HeartRateNumHeader);
-				break;
-			case 0x07:
-				// StepsNumHeader
-				dprintf(2, "@ 0x%08zX  StepsNumHeader\n", offset);
-				StepsNumHeader * sn = (StepsNumHeader *)&fileData[offset];
-				dprintf(3, "                digitSet: %u, justification: %u\n", sn->digitSet, sn->justification);
-				offset += sizeof(StepsNumHeader);
-				break;
-			case 0x09:
-				// KCalNumHeader
-				dprintf(2, "@ 0x%08zX  KCalNumHeader\n", offset);
-				offset += sizeof(KCalNumHeader);
-				break;
-			case 0x0A:
-				// HandsHeader
-				dprintf(2, "@ 0x%08zX  HandsHeader\n", offset);
-				HandsHeader * hands = (HandsHeader *)&fileData[offset];				
-				if(dump) {		
-					sprintf(&dfnBuf[baseSize], "hand_%u.%s", hands->subtype, dumpFormatStr(format));
-					dumpImage(dfnBuf, &fileData[hands->offset], hands->width, hands->height, format);
-				}
-				offset += sizeof(HandsHeader);
-				break;
-			case 0x0D:
-				// DayNumHeader
-				dprintf(2, "@ 0x%08zX  DayNumHeader\n", offset);
-				DayNumHeader * dn = (DayNumHeader *)&fileData[offset];
-				dprintf(3, "                digitSet: %u, justification: %u\n", dn->digitSet, dn->justification);
-				offset += sizeof(DayNumHeader);
-				break;
-			case 0x0F:
-				// MonthNumHeader
-				dprintf(2, "@ 0x%08zX  MonthNumHeader\n", offset);
-				MonthNumHeader * mn = (MonthNumHeader *)&fileData[offset];
-				dprintf(3, "                digitSet: %u, justification: %u\n", mn->digitSet, mn->justification);
-				offset += sizeof(MonthNumHeader);
-				break;
-			case 0x12:
-				// BarDisplayHeader
-				BarDisplayHeader * bdh = (BarDisplayHeader *)&fileData[offset];
-				dprintf(2, "@ 0x%08zX  BarDisplayHeader. subtype: %u. count: %u.\n", offset, bdh->subtype, bdh->count);
-				if(dump) {
-					for(size_t i=0; i<bdh->count; i++) {
-						sprintf(&dfnBuf[baseSize], "bardisplay_%u_%zu.%s", bdh->subtype, i, dumpFormatStr(format));
-						dumpImage(dfnBuf, &fileData[bdh->owh[i].offset], bdh->owh[i].width, bdh->owh[i].height, format);
-					}
-				}						
-				offset += sizeof(BarDisplayHeader) + sizeof(OffsetWidthHeight) * (bdh->count-1);
-				break;
-			case 0x1B:
-				// WeatherHeader
-				WeatherHeader * wh = (WeatherHeader *)&fileData[offset];
-				dprintf(2, "@ 0x%08zX  WeatherHeader. count: %u.\n", offset, wh->count);
-				if(dump) {
-					for(size_t i=0; i<wh->count; i++) {
-						sprintf(&dfnBuf[baseSize], "weather_%u_%zu.%s", wh->count, i, dumpFormatStr(format));
-						dumpImage(dfnBuf, &fileData[wh->owh[i].offset], wh->owh[i].width, wh->owh[i].height, format);
-					}
-				}										
-				offset += sizeof(WeatherHeader);
-				break;
-			case 0x1D:
-				// 
-				Unknown1D01 * u1h = (Unknown1D01 *)&fileData[offset];
-				dprintf(1, "@ 0x%08zX  Unknown1D01Header. unknown: %u.\n", offset, u1h->unknown);
-				offset += sizeof(Unknown1D01);
-				break;
-			case 0x23:
-				dprintf(1, "@ 0x%08zX  DashHeader.\n", offset);
-				offset += sizeof(DashHeader);
-				break;	
-			default:
-				// UNKNOWN DATA
-				dprintf(0, "@ 0x%08zX  UNKNOWN TYPE 0x%02X (one=0x%02X)\n", offset, e_type, one);
-				dprintf(0, "ERROR: Unknown e_type found. Stopping early.\n");
-				more = false;
-				break;
+	// finish the archive: everything has been added
+	if(archive != NULL) {
+		setOutputArchive(NULL, NULL);
+		if(archiveFinish(archive) != 0) {
+			dprintf(0, "ERROR: Failed to write the archive %s\n", archiveName);
+			rval = 1;
 		}
+		archive = deleteArchive(archive);
+	}
+
+	// report how well the cache did, to help size it
+	if(opt.cache != NULL) {
+		size_t hits, misses, stored;
+		cacheStats(opt.cache, &hits, &misses, &stored);
+		dprintf(0, "Cache: %zu hit(s), %zu miss(es), %zu stored.\n", hits, misses, stored);
+		opt.cache = deleteImageCache(opt.cache);
 	}
 
-	// if we are dumping, then save the json file
-	if(dump) {
-		// json filename
-		dprintf(2, "Saving JSON data... ");
-		sprintf(fnBuf, "watchface.json");
-		sprintf(&dfnBuf[baseSize], "%s", fnBuf);
-		char * jsonString = cJSON_Print(cj);
-		dumpBlob(dfnBuf, (u8 *)jsonString, strlen(jsonString));
-		free(jsonString);
-		dprintf(2, "done.\n");
+	// per-file write latency, for tuning on slow or network file systems
+	if(ioStats) {
+		OutputStats os;
+		outputGetStats(&os);
+		double mean = os.files ? os.totalSeconds / (double)os.files : 0;
+		dprintf(0, "Output: %zu file(s), %llu bytes, %zu failed. Per file: mean %.3f ms, p50 < %.3f ms, p99 < %.3f ms, max %.3f ms.\n",
+			os.files, (unsigned long long)os.bytes, os.failures, mean * 1e3, outputStatsPercentile(&os, 0.5) * 1e3,
+			outputStatsPercentile(&os, 0.99) * 1e3, os.maxSeconds * 1e3);
 	}
 
 	// clean up
-	cJSON_Delete(cj);
-	deleteBytes(bytes);
+	inputs = deleteFileList(inputs);
+	deleteDefaultPool();
 	dprintf(1, "\ndone.\n\n");
 
-    return 0; // SUCCESS
+    return rval;
 }
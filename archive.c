@@ -0,0 +1,268 @@
+/*  archive.c - tar stream writer
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Writes an uncompressed POSIX ustar archive: for each entry a 512 byte header, then
+	the data padded to a multiple of 512 bytes, and two zero blocks at the end. Any tar
+	reads it. Identical files are stored once, with hard link entries for the rest.
+	Entries are stamped with the time the archive was started, or SOURCE_DATE_EPOCH if
+	it is set, so that the same dump always gives the same archive.
+
+	Written to "-", the archive goes to what was stdout, and stdout is pointed at stderr
+	so that messages can't end up inside the archive. It can also be kept in memory, for
+	the server to send back.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "bytes.h"
+#include "output.h"
+#include "archive.h"
+#include "strutil.h"
+
+#define TAR_BLOCK 512
+#define TAR_MAX_PIECES 16			// pieces of one entry's data written in one go
+
+struct _Archive {
+	pthread_mutex_t lock;			// for everything below
+	OutFile * out;
+	bool memory;					// out is a memory file, and bytes gets the archive when finished
+	Bytes * bytes;
+	time_t mtime;					// every entry gets the time the archive was started, or SOURCE_DATE_EPOCH
+	bool failed;					// a write failed, so the archive is unusable
+	bool finished;
+};
+
+static const u8 ZEROS[TAR_BLOCK * 2] = { 0 };
+
+//----------------------------------------------------------------------------
+//  NEW / DELETE
+//----------------------------------------------------------------------------
+
+// An archive written to out, which it closes when finished
+static Archive * newArchiveOn(OutFile * out) {
+	Archive * a = calloc(1, sizeof(Archive));
+	if(a == NULL) {
+		dprintf(0, "ERROR: Out of memory\n");
+		outputClose(out, false);
+		return NULL;
+	}
+	pthread_mutex_init(&a->lock, NULL);
+	a->out = out;
+	const char * epoch = getenv("SOURCE_DATE_EPOCH");
+	a->mtime = (epoch != NULL && *epoch != 0) ? (time_t)strtoll(epoch, NULL, 10) : time(NULL);
+	return a;
+}
+
+// Start an archive in fileName, or on stdout for "-". Returns NULL on failure.
+Archive * newArchive(const char * fileName) {
+	OutFile * out = NULL;
+	if(streq(fileName, "-")) {
+		out = outputOpenStdout();
+	} else {
+		out = outputOpen(fileName, 0);
+	}
+	if(out == NULL) {
+		dprintf(0, "ERROR: Can't open %s for the archive.\n", fileName);
+		return NULL;
+	}
+	return newArchiveOn(out);
+}
+
+// Start an archive in memory. Take it with archiveTakeBytes once finished.
+Archive * newArchiveMemory(void) {
+	OutFile * out = outputOpenMemory("archive");
+	if(out == NULL) {
+		return NULL;
+	}
+	Archive * a = newArchiveOn(out);
+	if(a != NULL) {
+		a->memory = true;
+	}
+	return a;
+}
+
+// Finishes the archive if that hasn't been done, then frees it
+Archive * deleteArchive(Archive * a) {
+	if(a != NULL) {
+		archiveFinish(a);
+		deleteBytes(a->bytes);
+		pthread_mutex_destroy(&a->lock);
+		free(a);
+	}
+	return NULL;
+}
+
+// The finished archive, if it was kept in memory. The caller owns it. Returns NULL if the archive
+// failed, or was already taken.
+Bytes * archiveTakeBytes(Archive * a) {
+	pthread_mutex_lock(&a->lock);
+	Bytes * b = a->bytes;
+	a->bytes = NULL;
+	pthread_mutex_unlock(&a->lock);
+	return b;
+}
+
+//----------------------------------------------------------------------------
+//  HEADERS
+//----------------------------------------------------------------------------
+
+// Octal, zero padded to fill the field but for its terminating NUL
+static void tarOctal(char * field, size_t fieldSize, u64 value) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%0*llo", (int)(fieldSize - 1), (unsigned long long)value);
+	memcpy(field, buf, fieldSize - 1);
+}
+
+// Fill a ustar header. Names longer than 100 bytes are split at a '/' into prefix and name.
+// Returns 0 on success, or 1 if the name can't be stored.
+static int tarHeader(u8 * h, const char * name, u64 size, char type, const char * linkName, time_t mtime) {
+	memset(h, 0, TAR_BLOCK);
+	size_t len = strlen(name);
+	if(len <= 100) {
+		memcpy(&h[0], name, len);
+	} else {
+		// the last '/' that leaves a name of at most 100 bytes and a prefix of at most 155
+		const char * split = NULL;
+		for(const char * p = name; *p; p++) {
+			if(*p == '/' && (size_t)(p - name) <= 155 && strlen(p + 1) <= 100 && p[1] != '\0') {
+				split = p;
+			}
+		}
+		if(split == NULL) {
+			return 1;
+		}
+		memcpy(&h[345], name, (size_t)(split - name));		// prefix
+		memcpy(&h[0], split + 1, strlen(split + 1));
+	}
+	if(linkName != NULL) {
+		size_t linkLen = strlen(linkName);
+		if(linkLen > 100) {
+			return 1;
+		}
+		memcpy(&h[157], linkName, linkLen);
+	}
+	if(size >= ((u64)1 << 33)) {
+		return 1;		// 11 octal digits
+	}
+
+	tarOctal((char *)&h[100], 8, 0644);						// mode
+	tarOctal((char *)&h[108], 8, 0);						// uid
+	tarOctal((char *)&h[116], 8, 0);						// gid
+	tarOctal((char *)&h[124], 12, size);
+	tarOctal((char *)&h[136], 12, (u64)(mtime > 0 ? mtime : 0));
+	h[156] = (u8)type;
+	memcpy(&h[257], "ustar", 6);							// magic, with its NUL
+	memcpy(&h[263], "00", 2);								// version
+	tarOctal((char *)&h[329], 8, 0);						// devmajor
+	tarOctal((char *)&h[337], 8, 0);						// devminor
+
+	// the checksum is the sum of the header bytes, taking the checksum field as spaces
+	memset(&h[148], ' ', 8);
+	unsigned sum = 0;
+	for(int i=0; i<TAR_BLOCK; i++) {
+		sum += h[i];
+	}
+	snprintf((char *)&h[148], 8, "%06o", sum);			// then NUL, then the space already there
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//  ENTRIES
+//----------------------------------------------------------------------------
+
+// Write one entry, header and padded data, while holding the lock
+static int writeEntry(Archive * a, const u8 * header, const OutPiece * pieces, int count, u64 size) {
+	if(a->failed || a->finished) {
+		return 1;
+	}
+	OutPiece all[TAR_MAX_PIECES + 2];
+	int n = 0;
+	all[n++] = (OutPiece){ header, TAR_BLOCK };
+	for(int i=0; i<count; i++) {
+		if(n == TAR_MAX_PIECES + 1) {
+			if(outputWrite(a->out, all, n) != 0) {
+				a->failed = true;
+				return 1;
+			}
+			n = 0;
+		}
+		all[n++] = pieces[i];
+	}
+	size_t pad = (size_t)((TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+	if(pad > 0) {
+		all[n++] = (OutPiece){ ZEROS, pad };
+	}
+	if(outputWrite(a->out, all, n) != 0) {
+		a->failed = true;
+		return 1;
+	}
+	return 0;
+}
+
+// Add a file made of pieces. name uses '/' between folders. Returns 0 on success.
+int archiveAdd(Archive * a, const char * name, const OutPiece * pieces, int count) {
+	u64 size = 0;
+	for(int i=0; i<count; i++) {
+		size += pieces[i].size;
+	}
+	u8 header[TAR_BLOCK];
+	if(tarHeader(header, name, size, '0', NULL, a->mtime) != 0) {
+		dprintf(0, "ERROR: Can't store %s in the archive.\n", name);
+		return 1;
+	}
+	pthread_mutex_lock(&a->lock);
+	int r = writeEntry(a, header, pieces, count, size);
+	pthread_mutex_unlock(&a->lock);
+	return r;
+}
+
+// Add name as a hard link to target, which must already be in the archive. Returns 0 on success.
+int archiveAddLink(Archive * a, const char * name, const char * target) {
+	u8 header[TAR_BLOCK];
+	if(tarHeader(header, name, 0, '1', target, a->mtime) != 0) {
+		return 1;
+	}
+	pthread_mutex_lock(&a->lock);
+	int r = writeEntry(a, header, NULL, 0, 0);
+	pthread_mutex_unlock(&a->lock);
+	return r;
+}
+
+// Write the end of the archive and close it. Nothing can be added after this.
+// Returns 0 if the whole archive was written.
+int archiveFinish(Archive * a) {
+	pthread_mutex_lock(&a->lock);
+	if(a->finished) {
+		pthread_mutex_unlock(&a->lock);
+		return a->failed ? 1 : 0;
+	}
+	if(!a->failed) {
+		OutPiece end = { ZEROS, sizeof(ZEROS) };
+		if(outputWrite(a->out, &end, 1) != 0) {
+			a->failed = true;
+		}
+	}
+	if(a->memory) {
+		a->bytes = outputCloseToBytes(a->out, !a->failed);
+		a->failed = (a->bytes == NULL);
+	} else if(outputClose(a->out, !a->failed) != 0) {
+		a->failed = true;
+	}
+	a->out = NULL;
+	a->finished = true;
+	pthread_mutex_unlock(&a->lock);
+	return a->failed ? 1 : 0;
+}
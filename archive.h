@@ -0,0 +1,17 @@
+// archive.h
+// a tar (POSIX ustar) stream of dumped files, to one file, to stdout or to memory
+
+// The Archive type is declared in output.h, which files going into an archive pass through.
+// It is safe to add to from several threads at once. Each entry is written whole, in the order added.
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+Archive * newArchive(const char * fileName);
+Archive * newArchiveMemory(void);
+Archive * deleteArchive(Archive * a);
+int archiveAdd(Archive * a, const char * name, const OutPiece * pieces, int count);
+int archiveAddLink(Archive * a, const char * name, const char * target);
+int archiveFinish(Archive * a);
+Bytes * archiveTakeBytes(Archive * a);
@@ -0,0 +1,260 @@
+/*  batch.c - collect lists of watch face files for batch processing
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "types.h"
+#include "adawft.h"
+#include "hash.h"
+#include "batch.h"
+#include "strutil.h"
+
+//----------------------------------------------------------------------------
+//  NEWFILELIST, DELETEFILELIST
+//----------------------------------------------------------------------------
+
+FileList * newFileList(void) {
+	FileList * fl = (FileList *)malloc(sizeof(FileList));
+	if(fl == NULL) {
+		return NULL;
+	}
+	fl->count = 0;
+	fl->capacity = 0;
+	fl->paths = NULL;
+	fl->outNames = NULL;
+	fl->names = newHashStore();
+	if(fl->names == NULL) {
+		free(fl);
+		return NULL;
+	}
+	return fl;
+}
+
+FileList * deleteFileList(FileList * fl) {
+	if(fl != NULL) {
+		for(size_t i=0; i<fl->count; i++) {
+			free(fl->paths[i]);
+			free(fl->outNames[i]);
+		}
+		free(fl->paths);
+		free(fl->outNames);
+		deleteHashStore(fl->names);
+		free(fl);
+		fl = NULL;
+	}
+	return fl;
+}
+
+// Last directory separator in a path, or NULL
+static const char * lastSeparator(const char * path) {
+	const char * sep = strrchr(path, '/');
+	const char * bsep = strrchr(path, '\\');
+	if(sep == NULL || (bsep != NULL && bsep > sep)) {
+		return bsep;
+	}
+	return sep;
+}
+
+static char * dupString(const char * s) {
+	size_t len = strlen(s);
+	char * d = malloc(len + 1);
+	if(d != NULL) {
+		memcpy(d, s, len + 1);
+	}
+	return d;
+}
+
+// Make an output name from a path: drop the extension, and flatten any directories into '_'
+static char * makeOutName(const char * relPath) {
+	char * name = dupString(relPath);
+	if(name == NULL) {
+		return NULL;
+	}
+	char * dot = strrchr(name, '.');
+	const char * sep = lastSeparator(name);
+	if(dot != NULL && dot != name && (sep == NULL || dot > sep + 1)) {
+		*dot = 0;
+	}
+	for(char * c = name; *c; c++) {
+		if(*c == '/' || *c == '\\' || *c == ':') {
+			*c = '_';
+		}
+	}
+	return name;
+}
+
+// Make name unique among the names added so far, adding _2, _3, ... if needed. Frees name if replaced.
+static char * uniqueOutName(FileList * fl, char * name) {
+	char * candidate = name;
+	size_t len = strlen(name);
+	for(unsigned n = 2; ; n++) {
+		if(hashStoreAdd(fl->names, (const u8 *)candidate, strlen(candidate), 0, fl->count) == fl->count) {
+			break;
+		}
+		if(candidate != name) {
+			free(candidate);
+		}
+		candidate = malloc(len + 12);
+		if(candidate == NULL) {
+			free(name);
+			return NULL;
+		}
+		snprintf(candidate, len + 12, "%s_%u", name, n);
+	}
+	if(candidate != name) {
+		dprintf(0, "WARNING: Output name '%s' already used, dumping to '%s' instead\n", name, candidate);
+		free(name);
+	}
+	return candidate;
+}
+
+// Add a single file
+static int fileListAdd(FileList * fl, const char * path, const char * relPath) {
+	if(fl->count == fl->capacity) {
+		size_t newCapacity = fl->capacity ? fl->capacity * 2 : 64;
+		char ** p = realloc(fl->paths, newCapacity * sizeof(char *));
+		if(p == NULL) {
+			return 1;
+		}
+		fl->paths = p;
+		char ** o = realloc(fl->outNames, newCapacity * sizeof(char *));
+		if(o == NULL) {
+			return 1;
+		}
+		fl->outNames = o;
+		fl->capacity = newCapacity;
+	}
+	char * pathCopy = dupString(path);
+	char * outName = makeOutName(relPath);
+	if(pathCopy == NULL || outName == NULL) {
+		free(pathCopy);
+		free(outName);
+		return 1;
+	}
+	outName = uniqueOutName(fl, outName);
+	if(outName == NULL) {
+		free(pathCopy);
+		return 1;
+	}
+	fl->paths[fl->count] = pathCopy;
+	fl->outNames[fl->count] = outName;
+	fl->count++;
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//  FILELISTADDPATH - add a file, or every file under a directory
+//----------------------------------------------------------------------------
+
+static int compareStrings(const void * a, const void * b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Walk a directory, adding files in sorted order so the results are repeatable. Hidden entries are skipped.
+static int addDirectory(FileList * fl, const char * dirPath, size_t rootLen) {
+	DIR * dir = opendir(dirPath);
+	if(dir == NULL) {
+		dprintf(0, "ERROR: Unable to open directory '%s'\n", dirPath);
+		return 1;
+	}
+
+	size_t count = 0;
+	size_t capacity = 0;
+	char ** names = NULL;
+	struct dirent * ent;
+	while((ent = readdir(dir)) != NULL) {
+		if(ent->d_name[0] == '.') {
+			continue;
+		}
+		if(count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			char ** n = realloc(names, capacity * sizeof(char *));
+			if(n == NULL) {
+				break;
+			}
+			names = n;
+		}
+		names[count] = dupString(ent->d_name);
+		if(names[count] != NULL) {
+			count++;
+		}
+	}
+	closedir(dir);
+
+	if(count > 0) {
+		qsort(names, count, sizeof(char *), compareStrings);
+	}
+
+	int errors = 0;
+	char path[1024];
+	for(size_t i=0; i<count; i++) {
+		int len = snprintf(path, sizeof(path), "%s%s%s", dirPath, DIR_SEPERATOR, names[i]);
+		free(names[i]);
+		if(len < 0 || (size_t)len >= sizeof(path)) {
+			dprintf(0, "WARNING: Path too long, skipped: %s\n", path);
+			continue;
+		}
+		struct stat st;
+		if(stat(path, &st) != 0) {
+			continue;
+		}
+		if(S_ISDIR(st.st_mode)) {
+			errors += addDirectory(fl, path, rootLen);
+		} else if(S_ISREG(st.st_mode)) {
+			errors += fileListAdd(fl, path, &path[rootLen]);
+		}
+	}
+	free(names);
+	return errors;
+}
+
+// Add a path. Files are added as-is, directories are walked recursively.
+int fileListAddPath(FileList * fl, const char * path) {
+	struct stat st;
+	if(stat(path, &st) != 0) {
+		dprintf(0, "ERROR: Unable to find '%s'\n", path);
+		return 1;
+	}
+	if(S_ISDIR(st.st_mode)) {
+		// names are relative to the directory (not including it)
+		size_t rootLen = strlen(path) + strlen(DIR_SEPERATOR);
+		return addDirectory(fl, path, rootLen);
+	}
+
+	// a single file: name it after the file itself
+	const char * base = lastSeparator(path);
+	return fileListAdd(fl, path, base ? base + 1 : path);
+}
+
+//----------------------------------------------------------------------------
+//  FILELISTADDSTREAM - add each line of a stream as a path
+//----------------------------------------------------------------------------
+
+int fileListAddStream(FileList * fl, FILE * f) {
+	int errors = 0;
+	char line[1024];
+	while(fgets(line, sizeof(line), f) != NULL) {
+		size_t len = strlen(line);
+		while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
+			line[--len] = 0;
+		}
+		if(len == 0) {
+			continue;
+		}
+		errors += fileListAddPath(fl, line);
+	}
+	return errors;
+}
@@ -0,0 +1,23 @@
+// batch.h
+// collect lists of watch face files for batch processing
+
+//----------------------------------------------------------------------------
+//  EXPORTED STRUCTS
+//----------------------------------------------------------------------------
+
+typedef struct _FileList {
+	size_t count;
+	size_t capacity;
+	char ** paths;			// input file paths
+	char ** outNames;		// name to dump each one under: the path without extension, relative to where it was found. Unique.
+	HashStore * names;		// the outNames so far, to find collisions
+} FileList;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+FileList * newFileList(void);
+FileList * deleteFileList(FileList * fl);
+int fileListAddPath(FileList * fl, const char * path);
+int fileListAddStream(FileList * fl, FILE * f);
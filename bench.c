@@ -0,0 +1,599 @@
+/*  bench.c - benchmark the decode, convert and dump paths
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Builds synthetic RLE_NEW faces at real screen sizes, then times each stage of the
+	pipeline over every image in the face. Results are tab separated, one line per stage
+	and face size, after a few '#' comment lines describing the run:
+
+		stage  face  images  seconds  images_per_s  mb_per_s
+
+	MB/s is measured in decoded ARGB8565 pixel data (3 bytes per pixel), so stages can be
+	compared with each other. For the 'index' and 'thumbnail' stages an item is a whole face,
+	and MB/s is measured over the face file.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#ifndef WINDOWS
+#define _POSIX_C_SOURCE 200809L		// for clock_gettime
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "face_new.h"
+#include "adawft.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "pool.h"
+#include "pixel.h"
+#include "rle.h"
+#include "cache.h"
+#include "dump.h"
+#include "face.h"
+#include "render.h"
+#include "hand.h"
+#include "strutil.h"
+
+//----------------------------------------------------------------------------
+//  TIMING
+//----------------------------------------------------------------------------
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double minTime = 0.5;		// seconds to run each stage for
+
+//----------------------------------------------------------------------------
+//  SYNTHETIC IMAGES
+//----------------------------------------------------------------------------
+
+typedef enum _SynthKind {
+	SYN_BACKGROUND = 0,		// opaque: stepped gradient bands, with a noisy 'photo' patch
+	SYN_GLYPH = 1,			// transparent, with an anti-aliased ring like a digit or icon
+	SYN_HAND = 2,			// transparent, with a tapered opaque bar
+} SynthKind;
+
+static u32 hash32(u32 x) {
+	x ^= x >> 16;
+	x *= 0x7FEB352D;
+	x ^= x >> 15;
+	x *= 0x846CA68B;
+	x ^= x >> 16;
+	return x;
+}
+
+static void setPixel(u8 * p, u8 a, u8 r, u8 g, u8 b) {
+	u16 c = (u16)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+	p[0] = a;
+	p[1] = (u8)(c >> 8);
+	p[2] = (u8)(c & 0xFF);
+}
+
+// A w x h ARGB8565 image of the given kind
+static Img * synthImage(u32 w, u32 h, SynthKind kind, u32 seed) {
+	Img * img = malloc(sizeof(Img));
+	if(img == NULL) {
+		return NULL;
+	}
+	img->w = w;
+	img->h = h;
+	img->format = IF_ARGB8565;
+	img->size = w * h * 3;
+	img->data = malloc(img->size);
+	if(img->data == NULL) {
+		free(img);
+		return NULL;
+	}
+
+	int cx = w / 2;
+	int cy = h / 2;
+	int radius = (w < h ? w : h) / 2 - 1;
+	for(u32 y=0; y<h; y++) {
+		for(u32 x=0; x<w; x++) {
+			u8 * p = &img->data[(y * w + x) * 3];
+			int dx = (int)x - cx;
+			int dy = (int)y - cy;
+			int d2 = dx*dx + dy*dy;
+			if(kind == SYN_BACKGROUND) {
+				if(x > w/2 && y < h/3) {
+					u32 n = hash32(seed ^ (y * w + x));
+					setPixel(p, 0xFF, 96 + (n & 63), 64 + ((n >> 8) & 63), 32 + ((n >> 16) & 63));
+				} else {
+					int band = 0;
+					while((band+1)*(band+1)*64 <= d2) {
+						band++;
+					}
+					setPixel(p, 0xFF, (u8)(band * 9), (u8)(20 + band * 5), (u8)(60 + band * 3));
+				}
+			} else if(kind == SYN_GLYPH) {
+				// ring between 0.6 and 0.9 of the radius, 1 pixel of alpha ramp each side
+				int inner = radius * 6 / 10;
+				int outer = radius * 9 / 10;
+				int dist = 0;
+				while((dist+1)*(dist+1) <= d2) {
+					dist++;
+				}
+				u8 a = 0;
+				if(dist > inner && dist < outer) {
+					a = 0xFF;
+				} else if(dist == inner || dist == outer) {
+					a = 0x80;
+				}
+				if(a == 0) {
+					setPixel(p, 0, 0, 0, 0);
+				} else {
+					setPixel(p, a, 250, 250, 250);
+				}
+			} else {
+				// hand: a bar that narrows towards the top
+				int half = 1 + (int)((w / 2) * y / (h ? h : 1));
+				if(abs(dx) < half) {
+					setPixel(p, 0xFF, 230, 40, 40);
+				} else if(abs(dx) == half) {
+					setPixel(p, 0x60, 230, 40, 40);
+				} else {
+					setPixel(p, 0, 0, 0, 0);
+				}
+			}
+		}
+	}
+	return img;
+}
+
+//----------------------------------------------------------------------------
+//  SYNTHETIC FACE - header layout follows face_new.h
+//----------------------------------------------------------------------------
+
+#define FACE_DIGITS 10
+#define FACE_HANDS 3
+#define FACE_DAYNAMES 7
+#define FACE_IMAGES (1 + FACE_DIGITS + 1 + FACE_HANDS + FACE_DAYNAMES)
+
+// A face with a preview, one set of digits, a background, the time, three hands and the day names
+static Bytes * synthFace(u32 w, u32 h) {
+	u32 sizes[FACE_IMAGES][2];
+	SynthKind kinds[FACE_IMAGES];
+	size_t n = 0;
+	sizes[n][0] = w * 7 / 12; sizes[n][1] = h * 11 / 20; kinds[n++] = SYN_BACKGROUND;	// preview
+	for(int i=0; i<FACE_DIGITS; i++) {
+		sizes[n][0] = w / 8; sizes[n][1] = h / 6; kinds[n++] = SYN_GLYPH;
+	}
+	sizes[n][0] = w; sizes[n][1] = h; kinds[n++] = SYN_BACKGROUND;
+	for(int i=0; i<FACE_HANDS; i++) {
+		sizes[n][0] = w / 16 + 2 * i; sizes[n][1] = h * (3 + i) / 10; kinds[n++] = SYN_HAND;
+	}
+	for(int i=0; i<FACE_DAYNAMES; i++) {
+		sizes[n][0] = w / 4; sizes[n][1] = h / 12; kinds[n++] = SYN_GLYPH;
+	}
+
+	// compress every image
+	Bytes * rle[FACE_IMAGES];
+	size_t dataSize = 0;
+	for(size_t i=0; i<FACE_IMAGES; i++) {
+		Img * img = synthImage(sizes[i][0], sizes[i][1], kinds[i], (u32)i);
+		rle[i] = (img != NULL) ? rleNewEncode(img->data, img->w, img->h, RLE_BEST) : NULL;
+		deleteImg(img);
+		if(rle[i] == NULL) {
+			for(size_t j=0; j<i; j++) {
+				deleteBytes(rle[j]);
+			}
+			return NULL;
+		}
+		dataSize += rle[i]->size;
+	}
+
+	size_t headersSize = sizeof(FaceHeaderN) + 2 + sizeof(DigitsHeader) + sizeof(ImageHeader) + sizeof(TimeHeader)
+		+ FACE_HANDS * sizeof(HandsHeader) + sizeof(DayNameHeader) + 2;
+	Bytes * face = newBytes(headersSize + dataSize);
+	if(face == NULL) {
+		for(size_t i=0; i<FACE_IMAGES; i++) {
+			deleteBytes(rle[i]);
+		}
+		return NULL;
+	}
+	u8 * d = face->data;
+	memset(d, 0, headersSize);
+
+	// image data goes after the headers
+	u32 offsets[FACE_IMAGES];
+	size_t pos = headersSize;
+	for(size_t i=0; i<FACE_IMAGES; i++) {
+		offsets[i] = (u32)pos;
+		memcpy(&d[pos], rle[i]->data, rle[i]->size);
+		pos += rle[i]->size;
+		rle[i] = deleteBytes(rle[i]);
+	}
+
+	n = 0;
+	size_t offset = 0;
+	FaceHeaderN * fh = (FaceHeaderN *)&d[offset];
+	fh->apiVer = 18;
+	fh->unknown = 0xFFFF;
+	fh->previewOffset = offsets[n];
+	fh->previewWidth = (u16)sizes[n][0];
+	fh->previewHeight = (u16)sizes[n][1];
+	n++;
+	fh->dhOffset = sizeof(FaceHeaderN);
+	fh->bhOffset = sizeof(FaceHeaderN) + 2 + sizeof(DigitsHeader);
+	offset += sizeof(FaceHeaderN);
+
+	set_u16(&d[offset], 0x0101);
+	offset += 2;
+	DigitsHeader * dh = (DigitsHeader *)&d[offset];
+	dh->digitSet = 0;
+	for(int i=0; i<FACE_DIGITS; i++, n++) {
+		dh->owh[i].offset = offsets[n];
+		dh->owh[i].width = (u16)sizes[n][0];
+		dh->owh[i].height = (u16)sizes[n][1];
+	}
+	offset += sizeof(DigitsHeader);
+
+	ImageHeader * ih = (ImageHeader *)&d[offset];
+	ih->one = 1;
+	ih->e_type = ET_IMAGE;
+	ih->offset = offsets[n];
+	ih->width = (u16)sizes[n][0];
+	ih->height = (u16)sizes[n][1];
+	n++;
+	offset += sizeof(ImageHeader);
+
+	TimeHeader * th = (TimeHeader *)&d[offset];
+	th->one = 1;
+	th->e_type = ET_TIME;
+	for(int i=0; i<4; i++) {
+		th->xy[i].x = (u16)(w / 8 + i * w / 5);
+		th->xy[i].y = (u16)(h / 4);
+	}
+	offset += sizeof(TimeHeader);
+
+	for(int i=0; i<FACE_HANDS; i++, n++) {
+		HandsHeader * hh = (HandsHeader *)&d[offset];
+		hh->one = 1;
+		hh->e_type = ET_HANDS;
+		hh->subtype = (u8)i;
+		hh->offset = offsets[n];
+		hh->width = (u16)sizes[n][0];
+		hh->height = (u16)sizes[n][1];
+		hh->x = (u16)(w / 2);
+		hh->y = (u16)(h / 2);
+		offset += sizeof(HandsHeader);
+	}
+
+	DayNameHeader * dn = (DayNameHeader *)&d[offset];
+	dn->one = 1;
+	dn->e_type = ET_DAYNAME;
+	dn->subtype = 1;
+	for(int i=0; i<FACE_DAYNAMES; i++, n++) {
+		dn->owh[i].offset = offsets[n];
+		dn->owh[i].width = (u16)sizes[n][0];
+		dn->owh[i].height = (u16)sizes[n][1];
+	}
+	offset += sizeof(DayNameHeader);
+	// the final 2 bytes are already 0: end of headers
+
+	return face;
+}
+
+//----------------------------------------------------------------------------
+//  STAGES - each runs once over every image in the face
+//----------------------------------------------------------------------------
+
+typedef struct _BenchCtx {
+	const FaceIndex * fi;
+	Img ** pixels;				// ARGB8565 of each image, decoded once up front
+	const char * tmpName;		// file written by the dump stages
+	bool ok;
+} BenchCtx;
+
+static void stageEncode(BenchCtx * c, RleMode mode) {
+	for(size_t i=0; i<c->fi->imageCount; i++) {
+		Img * img = c->pixels[i];
+		Bytes * b = rleNewEncode(img->data, img->w, img->h, mode);
+		c->ok &= (b != NULL);
+		deleteBytes(b);
+	}
+}
+
+static void stageEncodeFast(BenchCtx * c) {
+	stageEncode(c, RLE_FAST);
+}
+
+static void stageEncodeBest(BenchCtx * c) {
+	stageEncode(c, RLE_BEST);
+}
+
+static void stageDecode(BenchCtx * c) {
+	for(size_t i=0; i<c->fi->imageCount; i++) {
+		const FaceImage * fimg = &c->fi->images[i];
+		Img * img = rleNewDecode(&c->fi->data[fimg->offset], fimg->size, fimg->width, fimg->height);
+		c->ok &= (img != NULL);
+		deleteImg(img);
+	}
+}
+
+static void stageConvert(BenchCtx * c) {
+	for(size_t i=0; i<c->fi->imageCount; i++) {
+		Img * img = cloneImg(c->pixels[i]);
+		img = (img != NULL) ? convertImg(img, IF_ARGB8888) : NULL;
+		c->ok &= (img != NULL);
+		deleteImg(img);
+	}
+}
+
+static void stageImgToBMP(BenchCtx * c) {
+	for(size_t i=0; i<c->fi->imageCount; i++) {
+		Bytes * b = imgToBMP(c->pixels[i]);
+		c->ok &= (b != NULL);
+		deleteBytes(b);
+	}
+}
+
+static void stageRleToBMP(BenchCtx * c) {
+	for(size_t i=0; i<c->fi->imageCount; i++) {
+		const FaceImage * fimg = &c->fi->images[i];
+		Bytes * b = rleNewToBMP(&c->fi->data[fimg->offset], fimg->size, fimg->width, fimg->height);
+		c->ok &= (b != NULL);
+		deleteBytes(b);
+	}
+}
+
+static void stageDumpBMP(BenchCtx * c) {
+	for(size_t i=0; i<c->fi->imageCount; i++) {
+		const FaceImage * fimg = &c->fi->images[i];
+		c->ok &= (dumpImage(c->tmpName, (u8 *)&c->fi->data[fimg->offset], fimg->size, fimg->width, fimg->height, FMT_BMP) == 0);
+	}
+}
+
+// The older 16 bit BMP writer, fed uncompressed RGB565 (the alpha byte is dropped)
+static void stageDumpBMP16(BenchCtx * c) {
+	for(size_t i=0; i<c->fi->imageCount; i++) {
+		Img * img = c->pixels[i];
+		size_t count = (size_t)img->w * img->h;
+		u8 * rgb565 = malloc(count * 2 + 2);
+		if(rgb565 == NULL) {
+			c->ok = false;
+			return;
+		}
+		for(size_t p=0; p<count; p++) {
+			rgb565[p*2] = img->data[p*3+2];
+			rgb565[p*2+1] = img->data[p*3+1];
+		}
+		c->ok &= (dumpBMP16((char *)c->tmpName, rgb565, count * 2, img->w, img->h, false) == 0);
+		free(rgb565);
+	}
+}
+
+// Composite every image onto a canvas of the same size, half the pixels pre-filled
+static void stageBlend(BenchCtx * c, size_t dstBpp, void (*blend)(u8 * dst, const u8 * src, size_t count)) {
+	for(size_t i=0; i<c->fi->imageCount; i++) {
+		Img * img = c->pixels[i];
+		size_t rowBytes = (size_t)img->w * dstBpp;
+		u8 * canvas = malloc(rowBytes * img->h + 1);
+		if(canvas == NULL) {
+			c->ok = false;
+			return;
+		}
+		memset(canvas, 0x40, rowBytes * img->h);
+		for(u32 y=0; y<img->h; y++) {
+			blend(&canvas[y * rowBytes], &img->data[(size_t)y * img->w * 3], img->w);
+		}
+		free(canvas);
+	}
+}
+
+static void stageBlend8888(BenchCtx * c) {
+	stageBlend(c, 4, blend8565over8888);
+}
+
+static void stageBlend565(BenchCtx * c) {
+	stageBlend(c, 2, blend8565over565);
+}
+
+// The same composite, straight from the RLE_NEW rows in the face
+static void stageBlendRle(BenchCtx * c) {
+	for(size_t i=0; i<c->fi->imageCount; i++) {
+		const FaceImage * fimg = &c->fi->images[i];
+		const u8 * imgData = &c->fi->data[fimg->offset];
+		size_t rowBytes = (size_t)fimg->width * 4;
+		u8 * canvas = malloc(rowBytes * fimg->height + 1);
+		if(canvas == NULL) {
+			c->ok = false;
+			return;
+		}
+		memset(canvas, 0x40, rowBytes * fimg->height);
+		for(u32 y=0; y<fimg->height; y++) {
+			const u8 * row = &imgData[rleNewRowOffset(imgData, y)];
+			c->ok &= (rleNewBlendRow8888(row, rleNewRowSize(imgData, y), &canvas[y * rowBytes], fimg->width, 0, fimg->width) == 0);
+		}
+		free(canvas);
+	}
+}
+
+// A full minute of second hand positions for every hand, sprites built once per hand
+static void stageRotateHands(BenchCtx * c) {
+	Img frame = { .w = 466, .h = 466, .format = IF_ARGB8888 };
+	frame.size = frame.w * frame.h * 4;
+	frame.data = calloc(frame.size, 1);
+	if(frame.data == NULL) {
+		c->ok = false;
+		return;
+	}
+	RenderRect clip = { 0, 0, (int)frame.w, (int)frame.h };
+	for(size_t i=0; i<c->fi->elementCount; i++) {
+		const FaceElement * e = &c->fi->elements[i];
+		if(e->eType != ET_HANDS || e->imageCount == 0) {
+			continue;
+		}
+		const FaceImage * fimg = &e->images[0];
+		HandSprite * h = newHandSprite(&c->fi->data[fimg->offset], fimg->size, fimg->width, fimg->height);
+		if(h == NULL) {
+			c->ok = false;
+			break;
+		}
+		for(u32 s=0; s<60; s++) {
+			handDraw(&frame, &clip, h, (i32)fimg->width * (HAND_ONE / 2), (i32)fimg->height * HAND_ONE, 233, 233, s * HAND_TURN / 60);
+		}
+		h = deleteHandSprite(h);
+	}
+	free(frame.data);
+}
+
+static void stageIndex(BenchCtx * c) {
+	FaceIndex * fi = newFaceIndex(c->fi->data, c->fi->size);
+	c->ok &= (fi != NULL && fi->imageCount == c->fi->imageCount);
+	deleteFaceIndex(fi);
+}
+
+// Index a face and decode only its preview, as a thumbnail service would
+static void stageThumbnail(BenchCtx * c) {
+	FaceIndex * fi = newFaceIndex(c->fi->data, c->fi->size);
+	c->ok &= (fi != NULL && faceImageGet(fi, fi->preview) != NULL && fi->decodeCount == 1);
+	deleteFaceIndex(fi);
+}
+
+typedef struct _Stage {
+	const char * name;
+	void (*fn)(BenchCtx * c);
+} Stage;
+
+static const Stage STAGES[] = {
+	{ "index", stageIndex },
+	{ "thumbnail", stageThumbnail },
+	{ "decode", stageDecode },
+	{ "encode_fast", stageEncodeFast },
+	{ "encode_best", stageEncodeBest },
+	{ "convert_8888", stageConvert },
+	{ "blend_8888", stageBlend8888 },
+	{ "blend_565", stageBlend565 },
+	{ "blend_rle", stageBlendRle },
+	{ "rotate_hands", stageRotateHands },
+	{ "img_to_bmp", stageImgToBMP },
+	{ "rle_to_bmp", stageRleToBMP },
+	{ "dump_bmp", stageDumpBMP },
+	{ "dump_bmp16", stageDumpBMP16 },
+};
+
+//----------------------------------------------------------------------------
+//  BENCHFACE - run every stage on one face size
+//----------------------------------------------------------------------------
+
+static int benchFace(u32 w, u32 h, const char * tmpName) {
+	Bytes * face = synthFace(w, h);
+	FaceIndex * fi = (face != NULL) ? newFaceIndex(face->data, face->size) : NULL;
+	if(fi == NULL || fi->truncated) {
+		dprintf(0, "ERROR: Failed to build a %ux%u face\n", w, h);
+		deleteFaceIndex(fi);
+		deleteBytes(face);
+		return 1;
+	}
+
+	// decoded pixels, for the stages that start from ARGB8565
+	BenchCtx c = { fi, calloc(fi->imageCount, sizeof(Img *)), tmpName, true };
+	size_t pixelBytes = 0;
+	for(size_t i=0; c.pixels != NULL && i<fi->imageCount; i++) {
+		const FaceImage * fimg = &fi->images[i];
+		c.pixels[i] = rleNewDecode(&fi->data[fimg->offset], fimg->size, fimg->width, fimg->height);
+		if(c.pixels[i] == NULL) {
+			c.ok = false;
+			break;
+		}
+		pixelBytes += c.pixels[i]->size;
+	}
+
+	char faceName[32];
+	snprintf(faceName, sizeof(faceName), "%ux%u", w, h);
+	for(size_t s=0; c.ok && s<sizeof(STAGES)/sizeof(STAGES[0]); s++) {
+		bool perFace = (STAGES[s].fn == stageIndex || STAGES[s].fn == stageThumbnail);
+		size_t reps = 0;
+		double start = now();
+		double elapsed = 0;
+		do {
+			STAGES[s].fn(&c);
+			reps++;
+			elapsed = now() - start;
+		} while(c.ok && (elapsed < minTime || reps < 3));
+
+		if(!c.ok) {
+			dprintf(0, "ERROR: Stage %s failed on %s\n", STAGES[s].name, faceName);
+			break;
+		}
+		size_t items = reps * (perFace ? 1 : fi->imageCount);
+		double bytes = (double)reps * (perFace ? face->size : pixelBytes);
+		printf("%s\t%s\t%zu\t%.4f\t%.1f\t%.2f\n", STAGES[s].name, faceName, items, elapsed, items / elapsed, bytes / elapsed / 1e6);
+		fflush(stdout);
+	}
+	remove(tmpName);
+
+	int rval = c.ok ? 0 : 1;
+	for(size_t i=0; c.pixels != NULL && i<fi->imageCount; i++) {
+		deleteImg(c.pixels[i]);
+	}
+	free(c.pixels);
+	deleteFaceIndex(fi);
+	deleteBytes(face);
+	return rval;
+}
+
+//----------------------------------------------------------------------------
+//  MAIN
+//----------------------------------------------------------------------------
+
+int main(int argc, char * argv[]) {
+	DEBUG_LEVEL = 0;
+	const char * tmpName = "bench_tmp.bmp";
+
+	for(int i=1; i<argc; i++) {
+		unsigned threads;
+		if(streqn(argv[i], "--threads=", 10) && readUnsigned(&argv[i][10], POOL_MAX_THREADS, &threads)) {
+			setDefaultPoolThreads(threads);
+		} else if(streqn(argv[i], "--isa=", 6)) {
+			const char * isa = &argv[i][6];
+			if(streq(isa, "scalar")) {
+				setPixelIsa(PIXEL_ISA_SCALAR);
+			} else if(streq(isa, "sse2")) {
+				setPixelIsa(PIXEL_ISA_SSE2);
+			} else if(streq(isa, "avx2")) {
+				setPixelIsa(PIXEL_ISA_AVX2);
+			} else {
+				setPixelIsa(PIXEL_ISA_AUTO);
+			}
+		} else if(streqn(argv[i], "--time=", 7)) {
+			minTime = atoi(&argv[i][7]) / 1000.0;
+		} else if(streqn(argv[i], "--tmp=", 6)) {
+			tmpName = &argv[i][6];
+		} else {
+			printf("Usage: %s [--threads=N] [--isa=auto|scalar|sse2|avx2] [--time=MS] [--tmp=FILE]\n", argv[0]);
+			printf("  --threads=N     Threads for decoding and encoding. 0 (the default) uses every core.\n");
+			printf("  --isa=ISA       Pixel kernels to use.\n");
+			printf("  --time=MS       Minimum time to run each stage for. Default 500.\n");
+			printf("  --tmp=FILE      Scratch file for the dump stages. Default bench_tmp.bmp.\n");
+			return 1;
+		}
+	}
+
+	printf("# adawft bench\n");
+	printf("# cpus\t%u\n", cpuCount());
+	printf("# isa\t%s\n", pixelIsaStr(pixelIsa()));
+	printf("stage\tface\timages\tseconds\timages_per_s\tmb_per_s\n");
+
+	int rval = 0;
+	rval |= benchFace(240, 296, tmpName);
+	rval |= benchFace(466, 466, tmpName);
+
+	deleteDefaultPool();
+	return rval;
+}
@@ -19,23 +19,15 @@
 #include "bytes.h"
 #include "adawft.h"
 #include "bmp.h"
+#include "pool.h"
+#include "pixel.h"
+#include "rle.h"
+#include "qoi.h"
 
 //----------------------------------------------------------------------------
-//  RGB565 to RGB888 conversion
+//  RGB888 to RGB565 conversion (see pixel.c for RGB565 to RGB888)
 //----------------------------------------------------------------------------
 
-static RGBTrip RGB565to888(u16 pixel) {	
-	pixel = swap_bo_u16(pixel);				// need to reverse the source pixel
-	RGBTrip output;
-	output.b = (u8)((pixel & 0x001F) << 3);		// first 5 bits
-	output.b |= (pixel & 0x001C) >> 3;			// add extra precision of 3 bits
-	output.g = (pixel & 0x07E0) >> 3;			// first 6 bits
-	output.g |= (pixel & 0x0600) >> 9;			// add extra precision of 2 bits
-	output.r = (pixel & 0xF800) >> 8;			// first 5 bits
-	output.r |= (pixel & 0xE000) >> 13;			// add extra precision of 3 bits
-	return output;
-}
-
 static u16 RGB888to565(u8 * buf) {
     u16 output = 0;
 	u8 b = buf[0];
@@ -355,10 +347,10 @@ Bytes * imgToBMP(const Img * srcImg) {
 	}
 
 	// Create some bytes to store the BMP
-	Bytes * b = malloc(sizeof(Bytes) + bmpHeader.fileSize);
-	b->size = bmpHeader.fileSize;
+	Bytes * b = newBytes(bmpHeader.fileSize);
 	if(b==NULL) {
 		printf("ERROR: Couldn't allocate memory!\n");
+		deleteImg(img);
 		return NULL;
 	}
 
@@ -373,28 +365,113 @@ Bytes * imgToBMP(const Img * srcImg) {
 		offset += destRowSize;
 	}
 
+	deleteImg(img);
 	return b; // SUCCESS
 }
 
+// rleNewToBMP
+
+typedef struct _RleToBMPCtx {
+	const u8 * imgData;
+	size_t size;
+	u8 * pixels;			// start of the BMP pixel area
+	u32 width;
+	u32 height;
+} RleToBMPCtx;
+
+static int rleToBMPRowTask(void * ctx, size_t y) {
+	RleToBMPCtx * c = (RleToBMPCtx *)ctx;
+	u8 * dst = &c->pixels[y * c->width * 4];
+	size_t srcSize;
+	const u8 * src = rleNewRow(c->imgData, c->size, c->height, (u32)y, &srcSize);
+	if(src == NULL) {
+		memset(dst, 0, (size_t)c->width * 4);
+		return 1;
+	}
+	return rleNewDecodeRow8888(src, srcSize, dst, c->width);
+}
+
+// Decode RLE_NEW image data (starting at the row table, size bytes in all) straight into the pixel area
+// of a 32bpp BMP. No intermediate images are made. Rows are decoded in parallel.
+Bytes * rleNewToBMP(const u8 * imgData, size_t size, u32 width, u32 height) {
+	if((size_t)width * height * 4 + sizeof(BMPHeaderV5) > UINT32_MAX) {
+		printf("ERROR: Image of %u x %u is too big for a BMP\n", width, height);
+		return NULL;
+	}
+	BMPHeaderV5 bmpHeader;
+	setBMPHeaderV5(&bmpHeader, width, height, 32);
+
+	// Create some bytes to store the BMP
+	Bytes * b = newBytes(bmpHeader.fileSize);
+	if(b==NULL) {
+		printf("ERROR: Couldn't allocate memory!\n");
+		return NULL;
+	}
+
+	// write the header, then decode the rows into place. 32bpp rows never need padding.
+	memcpy(b->data, &bmpHeader, sizeof(bmpHeader));
+	RleToBMPCtx ctx = { imgData, size, b->data + sizeof(bmpHeader), width, height };
+	if(poolForChecked(defaultPool(), height, rleToBMPRowTask, &ctx) != 0) {
+		printf("WARNING: Some rows of RLE image did not decode cleanly\n");
+	}
 
+	return b; // SUCCESS
+}
 
 
 //----------------------------------------------------------------------------
 //  IMG, newIMG, deleteIMG - read bitmap file into basic RGB565 data format
 //----------------------------------------------------------------------------
 
-// Allocate Img and fill it with pixels from a bmp file. Returns NULL for failure. Delete with deleteImg.
+// Read a QOI file into an ARGB8888 Img
+static Img * newImgFromQOI(const Bytes * bytes) {
+	u32 w, h;
+	if(qoiReadHeader(bytes->data, bytes->size, &w, &h) != 0) {
+		return NULL;
+	}
+	Img * img = malloc(sizeof(Img));
+	if(img == NULL) {
+		printf("ERROR: Out of memory.\n");
+		return NULL;
+	}
+	img->w = w;
+	img->h = h;
+	img->format = IF_ARGB8888;
+	img->size = w * h * 4;
+	img->data = malloc(img->size);
+	if(img->data == NULL) {
+		printf("ERROR: Out of memory.\n");
+		deleteImg(img);
+		return NULL;
+	}
+	if(qoiDecode8888(bytes->data, bytes->size, img->data, w, h) != 0) {
+		deleteImg(img);
+		return NULL;
+	}
+	return img;
+}
+
+// Allocate Img and fill it with pixels from a bmp or qoi file. Returns NULL for failure. Delete with deleteImg.
 Img * newImgFromFile(char * filename) {
-    // read in the whole file
-	Bytes * bytes = newBytesFromFile(filename);
+    // map in the whole file (read-only, so the header is copied into locals before being adjusted)
+	Bytes * bytes = mapBytesFromFile(filename);
 	if(bytes==NULL) {
 		printf("ERROR: Unable to read file.\n");
 		return NULL;
 	}
+	Img * img = newImgFromBytes(bytes);
+	deleteBytes(bytes);
+	return img;
+}
+
+// The same, for a bmp or qoi file already in memory. bytes is only read.
+Img * newImgFromBytes(const Bytes * bytes) {
+	if(isQOI(bytes->data, bytes->size)) {
+		return newImgFromQOI(bytes);
+	}
 
 	if(bytes->size < BASIC_BMP_HEADER_SIZE) {
 		printf("ERROR: File is too small.\n");
-		deleteBytes(bytes);
 		return NULL;
 	}
 
@@ -434,38 +511,37 @@ Img * newImgFromFile(char * filename) {
 	}
 
 	if(fail) {
-		deleteBytes(bytes);
 		return NULL;
 	}
 
 	// Check if it's a top-down or bottom-up BMP. Normalise height to be positive.
 	bool topDown = false;
-	if(h->height < 0) {
+	i32 height = h->height;
+	if(height < 0) {
 		topDown = true;
-		h->height = -h->height;
+		height = -height;
 	}
 
-	if(h->height < 1 || h->width < 1) {
+	if(height < 1 || h->width < 1) {
 		printf("ERROR: BMP has no dimensions!\n");
-		deleteBytes(bytes);
 		return NULL;
 	}
 
-	u32 rowSize = h->imageDataSize / (u32)h->height;
-	if(rowSize < ((u32)h->width * 2)) {		
+	u32 minRowSize = (u32)h->width * (h->bpp / 8);
+	u32 imageDataSize = h->imageDataSize;
+	u32 rowSize = imageDataSize / (u32)height;
+	if(rowSize < minRowSize) {
 		// we'll have to calculate it ourselves! size of file is in b->bytes, subtract h->offset.
-		h->imageDataSize = (u32)bytes->size - h->offset;
-		rowSize = h->imageDataSize / (u32)h->height;
-		if(rowSize < ((u32)h->width * 2)) {
-			printf("ERROR: BMP imageDataSize (%u) doesn't make sense!\n", h->imageDataSize);
-			deleteBytes(bytes);
+		imageDataSize = (h->offset < bytes->size) ? (u32)(bytes->size - h->offset) : 0;
+		rowSize = imageDataSize / (u32)height;
+		if(rowSize < minRowSize) {
+			printf("ERROR: BMP imageDataSize (%u) doesn't make sense!\n", imageDataSize);
 			return NULL;
 		}
 	}
 
-	if(h->offset + h->imageDataSize < bytes->size) {
+	if((size_t)h->offset + (size_t)rowSize * ((u32)height - 1) + minRowSize > bytes->size) {
 		printf("ERROR: BMP file is too short to contain supposed data.\n");
-		deleteBytes(bytes);
 		return NULL;
 	}
 
@@ -473,14 +549,13 @@ Img * newImgFromFile(char * filename) {
 	Img * img = malloc(sizeof(Img));
 	if(img == NULL) {
 		printf("ERROR: Out of memory.\n");
-		deleteBytes(bytes);
 		return NULL;
 	}
 	img->w = (u32)h->width;
-	img->h = (u32)h->height;
+	img->h = (u32)height;
 	if(h->bpp == 16) {
 		img->format = IF_ARGB8565;			// We'll read it into this format
-		img->size = img->w * img->h * 2;
+		img->size = img->w * img->h * 3;
 	} else { // bpp = 24 or 32
 		img->format = IF_ARGB8888;			// We'll read it into this format
 		img->size = img->w * img->h * 4;	// Size is simple to calculate when no compression
@@ -489,25 +564,20 @@ Img * newImgFromFile(char * filename) {
 	img->data = malloc(img->size);
 	if(img->data == NULL) {
 		printf("ERROR: Out of memory.\n");
-		deleteBytes(bytes);
 		deleteImg(img);
 		return NULL;
 	}
 
 	// Reading the file data depends on bpp
 	if(h->bpp == 16) { // RGB565
-		printf("WARNING: THIS CODE FOR RGB565 IS UNTESTED!...\n");
-
 		// check bitfields are what we expect
 		if(bytes->size < sizeof(BMPHeaderClassic)) {
 			printf("ERROR: BMP file is too short to contain bitfields.\n");
-			deleteBytes(bytes);
 			deleteImg(img);
 			return NULL;
 		}
 		if(h->bmiColors[0] != 0xF800 || h->bmiColors[1] != 0x07E0 || h->bmiColors[2] != 0x001F) {
 			printf("ERROR: BMP bitfields are not what we expect (RGB565).\n");
-			deleteBytes(bytes);
 			deleteImg(img);
 			return NULL;
 		}
@@ -518,26 +588,31 @@ Img * newImgFromFile(char * filename) {
 			size_t bmpOffset = h->offset + row * rowSize;
 			// for each pixel in this row
 			for(size_t x=0; x<img->w; x++) {
-				// read the pixel 565
-				u8 a = bytes->data[bmpOffset + 2*x];
-				u8 b = bytes->data[bmpOffset + 2*x + 1] ;
-				// set the pixel 8565, full alpha
+				// read the pixel 565, little-endian
+				u8 lo = bytes->data[bmpOffset + 2*x];
+				u8 hi = bytes->data[bmpOffset + 2*x + 1];
+				// set the pixel 8565 (alpha, hi, lo), full alpha
 				u8 destData[3];
 				destData[0] = 0xFF;	// full alpha
-				destData[1] = a;
-				destData[2] = b;
+				destData[1] = hi;
+				destData[2] = lo;
 				memcpy(&img->data[(y * img->w + x) * 3], destData, 3);
 			}
 		}
 
 		// done!
-	} else if (h->bpp == 32 && h->dibHeaderSize > 40) { 	// ARGB8888
-		BMPHeaderV4 * h4 = (BMPHeaderV4 *)&h;
-		// check bitfields (if they exist) are what we expect
+	} else if (h->bpp == 32) { 	// ARGB8888, stored as b, g, r, a
+		// check bitfields (if they exist) are what we expect. Only V4 and V5 headers have an alpha mask.
 		if(h->compressionType == 3) {
-			if(h4->RGBAmasks[0] != 0xFF000000 || h4->RGBAmasks[1] != 0x00FF0000 || h4->RGBAmasks[2] != 0x0000FF00 || h4->RGBAmasks[3] != 0x000000FF) {
+			BMPHeaderV4 h4;
+			if(h->dibHeaderSize < 108 || bytes->size < sizeof(h4)) {
+				printf("ERROR: BMP file is too short to contain bitfields.\n");
+				deleteImg(img);
+				return NULL;
+			}
+			memcpy(&h4, bytes->data, sizeof(h4));
+			if(h4.RGBAmasks[0] != 0x00FF0000 || h4.RGBAmasks[1] != 0x0000FF00 || h4.RGBAmasks[2] != 0x000000FF || h4.RGBAmasks[3] != 0xFF000000) {
 				printf("ERROR: BMP bitfields are not what we expect for 32-bit image (ARGB8888).\n");
-				deleteBytes(bytes);
 				deleteImg(img);
 				return NULL;
 			}
@@ -555,7 +630,6 @@ Img * newImgFromFile(char * filename) {
 		if(h->compressionType == 3) {
 			if(h->bmiColors[0] != 0xFF0000 || h->bmiColors[1] != 0x00FF00 || h->bmiColors[2] != 0x0000FF) {
 				printf("ERROR: BMP bitfields are not what we expect (RGB888).\n");
-				deleteBytes(bytes);
 				deleteImg(img);
 				return NULL;
 			}
@@ -566,22 +640,14 @@ Img * newImgFromFile(char * filename) {
 			u32 row = topDown ? y : (img->h - y - 1);
 			size_t bmpOffset = h->offset + row * rowSize;
 			for(u32 x=0; x < img->w; x++) {
-				// RGB888 to ARGB8565 conversion
-				u32 pixel = 0xFF; // set alpha
-				pixel <<= 8;		
-				pixel |= bytes->data[bmpOffset + x * 3];
-				pixel <<= 8;
-				pixel |= bytes->data[bmpOffset + x * 3 + 1];
-				pixel <<= 8;
-				pixel |= bytes->data[bmpOffset + x * 3 + 2];
-				memcpy(&img->data[(y * img->w + x) * 4], &pixel, 4);
+				// RGB888 (b, g, r) to ARGB8888 (b, g, r, a), full alpha
+				u8 * dest = &img->data[(y * img->w + x) * 4];
+				memcpy(dest, &bytes->data[bmpOffset + x * 3], 3);
+				dest[3] = 0xFF;
 			}
 		}
 	}
 
-	// Free filedata
-	deleteBytes(bytes);
-
 	// Return Img
 	return img;
 }
@@ -623,8 +689,75 @@ Img * cloneImg(const Img * i) {
 Img * convertImg(Img * i, ImgFormat newFormat) {
 	// Convert between different image formats
 	// Our converters will be ARGB8888 <> ARGB8565
-	// and RLE_NEW <> ARGB8565
-	// We will re-call ourselves to do ARGB8888 <> RLE_NEW
+	// and RLE_NEW <> ARGB8565, and QOI <> ARGB8888
+	// We will re-call ourselves to do the rest
+
+	if(i->format == IF_QOI && newFormat != IF_QOI) {
+		// decode first
+		Img * newImg = malloc(sizeof(Img));
+		if(newImg == NULL) {
+			printf("ERROR: Out of memory\n");
+			deleteImg(i);
+			return NULL;
+		}
+		newImg->w = i->w;
+		newImg->h = i->h;
+		newImg->format = IF_ARGB8888;
+		newImg->size = i->w * i->h * 4;
+		newImg->data = malloc(newImg->size);
+		if(newImg->data == NULL || qoiDecode8888(i->data, i->size, newImg->data, i->w, i->h) != 0) {
+			if(newImg->data == NULL) {
+				printf("ERROR: Out of memory\n");
+			}
+			deleteImg(i);
+			deleteImg(newImg);
+			return NULL;
+		}
+		deleteImg(i);
+		i = newImg;
+		if(newFormat == IF_ARGB8888) {
+			return i;
+		}
+	}
+	if(newFormat == IF_QOI) {
+		if(i->format == IF_RLE_NEW || i->format == IF_ARGB8565) {
+			// Convert to ARGB8888 first
+			i = convertImg(i, IF_ARGB8888);
+			if(i == NULL) {
+				return NULL;
+			}
+		}
+		if(i->format == IF_ARGB8888) {
+			Bytes * b = qoiEncode8888(i->data, i->w, i->h);
+			if(b == NULL) {
+				deleteImg(i);
+				return NULL;
+			}
+			Img * newImg = malloc(sizeof(Img));
+			if(newImg == NULL) {
+				printf("ERROR: Out of memory\n");
+				deleteBytes(b);
+				deleteImg(i);
+				return NULL;
+			}
+			newImg->w = i->w;
+			newImg->h = i->h;
+			newImg->format = newFormat;
+			newImg->size = (u32)b->size;
+			newImg->data = malloc(newImg->size);
+			if(newImg->data == NULL) {
+				printf("ERROR: Out of memory\n");
+				deleteBytes(b);
+				deleteImg(i);
+				deleteImg(newImg);
+				return NULL;
+			}
+			memcpy(newImg->data, b->data, newImg->size);
+			deleteBytes(b);
+			deleteImg(i);
+			return newImg;
+		}
+	}
 
 	if(newFormat == IF_ARGB8888) {
 		if(i->format == IF_RLE_NEW) {
@@ -653,20 +786,8 @@ Img * convertImg(Img * i, ImgFormat newFormat) {
 				deleteImg(newImg);
 				return NULL;
 			}
-			// Go row by row, pixel by pixel
-			for(size_t y=0; y<i->h; y++) {
-				for(size_t x=0; x<i->w; x++) {
-					u8 * p = &i->data[i->w * y * 3 + x * 3];
-					ARGB8888 * output = (ARGB8888 *)&newImg->data[(i->w * y + x) * 4];
-					// Read in 3 bytes, convert to 4 bytes
-					// Alpha byte is the same, RGB parts need converting from 565 to 888
-					output->a = p[0];
-					RGBTrip rgb = RGB565to888(get_u16(&p[1]));
-					output->r = rgb.r;
-					output->g = rgb.g;
-					output->b = rgb.b;
-				}
-			}
+			// Alpha byte is the same, RGB parts need converting from 565 to 888. Done many pixels at a time.
+			argb8565to8888(newImg->data, i->data, (size_t)i->w * i->h);
 			deleteImg(i);
 			return(newImg);
 		}
@@ -696,13 +817,13 @@ Img * convertImg(Img * i, ImgFormat newFormat) {
 				for(size_t x=0; x<i->w; x++) {
 					u8 * p = &i->data[(i->w * y + x) * 4];
 					u8 * output = &newImg->data[(i->w * y + x) * 3];
-					// Converting ARGB8888 to ARGB8565
+					// Converting ARGB8888 (b, g, r, a) to ARGB8565 (a, hi, lo)
 					// Convert 4 bytes to 3 bytes
 					// Alpha byte is the same
-					output[0] = p[0];
-					u16 rgb565 = RGB888to565(&p[1]);
-					output[1] = (rgb565 & 0xFF); 			// lo byte
-					output[2] = (rgb565 >> 8);				// hi byte
+					output[0] = p[3];
+					u16 rgb565 = RGB888to565(p);
+					output[1] = (rgb565 >> 8);				// hi byte
+					output[2] = (rgb565 & 0xFF); 			// lo byte
 				}
 			}
 			deleteImg(i);
@@ -728,34 +849,9 @@ Img * convertImg(Img * i, ImgFormat newFormat) {
 				return NULL;
 			}
 			
-			// decompress the data
-			size_t bytesOut = 0;
-			size_t bytesIn = 0;
-
-			while(bytesIn < i->size) {
-				u8 cmd = i->data[bytesIn]; 		// read a byte
-				bytesIn++;				
-				if((cmd & 0x80) != 0) { // Repeat the pixel
-					size_t count = (cmd & 0x7F);
-					// printf("1:%zu ", count*3);
-					u8 data[3];
-					data[0] = i->data[bytesIn]; 
-					data[1] = i->data[bytesIn+1];
-					data[2] = i->data[bytesIn+2];
-					bytesIn += 3;
-					for(size_t j=0; j<count; j++) {
-						newImg->data[bytesOut]   = data[0]; 
-						newImg->data[bytesOut+1] = data[1]; 
-						newImg->data[bytesOut+2] = data[2]; 
-						bytesOut += 3;
-					}
-				} else { // Normal pixel data
-					size_t count = cmd * 3;
-					//printf("0:%zu ", count);
-					memcpy(&newImg->data[bytesOut], &i->data[bytesIn], count);
-					bytesOut += count;
-					bytesIn += count;
-				}
+			// decompress the data: the rows follow each other, so decode them as one long row
+			if(rleNewDecodeRow(i->data, i->size, newImg->data, i->w * i->h) != 0) {
+				printf("WARNING: RLE image did not decode cleanly\n");
 			}
 			deleteImg(i);
 			return newImg;
@@ -771,8 +867,36 @@ Img * convertImg(Img * i, ImgFormat newFormat) {
 		}
 		if(i->format == IF_ARGB8565) {		
 			// compress it
-			printf("ERROR: COMPRESSION NOT YET IMPLEMENTED\n");
-			return NULL;
+			Bytes * b = rleNewEncode(i->data, i->w, i->h, RLE_BEST);
+			if(b == NULL) {
+				deleteImg(i);
+				return NULL;
+			}
+			// Img only holds the compressed rows, not the row table (use rleNewEncode directly to get that)
+			size_t tableSize = (size_t)i->h * RLE_NEW_ROW_ENTRY_SIZE;
+			Img * newImg = malloc(sizeof(Img));
+			if(newImg == NULL) {
+				printf("ERROR: Out of memory\n");
+				deleteBytes(b);
+				deleteImg(i);
+				return NULL;
+			}
+			newImg->w = i->w;
+			newImg->h = i->h;
+			newImg->format = newFormat;
+			newImg->size = b->size - tableSize;
+			newImg->data = malloc(newImg->size + 1);
+			if(newImg->data == NULL) {
+				printf("ERROR: Out of memory\n");
+				deleteBytes(b);
+				deleteImg(i);
+				deleteImg(newImg);
+				return NULL;
+			}
+			memcpy(newImg->data, &b->data[tableSize], newImg->size);
+			deleteBytes(b);
+			deleteImg(i);
+			return newImg;
 		}
 	}
 	// If we get here, it was a weird request (or a bug)
@@ -108,6 +108,7 @@ typedef struct _ARGB8565 {
 
 void setBMPHeaderClassic(BMPHeaderClassic * dest, u32 width, u32 height, u8 bpp);
 void setBMPHeaderV4(BMPHeaderV4 * dest, u32 width, u32 height, u8 bpp);
+void setBMPHeaderV5(BMPHeaderV5 * dest, u32 width, u32 height, u8 bpp);
 int dumpBMP16(char * filename, u8 * srcData, size_t srcDataSize, u32 imgWidth, u32 imgHeight, bool basicRLE);
 
 
@@ -120,6 +121,7 @@ typedef enum _ImgFormat {
 	IF_ARGB8888 = 0,				// ARGB8888   4 bytes per pixel
 	IF_ARGB8565 = 1,				// ARGB8565   3 bytes per pixel
 	IF_RLE_NEW = 2,					// Compressed ARGB8565
+	IF_QOI = 3,						// A whole QOI file, see qoi.h
 } ImgFormat;
 
 // Img is a basic image data struct that may be compressed
@@ -134,7 +136,9 @@ typedef struct _Img{
 extern const char * ImgCompressionStr[8];
 
 Img * newImgFromFile(char * filename);
+Img * newImgFromBytes(const Bytes * bytes);
 Img * deleteImg(Img * i);
 Img * cloneImg(const Img * i);
 Img * convertImg(Img * i, ImgFormat format);
 Bytes * imgToBMP(const Img * i);
+Bytes * rleNewToBMP(const u8 * imgData, size_t size, u32 width, u32 height);
@@ -0,0 +1,207 @@
+/*  bmpstream.c - streaming BMP writer
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Rows are produced into a ring of two batches. While the pool fills one batch, the
+	other is written out (see output.c), the first time together with the header in one
+	vectored write. Memory is two batches of about STREAM_BATCH_BYTES each (or two rows,
+	if a row is bigger), however tall the image.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "pool.h"
+#include "pixel.h"
+#include "rle.h"
+#include "output.h"
+#include "bmpstream.h"
+#include "strutil.h"
+
+#define STREAM_BATCH_BYTES (128 * 1024)
+
+//----------------------------------------------------------------------------
+//  STREAMBMP
+//----------------------------------------------------------------------------
+
+typedef struct _StreamCtx {
+	BMPRowFunc fn;
+	void * ctx;
+	size_t rowSize;
+} StreamCtx;
+
+typedef struct _StreamRow {
+	const StreamCtx * s;
+	size_t y;
+	u8 * row;
+	int result;				// from fn, read once the batch has been waited for
+} StreamRow;
+
+static void streamRowTask(void * arg) {
+	StreamRow * r = (StreamRow *)arg;
+	r->result = r->s->fn(r->s->ctx, r->y, r->row);
+}
+
+// Queue the rows of batch b into ring slot (b & 1)
+static void submitBatch(StreamCtx * s, StreamRow * rows, u8 * ring, size_t batchRows, size_t b, u32 height, PoolGroup * g) {
+	size_t slot = b & 1;
+	size_t y0 = b * batchRows;
+	size_t y1 = (y0 + batchRows < height) ? y0 + batchRows : height;
+	for(size_t y=y0; y<y1; y++) {
+		StreamRow * r = &rows[slot * batchRows + (y - y0)];
+		r->s = s;
+		r->y = y;
+		r->row = &ring[(slot * batchRows + (y - y0)) * s->rowSize];
+		poolSubmit(defaultPool(), g, streamRowTask, r);
+	}
+}
+
+// Write a top-down 32bpp BMP with a V5 header, asking fn for each row. Returns 0 on success.
+// On failure the partly written file is removed. Damaged rows are written, with a warning.
+int streamBMP(const char * fileName, u32 width, u32 height, BMPRowFunc fn, void * ctx) {
+	if(width == 0 || height == 0 || (size_t)width * height * 4 + sizeof(BMPHeaderV5) > UINT32_MAX) {
+		dprintf(0, "ERROR: A BMP can't be %u x %u\n", width, height);
+		return 1;
+	}
+	BMPHeaderV5 bmpHeader;
+	setBMPHeaderV5(&bmpHeader, width, height, 32);
+
+	StreamCtx s = { fn, ctx, (size_t)width * 4 };		// 32bpp rows never need padding
+	size_t batchRows = STREAM_BATCH_BYTES / s.rowSize;
+	if(batchRows < 1) {
+		batchRows = 1;
+	}
+	if(batchRows > height) {
+		batchRows = height;
+	}
+	size_t batches = (height + batchRows - 1) / batchRows;
+
+	u8 * ring = malloc(2 * batchRows * s.rowSize);
+	StreamRow * rows = malloc(2 * batchRows * sizeof(StreamRow));
+	if(ring == NULL || rows == NULL) {
+		dprintf(0, "ERROR: Out of memory\n");
+		free(ring);
+		free(rows);
+		return 1;
+	}
+	OutFile * out = outputOpen(fileName, bmpHeader.fileSize);
+	if(out == NULL) {
+		dprintf(0, "ERROR: Can't open %s for writing.\n", fileName);
+		free(ring);
+		free(rows);
+		return 1;
+	}
+
+	int r = 0;
+	size_t damaged = 0;
+	PoolGroup groups[2] = { POOL_GROUP_INIT, POOL_GROUP_INIT };
+	submitBatch(&s, rows, ring, batchRows, 0, height, &groups[0]);
+	for(size_t b=0; b<batches; b++) {
+		poolWait(defaultPool(), &groups[b & 1]);
+		size_t y0 = b * batchRows;
+		size_t count = ((y0 + batchRows < height) ? batchRows : height - y0);
+		for(size_t i=0; i<count; i++) {
+			damaged += (rows[(b & 1) * batchRows + i].result != 0) ? 1 : 0;
+		}
+		// start on the next batch, then write this one while it's filled
+		if(b + 1 < batches) {
+			submitBatch(&s, rows, ring, batchRows, b + 1, height, &groups[(b + 1) & 1]);
+		}
+		if(r != 0) {
+			continue;		// still wait for every queued row, as they point into ring
+		}
+		OutPiece pieces[2];
+		int n = 0;
+		if(b == 0) {
+			pieces[n++] = (OutPiece){ &bmpHeader, sizeof(bmpHeader) };
+		}
+		pieces[n++] = (OutPiece){ &ring[(b & 1) * batchRows * s.rowSize], count * s.rowSize };
+		r = outputWrite(out, pieces, n);
+	}
+
+	if(outputClose(out, r == 0) != 0) {
+		r = 1;
+	}
+	free(ring);
+	free(rows);
+	if(r != 0) {
+		dprintf(0, "ERROR: Failed to write %s\n", fileName);
+	} else if(damaged != 0) {
+		printf("WARNING: Some rows of RLE image did not decode cleanly\n");
+	}
+	return r;
+}
+
+//----------------------------------------------------------------------------
+//  RLENEWSTREAMBMP / IMGSTREAMBMP
+//----------------------------------------------------------------------------
+
+typedef struct _RleRows {
+	const u8 * imgData;
+	size_t size;
+	u32 width;
+	u32 height;
+} RleRows;
+
+static int rleRow(void * ctx, size_t y, u8 * row) {
+	RleRows * c = (RleRows *)ctx;
+	size_t srcSize;
+	const u8 * src = rleNewRow(c->imgData, c->size, c->height, (u32)y, &srcSize);
+	if(src == NULL) {
+		memset(row, 0, (size_t)c->width * 4);
+		return 1;
+	}
+	return rleNewDecodeRow8888(src, srcSize, row, c->width);
+}
+
+// Decode RLE_NEW image data (starting at the row table, size bytes in all) straight to a BMP file.
+// The same file as saving rleNewToBMP, without the whole image ever being in memory.
+int rleNewStreamBMP(const char * fileName, const u8 * imgData, size_t size, u32 width, u32 height) {
+	RleRows c = { imgData, size, width, height };
+	return streamBMP(fileName, width, height, rleRow, &c);
+}
+
+static int img8888Row(void * ctx, size_t y, u8 * row) {
+	const Img * img = (const Img *)ctx;
+	memcpy(row, &img->data[y * img->w * 4], (size_t)img->w * 4);
+	return 0;
+}
+
+static int img8565Row(void * ctx, size_t y, u8 * row) {
+	const Img * img = (const Img *)ctx;
+	argb8565to8888(row, &img->data[y * img->w * 3], img->w);
+	return 0;
+}
+
+// Save an Img as a BMP file, the same file as saving imgToBMP. ARGB8888 and ARGB8565 images
+// are converted a row at a time; other formats are converted as a whole first.
+int imgStreamBMP(const char * fileName, const Img * img) {
+	if(img->format == IF_ARGB8888) {
+		return streamBMP(fileName, img->w, img->h, img8888Row, (void *)img);
+	}
+	if(img->format == IF_ARGB8565) {
+		return streamBMP(fileName, img->w, img->h, img8565Row, (void *)img);
+	}
+	Img * i = cloneImg(img);
+	if(i != NULL) {
+		i = convertImg(i, IF_ARGB8888);
+	}
+	if(i == NULL) {
+		dprintf(0, "ERROR: Failed to convert image for %s\n", fileName);
+		return 1;
+	}
+	int r = streamBMP(fileName, i->w, i->h, img8888Row, i);
+	deleteImg(i);
+	return r;
+}
@@ -0,0 +1,18 @@
+// bmpstream.h
+// write 32bpp BMPs row by row, so memory use is a few rows rather than the whole file
+
+//----------------------------------------------------------------------------
+//  EXPORTED TYPES
+//----------------------------------------------------------------------------
+
+// Fill row y (top row is 0) with width ARGB8888 pixels. Called from the thread pool, for
+// several rows at once, so it must only touch row. Returns 0, or 1 if the row is damaged.
+typedef int (*BMPRowFunc)(void * ctx, size_t y, u8 * row);
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+int streamBMP(const char * fileName, u32 width, u32 height, BMPRowFunc fn, void * ctx);
+int rleNewStreamBMP(const char * fileName, const u8 * imgData, size_t size, u32 width, u32 height);
+int imgStreamBMP(const char * fileName, const Img * img);
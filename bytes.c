@@ -1,6 +1,10 @@
 // bytes
 // a struct and wrapper around malloc/free that stores size
 
+#ifndef WINDOWS
+#define _POSIX_C_SOURCE 200809L		// for mmap, posix_madvise
+#endif
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -9,8 +13,31 @@
 
 #include "types.h"
 #include "bytes.h"
+#include "output.h"
 #include "strutil.h"
 
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+//----------------------------------------------------------------------------
+//  NEWBYTES - allocate a Bytes struct able to hold size bytes
+//----------------------------------------------------------------------------
+
+Bytes * newBytes(size_t size) {
+	Bytes * b = (Bytes *)malloc(sizeof(Bytes)+size);
+	if(b == NULL) {
+		return NULL;
+	}
+	b->size = size;
+	b->data = b->buf;
+	b->mapped = false;
+	return b;
+}
+
 //----------------------------------------------------------------------------
 //  NEWBYTESFROMFILE - read entire file into memory into a Bytes struct
 //----------------------------------------------------------------------------
@@ -30,14 +57,13 @@ Bytes * newBytesFromFile(const char * fileName) {
 	size_t fileSize = (size_t)ftr;
 
 	// Allocate buffer
-	Bytes * b = (Bytes *)malloc(sizeof(Bytes)+fileSize);
+	Bytes * b = newBytes(fileSize);
 	if(b == NULL) {
 		dprintf(0, "ERROR: Unable to allocate enough memory to open file (NBFF).\n");
 		fclose(f);
 		return NULL;
 	}
 
-	b->size = fileSize;	
  	// Read whole file
 	if(fread(b->data, 1, fileSize, f) != fileSize) {
 		dprintf(0, "ERROR: Read failed.\n");
@@ -54,19 +80,62 @@ Bytes * newBytesFromFile(const char * fileName) {
 }
 
 
+//----------------------------------------------------------------------------
+//  MAPBYTESFROMFILE - map a file into memory read-only, without copying it
+//----------------------------------------------------------------------------
+
+// The data is a read-only view of the page cache: don't write to it. Falls back to reading the
+// file into memory where mapping isn't possible. Delete with deleteBytes either way.
+Bytes * mapBytesFromFile(const char * fileName) {
+#ifndef WINDOWS
+	int fd = open(fileName, O_RDONLY);
+	if(fd < 0) {
+		dprintf(0, "ERROR: Failed to open input file: '%s'\n", fileName);
+		return NULL;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		close(fd);
+		return newBytesFromFile(fileName);		// empty or special file, just read it
+	}
+	size_t fileSize = (size_t)st.st_size;
+
+	void * map = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);		// the mapping keeps its own reference
+	if(map == MAP_FAILED) {
+		return newBytesFromFile(fileName);
+	}
+	posix_madvise(map, fileSize, POSIX_MADV_WILLNEED);
+
+	Bytes * b = newBytes(0);
+	if(b == NULL) {
+		dprintf(0, "ERROR: Unable to allocate memory (MBFF).\n");
+		munmap(map, fileSize);
+		return NULL;
+	}
+	b->size = fileSize;
+	b->data = (u8 *)map;
+	b->mapped = true;
+	return b;
+#else
+	return newBytesFromFile(fileName);
+#endif
+}
+
+
 //----------------------------------------------------------------------------
 //  NEWBYTESFROMMEMORY - clone bytes from memory into a Bytes struct
 //----------------------------------------------------------------------------
 
 Bytes * newBytesFromMemory(const u8 * data, size_t size) {
 	// Allocate buffer
-	Bytes * b = (Bytes *)malloc(sizeof(Bytes)+size);
+	Bytes * b = newBytes(size);
 	if(b == NULL) {
 		dprintf(0, "ERROR: Unable to allocate enough memory (NBFM).\n");
 		return NULL;
 	}
 
-	b->size = size;	
 	memcpy(b->data, data, size);	
 
 	// Return the allocated memory filled with the data
@@ -75,11 +144,16 @@ Bytes * newBytesFromMemory(const u8 * data, size_t size) {
 
 
 //----------------------------------------------------------------------------
-//  DELETEBYTES - delete data allocated using newBytesFromFile
+//  DELETEBYTES - delete data allocated using newBytes, newBytesFromFile, mapBytesFromFile etc.
 //----------------------------------------------------------------------------
 
 Bytes * deleteBytes(Bytes * b) {
 	if(b != NULL) {
+#ifndef WINDOWS
+		if(b->mapped) {
+			munmap(b->data, b->size);
+		}
+#endif
 		free(b);
 		b = NULL;
 	}
@@ -91,33 +165,7 @@ Bytes * deleteBytes(Bytes * b) {
 //----------------------------------------------------------------------------
 
 int saveBytesToFile(const Bytes * b, const char * fileName) {
-	// open the dump file
-	FILE * dumpFile = fopen(fileName, "wb");
-	if(dumpFile == NULL) {
-		return 1;	// FAILED
-	}
-	int idx = 0;
-	size_t length = b->size;
-
-	// write the data to the dump file
-	while(length > 0) {
-		size_t bytesToWrite = 4096;
-		if(length < bytesToWrite) {
-			bytesToWrite = length;
-		}
-
-		size_t rval = fwrite(&b->data[idx],1,bytesToWrite,dumpFile);
-		if(rval != bytesToWrite) {
-			fclose(dumpFile);
-			remove(fileName);
-			return 2;	// FAILED
-		}
-		idx += bytesToWrite;
-		length -= bytesToWrite;
-	}
-
-	// close the dump file
-	fclose(dumpFile);
-
-	return 0; // SUCCESS
+	// the whole buffer in one write, see output.c
+	OutPiece piece = { b->data, b->size };
+	return outputFile(fileName, &piece, 1);
 }
\ No newline at end of file
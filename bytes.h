@@ -7,14 +7,18 @@
 
 typedef struct _Bytes {
     size_t size;
-    u8 data[16];        // cover weird padding/align situations
+    bool mapped;        // data is a file mapping, not part of this allocation
+    u8 * data;          // points to buf, or to a read-only file mapping (see mapBytesFromFile)
+    u8 buf[16];         // the data itself, running on past the struct. Straight after data, so pointer aligned.
 } Bytes;
 
 //----------------------------------------------------------------------------
 //  EXPORTED FUNCTIONS
 //----------------------------------------------------------------------------
 
+Bytes * newBytes(size_t size);
 Bytes * newBytesFromFile(const char * filename);
+Bytes * mapBytesFromFile(const char * filename);
 Bytes * newBytesFromMemory(const u8 * data, size_t size);
 Bytes * deleteBytes(Bytes * b);
 int saveBytesToFile(const Bytes * b, const char * filename);
\ No newline at end of file
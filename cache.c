@@ -0,0 +1,191 @@
+/*  cache.c - persistent on-disk cache of converted images
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Each entry is one file, named by a 128 bit hash of the RLE_NEW data together with the
+	image size and output format, and holds exactly what was dumped for it. Entries are
+	spread over 256 sub-folders. An entry is written to a temporary file and renamed into
+	place, so a reader never sees half an entry, even with several runs sharing the folder.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#ifndef WINDOWS
+#define _POSIX_C_SOURCE 200809L		// for getpid
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/stat.h>		// for mkdir()
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#include "types.h"
+#include "adawft.h"
+#include "bytes.h"
+#include "hash.h"
+#include "cache.h"
+#include "strutil.h"
+
+// Bump this whenever the output of any format changes, so entries written before are never used
+#define CACHE_VERSION 1
+
+struct _ImageCache {
+	char * folderName;
+	pthread_mutex_t lock;		// for everything below
+	size_t hits;
+	size_t misses;
+	size_t stored;
+	unsigned tmpCounter;
+	bool made[256];				// sub-folders known to exist
+};
+
+//----------------------------------------------------------------------------
+//  NEW / DELETE
+//----------------------------------------------------------------------------
+
+// Open (creating if needed) the cache in folderName
+ImageCache * newImageCache(const char * folderName) {
+	d_mkdir(folderName, 0777);		// may already exist
+	struct stat st;
+	if(stat(folderName, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		dprintf(0, "ERROR: Can't use %s as a cache folder\n", folderName);
+		return NULL;
+	}
+
+	ImageCache * c = calloc(1, sizeof(ImageCache));
+	char * name = malloc(strlen(folderName) + 1);
+	if(c == NULL || name == NULL) {
+		printf("ERROR: Out of memory\n");
+		free(c);
+		free(name);
+		return NULL;
+	}
+	strcpy(name, folderName);
+	c->folderName = name;
+	pthread_mutex_init(&c->lock, NULL);
+	return c;
+}
+
+ImageCache * deleteImageCache(ImageCache * c) {
+	if(c != NULL) {
+		pthread_mutex_destroy(&c->lock);
+		free(c->folderName);
+		free(c);
+	}
+	return NULL;
+}
+
+//----------------------------------------------------------------------------
+//  KEYS AND PATHS
+//----------------------------------------------------------------------------
+
+// Two 64 bit hashes with unrelated seeds. params should hold everything besides the data that
+// changes the output, e.g. width, height and format. It is hashed on its own, into the seed.
+CacheKey cacheKey(const u8 * data, size_t size, const void * params, size_t paramsSize) {
+	u64 seed = hashBytes((const u8 *)params, paramsSize, CACHE_VERSION);
+	CacheKey key;
+	key.h[0] = hashBytes(data, size, seed);
+	key.h[1] = hashBytes(data, size, seed ^ 0xC2B2AE3D27D4EB4FULL);
+	return key;
+}
+
+// FOLDER/ab/ab....ext. Returns 0 on success.
+static int entryPath(const ImageCache * c, const CacheKey * key, const char * ext, char * buf, size_t bufSize) {
+	int len = snprintf(buf, bufSize, "%s%s%02x%s%016llx%016llx.%s", c->folderName, DIR_SEPERATOR,
+		(unsigned)(key->h[0] >> 56), DIR_SEPERATOR, (unsigned long long)key->h[0], (unsigned long long)key->h[1], ext);
+	return (len < 0 || (size_t)len >= bufSize) ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+//  LOAD / STORE
+//----------------------------------------------------------------------------
+
+// The entry for key, or NULL if there isn't one. Counts a hit or a miss.
+Bytes * cacheLoad(ImageCache * c, const CacheKey * key, const char * ext) {
+	char path[1024];
+	Bytes * b = NULL;
+	FILE * f = NULL;
+	if(entryPath(c, key, ext, path, sizeof(path)) == 0) {
+		f = fopen(path, "rb");
+	}
+	if(f != NULL) {
+		fseek(f, 0, SEEK_END);
+		long size = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		if(size > 0) {
+			b = newBytes((size_t)size);
+		}
+		if(b != NULL && fread(b->data, 1, b->size, f) != b->size) {
+			b = deleteBytes(b);
+		}
+		fclose(f);
+	}
+
+	pthread_mutex_lock(&c->lock);
+	if(b != NULL) {
+		c->hits++;
+	} else {
+		c->misses++;
+	}
+	pthread_mutex_unlock(&c->lock);
+	return b;
+}
+
+// Add an entry. Returns 0 on success. Failing to store is never fatal, the entry is just missing next time.
+int cacheStore(ImageCache * c, const CacheKey * key, const char * ext, const Bytes * b) {
+	char path[1024];
+	char tmpPath[1100];
+	if(entryPath(c, key, ext, path, sizeof(path)) != 0) {
+		return 1;
+	}
+	unsigned sub = (unsigned)(key->h[0] >> 56);
+#ifndef WINDOWS
+	unsigned pid = (unsigned)getpid();
+#else
+	unsigned pid = 0;
+#endif
+
+	pthread_mutex_lock(&c->lock);
+	if(!c->made[sub]) {
+		char subPath[1024];
+		snprintf(subPath, sizeof(subPath), "%s%s%02x", c->folderName, DIR_SEPERATOR, sub);
+		d_mkdir(subPath, 0777);		// may already exist
+		c->made[sub] = true;
+	}
+	unsigned counter = c->tmpCounter++;
+	pthread_mutex_unlock(&c->lock);
+
+	// unique to this process and call, so concurrent writers never share a temporary file
+	snprintf(tmpPath, sizeof(tmpPath), "%s.%u.%u.tmp", path, pid, counter);
+	if(saveBytesToFile(b, tmpPath) != 0) {
+		remove(tmpPath);
+		return 1;
+	}
+	if(rename(tmpPath, path) != 0) {
+		remove(tmpPath);		// on Windows, another run got there first
+		return 1;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	c->stored++;
+	pthread_mutex_unlock(&c->lock);
+	return 0;
+}
+
+void cacheStats(ImageCache * c, size_t * hits, size_t * misses, size_t * stored) {
+	pthread_mutex_lock(&c->lock);
+	*hits = c->hits;
+	*misses = c->misses;
+	*stored = c->stored;
+	pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,25 @@
+// cache.h
+// a persistent on-disk cache of converted images, shared by every run that uses the same folder
+
+//----------------------------------------------------------------------------
+//  EXPORTED TYPES
+//----------------------------------------------------------------------------
+
+// 128 bits of content hash. Entries are only ever looked up by key, so collisions must be negligible.
+typedef struct _CacheKey {
+	u64 h[2];
+} CacheKey;
+
+// Safe to use from several threads at once
+typedef struct _ImageCache ImageCache;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+ImageCache * newImageCache(const char * folderName);
+ImageCache * deleteImageCache(ImageCache * c);
+CacheKey cacheKey(const u8 * data, size_t size, const void * params, size_t paramsSize);
+Bytes * cacheLoad(ImageCache * c, const CacheKey * key, const char * ext);
+int cacheStore(ImageCache * c, const CacheKey * key, const char * ext, const Bytes * b);
+void cacheStats(ImageCache * c, size_t * hits, size_t * misses, size_t * stored);
@@ -0,0 +1,674 @@
+/*  deflate.c - deflate encoder and zlib wrapper
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	LZ77 over a 32K window with hash chains, then Huffman coding. The level picks how far
+	each hash chain is followed and whether matching is lazy (a match is put off by one
+	byte if a longer one starts there). Every block is written whichever way is smallest:
+	stored, fixed codes, or dynamic codes built for that block.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "bytes.h"
+#include "deflate.h"
+
+//----------------------------------------------------------------------------
+//  DEFLATE CONSTANTS
+//----------------------------------------------------------------------------
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define BLOCK_SYMBOLS 32768			// symbols per block, before a block is written out
+#define MAX_STORED 65535			// bytes per stored block
+
+#define LITLEN_CODES 286
+#define DIST_CODES 30
+#define CODELEN_CODES 19
+#define MAX_BITS 15
+#define MAX_CODELEN_BITS 7
+#define END_OF_BLOCK 256
+
+static const u16 LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const u8 LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const u16 DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const u8 DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const u8 CODELEN_ORDER[CODELEN_CODES] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// How hard each level tries
+typedef struct _LevelInfo {
+	u16 maxChain;		// hash chain entries looked at per position
+	u16 niceLength;		// stop looking once a match is this long
+	bool lazy;
+} LevelInfo;
+
+static const LevelInfo LEVEL_INFO[DEFLATE_LEVEL_MAX + 1] = {
+	{    0,   0, false },	// 0: stored
+	{    4,  16, false },
+	{    8,  32, false },
+	{   16,  64, false },
+	{   16,  64, true },
+	{   32, 128, true },
+	{  128, 258, true },	// 6: default
+	{  256, 258, true },
+	{ 1024, 258, true },
+	{ 4096, 258, true },
+};
+
+static int floorLog2(u32 x) {
+	int n = 0;
+	while(x >>= 1) {
+		n++;
+	}
+	return n;
+}
+
+// Length 3-258 to its code, 257-285
+static int lengthCode(int length) {
+	int l = length - MIN_MATCH;
+	if(length == MAX_MATCH) {
+		return 285;
+	}
+	if(l < 8) {
+		return 257 + l;
+	}
+	int nb = floorLog2((u32)l);
+	return 257 + 4 * (nb - 1) + ((l >> (nb - 2)) & 3);
+}
+
+// Distance 1-32768 to its code, 0-29
+static int distCode(int dist) {
+	int d = dist - 1;
+	if(d < 4) {
+		return d;
+	}
+	int nb = floorLog2((u32)d);
+	return 2 * nb + ((d >> (nb - 1)) & 1);
+}
+
+//----------------------------------------------------------------------------
+//  BIT WRITER - deflate packs bits from the least significant end
+//----------------------------------------------------------------------------
+
+typedef struct _BitWriter {
+	u8 * buf;
+	size_t size;
+	size_t capacity;
+	u64 bits;
+	int count;			// bits waiting in bits
+	bool error;			// out of memory
+} BitWriter;
+
+static bool reserveBytes(BitWriter * w, size_t n) {
+	if(w->size + n <= w->capacity) {
+		return true;
+	}
+	size_t capacity = w->capacity * 2 + n;
+	u8 * buf = realloc(w->buf, capacity);
+	if(buf == NULL) {
+		w->error = true;
+		return false;
+	}
+	w->buf = buf;
+	w->capacity = capacity;
+	return true;
+}
+
+// n is at most 16
+static void putBits(BitWriter * w, u32 value, int n) {
+	w->bits |= (u64)value << w->count;
+	w->count += n;
+	if(w->count >= 32) {
+		if(reserveBytes(w, 4)) {
+			for(int i=0; i<4; i++) {
+				w->buf[w->size++] = (u8)(w->bits >> (8 * i));
+			}
+		}
+		w->bits >>= 32;
+		w->count -= 32;
+	}
+}
+
+// Pad with zero bits to a whole byte, and flush
+static void alignBits(BitWriter * w) {
+	if(!reserveBytes(w, 8)) {
+		return;
+	}
+	while(w->count > 0) {
+		w->buf[w->size++] = (u8)w->bits;
+		w->bits >>= 8;
+		w->count = (w->count > 8) ? w->count - 8 : 0;
+	}
+	w->bits = 0;
+}
+
+static void putBytes(BitWriter * w, const u8 * src, size_t n) {
+	if(reserveBytes(w, n)) {
+		memcpy(&w->buf[w->size], src, n);
+		w->size += n;
+	}
+}
+
+//----------------------------------------------------------------------------
+//  HUFFMAN CODES
+//----------------------------------------------------------------------------
+
+// Code lengths for count symbols (at most LITLEN_CODES), none longer than maxBits. Unused symbols get 0.
+// If the lengths come out too long, the frequencies are flattened and the tree built again.
+static void huffmanLengths(const u32 * freqIn, int count, int maxBits, u8 * lengths) {
+	u32 freq[LITLEN_CODES];
+	int syms[LITLEN_CODES];
+	u32 weight[2 * LITLEN_CODES];
+	int parent[2 * LITLEN_CODES];
+	int depth[2 * LITLEN_CODES];
+	memcpy(freq, freqIn, count * sizeof(u32));
+	memset(lengths, 0, count);
+
+	while(true) {
+		// used symbols, sorted by frequency (insertion sort, there are few of them)
+		int n = 0;
+		for(int i=0; i<count; i++) {
+			if(freq[i] == 0) {
+				continue;
+			}
+			int j = n++;
+			while(j > 0 && freq[syms[j-1]] > freq[i]) {
+				syms[j] = syms[j-1];
+				j--;
+			}
+			syms[j] = i;
+		}
+		if(n == 0) {
+			return;
+		}
+		if(n == 1) {
+			lengths[syms[0]] = 1;
+			return;
+		}
+
+		// two queues: the sorted leaves, and the internal nodes, which are made in order of weight
+		for(int i=0; i<n; i++) {
+			weight[i] = freq[syms[i]];
+		}
+		int leaf = 0;
+		int node = n;
+		for(int next=n; next<2*n-1; next++) {
+			int pick[2];
+			for(int k=0; k<2; k++) {
+				if(leaf < n && (node >= next || weight[leaf] <= weight[node])) {
+					pick[k] = leaf++;
+				} else {
+					pick[k] = node++;
+				}
+			}
+			weight[next] = weight[pick[0]] + weight[pick[1]];
+			parent[pick[0]] = next;
+			parent[pick[1]] = next;
+		}
+
+		// parents always come after their children, so walk back from the root
+		int maxDepth = 0;
+		depth[2*n-2] = 0;
+		for(int i=2*n-3; i>=0; i--) {
+			depth[i] = depth[parent[i]] + 1;
+			if(i < n && depth[i] > maxDepth) {
+				maxDepth = depth[i];
+			}
+		}
+		if(maxDepth <= maxBits) {
+			for(int i=0; i<n; i++) {
+				lengths[syms[i]] = (u8)depth[i];
+			}
+			return;
+		}
+		for(int i=0; i<count; i++) {
+			if(freq[i] != 0) {
+				freq[i] = (freq[i] >> 1) | 1;
+			}
+		}
+	}
+}
+
+// Canonical codes from lengths, bit reversed to suit the bit writer
+static void huffmanCodes(const u8 * lengths, int count, u16 * codes) {
+	int blCount[MAX_BITS + 1] = { 0 };
+	int nextCode[MAX_BITS + 1];
+	for(int i=0; i<count; i++) {
+		blCount[lengths[i]]++;
+	}
+	blCount[0] = 0;
+	int code = 0;
+	for(int bits=1; bits<=MAX_BITS; bits++) {
+		code = (code + blCount[bits-1]) << 1;
+		nextCode[bits] = code;
+	}
+	for(int i=0; i<count; i++) {
+		int len = lengths[i];
+		if(len == 0) {
+			codes[i] = 0;
+			continue;
+		}
+		int c = nextCode[len]++;
+		int r = 0;
+		for(int b=0; b<len; b++) {
+			r = (r << 1) | ((c >> b) & 1);
+		}
+		codes[i] = (u16)r;
+	}
+}
+
+//----------------------------------------------------------------------------
+//  BLOCKS
+//----------------------------------------------------------------------------
+
+// A literal (dist 0) or a match
+typedef struct _Symbol {
+	u16 litLen;
+	u16 dist;
+} Symbol;
+
+typedef struct _Deflater {
+	const u8 * src;
+	size_t size;
+	const LevelInfo * info;
+	i32 * head;				// HASH_SIZE: latest position with each hash, or -1
+	i32 * prev;				// WINDOW_SIZE: the position before, with the same hash
+	size_t nextInsert;		// positions before this are in the hash chains
+	Symbol * symbols;		// BLOCK_SYMBOLS
+	size_t symbolCount;
+	size_t blockStart;		// first source byte of the current block
+	BitWriter w;
+} Deflater;
+
+static void fixedLengths(u8 * litLen, u8 * dist) {
+	for(int i=0; i<288; i++) {
+		litLen[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+	}
+	for(int i=0; i<DIST_CODES; i++) {
+		dist[i] = 5;
+	}
+}
+
+// zlib's inflate rejects an incomplete code, which is what a single symbol makes. So use at least two.
+static void atLeastTwo(u32 * freq, int count) {
+	int used = 0;
+	for(int i=0; i<count; i++) {
+		used += (freq[i] != 0);
+	}
+	for(int i=0; i<count && used<2; i++) {
+		if(freq[i] == 0) {
+			freq[i] = 1;
+			used++;
+		}
+	}
+}
+
+// Bits for the symbols (and their extra bits) with these code lengths
+static size_t symbolBits(const u32 * litFreq, const u32 * distFreq, const u8 * litLen, const u8 * distLen) {
+	size_t bits = 0;
+	for(int i=0; i<LITLEN_CODES; i++) {
+		bits += (size_t)litFreq[i] * (litLen[i] + ((i >= 257) ? LENGTH_EXTRA[i - 257] : 0));
+	}
+	for(int i=0; i<DIST_CODES; i++) {
+		bits += (size_t)distFreq[i] * (distLen[i] + DIST_EXTRA[i]);
+	}
+	return bits;
+}
+
+static void writeSymbols(Deflater * d, const u8 * litLen, const u16 * litCodes, const u8 * distLen, const u16 * distCodes) {
+	BitWriter * w = &d->w;
+	for(size_t i=0; i<d->symbolCount; i++) {
+		const Symbol * s = &d->symbols[i];
+		if(s->dist == 0) {
+			putBits(w, litCodes[s->litLen], litLen[s->litLen]);
+			continue;
+		}
+		int lc = lengthCode(s->litLen);
+		putBits(w, litCodes[lc], litLen[lc]);
+		if(LENGTH_EXTRA[lc - 257]) {
+			putBits(w, s->litLen - LENGTH_BASE[lc - 257], LENGTH_EXTRA[lc - 257]);
+		}
+		int dc = distCode(s->dist);
+		putBits(w, distCodes[dc], distLen[dc]);
+		if(DIST_EXTRA[dc]) {
+			putBits(w, s->dist - DIST_BASE[dc], DIST_EXTRA[dc]);
+		}
+	}
+	putBits(w, litCodes[END_OF_BLOCK], litLen[END_OF_BLOCK]);
+}
+
+static void writeStored(Deflater * d, size_t end, bool final) {
+	size_t pos = d->blockStart;
+	do {
+		size_t n = end - pos;
+		if(n > MAX_STORED) {
+			n = MAX_STORED;
+		}
+		bool last = final && (pos + n == end);
+		putBits(&d->w, last ? 1 : 0, 3);		// BFINAL, BTYPE 00
+		alignBits(&d->w);
+		u8 len[4] = { (u8)n, (u8)(n >> 8), (u8)~n, (u8)(~n >> 8) };
+		putBytes(&d->w, len, 4);
+		putBytes(&d->w, &d->src[pos], n);
+		pos += n;
+	} while(pos < end);
+}
+
+// Write the symbols so far, covering source bytes blockStart to end, as the smallest kind of block
+static void flushBlock(Deflater * d, size_t end, bool final) {
+	u32 litFreq[LITLEN_CODES] = { 0 };
+	u32 distFreq[DIST_CODES] = { 0 };
+	for(size_t i=0; i<d->symbolCount; i++) {
+		const Symbol * s = &d->symbols[i];
+		if(s->dist == 0) {
+			litFreq[s->litLen]++;
+		} else {
+			litFreq[lengthCode(s->litLen)]++;
+			distFreq[distCode(s->dist)]++;
+		}
+	}
+	litFreq[END_OF_BLOCK] = 1;
+
+	// fixed codes
+	u8 fixedLit[288];
+	u8 fixedDist[DIST_CODES];
+	fixedLengths(fixedLit, fixedDist);
+	size_t fixedBits = 3 + symbolBits(litFreq, distFreq, fixedLit, fixedDist);
+
+	// dynamic codes
+	u32 litTree[LITLEN_CODES];
+	u32 distTree[DIST_CODES];
+	memcpy(litTree, litFreq, sizeof(litTree));
+	memcpy(distTree, distFreq, sizeof(distTree));
+	atLeastTwo(litTree, LITLEN_CODES);
+	atLeastTwo(distTree, DIST_CODES);
+	u8 litLen[LITLEN_CODES];
+	u8 distLen[DIST_CODES];
+	huffmanLengths(litTree, LITLEN_CODES, MAX_BITS, litLen);
+	huffmanLengths(distTree, DIST_CODES, MAX_BITS, distLen);
+
+	int hlit = LITLEN_CODES;
+	while(hlit > 257 && litLen[hlit-1] == 0) {
+		hlit--;
+	}
+	int hdist = DIST_CODES;
+	while(hdist > 1 && distLen[hdist-1] == 0) {
+		hdist--;
+	}
+
+	// run length code the code lengths: 16 repeats the last 3-6 times, 17 and 18 are runs of zeros
+	u8 all[LITLEN_CODES + DIST_CODES];
+	memcpy(all, litLen, hlit);
+	memcpy(&all[hlit], distLen, hdist);
+	int total = hlit + hdist;
+	u8 clSym[LITLEN_CODES + DIST_CODES];
+	u8 clExtra[LITLEN_CODES + DIST_CODES];
+	int clCount = 0;
+	u32 clFreq[CODELEN_CODES] = { 0 };
+	for(int i=0; i<total; ) {
+		int run = 1;
+		while(i + run < total && all[i + run] == all[i]) {
+			run++;
+		}
+		if(all[i] == 0 && run >= 3) {
+			int n = run > 138 ? 138 : run;
+			clSym[clCount] = (n >= 11) ? 18 : 17;
+			clExtra[clCount++] = (u8)((n >= 11) ? n - 11 : n - 3);
+			i += n;
+		} else if(all[i] != 0 && run >= 4) {
+			clSym[clCount] = all[i];
+			clExtra[clCount++] = 0;
+			int n = run - 1 > 6 ? 6 : run - 1;
+			clSym[clCount] = 16;
+			clExtra[clCount++] = (u8)(n - 3);
+			i += n + 1;
+		} else {
+			clSym[clCount] = all[i];
+			clExtra[clCount++] = 0;
+			i++;
+		}
+	}
+	for(int i=0; i<clCount; i++) {
+		clFreq[clSym[i]]++;
+	}
+	atLeastTwo(clFreq, CODELEN_CODES);
+	u8 clLen[CODELEN_CODES];
+	u16 clCodes[CODELEN_CODES];
+	huffmanLengths(clFreq, CODELEN_CODES, MAX_CODELEN_BITS, clLen);
+	huffmanCodes(clLen, CODELEN_CODES, clCodes);
+	int hclen = CODELEN_CODES;
+	while(hclen > 4 && clLen[CODELEN_ORDER[hclen-1]] == 0) {
+		hclen--;
+	}
+	size_t dynamicBits = 3 + 14 + 3 * (size_t)hclen + symbolBits(litFreq, distFreq, litLen, distLen);
+	for(int i=0; i<clCount; i++) {
+		dynamicBits += clLen[clSym[i]] + ((clSym[i] == 16) ? 2 : (clSym[i] == 17) ? 3 : (clSym[i] == 18) ? 7 : 0);
+	}
+
+	// stored: header, padding (at most 7), and 4 bytes of length per 64K
+	size_t storedBytes = end - d->blockStart;
+	size_t storedBits = (storedBytes / MAX_STORED + 1) * (3 + 7 + 32) + storedBytes * 8;
+
+	if(storedBits < fixedBits && storedBits < dynamicBits) {
+		writeStored(d, end, final);
+	} else if(fixedBits <= dynamicBits) {
+		u16 litCodes[288];
+		u16 distCodes[DIST_CODES];
+		huffmanCodes(fixedLit, 288, litCodes);
+		huffmanCodes(fixedDist, DIST_CODES, distCodes);
+		putBits(&d->w, (final ? 1 : 0) | (1 << 1), 3);
+		writeSymbols(d, fixedLit, litCodes, fixedDist, distCodes);
+	} else {
+		u16 litCodes[LITLEN_CODES];
+		u16 distCodes[DIST_CODES];
+		huffmanCodes(litLen, LITLEN_CODES, litCodes);
+		huffmanCodes(distLen, DIST_CODES, distCodes);
+		putBits(&d->w, (final ? 1 : 0) | (2 << 1), 3);
+		putBits(&d->w, hlit - 257, 5);
+		putBits(&d->w, hdist - 1, 5);
+		putBits(&d->w, hclen - 4, 4);
+		for(int i=0; i<hclen; i++) {
+			putBits(&d->w, clLen[CODELEN_ORDER[i]], 3);
+		}
+		for(int i=0; i<clCount; i++) {
+			putBits(&d->w, clCodes[clSym[i]], clLen[clSym[i]]);
+			if(clSym[i] >= 16) {
+				putBits(&d->w, clExtra[i], (clSym[i] == 16) ? 2 : (clSym[i] == 17) ? 3 : 7);
+			}
+		}
+		writeSymbols(d, litLen, litCodes, distLen, distCodes);
+	}
+
+	d->symbolCount = 0;
+	d->blockStart = end;
+}
+
+//----------------------------------------------------------------------------
+//  LZ77
+//----------------------------------------------------------------------------
+
+static u32 hash3(const u8 * p) {
+	u32 v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Add positions up to (not including) end to the hash chains
+static void insertTo(Deflater * d, size_t end) {
+	if(end + MIN_MATCH > d->size) {
+		end = (d->size >= MIN_MATCH) ? d->size - MIN_MATCH + 1 : 0;
+	}
+	for(size_t p=d->nextInsert; p<end; p++) {
+		u32 h = hash3(&d->src[p]);
+		d->prev[p & WINDOW_MASK] = d->head[h];
+		d->head[h] = (i32)p;
+	}
+	if(end > d->nextInsert) {
+		d->nextInsert = end;
+	}
+}
+
+// Longest match for pos among the positions already inserted. Returns its length (0 if under MIN_MATCH).
+static int findMatch(const Deflater * d, size_t pos, int * dist) {
+	if(pos + MIN_MATCH > d->size) {
+		return 0;
+	}
+	const u8 * src = d->src;
+	int maxLen = (d->size - pos < MAX_MATCH) ? (int)(d->size - pos) : MAX_MATCH;
+	int best = MIN_MATCH - 1;
+	int chain = d->info->maxChain;
+	i32 cand = d->head[hash3(&src[pos])];
+	while(cand >= 0 && pos - (size_t)cand <= WINDOW_SIZE && chain-- > 0) {
+		const u8 * a = &src[cand];
+		const u8 * b = &src[pos];
+		if(a[best] == b[best] && a[0] == b[0] && a[1] == b[1]) {
+			int len = 2;
+			while(len < maxLen && a[len] == b[len]) {
+				len++;
+			}
+			if(len > best) {
+				best = len;
+				*dist = (int)(pos - (size_t)cand);
+				if(len >= d->info->niceLength || len == maxLen) {
+					break;
+				}
+			}
+		}
+		i32 next = d->prev[cand & WINDOW_MASK];
+		if(next >= cand) {
+			break;			// the slot has been reused by a newer position
+		}
+		cand = next;
+	}
+	return (best >= MIN_MATCH) ? best : 0;
+}
+
+static void addSymbol(Deflater * d, u16 litLen, u16 dist, size_t end) {
+	d->symbols[d->symbolCount].litLen = litLen;
+	d->symbols[d->symbolCount].dist = dist;
+	if(++d->symbolCount == BLOCK_SYMBOLS) {
+		flushBlock(d, end, false);
+	}
+}
+
+static void compressAll(Deflater * d) {
+	size_t pos = 0;
+	while(pos < d->size) {
+		int dist = 0;
+		int len = findMatch(d, pos, &dist);
+		insertTo(d, pos + 1);
+
+		// lazy: if a longer match starts at the next byte, emit this byte as a literal and take that one
+		if(len > 0 && d->info->lazy && len < d->info->niceLength) {
+			int dist2 = 0;
+			int len2 = findMatch(d, pos + 1, &dist2);
+			if(len2 > len) {
+				addSymbol(d, d->src[pos], 0, pos + 1);
+				pos++;
+				insertTo(d, pos + 1);
+				len = len2;
+				dist = dist2;
+			}
+		}
+
+		if(len > 0) {
+			addSymbol(d, (u16)len, (u16)dist, pos + len);
+			insertTo(d, pos + len);
+			pos += len;
+		} else {
+			addSymbol(d, d->src[pos], 0, pos + 1);
+			pos++;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+//  ZLIB
+//----------------------------------------------------------------------------
+
+u32 adler32(u32 adler, const u8 * data, size_t size) {
+	u32 a = adler & 0xFFFF;
+	u32 b = adler >> 16;
+	while(size > 0) {
+		size_t n = (size < 5552) ? size : 5552;		// most bytes before b could overflow
+		size -= n;
+		while(n--) {
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+// Compress src into a zlib stream. Returns NULL if out of memory.
+Bytes * zlibCompress(const u8 * src, size_t size, int level) {
+	if(level < DEFLATE_LEVEL_MIN) {
+		level = DEFLATE_LEVEL_MIN;
+	}
+	if(level > DEFLATE_LEVEL_MAX) {
+		level = DEFLATE_LEVEL_MAX;
+	}
+
+	Deflater d;
+	memset(&d, 0, sizeof(d));
+	d.src = src;
+	d.size = size;
+	d.info = &LEVEL_INFO[level];
+	d.w.capacity = size / 2 + 1024;
+	d.w.buf = malloc(d.w.capacity);
+	if(level > 0) {
+		d.head = malloc(HASH_SIZE * sizeof(i32));
+		d.prev = malloc(WINDOW_SIZE * sizeof(i32));
+		d.symbols = malloc(BLOCK_SYMBOLS * sizeof(Symbol));
+	}
+	if(d.w.buf == NULL || (level > 0 && (d.head == NULL || d.prev == NULL || d.symbols == NULL))) {
+		d.w.error = true;
+	}
+
+	// header: 32K window, deflate, and a hint of the level
+	u8 flevel = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+	u8 header[2] = { 0x78, (u8)(flevel << 6) };
+	header[1] |= (u8)(31 - ((header[0] << 8) | header[1]) % 31);
+	if(!d.w.error) {
+		putBytes(&d.w, header, 2);
+		if(level == 0) {
+			writeStored(&d, size, true);
+		} else {
+			memset(d.head, 0xFF, HASH_SIZE * sizeof(i32));		// all -1
+			compressAll(&d);
+			flushBlock(&d, size, true);
+		}
+		alignBits(&d.w);
+		u32 adler = adler32(1, src, size);
+		u8 trailer[4] = { (u8)(adler >> 24), (u8)(adler >> 16), (u8)(adler >> 8), (u8)adler };
+		putBytes(&d.w, trailer, 4);
+	}
+
+	Bytes * b = NULL;
+	if(!d.w.error) {
+		b = newBytesFromMemory(d.w.buf, d.w.size);
+	}
+	if(b == NULL) {
+		printf("ERROR: Out of memory\n");
+	}
+	free(d.w.buf);
+	free(d.head);
+	free(d.prev);
+	free(d.symbols);
+	return b;
+}
@@ -0,0 +1,18 @@
+// deflate.h
+// a self-contained deflate (RFC 1951) encoder with a zlib (RFC 1950) wrapper
+
+//----------------------------------------------------------------------------
+//  EFFORT LEVELS
+//----------------------------------------------------------------------------
+
+// 0 stores without compressing, 1 is fastest, 9 is smallest. Same meaning as zlib's levels.
+#define DEFLATE_LEVEL_MIN 0
+#define DEFLATE_LEVEL_MAX 9
+#define DEFLATE_LEVEL_DEFAULT 6
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+u32 adler32(u32 adler, const u8 * data, size_t size);
+Bytes * zlibCompress(const u8 * src, size_t size, int level);
@@ -6,10 +6,20 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "types.h"
 #include "bytes.h"
 #include "bmp.h"
+#include "bmpstream.h"
+#include "pool.h"
+#include "rle.h"
+#include "hash.h"
+#include "cache.h"
+#include "deflate.h"
+#include "png.h"
+#include "qoi.h"
+#include "output.h"
 #include "dump.h"
 #include "strutil.h"
 
@@ -19,140 +29,495 @@ const char * dumpFormatStr(Format f) {
 		case FMT_BIN: return "bin";
 		case FMT_RAW: return "raw";
 		case FMT_BMP: return "bmp";
+		case FMT_PNG: return "png";
+		case FMT_QOI: return "qoi";
 	}
 	return "err";
 }
 
-// determine image size from compressed data -- this doesn't include the size of the header
-static size_t determineImageSize(u8 * srcData, const size_t height) {
-	size_t headerSize = height * 4;
-	const u8 * lastHeaderEntryPtr = &srcData[headerSize - 4];
-	size_t lastOffset = get_u16(lastHeaderEntryPtr) + ((get_u16(&lastHeaderEntryPtr[2]) & 0x001F) << 16);		// extra 5 bits
-	size_t lastSize = get_u16(&lastHeaderEntryPtr[2]) >> 5;
-	size_t imageSize = lastOffset + lastSize;
-	return (imageSize - headerSize);
-}
-
 // dump raw compressed image data
 static int dumpImageBin(const char * filename, u8 * srcData, const size_t height) {
-	size_t headerSize = height * 4;
-	size_t imageSize = determineImageSize(srcData, height);
-	dprintf(1, "Dumping BIN %s ... ", filename);	
-	
-	int r = dumpBlob(filename, srcData, imageSize + headerSize);
+	int r = dumpBlob(filename, srcData, rleNewImageSize(srcData, height));
 	if(r!=0) {
-		dprintf(0, "ERROR: dumpImage failed (%d)\n", r);
+		dprintf(0, "ERROR: dumpImage failed for %s (%d)\n", filename, r);
 		return 1;
 	}
-	dprintf(1, "OK\n");
+	dprintf(1, "Dumping BIN %s ... OK.\n", filename);	// one line per image, as images may be dumped in parallel
 	return 0;
 }
 
 // dump raw decompressed image data
-static int dumpImageRaw(const char * filename, u8 * srcData, const size_t width, const size_t height) {
-	size_t headerSize = height * 4;
-	size_t imageSize = determineImageSize(srcData, height);
-	dprintf(1, "Dumping RAW %s ... ", filename);	
-
-	Img srcImg;
-	srcImg.w = width;
-	srcImg.h = height;
-	srcImg.format = IF_RLE_NEW;
-	srcImg.data = &srcData[headerSize];
-	srcImg.size = imageSize;
-
-	Img * img = cloneImg(&srcImg);
-
-	// convert it to a raw format
-	img = convertImg(img, IF_ARGB8565);
+static int dumpImageRaw(const char * filename, u8 * srcData, size_t srcSize, const size_t width, const size_t height) {
+	// decode the rows in parallel, using the row table
+	Img * img = rleNewDecode(srcData, srcSize, width, height);
 	if(img==NULL) {
-		dprintf(0, "ERROR: Failed to convertImg in dumpImageRaw\n");
-		deleteImg(img);
+		dprintf(0, "ERROR: Failed to decode image in dumpImageRaw\n");
+		return 1;
 	}
 	
 	int r = dumpBlob(filename, img->data, img->size);
 	if(r != 0) {
-		dprintf(0, "ERROR: Filed to save RAW file!\n");		
+		dprintf(0, "ERROR: Filed to save RAW file %s!\n", filename);		
 		img = deleteImg(img);
 		return 1;
 	}
 	
-	dprintf(1, "OK.\n");
+	dprintf(1, "Dumping RAW %s ... OK.\n", filename);
 	img = deleteImg(img);
 	return 0;
 }
 
 // dump an image as a windows bmp
-static int dumpImageBMP(const char * filename, u8 * srcData, const size_t width, const size_t height) {
-	size_t headerSize = height * 4;
-	size_t imageSize = determineImageSize(srcData, height);
-	dprintf(1, "Dumping BMP %s ... ", filename);
-
-	Img srcImg;
-	srcImg.w = width;
-	srcImg.h = height;
-	srcImg.format = IF_RLE_NEW;
-	srcImg.data = &srcData[headerSize];
-	srcImg.size = imageSize;
-
-	Img * img = cloneImg(&srcImg);
-
-	// now we can save it
-	Bytes * b = imgToBMP(img);
-	img = deleteImg(img);
+static int dumpImageBMP(const char * filename, u8 * srcData, size_t srcSize, const size_t width, const size_t height) {
+	// decode a few rows at a time straight to the file, no intermediate images
+	int r = rleNewStreamBMP(filename, srcData, srcSize, width, height);
+	if(r != 0) {
+		dprintf(0, "ERROR: Filed to save BMP file %s!\n", filename);		
+		return 1;
+	}
+
+	dprintf(1, "Dumping BMP %s ... OK.\n", filename);
+	return 0;
+}
+
+// dump an image as a PNG, at the default effort level
+static int dumpImagePNG(const char * filename, u8 * srcData, size_t srcSize, const size_t width, const size_t height) {
+	Bytes * b = rleNewToPNG(srcData, srcSize, width, height, defaultPngLevel());
 	if(b == NULL) {
-		dprintf(0, "ERROR: Failed to convert image to BMP!\n");
-		return 1;	// ERROR
+		dprintf(0, "ERROR: Failed to convert image to PNG!\n");
+		return 1;
 	}
 	int r = saveBytesToFile(b, filename);
+	b = deleteBytes(b);
 	if(r != 0) {
-		dprintf(0, "ERROR: Filed to save BMP file!\n");		
+		dprintf(0, "ERROR: Filed to save PNG file %s!\n", filename);
+		return 1;
 	}
+
+	dprintf(1, "Dumping PNG %s ... OK.\n", filename);
+	return 0;
+}
+
+// dump an image as a QOI
+static int dumpImageQOI(const char * filename, u8 * srcData, size_t srcSize, const size_t width, const size_t height) {
+	Bytes * b = rleNewToQOI(srcData, srcSize, width, height);
+	if(b == NULL) {
+		dprintf(0, "ERROR: Failed to convert image to QOI!\n");
+		return 1;
+	}
+	int r = saveBytesToFile(b, filename);
 	b = deleteBytes(b);
+	if(r != 0) {
+		dprintf(0, "ERROR: Filed to save QOI file %s!\n", filename);
+		return 1;
+	}
 
-	dprintf(1, "OK.\n");
+	dprintf(1, "Dumping QOI %s ... OK.\n", filename);
 	return 0;
 }
 
-// dump an image in the requested format
-int dumpImage(const char * filename, u8 * srcData, const size_t width, const size_t height, const Format format) {
+// dump an image in the requested format. srcData is the row table and rows, within srcSize bytes.
+int dumpImage(const char * filename, u8 * srcData, size_t srcSize, const size_t width, const size_t height, const Format format) {
+	if(!rleNewFits(srcData, srcSize, height)) {
+		dprintf(0, "ERROR: Image data for %s is damaged, skipped.\n", filename);
+		return 1;
+	}
 	if(format == FMT_BIN) {
 		return dumpImageBin(filename, srcData, height);
 	} else if(format == FMT_RAW) {
-		return dumpImageRaw(filename, srcData, width, height);
+		return dumpImageRaw(filename, srcData, srcSize, width, height);
+	} else if(format == FMT_PNG) {
+		return dumpImagePNG(filename, srcData, srcSize, width, height);
+	} else if(format == FMT_QOI) {
+		return dumpImageQOI(filename, srcData, srcSize, width, height);
 	} else { // format == FMT_BMP
-		return dumpImageBMP(filename, srcData, width, height);
+		return dumpImageBMP(filename, srcData, srcSize, width, height);
 	}
 }
 
-// dump binary data to file
-int dumpBlob(const char * fileName, const u8 * srcData, size_t length) {
-	// open the dump file
-	FILE * dumpFile = fopen(fileName,"wb");
-	if(dumpFile==NULL) {
-		return 1;	// FAILED
-	}
-	int idx = 0;
-
-	// write the data to the dump file
-	while(length > 0) {
-		size_t bytesToWrite = 4096;
-		if(length < bytesToWrite) {
-			bytesToWrite = length;
+//----------------------------------------------------------------------------
+//  CACHED AND BATCHED DUMPS - converted images are kept in an ImageCache, across
+//  runs, and small files are written together through an OutputBatch
+//----------------------------------------------------------------------------
+
+// For messages
+static const char * formatLabel(Format format) {
+	switch(format) {
+		case FMT_BIN: return "BIN";
+		case FMT_RAW: return "RAW";
+		case FMT_PNG: return "PNG";
+		case FMT_QOI: return "QOI";
+		case FMT_BMP: return "BMP";
+	}
+	return "BMP";
+}
+
+// The whole file for a RAW, BMP, PNG or QOI dump
+static Bytes * imageFileBytes(u8 * srcData, size_t srcSize, const size_t width, const size_t height, const Format format) {
+	if(format == FMT_RAW) {
+		Img * img = rleNewDecode(srcData, srcSize, width, height);
+		if(img == NULL) {
+			return NULL;
 		}
+		Bytes * b = newBytesFromMemory(img->data, img->size);
+		deleteImg(img);
+		return b;
+	}
+	if(format == FMT_PNG) {
+		return rleNewToPNG(srcData, srcSize, width, height, defaultPngLevel());
+	}
+	if(format == FMT_QOI) {
+		return rleNewToQOI(srcData, srcSize, width, height);
+	}
+	return rleNewToBMP(srcData, srcSize, width, height);
+}
 
-		size_t rval = fwrite(&srcData[idx],1,bytesToWrite,dumpFile);
-		if(rval != bytesToWrite) {
-			fclose(dumpFile);
-			remove(fileName);
-			return 2;	// FAILED
+// The whole file for an image in any format, using the cache if there is one. A hit skips decoding and
+// conversion. BIN is just a copy of the data, so doesn't use the cache. Sets *hit, unless it's NULL.
+// Returns NULL if the image isn't all inside srcSize bytes.
+Bytes * dumpImageBytes(ImageCache * cache, u8 * srcData, size_t srcSize, const size_t width, const size_t height, const Format format, bool * hit) {
+	if(hit != NULL) {
+		*hit = false;
+	}
+	if(!rleNewFits(srcData, srcSize, height)) {
+		return NULL;
+	}
+	if(format == FMT_BIN) {
+		return newBytesFromMemory(srcData, rleNewImageSize(srcData, height));
+	}
+
+	// the key covers the row table and the data, plus everything else the output depends on.
+	// PNG output also depends on the effort level.
+	u32 params[4] = { (u32)width, (u32)height, (u32)format, (format == FMT_PNG) ? (u32)defaultPngLevel() : 0 };
+	CacheKey key = cacheKey(srcData, rleNewImageSize(srcData, height), params, sizeof(params));
+	Bytes * b = (cache != NULL) ? cacheLoad(cache, &key, dumpFormatStr(format)) : NULL;
+	if(b != NULL) {
+		if(hit != NULL) {
+			*hit = true;
 		}
-		idx += bytesToWrite;
-		length -= bytesToWrite;
+		return b;
+	}
+	b = imageFileBytes(srcData, srcSize, width, height, format);
+	if(b != NULL && cache != NULL) {
+		cacheStore(cache, &key, dumpFormatStr(format), b);
 	}
+	return b;
+}
 
-	// close the dump file
-	fclose(dumpFile);
+// Dump an image, using the cache if there is one.
+// With a batch, the file may only be written when the batch is flushed: if that fails, *result is set.
+// Uncached BMPs are streamed to the file as they are decoded, so never go through the batch.
+static int dumpImageTo(OutputBatch * ob, ImageCache * cache, const char * filename, u8 * srcData, size_t srcSize, const size_t width, const size_t height, const Format format, int * result) {
+	if((ob == NULL || format == FMT_BMP) && (cache == NULL || format == FMT_BIN)) {
+		return dumpImage(filename, srcData, srcSize, width, height, format);
+	}
+	if(!rleNewFits(srcData, srcSize, height)) {
+		dprintf(0, "ERROR: Image data for %s is damaged, skipped.\n", filename);
+		return 1;
+	}
+	if(format == FMT_BIN) {
+		outputBatchAdd(ob, filename, srcData, rleNewImageSize(srcData, height), NULL, result);
+		dprintf(1, "Dumping %s %s ... OK.\n", formatLabel(format), filename);
+		return 0;
+	}
+
+	bool hit;
+	Bytes * b = dumpImageBytes(cache, srcData, srcSize, width, height, format, &hit);
+	if(b == NULL) {
+		dprintf(0, "ERROR: Failed to convert image for %s\n", filename);
+		return 1;
+	}
+
+	if(ob != NULL) {
+		outputBatchAdd(ob, filename, b->data, b->size, b, result);		// the batch deletes b
+	} else {
+		int r = saveBytesToFile(b, filename);
+		b = deleteBytes(b);
+		if(r != 0) {
+			dprintf(0, "ERROR: Failed to save %s!\n", filename);
+			return 1;
+		}
+	}
+	dprintf(1, "Dumping %s %s ... OK%s.\n", formatLabel(format), filename, hit ? " (cached)" : "");
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//  DUMP QUEUE - dump images in parallel on the thread pool
+//----------------------------------------------------------------------------
 
-	return 0; // SUCCESS
+typedef struct _DumpJob {
+	struct _DumpJob * linkTo;	// an earlier job with identical output, linked to instead of dumping again
+	char * filename;
+	u8 * srcData;
+	size_t srcSize;
+	size_t width;
+	size_t height;
+	Format format;
+	ImageCache * cache;		// or NULL
+	OutputBatch * batch;	// or NULL
+	void * tag;				// caller's data, handed back with the result
+	struct _DumpQueue * queue;
+	Bytes * file;			// while archiving, the finished file, until it is added in job order
+	bool done;				// while archiving, finished and ready to add (under the queue lock)
+	int result;
+} DumpJob;
+
+struct _DumpQueue {
+	Pool * pool;
+	PoolGroup group;
+	bool dedupe;			// link identical images to the first one dumped
+	HashStore * store;		// the images queued so far, by content
+	ImageCache * cache;		// converted images kept across runs, or NULL (not owned)
+	OutputBatch * batch;	// small files, written together when the queue finishes, or NULL
+	pthread_mutex_t lock;	// for the jobs array, count, done, added and adding
+	size_t count;
+	size_t capacity;
+	DumpJob ** jobs;		// jobs are allocated individually, so they stay put while the array grows
+	size_t added;			// while archiving, jobs before this have gone into the archive
+	bool adding;			// a thread is adding finished jobs to the archive
+};
+
+DumpQueue * newDumpQueue(void) {
+	DumpQueue * q = malloc(sizeof(DumpQueue));
+	if(q == NULL) {
+		return NULL;
+	}
+	q->pool = defaultPool();
+	q->group = (PoolGroup)POOL_GROUP_INIT;
+	q->dedupe = false;
+	q->store = NULL;
+	q->cache = NULL;
+	q->batch = newOutputBatch();		// if this fails, files are just written one at a time
+	pthread_mutex_init(&q->lock, NULL);
+	q->count = 0;
+	q->capacity = 0;
+	q->jobs = NULL;
+	q->added = 0;
+	q->adding = false;
+	return q;
+}
+
+// Waits for any unfinished jobs, then frees the queue
+DumpQueue * deleteDumpQueue(DumpQueue * q) {
+	if(q != NULL) {
+		dumpQueueFinish(q);
+		for(size_t i=0; i<q->count; i++) {
+			free(q->jobs[i]->filename);
+			free(q->jobs[i]);
+		}
+		free(q->jobs);
+		deleteHashStore(q->store);
+		deleteOutputBatch(q->batch);
+		pthread_mutex_destroy(&q->lock);
+		free(q);
+		q = NULL;
+	}
+	return q;
+}
+
+// Identical images are dumped once, and the rest hard linked to it. Off by default.
+void dumpQueueSetDedupe(DumpQueue * q, bool dedupe) {
+	q->dedupe = dedupe;
+}
+
+// Look up and store converted images in cache. The cache must outlive the queue.
+void dumpQueueSetCache(DumpQueue * q, ImageCache * cache) {
+	q->cache = cache;
+}
+
+// Convert a job's image and keep the whole file in the job. Returns 0 on success.
+static int keepDump(DumpJob * job) {
+	if(!rleNewFits(job->srcData, job->srcSize, job->height)) {
+		dprintf(0, "ERROR: Image data for %s is damaged, skipped.\n", job->filename);
+		return 1;
+	}
+	bool hit;
+	job->file = dumpImageBytes(job->cache, job->srcData, job->srcSize, job->width, job->height, job->format, &hit);
+	if(job->file == NULL) {
+		dprintf(0, "ERROR: Failed to convert image for %s\n", job->filename);
+		return 1;
+	}
+	dprintf(1, "Dumping %s %s ... OK%s.\n", formatLabel(job->format), job->filename, hit ? " (cached)" : "");
+	return 0;
+}
+
+// Write a kept file to the archive, and free it
+static void addKept(DumpJob * job) {
+	OutPiece piece = { job->file->data, job->file->size };
+	if(outputFile(job->filename, &piece, 1) != 0) {
+		dprintf(0, "ERROR: Failed to write %s\n", job->filename);
+		job->result = 1;
+	}
+	job->file = deleteBytes(job->file);
+}
+
+// Mark job done, then add every finished job to the archive that no earlier job is still holding
+// up. One thread adds at a time. Others just mark their job done, for it to pick up.
+static void retireJob(DumpQueue * q, DumpJob * job) {
+	pthread_mutex_lock(&q->lock);
+	job->done = true;
+	if(q->adding) {
+		pthread_mutex_unlock(&q->lock);
+		return;
+	}
+	q->adding = true;
+	while(q->added < q->count && q->jobs[q->added]->done) {
+		DumpJob * next = q->jobs[q->added++];
+		if(next->file != NULL) {
+			pthread_mutex_unlock(&q->lock);
+			addKept(next);
+			pthread_mutex_lock(&q->lock);
+		}
+	}
+	q->adding = false;
+	pthread_mutex_unlock(&q->lock);
+}
+
+static void dumpJobTask(void * arg) {
+	DumpJob * job = (DumpJob *)arg;
+	// jobs finish in any order, but archive entries must go in job order for the archive to be
+	// repeatable. Each file is kept only until the jobs before it are in.
+	if(outputArchiving()) {
+		job->result = keepDump(job);
+		retireJob(job->queue, job);
+		return;
+	}
+	// a batched write that fails straight away sets result itself
+	int r = dumpImageTo(job->batch, job->cache, job->filename, job->srcData, job->srcSize, job->width, job->height, job->format, &job->result);
+	if(r != 0) {
+		job->result = r;
+	}
+}
+
+// Queue an image to be dumped (same arguments as dumpImage). srcData must stay valid until dumpQueueFinish.
+// Returns the job number. If the job can't be queued it is run straight away.
+size_t dumpQueueImage(DumpQueue * q, const char * filename, u8 * srcData, size_t srcSize, const size_t width, const size_t height, const Format format, void * tag) {
+	DumpJob * job = malloc(sizeof(DumpJob));
+	char * name = malloc(strlen(filename) + 1);
+	pthread_mutex_lock(&q->lock);		// running jobs look at the array while archiving
+	if(q->count == q->capacity) {
+		size_t newCapacity = q->capacity ? q->capacity * 2 : 64;
+		DumpJob ** jobs = realloc(q->jobs, newCapacity * sizeof(DumpJob *));
+		if(jobs != NULL) {
+			q->jobs = jobs;
+			q->capacity = newCapacity;
+		}
+	}
+	bool full = (q->count == q->capacity);
+	pthread_mutex_unlock(&q->lock);
+	if(job == NULL || name == NULL || full) {
+		free(job);
+		free(name);
+		dprintf(0, "WARNING: Out of memory queueing %s, dumping it now.\n", filename);
+		dumpImage(filename, srcData, srcSize, width, height, format);
+		return (size_t)-1;
+	}
+
+	strcpy(name, filename);
+	job->linkTo = NULL;
+	job->filename = name;
+	job->srcData = srcData;
+	job->srcSize = srcSize;
+	job->width = width;
+	job->height = height;
+	job->format = format;
+	job->cache = q->cache;
+	job->batch = q->batch;
+	job->tag = tag;
+	job->queue = q;
+	job->file = NULL;
+	job->done = false;
+	job->result = 0;
+	size_t idx = q->count;
+
+	// the same compressed data, size and format always gives the same file
+	if(q->dedupe && width != 0 && height != 0 && rleNewFits(srcData, srcSize, height)) {
+		if(q->store == NULL) {
+			q->store = newHashStore();
+		}
+		if(q->store != NULL) {
+			u64 key = width | ((u64)height << 16) | ((u64)format << 32);
+			size_t first = hashStoreAdd(q->store, srcData, rleNewImageSize(srcData, height), key, idx);
+			if(first != idx) {
+				job->linkTo = q->jobs[first];
+				job->done = true;		// linked when the queue finishes, nothing to add before that
+			}
+		}
+	}
+
+	pthread_mutex_lock(&q->lock);
+	q->jobs[q->count++] = job;
+	pthread_mutex_unlock(&q->lock);
+	if(job->linkTo == NULL) {
+		poolSubmit(q->pool, &q->group, dumpJobTask, job);
+	}
+	return idx;
+}
+
+// Make job's file a hard link to the earlier, identical one. Returns 0 on success.
+static int linkDump(const DumpJob * job) {
+	if(outputLink(job->linkTo->filename, job->filename) != 0) {
+		return 1;
+	}
+	dprintf(1, "Linking %s to %s ... OK.\n", job->filename, job->linkTo->filename);
+	return 0;
+}
+
+// Write any files still kept while archiving, in job order. Only duplicates dumped in full
+// because they couldn't be linked are left by then: they come after everything else.
+static void writeKept(DumpQueue * q) {
+	for(size_t i=0; i<q->count; i++) {
+		if(q->jobs[i]->file != NULL) {
+			addKept(q->jobs[i]);
+		}
+	}
+}
+
+// Wait for every queued job to finish (this thread helps). Duplicates are linked once the
+// originals are written, or dumped in full if linking isn't possible.
+void dumpQueueFinish(DumpQueue * q) {
+	poolWait(q->pool, &q->group);
+	writeKept(q);
+	if(q->batch != NULL) {
+		outputBatchFlush(q->batch);		// the originals must exist before linking to them
+	}
+	bool again = false;
+	for(size_t i=0; i<q->count; i++) {
+		DumpJob * job = q->jobs[i];
+		if(job->linkTo == NULL) {
+			continue;
+		}
+		if(job->linkTo->result != 0 || linkDump(job) != 0) {
+			poolSubmit(q->pool, &q->group, dumpJobTask, job);
+			again = true;
+		}
+		job->linkTo = NULL;
+	}
+	if(again) {
+		poolWait(q->pool, &q->group);
+		writeKept(q);
+		if(q->batch != NULL) {
+			outputBatchFlush(q->batch);
+		}
+	}
+}
+
+size_t dumpQueueCount(const DumpQueue * q) {
+	return q->count;
+}
+
+// Result of job idx (0 for success), and its tag. Only valid after dumpQueueFinish.
+int dumpQueueResult(const DumpQueue * q, size_t idx, void ** tag) {
+	if(tag != NULL) {
+		*tag = q->jobs[idx]->tag;
+	}
+	return q->jobs[idx]->result;
+}
+
+// dump binary data to file
+int dumpBlob(const char * fileName, const u8 * srcData, size_t length) {
+	// the whole blob in one write, see output.c
+	OutPiece piece = { srcData, length };
+	return outputFile(fileName, &piece, 1);
 }
@@ -9,12 +9,30 @@ typedef enum _Format {
 	FMT_BIN = 0,
 	FMT_RAW = 1,
 	FMT_BMP = 2,
+	FMT_PNG = 3,
+	FMT_QOI = 4,
 } Format;
 
 //----------------------------------------------------------------------------
 //  DUMP FUNCTIONS
 //----------------------------------------------------------------------------
 
-int dumpImage(const char * filename, u8 * srcData, const size_t width, const size_t height, const Format format);
+int dumpImage(const char * filename, u8 * srcData, size_t srcSize, const size_t width, const size_t height, const Format format);
+Bytes * dumpImageBytes(ImageCache * cache, u8 * srcData, size_t srcSize, const size_t width, const size_t height, const Format format, bool * hit);
+
+//----------------------------------------------------------------------------
+//  DUMP QUEUE - dump many images in parallel
+//----------------------------------------------------------------------------
+
+typedef struct _DumpQueue DumpQueue;
+
+DumpQueue * newDumpQueue(void);
+DumpQueue * deleteDumpQueue(DumpQueue * q);
+void dumpQueueSetDedupe(DumpQueue * q, bool dedupe);
+void dumpQueueSetCache(DumpQueue * q, ImageCache * cache);
+size_t dumpQueueImage(DumpQueue * q, const char * filename, u8 * srcData, size_t srcSize, const size_t width, const size_t height, const Format format, void * tag);
+void dumpQueueFinish(DumpQueue * q);
+size_t dumpQueueCount(const DumpQueue * q);
+int dumpQueueResult(const DumpQueue * q, size_t idx, void ** tag);
 int dumpBlob(const char * fileName, const u8 * srcData, size_t length);
 const char * dumpFormatStr(Format f);
\ No newline at end of file
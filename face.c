@@ -0,0 +1,411 @@
+/*  face.c - index the elements of a 'new' watch face
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Parsing only: headers are walked and every image is located, but no pixels are decoded.
+	The buffer is walked twice, once to count and once to fill, so the whole index is a
+	single allocation.
+
+	Images are decoded when faceImageGet first asks for one, and kept for next time. A
+	service that only needs the preview never touches the digits or the other images.
+	With a limit set, the least recently used images are dropped to stay under it. The
+	decoded images belong to the index, which is not safe to share between threads.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "face_new.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "rle.h"
+#include "face.h"
+
+//----------------------------------------------------------------------------
+//  ELEMENTTYPESTR
+//----------------------------------------------------------------------------
+
+const char * elementTypeStr(u8 eType) {
+	switch(eType) {
+		case ET_IMAGE: return "image";
+		case ET_TIME: return "time_num";
+		case ET_DAYNAME: return "day_name";
+		case ET_BATTERYFILL: return "battery_fill";
+		case ET_HEARTRATENUM: return "heart_rate_num";
+		case ET_STEPSNUM: return "steps_num";
+		case ET_KCALNUM: return "kcal_num";
+		case ET_HANDS: return "hands";
+		case ET_DAYNUM: return "day_num";
+		case ET_MONTHNUM: return "month_num";
+		case ET_BARDISPLAY: return "bar_display";
+		case ET_WEATHER: return "weather";
+		case ET_UNKNOWN1D: return "unknown_1d";
+		case ET_DASH: return "dash";
+	}
+	return "unknown";
+}
+
+//----------------------------------------------------------------------------
+//  SCANFACE - one walk over the headers, either counting or filling
+//----------------------------------------------------------------------------
+
+// Header size for an element, or 0 if the type is unknown. p has at least 2 bytes, avail in total.
+static size_t elementHeaderSize(const u8 * p, size_t avail) {
+	switch(p[1]) {
+		case ET_IMAGE: return sizeof(ImageHeader);
+		case ET_TIME: return sizeof(TimeHeader);
+		case ET_DAYNAME: return sizeof(DayNameHeader);
+		case ET_BATTERYFILL: return sizeof(BatteryFillHeader);
+		case ET_HEARTRATENUM: return sizeof(HeartRateNumHeader);
+		case ET_STEPSNUM: return sizeof(StepsNumHeader);
+		case ET_KCALNUM: return sizeof(KCalNumHeader);
+		case ET_HANDS: return sizeof(HandsHeader);
+		case ET_DAYNUM: return sizeof(DayNumHeader);
+		case ET_MONTHNUM: return sizeof(MonthNumHeader);
+		case ET_BARDISPLAY:
+			if(avail < 4) {
+				return 0;
+			}
+			return sizeof(BarDisplayHeader) + sizeof(OffsetWidthHeight) * p[3] - sizeof(OffsetWidthHeight);
+		case ET_WEATHER: return sizeof(WeatherHeader);
+		case ET_UNKNOWN1D: return sizeof(Unknown1D01);
+		case ET_DASH: return sizeof(DashHeader);
+	}
+	return 0;
+}
+
+// Number of images an element refers to
+static size_t elementImageCount(const u8 * p) {
+	switch(p[1]) {
+		case ET_IMAGE: return 1;
+		case ET_DAYNAME: return 7;
+		case ET_BATTERYFILL: return 3;
+		case ET_HANDS: return 1;
+		case ET_BARDISPLAY: return ((const BarDisplayHeader *)p)->count;
+		case ET_WEATHER: {
+			u8 count = ((const WeatherHeader *)p)->count;
+			return count < 9 ? count : 9;
+		}
+		case ET_DASH: return 1;
+	}
+	return 0;
+}
+
+// Record an image, checking its row table and every row are inside the buffer
+static FaceImage * addImage(FaceIndex * fi, bool fill, u32 offset, u16 width, u16 height) {
+	size_t idx = fi->imageCount++;
+	if(!fill) {
+		return NULL;
+	}
+	FaceImage * img = &fi->images[idx];
+	img->offset = offset;
+	img->width = width;
+	img->height = height;
+	img->size = 0;
+	img->decoded = NULL;
+	img->lastUse = 0;
+	if(offset <= fi->size && rleNewFits(&fi->data[offset], fi->size - offset, height)) {
+		img->size = rleNewImageSize(&fi->data[offset], height);
+	}
+	return img;
+}
+
+static FaceImage * addImages(FaceIndex * fi, bool fill, const OffsetWidthHeight * owh, size_t count) {
+	FaceImage * first = fill ? &fi->images[fi->imageCount] : NULL;
+	for(size_t i=0; i<count; i++) {
+		addImage(fi, fill, owh[i].offset, owh[i].width, owh[i].height);
+	}
+	return first;
+}
+
+// Fill in the type-specific parts of an element
+static void fillElement(FaceIndex * fi, FaceElement * e) {
+	const u8 * p = e->header;
+	e->subtype = 0;
+	e->digitSet = 0;
+	e->justification = 0;
+	memset(e->digitSets, 0, sizeof(e->digitSets));
+	memset(e->fill, 0, sizeof(e->fill));
+	memset(e->xy, 0, sizeof(e->xy));
+	e->xyCount = 0;
+	e->imageCount = elementImageCount(p);
+	e->images = NULL;
+
+	switch(e->eType) {
+		case ET_IMAGE: {
+			const ImageHeader * h = (const ImageHeader *)p;
+			e->xy[0] = h->xy;
+			e->xyCount = 1;
+			e->images = addImage(fi, true, h->offset, h->width, h->height);
+			break;
+		}
+		case ET_TIME: {
+			const TimeHeader * h = (const TimeHeader *)p;
+			for(int i=0; i<4; i++) {
+				e->digitSets[i] = h->digitSet[i];
+				e->xy[i] = h->xy[i];
+			}
+			e->xyCount = 4;
+			break;
+		}
+		case ET_DAYNAME: {
+			const DayNameHeader * h = (const DayNameHeader *)p;
+			e->subtype = h->subtype;
+			e->xy[0] = h->xy;
+			e->xyCount = 1;
+			e->images = addImages(fi, true, h->owh, 7);
+			break;
+		}
+		case ET_BATTERYFILL: {
+			const BatteryFillHeader * h = (const BatteryFillHeader *)p;
+			e->xy[0] = h->xy;
+			e->xyCount = 1;
+			e->fill[0] = h->x1;
+			e->fill[1] = h->y1;
+			e->fill[2] = h->x2;
+			e->fill[3] = h->y2;
+			e->images = addImage(fi, true, h->owh.offset, h->owh.width, h->owh.height);
+			addImage(fi, true, h->owh1.offset, h->owh1.width, h->owh1.height);
+			addImage(fi, true, h->owh2.offset, h->owh2.width, h->owh2.height);
+			break;
+		}
+		case ET_HEARTRATENUM:
+		case ET_STEPSNUM:
+		case ET_KCALNUM: {
+			// these three share a layout up to the xy
+			const HeartRateNumHeader * h = (const HeartRateNumHeader *)p;
+			e->digitSet = h->digitSet;
+			e->justification = h->justification;
+			e->xy[0] = h->xy;
+			e->xyCount = 1;
+			break;
+		}
+		case ET_HANDS: {
+			const HandsHeader * h = (const HandsHeader *)p;
+			e->subtype = h->subtype;
+			e->xy[0].x = h->x;
+			e->xy[0].y = h->y;
+			e->xy[1] = h->unknownXY;
+			e->xyCount = 2;
+			e->images = addImage(fi, true, h->offset, h->width, h->height);
+			break;
+		}
+		case ET_DAYNUM:
+		case ET_MONTHNUM: {
+			const DayNumHeader * h = (const DayNumHeader *)p;
+			e->digitSet = h->digitSet;
+			e->justification = h->justification;
+			e->xy[0] = h->xy[0];
+			e->xy[1] = h->xy[1];
+			e->xyCount = 2;
+			break;
+		}
+		case ET_BARDISPLAY: {
+			const BarDisplayHeader * h = (const BarDisplayHeader *)p;
+			e->subtype = h->subtype;
+			e->xy[0] = h->xy;
+			e->xyCount = 1;
+			e->images = addImages(fi, true, h->owh, e->imageCount);
+			break;
+		}
+		case ET_WEATHER: {
+			const WeatherHeader * h = (const WeatherHeader *)p;
+			e->xy[0] = h->xy;
+			e->xyCount = 1;
+			e->images = addImages(fi, true, h->owh, e->imageCount);
+			break;
+		}
+		case ET_DASH: {
+			const DashHeader * h = (const DashHeader *)p;
+			e->images = addImage(fi, true, h->owh.offset, h->owh.width, h->owh.height);
+			break;
+		}
+	}
+}
+
+// Walk the headers. With fill false only the counts are updated; with fill true the arrays (already sized) are filled in.
+static void scanFace(FaceIndex * fi, bool fill) {
+	const u8 * data = fi->data;
+	size_t size = fi->size;
+	const FaceHeaderN * h = (const FaceHeaderN *)data;
+
+	fi->digitsCount = 0;
+	fi->elementCount = 0;
+	fi->imageCount = 0;
+	fi->truncated = false;
+	fi->apiVer = h->apiVer;
+	fi->unknown = h->unknown;
+
+	fi->preview = addImage(fi, fill, h->previewOffset, h->previewWidth, h->previewHeight);
+
+	// Digits come first, between the digits marker and the background header
+	size_t offset = h->dhOffset;
+	fi->digitsMarker = 0;
+	if(h->dhOffset != 0 && offset + 2 <= size) {
+		fi->digitsMarker = get_u16(&data[offset]);
+		offset += 2;
+		while(offset < h->bhOffset) {
+			if(offset + sizeof(DigitsHeader) > size) {
+				fi->truncated = true;
+				break;
+			}
+			const DigitsHeader * dh = (const DigitsHeader *)&data[offset];
+			if(fill) {
+				FaceDigits * d = &fi->digits[fi->digitsCount];
+				d->headerOffset = offset;
+				d->digitSet = dh->digitSet;
+				d->unknown = dh->unknown;
+				d->images = addImages(fi, true, dh->owh, 10);
+			} else {
+				fi->imageCount += 10;
+			}
+			fi->digitsCount++;
+			offset += sizeof(DigitsHeader);
+		}
+	}
+
+	// Then everything else, until a header starting with 0
+	offset = h->bhOffset;
+	while(true) {
+		if(offset + 2 > size) {
+			fi->truncated = true;
+			break;
+		}
+		if(data[offset] == 0) {
+			offset += 2;
+			break;
+		}
+		size_t headerSize = elementHeaderSize(&data[offset], size - offset);
+		if(headerSize == 0 || offset + headerSize > size) {
+			fi->truncated = true;
+			break;
+		}
+		if(fill) {
+			FaceElement * e = &fi->elements[fi->elementCount];
+			e->headerOffset = offset;
+			e->header = &data[offset];
+			e->headerSize = headerSize;
+			e->eType = data[offset+1];
+			fillElement(fi, e);
+		} else {
+			fi->imageCount += elementImageCount(&data[offset]);
+		}
+		fi->elementCount++;
+		offset += headerSize;
+	}
+	fi->endOffset = offset;
+}
+
+//----------------------------------------------------------------------------
+//  NEWFACEINDEX, DELETEFACEINDEX
+//----------------------------------------------------------------------------
+
+// Index a face held in memory. The buffer must outlive the index. Returns NULL if it isn't a face.
+FaceIndex * newFaceIndex(const u8 * data, size_t size) {
+	if(data == NULL || size < sizeof(FaceHeaderN)) {
+		return NULL;
+	}
+
+	// count
+	FaceIndex counts;
+	memset(&counts, 0, sizeof(counts));
+	counts.data = data;
+	counts.size = size;
+	scanFace(&counts, false);
+
+	// one block: the index, then the elements, digits and images
+	size_t elementsSize = counts.elementCount * sizeof(FaceElement);
+	size_t digitsSize = counts.digitsCount * sizeof(FaceDigits);
+	size_t imagesSize = counts.imageCount * sizeof(FaceImage);
+	u8 * block = malloc(sizeof(FaceIndex) + elementsSize + digitsSize + imagesSize);
+	if(block == NULL) {
+		return NULL;
+	}
+	FaceIndex * fi = (FaceIndex *)block;
+	*fi = counts;
+	fi->elements = (FaceElement *)&block[sizeof(FaceIndex)];
+	fi->digits = (FaceDigits *)&block[sizeof(FaceIndex) + elementsSize];
+	fi->images = (FaceImage *)&block[sizeof(FaceIndex) + elementsSize + digitsSize];
+
+	// fill
+	scanFace(fi, true);
+	return fi;
+}
+
+FaceIndex * deleteFaceIndex(FaceIndex * fi) {
+	if(fi != NULL) {
+		faceDropDecoded(fi);
+	}
+	free(fi);
+	return NULL;
+}
+
+//----------------------------------------------------------------------------
+//  FACEIMAGEGET - decode on first use, keeping the most recently used
+//----------------------------------------------------------------------------
+
+static void dropDecoded(FaceIndex * fi, FaceImage * img) {
+	fi->decodedSize -= img->decoded->size;
+	img->decoded = deleteImg(img->decoded);
+}
+
+// Drop the least recently used images until size more bytes fit under the limit
+static void makeRoom(FaceIndex * fi, size_t size) {
+	while(fi->decodedLimit != 0 && fi->decodedSize + size > fi->decodedLimit) {
+		FaceImage * lru = NULL;
+		for(size_t i=0; i<fi->imageCount; i++) {
+			FaceImage * img = &fi->images[i];
+			if(img->decoded != NULL && (lru == NULL || img->lastUse < lru->lastUse)) {
+				lru = img;
+			}
+		}
+		if(lru == NULL) {
+			break;
+		}
+		dropDecoded(fi, lru);
+	}
+}
+
+// The pixels of img, one of the images of fi, as ARGB8565. The Img belongs to the index, and stays
+// valid until deleteFaceIndex or faceDropDecoded, or until a later call drops it to stay under the
+// limit. An image bigger than the limit is still returned. Returns NULL if it isn't inside the buffer.
+const Img * faceImageGet(FaceIndex * fi, FaceImage * img) {
+	if(img->decoded == NULL) {
+		if(img->size == 0 || img->width == 0 || img->height == 0) {
+			return NULL;
+		}
+		makeRoom(fi, (size_t)img->width * img->height * 3);
+		img->decoded = rleNewDecode(&fi->data[img->offset], img->size, img->width, img->height);
+		if(img->decoded == NULL) {
+			return NULL;
+		}
+		fi->decodedSize += img->decoded->size;
+		fi->decodeCount++;
+	}
+	img->lastUse = ++fi->useClock;
+	return img->decoded;
+}
+
+// Keep at most bytes of decoded images, dropping the least recently used now if needed. 0 for no limit.
+void faceSetDecodedLimit(FaceIndex * fi, size_t bytes) {
+	fi->decodedLimit = bytes;
+	makeRoom(fi, 0);
+}
+
+// Drop every decoded image
+void faceDropDecoded(FaceIndex * fi) {
+	for(size_t i=0; i<fi->imageCount; i++) {
+		if(fi->images[i].decoded != NULL) {
+			dropDecoded(fi, &fi->images[i]);
+		}
+	}
+}
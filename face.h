@@ -0,0 +1,92 @@
+// face.h
+// parse a 'new' watch face into an index of its elements, decoding images only when asked for
+
+//----------------------------------------------------------------------------
+//  ELEMENT TYPES (e_type in each header)
+//----------------------------------------------------------------------------
+
+typedef enum _ElementType {
+	ET_IMAGE = 0x00,
+	ET_TIME = 0x02,
+	ET_DAYNAME = 0x04,
+	ET_BATTERYFILL = 0x05,
+	ET_HEARTRATENUM = 0x06,
+	ET_STEPSNUM = 0x07,
+	ET_KCALNUM = 0x09,
+	ET_HANDS = 0x0A,
+	ET_DAYNUM = 0x0D,
+	ET_MONTHNUM = 0x0F,
+	ET_BARDISPLAY = 0x12,
+	ET_WEATHER = 0x1B,
+	ET_UNKNOWN1D = 0x1D,
+	ET_DASH = 0x23,
+} ElementType;
+
+//----------------------------------------------------------------------------
+//  FACE INDEX
+//----------------------------------------------------------------------------
+
+// An RLE_NEW image in the face buffer, decoded by faceImageGet on first use
+typedef struct _FaceImage {
+	u32 offset;				// of the row table, from the start of the buffer
+	u16 width;
+	u16 height;
+	u32 size;				// row table plus data, or 0 if any of it isn't inside the buffer
+	Img * decoded;			// ARGB8565, or NULL until decoded (owned by the index)
+	u64 lastUse;			// when faceImageGet last returned it, for dropping the least recently used
+} FaceImage;
+
+typedef struct _FaceDigits {
+	size_t headerOffset;
+	u8 digitSet;
+	u16 unknown;
+	FaceImage * images;		// 10 images, for 0-9
+} FaceDigits;
+
+typedef struct _FaceElement {
+	size_t headerOffset;
+	const u8 * header;		// the raw header in the buffer, for anything not broken out below
+	size_t headerSize;
+	u8 eType;				// ElementType
+	u8 subtype;				// day name, hand and bar display subtype, 0 otherwise
+	u8 digitSet;			// number elements
+	u8 justification;		// number elements
+	u8 digitSets[4];		// time: digit set of each digit HHMM
+	u8 fill[4];				// battery fill: x1, y1, x2, y2 within the image
+	u8 xyCount;
+	XY xy[4];				// time: 4 digits. day and month: 2 digits. hands: centre then unknownXY.
+	size_t imageCount;
+	FaceImage * images;
+} FaceElement;
+
+typedef struct _FaceIndex {
+	const u8 * data;		// the parsed buffer, which the index points into (not owned)
+	size_t size;
+	u16 apiVer;
+	u16 unknown;
+	u16 digitsMarker;		// 0x0101 at the start of the digits section
+	FaceImage * preview;
+	size_t digitsCount;
+	FaceDigits * digits;
+	size_t elementCount;
+	FaceElement * elements;
+	size_t imageCount;
+	FaceImage * images;		// every image, in header order, starting with the preview
+	size_t endOffset;		// just past the last header parsed
+	bool truncated;			// stopped early: an unknown e_type, or headers running off the end of the buffer
+	size_t decodedLimit;	// bytes of decoded images to keep, or 0 for no limit. See faceSetDecodedLimit.
+	size_t decodedSize;		// bytes of decoded images held
+	size_t decodeCount;		// images decoded so far, counting any decoded again after being dropped
+	u64 useClock;
+} FaceIndex;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+FaceIndex * newFaceIndex(const u8 * data, size_t size);
+FaceIndex * deleteFaceIndex(FaceIndex * fi);
+const Img * faceImageGet(FaceIndex * fi, FaceImage * img);
+void faceSetDecodedLimit(FaceIndex * fi, size_t bytes);
+void faceDropDecoded(FaceIndex * fi);
+const char * elementTypeStr(u8 eType);
@@ -0,0 +1,278 @@
+/*  hand.c - rotated hand rasteriser
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "types.h"
+#include "face_new.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "rle.h"
+#include "face.h"
+#include "render.h"
+#include "hand.h"
+
+//----------------------------------------------------------------------------
+//  SIN AND COS
+//----------------------------------------------------------------------------
+
+// sin over a quarter turn in 256 steps, 16.16 fixed point. Values in between are interpolated, which
+// is accurate to better than one part in 65536.
+static const i32 QUARTER_SIN[257] = {
+	0, 402, 804, 1206, 1608, 2010, 2412, 2814,
+	3216, 3617, 4019, 4420, 4821, 5222, 5623, 6023,
+	6424, 6824, 7224, 7623, 8022, 8421, 8820, 9218,
+	9616, 10014, 10411, 10808, 11204, 11600, 11996, 12391,
+	12785, 13180, 13573, 13966, 14359, 14751, 15143, 15534,
+	15924, 16314, 16703, 17091, 17479, 17867, 18253, 18639,
+	19024, 19409, 19792, 20175, 20557, 20939, 21320, 21699,
+	22078, 22457, 22834, 23210, 23586, 23961, 24335, 24708,
+	25080, 25451, 25821, 26190, 26558, 26925, 27291, 27656,
+	28020, 28383, 28745, 29106, 29466, 29824, 30182, 30538,
+	30893, 31248, 31600, 31952, 32303, 32652, 33000, 33347,
+	33692, 34037, 34380, 34721, 35062, 35401, 35738, 36075,
+	36410, 36744, 37076, 37407, 37736, 38064, 38391, 38716,
+	39040, 39362, 39683, 40002, 40320, 40636, 40951, 41264,
+	41576, 41886, 42194, 42501, 42806, 43110, 43412, 43713,
+	44011, 44308, 44604, 44898, 45190, 45480, 45769, 46056,
+	46341, 46624, 46906, 47186, 47464, 47741, 48015, 48288,
+	48559, 48828, 49095, 49361, 49624, 49886, 50146, 50404,
+	50660, 50914, 51166, 51417, 51665, 51911, 52156, 52398,
+	52639, 52878, 53114, 53349, 53581, 53812, 54040, 54267,
+	54491, 54714, 54934, 55152, 55368, 55582, 55794, 56004,
+	56212, 56418, 56621, 56823, 57022, 57219, 57414, 57607,
+	57798, 57986, 58172, 58356, 58538, 58718, 58896, 59071,
+	59244, 59415, 59583, 59750, 59914, 60075, 60235, 60392,
+	60547, 60700, 60851, 60999, 61145, 61288, 61429, 61568,
+	61705, 61839, 61971, 62101, 62228, 62353, 62476, 62596,
+	62714, 62830, 62943, 63054, 63162, 63268, 63372, 63473,
+	63572, 63668, 63763, 63854, 63944, 64031, 64115, 64197,
+	64277, 64354, 64429, 64501, 64571, 64639, 64704, 64766,
+	64827, 64884, 64940, 64993, 65043, 65091, 65137, 65180,
+	65220, 65259, 65294, 65328, 65358, 65387, 65413, 65436,
+	65457, 65476, 65492, 65505, 65516, 65525, 65531, 65535,
+	65536,
+};
+
+// sin for 0 to a quarter turn (inclusive)
+static i32 quarterSin(u32 r) {
+	u32 i = r >> 6;
+	if(i >= 256) {
+		return QUARTER_SIN[256];
+	}
+	i32 frac = (i32)(r & 0x3F);
+	return QUARTER_SIN[i] + (((QUARTER_SIN[i + 1] - QUARTER_SIN[i]) * frac + 32) >> 6);
+}
+
+// sin of angle (HAND_TURN to a full turn), 16.16 fixed point
+i32 handSin(u32 angle) {
+	angle %= HAND_TURN;
+	u32 quarter = HAND_TURN / 4;
+	u32 r = angle % quarter;
+	switch(angle / quarter) {
+		case 0: return quarterSin(r);
+		case 1: return quarterSin(quarter - r);
+		case 2: return -quarterSin(r);
+	}
+	return -quarterSin(quarter - r);
+}
+
+i32 handCos(u32 angle) {
+	return handSin(angle % HAND_TURN + HAND_TURN / 4);
+}
+
+//----------------------------------------------------------------------------
+//  HAND SPRITE
+//----------------------------------------------------------------------------
+
+static inline u32 div255(u32 x) {
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+// Decode an RLE_NEW hand image of size bytes into a sprite
+HandSprite * newHandSprite(const u8 * imgData, size_t size, u32 width, u32 height) {
+	HandSprite * h = malloc(sizeof(HandSprite));
+	if(h == NULL) {
+		return NULL;
+	}
+	h->width = width;
+	h->height = height;
+	h->stride = (width + 2) * 4;
+	h->errors = 0;
+	h->pixels = calloc((size_t)h->stride * (height + 2), 1);
+	if(h->pixels == NULL) {
+		free(h);
+		return NULL;
+	}
+
+	for(u32 y=0; y<height; y++) {
+		u8 * row = &h->pixels[(size_t)(y + 1) * h->stride + 4];
+		size_t rowSize;
+		const u8 * src = rleNewRow(imgData, size, height, y, &rowSize);
+		if(src == NULL) {
+			h->errors++;
+			continue;
+		}
+		if(rleNewDecodeRow8888(src, rowSize, row, width) != 0) {
+			h->errors++;
+		}
+		// premultiply, so filtering doesn't bleed the colour of transparent pixels
+		for(u32 x=0; x<width; x++, row+=4) {
+			u32 a = row[3];
+			if(a != 255) {
+				row[0] = (u8)div255(row[0] * a);
+				row[1] = (u8)div255(row[1] * a);
+				row[2] = (u8)div255(row[2] * a);
+			}
+		}
+	}
+	return h;
+}
+
+HandSprite * deleteHandSprite(HandSprite * h) {
+	if(h != NULL) {
+		free(h->pixels);
+		free(h);
+	}
+	return NULL;
+}
+
+//----------------------------------------------------------------------------
+//  HANDDRAW
+//----------------------------------------------------------------------------
+
+static int64_t floorDiv(int64_t a, int64_t b) {
+	int64_t q = a / b;
+	return (q * b > a) ? q - 1 : q;
+}
+
+static int64_t ceilDiv(int64_t a, int64_t b) {
+	int64_t q = a / b;
+	return (q * b < a) ? q + 1 : q;
+}
+
+// Narrow [*t0, *t1) to the t where lo <= f0 + t * df <= hi
+static void limitSpan(int64_t f0, int64_t df, int64_t lo, int64_t hi, int64_t * t0, int64_t * t1) {
+	int64_t a, b;
+	if(df == 0) {
+		if(f0 < lo || f0 > hi) {
+			*t1 = *t0;
+		}
+		return;
+	}
+	if(df > 0) {
+		a = ceilDiv(lo - f0, df);
+		b = floorDiv(hi - f0, df);
+	} else {
+		a = ceilDiv(f0 - hi, -df);
+		b = floorDiv(f0 - lo, -df);
+	}
+	if(a > *t0) {
+		*t0 = a;
+	}
+	if(b + 1 < *t1) {
+		*t1 = b + 1;
+	}
+}
+
+// Screen rectangle covered by a width x height image drawn like handDraw, including the filter's fringe
+void handBounds(u32 width, u32 height, i32 pivotX, i32 pivotY, int x, int y, u32 angle, RenderRect * r) {
+	const int64_t one = HAND_ONE;
+	int64_t ca = handCos(angle);
+	int64_t sa = handSin(angle);
+	int64_t minX = INT64_MAX, minY = INT64_MAX, maxX = INT64_MIN, maxY = INT64_MIN;
+	for(int i=0; i<4; i++) {
+		int64_t ix = ((i & 1) ? (int64_t)width * one : 0) - pivotX;
+		int64_t iy = ((i & 2) ? (int64_t)height * one : 0) - pivotY;
+		int64_t sx = floorDiv(ix * ca - iy * sa, one);
+		int64_t sy = floorDiv(ix * sa + iy * ca, one);
+		minX = (sx < minX) ? sx : minX;
+		maxX = (sx > maxX) ? sx : maxX;
+		minY = (sy < minY) ? sy : minY;
+		maxY = (sy > maxY) ? sy : maxY;
+	}
+	r->x0 = x + (int)floorDiv(minX, one) - 1;
+	r->y0 = y + (int)floorDiv(minY, one) - 1;
+	r->x1 = x + (int)ceilDiv(maxX, one) + 1;
+	r->y1 = y + (int)ceilDiv(maxY, one) + 1;
+}
+
+// Draw h over an ARGB8888 frame, rotated clockwise by angle about its pivot (16.16, image pixels), with the
+// pivot placed at screen pixel x, y. Only pixels inside clip, and inside the rotated image, are touched.
+//
+// Each screen pixel centre is mapped back into the image, and the 4 nearest image pixels are blended with
+// 8 bit weights. Image coordinates step by (cos, -sin) along a screen row, so each row is 2 adds per pixel,
+// and the range of the row that lands on the image is worked out up front.
+void handDraw(Img * frame, const RenderRect * clip, const HandSprite * h, i32 pivotX, i32 pivotY, int x, int y, u32 angle) {
+	const int64_t one = HAND_ONE;
+	int64_t ca = handCos(angle);
+	int64_t sa = handSin(angle);
+
+	RenderRect box;
+	handBounds(h->width, h->height, pivotX, pivotY, x, y, angle, &box);
+	int64_t x0 = (box.x0 < clip->x0) ? clip->x0 : box.x0;
+	int64_t y0 = (box.y0 < clip->y0) ? clip->y0 : box.y0;
+	int64_t x1 = (box.x1 > clip->x1) ? clip->x1 : box.x1;
+	int64_t y1 = (box.y1 > clip->y1) ? clip->y1 : box.y1;
+	x0 = (x0 < 0) ? 0 : x0;
+	y0 = (y0 < 0) ? 0 : y0;
+	x1 = (x1 > (int64_t)frame->w) ? (int64_t)frame->w : x1;
+	y1 = (y1 > (int64_t)frame->h) ? (int64_t)frame->h : y1;
+	if(x0 >= x1 || y0 >= y1) {
+		return;
+	}
+
+	// u, v: image position plus half a pixel, so the top left filter tap is (u >> 16, v >> 16) in the
+	// bordered sprite. Valid from 0 until the tap would step past the border.
+	const int64_t maxU = (int64_t)(h->width + 1) * one - 1;
+	const int64_t maxV = (int64_t)(h->height + 1) * one - 1;
+	const size_t stride = h->stride;
+	for(int64_t fy=y0; fy<y1; fy++) {
+		int64_t dx2 = 2 * (x0 - x) + 1;			// pixel centre relative to the pivot, in half pixels
+		int64_t dy2 = 2 * (fy - y) + 1;
+		int64_t u = floorDiv(dx2 * ca + dy2 * sa, 2) + pivotX + one / 2;
+		int64_t v = floorDiv(dy2 * ca - dx2 * sa, 2) + pivotY + one / 2;
+		int64_t t0 = 0;
+		int64_t t1 = x1 - x0;
+		limitSpan(u, ca, 0, maxU, &t0, &t1);
+		limitSpan(v, -sa, 0, maxV, &t0, &t1);
+		if(t0 >= t1) {
+			continue;
+		}
+		u += t0 * ca;
+		v -= t0 * sa;
+		u8 * d = &frame->data[((size_t)fy * frame->w + (size_t)(x0 + t0)) * 4];
+		for(int64_t t=t0; t<t1; t++, u+=ca, v-=sa, d+=4) {
+			const u8 * p = &h->pixels[(size_t)(v >> 16) * stride + (size_t)(u >> 16) * 4];
+			u32 fx = (u32)(u >> 8) & 0xFF;
+			u32 fy8 = (u32)(v >> 8) & 0xFF;
+			u32 w00 = (256 - fx) * (256 - fy8);
+			u32 w01 = fx * (256 - fy8);
+			u32 w10 = (256 - fx) * fy8;
+			u32 w11 = fx * fy8;
+			u32 a = (p[3] * w00 + p[7] * w01 + p[stride + 3] * w10 + p[stride + 7] * w11 + 32768) >> 16;
+			if(a == 0) {
+				continue;
+			}
+			u32 ia = 255 - a;
+			for(int c=0; c<3; c++) {
+				u32 s = (p[c] * w00 + p[4 + c] * w01 + p[stride + c] * w10 + p[stride + 4 + c] * w11 + 32768) >> 16;
+				d[c] = (u8)(s + div255(d[c] * ia));
+			}
+			d[3] = (u8)(a + div255(d[3] * ia));
+		}
+	}
+}
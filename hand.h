@@ -0,0 +1,34 @@
+// hand.h
+// rotated, bilinear filtered drawing of watch hands
+
+//----------------------------------------------------------------------------
+//  FIXED POINT
+//----------------------------------------------------------------------------
+
+#define HAND_ONE 65536				// 1.0 in the 16.16 fixed point used for positions and sin/cos
+#define HAND_TURN 65536				// angle units in a full clockwise turn
+
+//----------------------------------------------------------------------------
+//  HAND SPRITE
+//----------------------------------------------------------------------------
+
+// A hand image decoded once and kept ready for drawing at any angle: premultiplied ARGB8888 with a
+// transparent border of 1 pixel on every side, so bilinear samples at the edges need no bounds checks.
+typedef struct _HandSprite {
+	u32 width;				// size of the image, not including the border
+	u32 height;
+	u32 stride;				// bytes per row of pixels, including the border
+	u8 * pixels;			// (width + 2) * (height + 2) pixels
+	int errors;				// rows that didn't decode (left transparent)
+} HandSprite;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+i32 handSin(u32 angle);
+i32 handCos(u32 angle);
+HandSprite * newHandSprite(const u8 * imgData, size_t size, u32 width, u32 height);
+HandSprite * deleteHandSprite(HandSprite * h);
+void handBounds(u32 width, u32 height, i32 pivotX, i32 pivotY, int x, int y, u32 angle, RenderRect * r);
+void handDraw(Img * frame, const RenderRect * clip, const HandSprite * h, i32 pivotX, i32 pivotY, int x, int y, u32 angle);
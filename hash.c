@@ -0,0 +1,213 @@
+/*  hash.c - content hashing and a store of byte strings
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	hashBytes is XXH64: four independent lanes of 8 bytes, so it runs at memory speed on
+	compressed image data. The store is an open addressed table of entries that point at
+	the caller's data; a matching hash is always confirmed with memcmp.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "hash.h"
+
+//----------------------------------------------------------------------------
+//  HASHBYTES
+//----------------------------------------------------------------------------
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static u64 rotl64(u64 x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+// little-endian loads, without care for alignment
+static u64 read64(const u8 * p) {
+	u64 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static u32 read32(const u8 * p) {
+	u32 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static u64 hashRound(u64 acc, u64 input) {
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static u64 hashMerge(u64 acc, u64 lane) {
+	acc ^= hashRound(0, lane);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+u64 hashBytes(const u8 * data, size_t size, u64 seed) {
+	const u8 * p = data;
+	const u8 * end = data + size;
+	u64 h;
+
+	if(size >= 32) {
+		u64 v1 = seed + PRIME64_1 + PRIME64_2;
+		u64 v2 = seed + PRIME64_2;
+		u64 v3 = seed;
+		u64 v4 = seed - PRIME64_1;
+		const u8 * limit = end - 32;
+		do {
+			v1 = hashRound(v1, read64(p));
+			v2 = hashRound(v2, read64(p + 8));
+			v3 = hashRound(v3, read64(p + 16));
+			v4 = hashRound(v4, read64(p + 24));
+			p += 32;
+		} while(p <= limit);
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = hashMerge(h, v1);
+		h = hashMerge(h, v2);
+		h = hashMerge(h, v3);
+		h = hashMerge(h, v4);
+	} else {
+		h = seed + PRIME64_5;
+	}
+	h += (u64)size;
+
+	// the tail
+	for(; p + 8 <= end; p += 8) {
+		h ^= hashRound(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if(p + 4 <= end) {
+		h ^= (u64)read32(p) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	for(; p < end; p++) {
+		h ^= (*p) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+	}
+
+	// avalanche
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+//----------------------------------------------------------------------------
+//  HASH STORE
+//----------------------------------------------------------------------------
+
+typedef struct _HashEntry {
+	u64 hash;
+	u64 key;				// the caller's extra key, e.g. width and height
+	const u8 * data;		// not owned
+	size_t size;
+	size_t value;
+} HashEntry;
+
+struct _HashStore {
+	HashEntry * entries;
+	size_t count;
+	size_t capacity;
+	size_t * slots;			// entry index + 1, or 0 for empty. Never more than half full.
+	size_t slotCount;		// a power of 2
+};
+
+HashStore * newHashStore(void) {
+	HashStore * s = calloc(1, sizeof(HashStore));
+	if(s == NULL) {
+		printf("ERROR: Out of memory\n");
+	}
+	return s;
+}
+
+HashStore * deleteHashStore(HashStore * s) {
+	if(s != NULL) {
+		free(s->entries);
+		free(s->slots);
+		free(s);
+	}
+	return NULL;
+}
+
+// Double the table and re-insert everything. Returns 0 on success.
+static int growSlots(HashStore * s) {
+	size_t slotCount = s->slotCount ? s->slotCount * 2 : 256;
+	size_t * slots = calloc(slotCount, sizeof(size_t));
+	if(slots == NULL) {
+		return 1;
+	}
+	for(size_t i=0; i<s->count; i++) {
+		size_t j = (size_t)s->entries[i].hash & (slotCount - 1);
+		while(slots[j] != 0) {
+			j = (j + 1) & (slotCount - 1);
+		}
+		slots[j] = i + 1;
+	}
+	free(s->slots);
+	s->slots = slots;
+	s->slotCount = slotCount;
+	return 0;
+}
+
+// Look for an earlier entry with the same key and the same bytes. If there is one, its value is returned.
+// If not, this one is added and value is returned. data must stay valid for the life of the store.
+// When out of memory nothing is added, and every lookup is a miss.
+size_t hashStoreAdd(HashStore * s, const u8 * data, size_t size, u64 key, size_t value) {
+	u64 hash = hashBytes(data, size, key);
+
+	if(s->slotCount != 0) {
+		size_t j = (size_t)hash & (s->slotCount - 1);
+		while(s->slots[j] != 0) {
+			const HashEntry * e = &s->entries[s->slots[j] - 1];
+			if(e->hash == hash && e->key == key && e->size == size && (e->data == data || memcmp(e->data, data, size) == 0)) {
+				return e->value;
+			}
+			j = (j + 1) & (s->slotCount - 1);
+		}
+	}
+
+	// not seen before
+	if((s->count + 1) * 2 > s->slotCount && growSlots(s) != 0) {
+		return value;
+	}
+	if(s->count == s->capacity) {
+		size_t capacity = s->capacity ? s->capacity * 2 : 64;
+		HashEntry * entries = realloc(s->entries, capacity * sizeof(HashEntry));
+		if(entries == NULL) {
+			return value;
+		}
+		s->entries = entries;
+		s->capacity = capacity;
+	}
+	HashEntry * e = &s->entries[s->count++];
+	e->hash = hash;
+	e->key = key;
+	e->data = data;
+	e->size = size;
+	e->value = value;
+	size_t j = (size_t)hash & (s->slotCount - 1);
+	while(s->slots[j] != 0) {
+		j = (j + 1) & (s->slotCount - 1);
+	}
+	s->slots[j] = s->count;
+	return value;
+}
@@ -0,0 +1,18 @@
+// hash.h
+// content hashing, and a store that finds byte strings seen before
+
+//----------------------------------------------------------------------------
+//  EXPORTED TYPES
+//----------------------------------------------------------------------------
+
+// Remembers byte strings by content. Not thread safe.
+typedef struct _HashStore HashStore;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+u64 hashBytes(const u8 * data, size_t size, u64 seed);
+HashStore * newHashStore(void);
+HashStore * deleteHashStore(HashStore * s);
+size_t hashStoreAdd(HashStore * s, const u8 * data, size_t size, u64 key, size_t value);
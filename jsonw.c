@@ -0,0 +1,169 @@
+/*  jsonw.c - streaming JSON writer
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Writes JSON as it is produced, instead of building a tree and printing it at the end.
+	The layout matches cJSON_Print exactly, so existing watchface.json files don't change.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "jsonw.h"
+
+//----------------------------------------------------------------------------
+//  INTERNAL HELPERS
+//----------------------------------------------------------------------------
+
+static void writeTabs(JsonWriter * w, int count) {
+	for(int i=0; i<count; i++) {
+		fputc('\t', w->f);
+	}
+}
+
+static void writeEscaped(JsonWriter * w, const char * s) {
+	fputc('"', w->f);
+	for(const unsigned char * c = (const unsigned char *)s; *c; c++) {
+		switch(*c) {
+			case '"':  fputs("\\\"", w->f); break;
+			case '\\': fputs("\\\\", w->f); break;
+			case '\b': fputs("\\b", w->f); break;
+			case '\f': fputs("\\f", w->f); break;
+			case '\n': fputs("\\n", w->f); break;
+			case '\r': fputs("\\r", w->f); break;
+			case '\t': fputs("\\t", w->f); break;
+			default:
+				if(*c < 32) {
+					fprintf(w->f, "\\u%04x", *c);
+				} else {
+					fputc(*c, w->f);
+				}
+				break;
+		}
+	}
+	fputc('"', w->f);
+}
+
+// Separator, indent and key for the next value at the current level
+static void writePrefix(JsonWriter * w, const char * key) {
+	if(w->depth == 0) {
+		return;
+	}
+	int level = w->depth - 1;
+	if(w->isArray[level]) {
+		if(!w->first[level]) {
+			fputs(", ", w->f);
+		}
+	} else {
+		if(!w->first[level]) {
+			fputs(",\n", w->f);
+		}
+		writeTabs(w, w->depth);
+		writeEscaped(w, key ? key : "");
+		fputs(":\t", w->f);
+	}
+	w->first[level] = false;
+}
+
+static void push(JsonWriter * w, bool isArray) {
+	if(w->depth >= JSONW_MAX_DEPTH) {
+		w->error = true;
+		return;
+	}
+	w->first[w->depth] = true;
+	w->isArray[w->depth] = isArray;
+	w->depth++;
+}
+
+static bool pop(JsonWriter * w, bool isArray) {
+	if(w->depth == 0 || w->isArray[w->depth-1] != isArray) {
+		w->error = true;
+		return false;
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------
+//  JSONW FUNCTIONS
+//----------------------------------------------------------------------------
+
+void jsonwInit(JsonWriter * w, FILE * f) {
+	w->f = f;
+	w->depth = 0;
+	w->error = false;
+}
+
+void jsonwBeginObject(JsonWriter * w, const char * key) {
+	writePrefix(w, key);
+	fputs("{\n", w->f);
+	push(w, false);
+}
+
+void jsonwEndObject(JsonWriter * w) {
+	if(!pop(w, false)) {
+		return;
+	}
+	if(!w->first[w->depth-1]) {
+		fputc('\n', w->f);
+	}
+	writeTabs(w, w->depth - 1);
+	fputc('}', w->f);
+	w->depth--;
+}
+
+void jsonwBeginArray(JsonWriter * w, const char * key) {
+	writePrefix(w, key);
+	fputc('[', w->f);
+	push(w, true);
+}
+
+void jsonwEndArray(JsonWriter * w) {
+	if(!pop(w, true)) {
+		return;
+	}
+	fputc(']', w->f);
+	w->depth--;
+}
+
+void jsonwInt(JsonWriter * w, const char * key, long value) {
+	writePrefix(w, key);
+	fprintf(w->f, "%ld", value);
+}
+
+void jsonwIntArray(JsonWriter * w, const char * key, const int * values, size_t count) {
+	jsonwBeginArray(w, key);
+	for(size_t i=0; i<count; i++) {
+		jsonwInt(w, NULL, values[i]);
+	}
+	jsonwEndArray(w);
+}
+
+void jsonwString(JsonWriter * w, const char * key, const char * value) {
+	writePrefix(w, key);
+	writeEscaped(w, value);
+}
+
+void jsonwBool(JsonWriter * w, const char * key, bool value) {
+	writePrefix(w, key);
+	fputs(value ? "true" : "false", w->f);
+}
+
+// Returns 0 if everything was balanced and written. Doesn't close the stream.
+int jsonwFinish(JsonWriter * w) {
+	if(w->error || w->depth != 0) {
+		return 1;
+	}
+	if(fflush(w->f) != 0 || ferror(w->f)) {
+		return 2;
+	}
+	return 0;
+}
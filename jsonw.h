@@ -0,0 +1,33 @@
+// jsonw.h
+// streaming JSON writer, formatted the same way as cJSON_Print
+
+//----------------------------------------------------------------------------
+//  EXPORTED STRUCTS
+//----------------------------------------------------------------------------
+
+#define JSONW_MAX_DEPTH 16
+
+// Lives on the caller's stack. Output goes straight to the stream, nothing is allocated.
+typedef struct _JsonWriter {
+	FILE * f;
+	int depth;
+	bool first[JSONW_MAX_DEPTH];	// no items written yet at this level
+	bool isArray[JSONW_MAX_DEPTH];
+	bool error;						// nesting too deep or unbalanced
+} JsonWriter;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+// key is the member name inside an object, and is ignored (pass NULL) inside an array or at the top level
+void jsonwInit(JsonWriter * w, FILE * f);
+void jsonwBeginObject(JsonWriter * w, const char * key);
+void jsonwEndObject(JsonWriter * w);
+void jsonwBeginArray(JsonWriter * w, const char * key);
+void jsonwEndArray(JsonWriter * w);
+void jsonwInt(JsonWriter * w, const char * key, long value);
+void jsonwIntArray(JsonWriter * w, const char * key, const int * values, size_t count);
+void jsonwString(JsonWriter * w, const char * key, const char * value);
+void jsonwBool(JsonWriter * w, const char * key, bool value);
+int jsonwFinish(JsonWriter * w);
@@ -0,0 +1,50 @@
+// libadawft.h
+// everything needed to use libadawft from another program
+
+// Typical use, indexing a face held in memory without decoding anything:
+//   FaceIndex * fi = newFaceIndex(data, size);
+//   for(size_t i=0; i<fi->elementCount; i++) { ... fi->elements[i].eType, .xy, .images ... }
+//   fi = deleteFaceIndex(fi);
+// Images are decoded only when asked for, and kept by the index until it's deleted:
+//   const Img * preview = faceImageGet(fi, fi->preview);		// ARGB8565
+// faceSetDecodedLimit(fi, bytes) keeps only the most recently used images within bytes.
+
+#ifndef LIBADAWFT_H
+#define LIBADAWFT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "types.h"
+#include "face_new.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "output.h"
+#include "archive.h"
+#include "bmpstream.h"
+#include "pool.h"
+#include "pixel.h"
+#include "rle.h"
+#include "hash.h"
+#include "cache.h"
+#include "deflate.h"
+#include "png.h"
+#include "qoi.h"
+#include "dump.h"
+#include "jsonw.h"
+#include "face.h"
+#include "render.h"
+#include "hand.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,373 @@
+/*  loadtest.c - load test the server
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Starts a server inside this process on a temporary socket, or uses one already running
+	(--socket), then has several clients send requests at the same time, each on its own
+	connection, sending the next request as soon as the last is answered. The faces given
+	are used in turn; convert requests send the preview image of a face as RLE_NEW data,
+	image requests ask for the preview of the face.
+
+	Results are tab separated, one line per request type and one for them all together,
+	after a few '#' comment lines describing the run:
+
+		op  requests  failed  seconds  req_per_s  mean_ms  p50_ms  p99_ms  max_ms
+
+	Latencies are measured by the clients, from sending a request to the end of its reply.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#ifndef WINDOWS
+#define _POSIX_C_SOURCE 200809L		// for clock_gettime, getpid
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "face_new.h"
+#include "adawft.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "pool.h"
+#include "cache.h"
+#include "output.h"
+#include "dump.h"
+#include "face.h"
+#include "render.h"
+#include "server.h"
+#include "strutil.h"
+
+#define LOAD_MAX_OPS 5
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+//----------------------------------------------------------------------------
+//  FACES - what the requests send
+//----------------------------------------------------------------------------
+
+typedef struct _LoadFace {
+	Bytes * face;
+	Bytes * preview;		// RLE_NEW, for convert requests
+	u32 width;
+	u32 height;
+} LoadFace;
+
+// Read a face, and copy out its preview. Returns 0 on success.
+static int loadFace(const char * fileName, LoadFace * lf) {
+	lf->face = newBytesFromFile(fileName);
+	FaceIndex * fi = (lf->face != NULL) ? newFaceIndex(lf->face->data, lf->face->size) : NULL;
+	if(fi == NULL || fi->preview->size == 0) {
+		dprintf(0, "ERROR: %s isn't a watch face.\n", fileName);
+		deleteFaceIndex(fi);
+		return 1;
+	}
+	lf->preview = newBytesFromMemory(&fi->data[fi->preview->offset], fi->preview->size);
+	lf->width = fi->preview->width;
+	lf->height = fi->preview->height;
+	deleteFaceIndex(fi);
+	return (lf->preview != NULL) ? 0 : 1;
+}
+
+//----------------------------------------------------------------------------
+//  CLIENTS
+//----------------------------------------------------------------------------
+
+typedef struct _LoadRun {
+	const char * socketPath;
+	const LoadFace * faces;
+	size_t faceCount;
+	ServeOp ops[LOAD_MAX_OPS];
+	size_t opCount;
+	size_t requests;		// per client
+	Format format;
+} LoadRun;
+
+typedef struct _LoadClient {
+	pthread_t thread;
+	const LoadRun * run;
+	size_t idx;
+	ServeOp * ops;			// per request
+	double * seconds;		// per request
+	bool * failed;			// per request
+	size_t done;
+} LoadClient;
+
+static void * clientThread(void * arg) {
+	LoadClient * c = (LoadClient *)arg;
+	const LoadRun * run = c->run;
+	int fd = serveConnect(run->socketPath);
+	if(fd < 0) {
+		dprintf(0, "ERROR: Client %zu can't connect to %s\n", c->idx, run->socketPath);
+		return NULL;
+	}
+
+	char args[128];
+	for(size_t r=0; r<run->requests; r++) {
+		// clients start at different places, so every op and face is in flight at once
+		ServeOp op = run->ops[(c->idx + r) % run->opCount];
+		const LoadFace * lf = &run->faces[(c->idx + r / run->opCount) % run->faceCount];
+		int len = snprintf(args, sizeof(args), "format=%s\n", dumpFormatStr(run->format));
+		const Bytes * data = lf->face;
+		if(op == SERVE_CONVERT) {
+			snprintf(&args[len], sizeof(args) - (size_t)len, "width=%u\nheight=%u\n", lf->width, lf->height);
+			data = lf->preview;
+		}
+
+		Bytes * reply = NULL;
+		double start = now();
+		int status = serveCall(fd, op, args, data->data, data->size, &reply);
+		c->seconds[r] = now() - start;
+		c->ops[r] = op;
+		c->failed[r] = (status != SERVE_OK);
+		c->done++;
+		deleteBytes(reply);
+		if(status < 0) {
+			dprintf(0, "ERROR: Client %zu lost its connection.\n", c->idx);
+			break;
+		}
+	}
+	close(fd);
+	return NULL;
+}
+
+//----------------------------------------------------------------------------
+//  RESULTS
+//----------------------------------------------------------------------------
+
+static int compareDouble(const void * a, const void * b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// One line of results for requests of op, or of every op if all is true
+static void report(const LoadClient * clients, size_t clientCount, ServeOp op, bool all, double elapsed) {
+	size_t count = 0;
+	for(size_t i=0; i<clientCount; i++) {
+		count += clients[i].done;
+	}
+	double * seconds = malloc((count ? count : 1) * sizeof(double));
+	if(seconds == NULL) {
+		return;
+	}
+	size_t n = 0;
+	size_t failed = 0;
+	double total = 0;
+	for(size_t i=0; i<clientCount; i++) {
+		for(size_t r=0; r<clients[i].done; r++) {
+			if(all || clients[i].ops[r] == op) {
+				seconds[n++] = clients[i].seconds[r];
+				total += clients[i].seconds[r];
+				failed += clients[i].failed[r] ? 1 : 0;
+			}
+		}
+	}
+	if(n > 0) {
+		qsort(seconds, n, sizeof(double), compareDouble);
+		printf("%s\t%zu\t%zu\t%.4f\t%.1f\t%.3f\t%.3f\t%.3f\t%.3f\n", all ? "all" : serveOpStr(op), n, failed, elapsed,
+			n / elapsed, total / n * 1e3, seconds[(n - 1) / 2] * 1e3, seconds[(size_t)((n - 1) * 0.99)] * 1e3, seconds[n - 1] * 1e3);
+	}
+	free(seconds);
+}
+
+//----------------------------------------------------------------------------
+//  MAIN
+//----------------------------------------------------------------------------
+
+static void * serverThread(void * arg) {
+	serverRun((Server *)arg);
+	return NULL;
+}
+
+int main(int argc, char * argv[]) {
+	DEBUG_LEVEL = 0;
+	LoadRun run;
+	memset(&run, 0, sizeof(run));
+	run.requests = 50;
+	run.format = FMT_BMP;
+	size_t clientCount = 4;
+	const char * opList = "index,dump,render,convert";
+	char tmpSocket[108];
+	LoadFace * faces = calloc((size_t)argc, sizeof(LoadFace));
+	if(faces == NULL) {
+		printf("ERROR: Out of memory\n");
+		return 1;
+	}
+
+	bool usage = false;
+	for(int i=1; i<argc; i++) {
+		if(streqn(argv[i], "--socket=", 9)) {
+			run.socketPath = &argv[i][9];
+		} else if(streqn(argv[i], "--clients=", 10)) {
+			clientCount = (size_t)atoi(&argv[i][10]);
+		} else if(streqn(argv[i], "--requests=", 11)) {
+			run.requests = (size_t)atoi(&argv[i][11]);
+		} else if(streqn(argv[i], "--ops=", 6)) {
+			opList = &argv[i][6];
+		} else if(streq(argv[i], "--bin")) {
+			run.format = FMT_BIN;
+		} else if(streq(argv[i], "--raw")) {
+			run.format = FMT_RAW;
+		} else if(streq(argv[i], "--bmp")) {
+			run.format = FMT_BMP;
+		} else if(streq(argv[i], "--png")) {
+			run.format = FMT_PNG;
+		} else if(streq(argv[i], "--qoi")) {
+			run.format = FMT_QOI;
+		} else if(streqn(argv[i], "--threads=", 10)) {
+			unsigned threads;
+			if(readUnsigned(&argv[i][10], POOL_MAX_THREADS, &threads)) {
+				setDefaultPoolThreads(threads);
+			} else {
+				dprintf(0, "ERROR: --threads must be a number from 0 to %u\n", POOL_MAX_THREADS);
+				usage = true;
+			}
+		} else if(streqn(argv[i], "--debug=", 8)) {
+			DEBUG_LEVEL = atoi(&argv[i][8]);
+		} else if(streqn(argv[i], "--", 2)) {
+			usage = true;
+		} else if(loadFace(argv[i], &faces[run.faceCount++]) != 0) {
+			usage = true;
+		}
+	}
+
+	// the ops, in the order each client cycles through them
+	char opCopy[64];
+	snprintf(opCopy, sizeof(opCopy), "%s", opList);
+	char * save = NULL;
+	for(char * t = strtok_r(opCopy, ",", &save); t != NULL; t = strtok_r(NULL, ",", &save)) {
+		int op = serveOpFromStr(t);
+		if(op < 0 || run.opCount == LOAD_MAX_OPS) {
+			usage = true;
+			break;
+		}
+		run.ops[run.opCount++] = (ServeOp)op;
+	}
+
+	if(usage || run.faceCount == 0 || run.opCount == 0 || clientCount == 0 || run.requests == 0) {
+		printf("Usage: %s [OPTIONS] FACE...\n", argv[0]);
+		printf("  --socket=PATH   Test the server already running there. By default one is started in this process.\n");
+		printf("  --clients=N     Connections sending requests at the same time. Default 4.\n");
+		printf("  --requests=N    Requests sent by each client. Default 50.\n");
+		printf("  --ops=OP,...    Requests to send, in turn: index, dump, render, convert or image.\n");
+		printf("                  Default index,dump,render,convert.\n");
+		printf("  --bmp --png --qoi --raw --bin   Format of dumped, rendered and converted images. Default bmp.\n");
+		printf("  --threads=N     Threads for the server started here. 0 (the default) uses every core.\n");
+		printf("  --debug=LEVEL   Print more, including each request the server answers at 1.\n");
+		for(size_t i=0; i<run.faceCount; i++) {
+			deleteBytes(faces[i].face);
+			deleteBytes(faces[i].preview);
+		}
+		free(faces);
+		return 1;
+	}
+	run.faces = faces;
+
+	// a server of our own, unless testing one already running
+	Server * server = NULL;
+	pthread_t serverTid;
+	if(run.socketPath == NULL) {
+		snprintf(tmpSocket, sizeof(tmpSocket), "/tmp/adawft-load-%u.sock", (unsigned)getpid());
+		run.socketPath = tmpSocket;
+		ServeOptions so = { NULL, false };
+		server = newServer(run.socketPath, &so);
+		if(server == NULL || pthread_create(&serverTid, NULL, serverThread, server) != 0) {
+			dprintf(0, "ERROR: Failed to start a server.\n");
+			return 1;
+		}
+	}
+
+	LoadClient * clients = calloc(clientCount, sizeof(LoadClient));
+	if(clients == NULL) {
+		printf("ERROR: Out of memory\n");
+		return 1;
+	}
+	for(size_t i=0; i<clientCount; i++) {
+		clients[i].run = &run;
+		clients[i].idx = i;
+		clients[i].ops = malloc(run.requests * sizeof(ServeOp));
+		clients[i].seconds = malloc(run.requests * sizeof(double));
+		clients[i].failed = malloc(run.requests * sizeof(bool));
+		if(clients[i].ops == NULL || clients[i].seconds == NULL || clients[i].failed == NULL) {
+			printf("ERROR: Out of memory\n");
+			return 1;
+		}
+	}
+
+	printf("# adawft load test\n");
+	printf("# cpus\t%u\n", cpuCount());
+	printf("# server\t%s\n", server ? "in process" : run.socketPath);
+	printf("# clients\t%zu\n", clientCount);
+	printf("# faces\t%zu\n", run.faceCount);
+	printf("# format\t%s\n", dumpFormatStr(run.format));
+	printf("op\trequests\tfailed\tseconds\treq_per_s\tmean_ms\tp50_ms\tp99_ms\tmax_ms\n");
+	fflush(stdout);
+
+	double start = now();
+	size_t started = 0;
+	for(; started<clientCount; started++) {
+		if(pthread_create(&clients[started].thread, NULL, clientThread, &clients[started]) != 0) {
+			dprintf(0, "ERROR: Only %zu client(s) started.\n", started);
+			break;
+		}
+	}
+	for(size_t i=0; i<started; i++) {
+		pthread_join(clients[i].thread, NULL);
+	}
+	double elapsed = now() - start;
+
+	size_t sent = 0;
+	size_t failed = 0;
+	for(size_t i=0; i<started; i++) {
+		sent += clients[i].done;
+		for(size_t r=0; r<clients[i].done; r++) {
+			failed += clients[i].failed[r] ? 1 : 0;
+		}
+	}
+	for(size_t o=0; o<run.opCount; o++) {
+		bool seen = false;
+		for(size_t p=0; p<o; p++) {
+			seen = seen || (run.ops[p] == run.ops[o]);
+		}
+		if(!seen) {
+			report(clients, started, run.ops[o], false, elapsed);
+		}
+	}
+	report(clients, started, SERVE_INDEX, true, elapsed);
+
+	if(server != NULL) {
+		serverStop(server);
+		pthread_join(serverTid, NULL);
+		server = deleteServer(server);
+	}
+	for(size_t i=0; i<clientCount; i++) {
+		free(clients[i].ops);
+		free(clients[i].seconds);
+		free(clients[i].failed);
+	}
+	free(clients);
+	for(size_t i=0; i<run.faceCount; i++) {
+		deleteBytes(faces[i].face);
+		deleteBytes(faces[i].preview);
+	}
+	free(faces);
+	deleteDefaultPool();
+
+	int complete = (started == clientCount && sent == clientCount * run.requests && failed == 0);
+	return complete ? 0 : 1;
+}
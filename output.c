@@ -0,0 +1,681 @@
+/*  output.c - file output layer
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Every file is written with one open, one vectored write of all its pieces (more only if
+	the system writes less than asked) and one close, rather than through stdio in small
+	chunks. On network volumes the cost is per system call, not per byte.
+
+	A batch holds the small files of a face until it is flushed. Then each directory is
+	opened once, and the files are created relative to it with openat, in parallel on the
+	pool, so no file pays for looking its whole path up again.
+
+	The time taken by every file is recorded, for outputGetStats.
+
+	While an archive is set, files inside its root folder go into the archive instead, and
+	links between them become link entries. Nothing is created inside the root on disk.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#ifndef WINDOWS
+#define _POSIX_C_SOURCE 200809L		// for openat, posix_fallocate, clock_gettime, link, dup
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#include "types.h"
+#include "adawft.h"
+#include "bytes.h"
+#include "pool.h"
+#include "output.h"
+#include "archive.h"
+#include "strutil.h"
+
+#define OUTPUT_MAX_PIECES 16					// iovecs per write call
+#define OUTPUT_PREALLOCATE_MIN (1024 * 1024)	// smaller files gain nothing from preallocation
+#define OUTPUT_SMALL_FILE (256 * 1024)			// bigger files skip the batch and are written straight away
+#define OUTPUT_BATCH_BYTES (32 * 1024 * 1024)	// most a batch holds, after which files are written straight away
+
+//----------------------------------------------------------------------------
+//  SETTINGS AND STATISTICS
+//----------------------------------------------------------------------------
+
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static OutputStats stats;			// protected by statsLock
+static bool preallocateFiles = false;
+static Archive * archive = NULL;	// set while nothing is being written
+static char archiveRoot[1024];
+static size_t archiveRootLen;
+
+// Reserve space for files of OUTPUT_PREALLOCATE_MIN or more before writing them. Off by default, as
+// where the file system can't do it natively, posix_fallocate writes the whole file an extra time.
+// Set before any output starts.
+void setOutputPreallocate(bool preallocate) {
+	preallocateFiles = preallocate;
+}
+
+static double now(void) {
+#ifndef WINDOWS
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static void recordFile(size_t bytes, double seconds, bool ok) {
+	u64 us = (u64)(seconds * 1e6);
+	int bucket = 0;
+	while(bucket < OUTPUT_HISTOGRAM_BUCKETS - 1 && (us >> bucket) != 0) {
+		bucket++;
+	}
+	pthread_mutex_lock(&statsLock);
+	stats.files++;
+	if(!ok) {
+		stats.failures++;
+	}
+	stats.bytes += bytes;
+	stats.totalSeconds += seconds;
+	if(seconds > stats.maxSeconds) {
+		stats.maxSeconds = seconds;
+	}
+	stats.histogram[bucket]++;
+	pthread_mutex_unlock(&statsLock);
+}
+
+void outputGetStats(OutputStats * s) {
+	pthread_mutex_lock(&statsLock);
+	*s = stats;
+	pthread_mutex_unlock(&statsLock);
+}
+
+// The time within which fraction (0 to 1) of the files were written. Only as exact as the
+// histogram: the answer is the top of a bucket.
+double outputStatsPercentile(const OutputStats * s, double fraction) {
+	if(s->files == 0) {
+		return 0;
+	}
+	size_t seen = 0;
+	for(int i=0; i<OUTPUT_HISTOGRAM_BUCKETS; i++) {
+		seen += s->histogram[i];
+		if((double)seen >= fraction * (double)s->files) {
+			return (double)((u64)1 << i) / 1e6;
+		}
+	}
+	return s->maxSeconds;
+}
+
+//----------------------------------------------------------------------------
+//  ARCHIVE
+//----------------------------------------------------------------------------
+
+// Send files inside root to a, until called again with a NULL. Set before any output starts.
+void setOutputArchive(Archive * a, const char * root) {
+	archive = a;
+	archiveRootLen = 0;
+	if(a != NULL) {
+		snprintf(archiveRoot, sizeof(archiveRoot), "%s", root);
+		archiveRootLen = strlen(archiveRoot);
+	}
+}
+
+bool outputArchiving(void) {
+	return archive != NULL;
+}
+
+// The name of fileName inside the archive, with '/' between folders. Returns false if there's
+// no archive, or the file isn't inside its root.
+static bool inArchive(const char * fileName, char * buf, size_t bufSize) {
+	if(archive == NULL || strncmp(fileName, archiveRoot, archiveRootLen) != 0) {
+		return false;
+	}
+	const char * rest = &fileName[archiveRootLen];
+	if(archiveRootLen > 0 && *rest != DIR_SEPERATOR[0]) {
+		return false;		// a folder that only starts with the same name
+	}
+	while(*rest == DIR_SEPERATOR[0]) {
+		rest++;
+	}
+	if(*rest == '\0' || strlen(rest) >= bufSize) {
+		return false;
+	}
+	size_t i = 0;
+	for(; rest[i]; i++) {
+		buf[i] = (rest[i] == DIR_SEPERATOR[0]) ? '/' : rest[i];
+	}
+	buf[i] = '\0';
+	return true;
+}
+
+//----------------------------------------------------------------------------
+//  SINGLE FILES
+//----------------------------------------------------------------------------
+
+struct _OutFile {
+#ifndef WINDOWS
+	int fd;
+#else
+	FILE * f;
+#endif
+	char * fileName;
+	size_t expected;		// preallocated size, or 0
+	size_t bytes;			// written so far
+	double start;
+	bool removable;			// remove the file if writing it fails
+	char * archiveName;		// going into the archive under this name, or NULL
+	bool memory;			// only collected in buf, see outputOpenMemory
+	u8 * buf;				// for the archive or memory, everything written so far
+	size_t capacity;
+};
+
+static OutFile * allocOutFile(const char * fileName, double start) {
+	OutFile * of = calloc(1, sizeof(OutFile));
+	char * copy = malloc(strlen(fileName) + 1);
+	if(of == NULL || copy == NULL) {
+		dprintf(0, "ERROR: Out of memory\n");
+		free(of);
+		free(copy);
+		return NULL;
+	}
+	strcpy(copy, fileName);
+	of->fileName = copy;
+	of->start = start;
+	of->removable = true;
+	return of;
+}
+
+// Open fileName, or name relative to the open directory dirFd if that's not -1
+static OutFile * openFile(int dirFd, const char * name, const char * fileName, size_t expectedSize) {
+	double start = now();
+	OutFile * of = allocOutFile(fileName, start);
+	if(of == NULL) {
+		recordFile(0, now() - start, false);
+		return NULL;
+	}
+
+	// archive entries need their size up front, so they are collected in memory and added on close
+	char entryName[1024];
+	if(inArchive(fileName, entryName, sizeof(entryName))) {
+		of->archiveName = malloc(strlen(entryName) + 1);
+		of->capacity = expectedSize ? expectedSize : 4096;
+		of->buf = malloc(of->capacity);
+		if(of->archiveName == NULL || of->buf == NULL) {
+			dprintf(0, "ERROR: Out of memory\n");
+			free(of->archiveName);
+			free(of->buf);
+			free(of->fileName);
+			free(of);
+			recordFile(0, now() - start, false);
+			return NULL;
+		}
+		strcpy(of->archiveName, entryName);
+		return of;
+	}
+
+#ifndef WINDOWS
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	of->fd = (dirFd >= 0) ? openat(dirFd, name, flags, 0666) : open(fileName, flags, 0666);
+	bool opened = (of->fd >= 0);
+	if(opened && preallocateFiles && expectedSize >= OUTPUT_PREALLOCATE_MIN) {
+		if(posix_fallocate(of->fd, 0, (off_t)expectedSize) == 0) {
+			of->expected = expectedSize;
+		}
+	}
+#else
+	(void)dirFd;
+	(void)name;
+	(void)expectedSize;
+	of->f = fopen(fileName, "wb");
+	bool opened = (of->f != NULL);
+#endif
+
+	if(!opened) {
+		free(of->fileName);
+		free(of);
+		recordFile(0, now() - start, false);
+		return NULL;
+	}
+	return of;
+}
+
+// Open a file to write. expectedSize is a hint, 0 if unknown. Returns NULL on failure.
+OutFile * outputOpen(const char * fileName, size_t expectedSize) {
+	return openFile(-1, NULL, fileName, expectedSize);
+}
+
+#ifndef WINDOWS
+// Write to an already open file descriptor, e.g. a copy of stdout. name is only for messages.
+// outputClose closes fd, but never removes anything.
+OutFile * outputOpenFd(int fd, const char * name) {
+	OutFile * of = allocOutFile(name, now());
+	if(of == NULL) {
+		return NULL;
+	}
+	of->fd = fd;
+	of->removable = false;
+	return of;
+}
+
+// Write to what is now stdout, and point stdout at stderr, so nothing printed afterwards ends up in the file
+OutFile * outputOpenStdout(void) {
+	fflush(stdout);
+	int fd = dup(1);
+	if(fd >= 0 && dup2(2, 1) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	if(fd < 0) {
+		return NULL;
+	}
+	return outputOpenFd(fd, "stdout");
+}
+#else
+OutFile * outputOpenStdout(void) {
+	dprintf(0, "ERROR: Output can't be written to stdout on Windows.\n");
+	return NULL;
+}
+#endif
+
+// Collect everything written in memory instead, for outputCloseToBytes. name is only for messages.
+OutFile * outputOpenMemory(const char * name) {
+	OutFile * of = allocOutFile(name, now());
+	if(of == NULL) {
+		return NULL;
+	}
+	of->capacity = 65536;
+	of->buf = malloc(of->capacity);
+	if(of->buf == NULL) {
+		dprintf(0, "ERROR: Out of memory\n");
+		free(of->fileName);
+		free(of);
+		return NULL;
+	}
+	of->memory = true;
+	of->removable = false;
+	return of;
+}
+
+// Add pieces to an archive entry's or memory file's buffer. Returns 0 on success.
+static int bufferWrite(OutFile * of, const OutPiece * pieces, int count) {
+	for(int i=0; i<count; i++) {
+		if(of->bytes + pieces[i].size > of->capacity) {
+			size_t capacity = of->capacity * 2;
+			while(capacity < of->bytes + pieces[i].size) {
+				capacity *= 2;
+			}
+			u8 * buf = realloc(of->buf, capacity);
+			if(buf == NULL) {
+				dprintf(0, "ERROR: Out of memory\n");
+				return 1;
+			}
+			of->buf = buf;
+			of->capacity = capacity;
+		}
+		if(pieces[i].size > 0) {
+			memcpy(&of->buf[of->bytes], pieces[i].data, pieces[i].size);
+		}
+		of->bytes += pieces[i].size;
+	}
+	return 0;
+}
+
+// Write all the pieces, in order, after anything written before. Returns 0 on success.
+int outputWrite(OutFile * of, const OutPiece * pieces, int count) {
+	if(of->archiveName != NULL || of->memory) {
+		return bufferWrite(of, pieces, count);
+	}
+#ifndef WINDOWS
+	struct iovec iov[OUTPUT_MAX_PIECES];
+	while(count > 0) {
+		int n = (count < OUTPUT_MAX_PIECES) ? count : OUTPUT_MAX_PIECES;
+		for(int i=0; i<n; i++) {
+			iov[i].iov_base = (void *)pieces[i].data;
+			iov[i].iov_len = pieces[i].size;
+		}
+		pieces += n;
+		count -= n;
+
+		struct iovec * v = iov;
+		while(n > 0) {
+			ssize_t written = writev(of->fd, v, n);
+			if(written < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				return 1;
+			}
+			of->bytes += (size_t)written;
+			// step over whatever was written, which may end part way through a piece
+			size_t done = (size_t)written;
+			while(n > 0 && done >= v->iov_len) {
+				done -= v->iov_len;
+				v++;
+				n--;
+			}
+			if(n > 0) {
+				v->iov_base = (u8 *)v->iov_base + done;
+				v->iov_len -= done;
+			}
+		}
+	}
+	return 0;
+#else
+	for(int i=0; i<count; i++) {
+		if(pieces[i].size > 0 && fwrite(pieces[i].data, pieces[i].size, 1, of->f) != 1) {
+			return 1;
+		}
+		of->bytes += pieces[i].size;
+	}
+	return 0;
+#endif
+}
+
+// Close the file. If ok is false, or anything fails now, the file is removed. Returns 0 on success.
+int outputClose(OutFile * of, bool ok) {
+	if(of->archiveName != NULL) {
+		OutPiece piece = { of->buf, of->bytes };
+		ok = ok && archiveAdd(archive, of->archiveName, &piece, 1) == 0;
+		recordFile(of->bytes, now() - of->start, ok);
+		free(of->archiveName);
+		free(of->buf);
+		free(of->fileName);
+		free(of);
+		return ok ? 0 : 1;
+	}
+	if(of->memory) {
+		outputCloseToBytes(of, false);
+		return ok ? 0 : 1;
+	}
+#ifndef WINDOWS
+	if(ok && of->expected > of->bytes && ftruncate(of->fd, (off_t)of->bytes) != 0) {
+		ok = false;		// don't leave preallocated space on the end
+	}
+	if(close(of->fd) != 0) {
+		ok = false;
+	}
+#else
+	if(fclose(of->f) != 0) {
+		ok = false;
+	}
+#endif
+	if(!ok && of->removable) {
+		remove(of->fileName);
+	}
+	recordFile(of->bytes, now() - of->start, ok);
+	free(of->fileName);
+	free(of);
+	return ok ? 0 : 1;
+}
+
+// Close a file opened with outputOpenMemory. Returns everything written to it, or NULL if ok is false.
+// Memory files aren't counted in the statistics.
+Bytes * outputCloseToBytes(OutFile * of, bool ok) {
+	Bytes * b = ok ? newBytesFromMemory(of->buf, of->bytes) : NULL;
+	free(of->buf);
+	free(of->fileName);
+	free(of);
+	return b;
+}
+
+// Write a whole file from pieces. Returns 0 on success; on failure no file is left behind.
+int outputFile(const char * fileName, const OutPiece * pieces, int count) {
+	char entryName[1024];
+	if(inArchive(fileName, entryName, sizeof(entryName))) {
+		// straight into the archive, without collecting it first
+		double start = now();
+		int r = archiveAdd(archive, entryName, pieces, count);
+		size_t total = 0;
+		for(int i=0; i<count; i++) {
+			total += pieces[i].size;
+		}
+		recordFile(total, now() - start, r == 0);
+		return r;
+	}
+	size_t total = 0;
+	for(int i=0; i<count; i++) {
+		total += pieces[i].size;
+	}
+	OutFile * of = outputOpen(fileName, total);
+	if(of == NULL) {
+		return 1;
+	}
+	int r = outputWrite(of, pieces, count);
+	return outputClose(of, r == 0);
+}
+
+// Write everything in f, from the start, as fileName. For output that can only be made through
+// stdio, written to a tmpfile() first. Returns 0 on success.
+int outputFileFromStream(const char * fileName, FILE * f) {
+	if(fflush(f) != 0 || fseek(f, 0, SEEK_END) != 0) {
+		return 1;
+	}
+	long size = ftell(f);
+	if(size < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		return 1;
+	}
+	u8 * data = malloc(size > 0 ? (size_t)size : 1);
+	if(data == NULL) {
+		dprintf(0, "ERROR: Out of memory\n");
+		return 1;
+	}
+	int r = 1;
+	if(fread(data, 1, (size_t)size, f) == (size_t)size) {
+		OutPiece piece = { data, (size_t)size };
+		r = outputFile(fileName, &piece, 1);
+	}
+	free(data);
+	return r;
+}
+
+// Make fileName a hard link to existing, replacing anything already there. Returns 0 on success,
+// or 1 if links aren't possible here, and the file should be written out in full instead.
+int outputLink(const char * existing, const char * fileName) {
+	char existingName[1024];
+	char entryName[1024];
+	if(inArchive(fileName, entryName, sizeof(entryName))) {
+		if(!inArchive(existing, existingName, sizeof(existingName))) {
+			return 1;
+		}
+		return archiveAddLink(archive, entryName, existingName);
+	}
+#ifndef WINDOWS
+	remove(fileName);		// left over from an earlier run
+	return (link(existing, fileName) == 0) ? 0 : 1;
+#else
+	(void)existing;
+	return 1;
+#endif
+}
+
+//----------------------------------------------------------------------------
+//  BATCHES
+//----------------------------------------------------------------------------
+
+typedef struct _BatchEntry {
+	char * fileName;
+	const u8 * data;
+	size_t size;
+	Bytes * owner;			// deleted once written, may be NULL
+	int * result;			// set non-zero if the write fails, may be NULL
+	int dirFd;				// the entry's directory, open during a flush, or -1
+	const char * name;		// fileName relative to dirFd
+	bool failed;
+} BatchEntry;
+
+struct _OutputBatch {
+	pthread_mutex_t lock;	// for everything below
+	BatchEntry * entries;
+	size_t count;
+	size_t capacity;
+	size_t bytes;			// total size of the entries
+};
+
+OutputBatch * newOutputBatch(void) {
+	OutputBatch * ob = calloc(1, sizeof(OutputBatch));
+	if(ob == NULL) {
+		dprintf(0, "ERROR: Out of memory\n");
+		return NULL;
+	}
+	pthread_mutex_init(&ob->lock, NULL);
+	return ob;
+}
+
+// Writes anything still waiting, then frees the batch
+OutputBatch * deleteOutputBatch(OutputBatch * ob) {
+	if(ob != NULL) {
+		outputBatchFlush(ob);
+		pthread_mutex_destroy(&ob->lock);
+		free(ob->entries);
+		free(ob);
+	}
+	return NULL;
+}
+
+// Queue a file to be written by the next flush. data must stay valid until then; if owner isn't
+// NULL, the batch deletes it once the file is written. Files too big to be worth holding, or that
+// don't fit, are written now. If the write fails (now or later) and result isn't NULL, *result is set to 1.
+void outputBatchAdd(OutputBatch * ob, const char * fileName, const u8 * data, size_t size, Bytes * owner, int * result) {
+	char * name = NULL;
+	bool queued = false;
+	if(size <= OUTPUT_SMALL_FILE) {
+		name = malloc(strlen(fileName) + 1);
+	}
+	if(name != NULL) {
+		strcpy(name, fileName);
+		pthread_mutex_lock(&ob->lock);
+		if(ob->count == ob->capacity && ob->bytes + size <= OUTPUT_BATCH_BYTES) {
+			size_t capacity = ob->capacity ? ob->capacity * 2 : 64;
+			BatchEntry * entries = realloc(ob->entries, capacity * sizeof(BatchEntry));
+			if(entries != NULL) {
+				ob->entries = entries;
+				ob->capacity = capacity;
+			}
+		}
+		if(ob->count < ob->capacity && ob->bytes + size <= OUTPUT_BATCH_BYTES) {
+			ob->entries[ob->count++] = (BatchEntry){ name, data, size, owner, result, -1, name, false };
+			ob->bytes += size;
+			queued = true;
+		}
+		pthread_mutex_unlock(&ob->lock);
+	}
+	if(queued) {
+		return;
+	}
+
+	free(name);
+	OutPiece piece = { data, size };
+	if(outputFile(fileName, &piece, 1) != 0) {
+		dprintf(0, "ERROR: Failed to write %s\n", fileName);
+		if(result != NULL) {
+			*result = 1;
+		}
+	}
+	deleteBytes(owner);
+}
+
+static void flushEntryTask(void * ctx, size_t idx) {
+	BatchEntry * e = &((BatchEntry *)ctx)[idx];
+	OutPiece piece = { e->data, e->size };
+	OutFile * of = openFile(e->dirFd, e->name, e->fileName, e->size);
+	e->failed = (of == NULL || outputClose(of, outputWrite(of, &piece, 1) == 0) != 0);
+}
+
+// Write every queued file, in parallel. Returns the number that failed.
+size_t outputBatchFlush(OutputBatch * ob) {
+	pthread_mutex_lock(&ob->lock);
+	BatchEntry * entries = ob->entries;
+	size_t count = ob->count;
+	ob->entries = NULL;
+	ob->count = 0;
+	ob->capacity = 0;
+	ob->bytes = 0;
+	pthread_mutex_unlock(&ob->lock);
+	if(count == 0) {
+		free(entries);
+		return 0;
+	}
+
+#ifndef WINDOWS
+	// open each directory once. A face's files are nearly always all in one. There are
+	// no directories to open for files going into an archive.
+	typedef struct _BatchDir {
+		char * name;
+		int fd;
+	} BatchDir;
+	BatchDir * dirs = (archive == NULL) ? malloc(count * sizeof(BatchDir)) : NULL;
+	size_t dirCount = 0;
+	for(size_t i=0; i<count && dirs != NULL; i++) {
+		BatchEntry * e = &entries[i];
+		const char * slash = strrchr(e->fileName, DIR_SEPERATOR[0]);
+		if(slash == NULL || slash == e->fileName) {
+			continue;		// no directory to open, or the root: use the whole name
+		}
+		size_t len = (size_t)(slash - e->fileName);
+		size_t d = 0;
+		while(d < dirCount && !(strlen(dirs[d].name) == len && memcmp(dirs[d].name, e->fileName, len) == 0)) {
+			d++;
+		}
+		if(d == dirCount) {
+			char * dirName = malloc(len + 1);
+			if(dirName == NULL) {
+				continue;
+			}
+			memcpy(dirName, e->fileName, len);
+			dirName[len] = '\0';
+			dirs[dirCount].name = dirName;
+			dirs[dirCount].fd = open(dirName, O_RDONLY | O_DIRECTORY);
+			dirCount++;
+		}
+		if(dirs[d].fd >= 0) {
+			e->dirFd = dirs[d].fd;
+			e->name = slash + 1;
+		}
+	}
+#endif
+
+	poolFor(defaultPool(), count, flushEntryTask, entries);
+
+#ifndef WINDOWS
+	for(size_t d=0; d<dirCount; d++) {
+		if(dirs[d].fd >= 0) {
+			close(dirs[d].fd);
+		}
+		free(dirs[d].name);
+	}
+	free(dirs);
+#endif
+
+	size_t failures = 0;
+	for(size_t i=0; i<count; i++) {
+		BatchEntry * e = &entries[i];
+		if(e->failed) {
+			dprintf(0, "ERROR: Failed to write %s\n", e->fileName);
+			if(e->result != NULL) {
+				*e->result = 1;
+			}
+			failures++;
+		}
+		deleteBytes(e->owner);
+		free(e->fileName);
+	}
+	free(entries);
+	return failures;
+}
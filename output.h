@@ -0,0 +1,63 @@
+// output.h
+// write whole files with as few system calls as possible, and time every file written
+
+//----------------------------------------------------------------------------
+//  EXPORTED TYPES
+//----------------------------------------------------------------------------
+
+// One buffer of a file's contents. A file is written from several pieces in one go.
+typedef struct _OutPiece {
+	const void * data;
+	size_t size;
+} OutPiece;
+
+// A file open for writing. Everything is timed from outputOpen to outputClose.
+typedef struct _OutFile OutFile;
+
+// A tar stream, see archive.h
+typedef struct _Archive Archive;
+
+// Files waiting to be written together. Safe to add to from several threads at once.
+typedef struct _OutputBatch OutputBatch;
+
+#define OUTPUT_HISTOGRAM_BUCKETS 32
+
+typedef struct _OutputStats {
+	size_t files;						// files written, or that failed
+	size_t failures;
+	u64 bytes;
+	double totalSeconds;				// sum of the time spent on each file
+	double maxSeconds;
+	size_t histogram[OUTPUT_HISTOGRAM_BUCKETS];		// bucket i: files that took under 2^i microseconds
+} OutputStats;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+// Single files
+OutFile * outputOpen(const char * fileName, size_t expectedSize);
+int outputWrite(OutFile * of, const OutPiece * pieces, int count);
+int outputClose(OutFile * of, bool ok);
+OutFile * outputOpenMemory(const char * name);
+Bytes * outputCloseToBytes(OutFile * of, bool ok);
+int outputFile(const char * fileName, const OutPiece * pieces, int count);
+int outputFileFromStream(const char * fileName, FILE * f);
+int outputLink(const char * existing, const char * fileName);
+#ifndef WINDOWS
+OutFile * outputOpenFd(int fd, const char * name);
+#endif
+OutFile * outputOpenStdout(void);
+
+// Batches of small files
+OutputBatch * newOutputBatch(void);
+OutputBatch * deleteOutputBatch(OutputBatch * ob);
+void outputBatchAdd(OutputBatch * ob, const char * fileName, const u8 * data, size_t size, Bytes * owner, int * result);
+size_t outputBatchFlush(OutputBatch * ob);
+
+// Settings and statistics, for the whole process
+void setOutputPreallocate(bool preallocate);
+void setOutputArchive(Archive * a, const char * root);
+bool outputArchiving(void);
+void outputGetStats(OutputStats * s);
+double outputStatsPercentile(const OutputStats * s, double fraction);
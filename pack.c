@@ -0,0 +1,586 @@
+/*  pack.c - build a binary face from watchface.json and its images
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	The reverse of --dump. The JSON is walked once, writing every header into a growing
+	buffer and noting where each image's offset field is. The images are then loaded and
+	compressed in parallel, laid out after the headers in the same order, and the offsets
+	patched in. Identical images (the same digits in several sets, repeated bar frames) are
+	only stored once.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>			// for offsetof()
+
+#include "types.h"
+#include "face_new.h"
+#include "adawft.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "pool.h"
+#include "rle.h"
+#include "face.h"
+#include "hash.h"
+#include "pack.h"
+#include "strutil.h"
+#include "cjson/cJSON.h"
+
+//----------------------------------------------------------------------------
+//  PACK CONTEXT
+//----------------------------------------------------------------------------
+
+// One image to be loaded and placed after the headers
+typedef struct _PackImage {
+	const char * fileName;	// from the JSON, relative to the folder
+	u16 width;
+	u16 height;
+	size_t fixup;			// where its u32 offset goes in the headers
+	Bytes * rle;			// RLE_NEW data, or NULL for an empty image
+	int error;
+	size_t same;			// the first image with identical data (itself if none)
+	u32 offset;				// where its data is in the output
+} PackImage;
+
+typedef struct _PackCtx {
+	const char * folderName;
+	RleMode mode;
+	u8 * headers;			// everything before the first image
+	size_t headersSize;
+	size_t headersCap;
+	PackImage * images;
+	size_t imageCount;
+	size_t imageCap;
+	int errors;				// problems found while walking the JSON
+} PackCtx;
+
+// Append count bytes to the headers. Returns where they were put.
+static size_t appendHeader(PackCtx * c, const void * src, size_t count) {
+	if(c->headersSize + count > c->headersCap) {
+		size_t cap = c->headersCap ? c->headersCap * 2 : 1024;
+		while(cap < c->headersSize + count) {
+			cap *= 2;
+		}
+		u8 * h = realloc(c->headers, cap);
+		if(h == NULL) {
+			dprintf(0, "ERROR: Out of memory\n");
+			c->errors++;
+			return c->headersSize;
+		}
+		c->headers = h;
+		c->headersCap = cap;
+	}
+	size_t pos = c->headersSize;
+	memcpy(&c->headers[pos], src, count);
+	c->headersSize += count;
+	return pos;
+}
+
+//----------------------------------------------------------------------------
+//  JSON HELPERS
+//----------------------------------------------------------------------------
+
+static int jsonInt(const cJSON * obj, const char * key, int def) {
+	const cJSON * item = cJSON_GetObjectItemCaseSensitive(obj, key);
+	return cJSON_IsNumber(item) ? item->valueint : def;
+}
+
+// u32 fields don't fit in valueint
+static u32 jsonU32(const cJSON * obj, const char * key) {
+	const cJSON * item = cJSON_GetObjectItemCaseSensitive(obj, key);
+	return (cJSON_IsNumber(item) && item->valuedouble >= 0) ? (u32)item->valuedouble : 0;
+}
+
+// Fill an array of bytes from a JSON int array. Missing entries are 0.
+static void jsonBytes(const cJSON * obj, const char * key, u8 * dst, size_t count) {
+	const cJSON * arr = cJSON_GetObjectItemCaseSensitive(obj, key);
+	for(size_t i=0; i<count; i++) {
+		const cJSON * item = cJSON_GetArrayItem(arr, (int)i);
+		dst[i] = cJSON_IsNumber(item) ? (u8)item->valueint : 0;
+	}
+}
+
+// Read the JSON xys array: [ { "x", "y" }, ... ]
+static void jsonXYs(const cJSON * obj, XY * xy, size_t count) {
+	const cJSON * arr = cJSON_GetObjectItemCaseSensitive(obj, "xys");
+	for(size_t i=0; i<count; i++) {
+		const cJSON * item = cJSON_GetArrayItem(arr, (int)i);
+		xy[i].x = (u16)jsonInt(item, "x", 0);
+		xy[i].y = (u16)jsonInt(item, "y", 0);
+	}
+}
+
+static u8 elementTypeFromStr(const char * s, bool * found) {
+	for(int t=0; t<256; t++) {
+		if(s != NULL && strcmp(elementTypeStr((u8)t), s) == 0) {
+			*found = true;
+			return (u8)t;
+		}
+	}
+	*found = false;
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//  HEADERS - one walk over the JSON, writing headers and listing images
+//----------------------------------------------------------------------------
+
+// Note an image from a JSON { "w", "h", "file_name" }. Every image header has u32 offset, u16 width,
+// u16 height in a row: that is at fixup in the headers, and is filled in once the layout is known.
+static void addImage(PackCtx * c, const cJSON * imgData, size_t fixup) {
+	if(c->imageCount == c->imageCap) {
+		size_t cap = c->imageCap ? c->imageCap * 2 : 64;
+		PackImage * imgs = realloc(c->images, cap * sizeof(PackImage));
+		if(imgs == NULL) {
+			dprintf(0, "ERROR: Out of memory\n");
+			c->errors++;
+			return;
+		}
+		c->images = imgs;
+		c->imageCap = cap;
+	}
+	PackImage * img = &c->images[c->imageCount++];
+	int w = jsonInt(imgData, "w", 0);
+	int h = jsonInt(imgData, "h", 0);
+	img->fileName = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(imgData, "file_name"));
+	img->width = (u16)w;
+	img->height = (u16)h;
+	img->fixup = fixup;
+	img->rle = NULL;
+	img->error = 0;
+	if(w < 0 || w > 0xFFFF || h < 0 || h > 0xFFFF || (w != 0 && h != 0 && img->fileName == NULL)) {
+		dprintf(0, "ERROR: Bad img_data in watchface.json (%d x %d, %s)\n", w, h, img->fileName ? img->fileName : "no file_name");
+		c->errors++;
+	}
+}
+
+// Images in a JSON img_data array, for an array of OffsetWidthHeight at owhPos in the headers
+static void addImages(PackCtx * c, const cJSON * arr, size_t owhPos, size_t count) {
+	for(size_t i=0; i<count; i++) {
+		const cJSON * item = cJSON_GetArrayItem(arr, (int)i);
+		if(item == NULL) {
+			dprintf(0, "ERROR: img_data has %d entries, %zu are needed\n", cJSON_GetArraySize(arr), count);
+			c->errors++;
+			return;
+		}
+		addImage(c, item, owhPos + i * sizeof(OffsetWidthHeight));
+	}
+}
+
+// Write one element header. Where it will land is known before it is written, so fixups can be noted first.
+static void packElement(PackCtx * c, const cJSON * e) {
+	const char * typeStr = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(e, "e_type"));
+	bool found;
+	u8 eType = elementTypeFromStr(typeStr, &found);
+	if(!found) {
+		dprintf(0, "ERROR: Unknown e_type in watchface.json: %s\n", typeStr ? typeStr : "(none)");
+		c->errors++;
+		return;
+	}
+	const cJSON * imgData = cJSON_GetObjectItemCaseSensitive(e, "img_data");
+	size_t pos = c->headersSize;
+	u16 x = (u16)jsonInt(e, "x", 0);
+	u16 y = (u16)jsonInt(e, "y", 0);
+
+	switch(eType) {
+		case ET_IMAGE: {
+			ImageHeader h = { 1, eType, { x, y }, 0, 0, 0 };
+			addImage(c, imgData, pos + offsetof(ImageHeader, offset));
+			appendHeader(c, &h, sizeof(h));
+			break;
+		}
+		case ET_TIME: {
+			TimeHeader h;
+			memset(&h, 0, sizeof(h));
+			h.one = 1;
+			h.e_type = eType;
+			jsonBytes(e, "digit_sets", h.digitSet, 4);
+			jsonXYs(e, h.xy, 4);
+			jsonBytes(e, "unknown", h.unknown, sizeof(h.unknown));
+			appendHeader(c, &h, sizeof(h));
+			break;
+		}
+		case ET_DAYNAME: {
+			DayNameHeader h;
+			memset(&h, 0, sizeof(h));
+			h.one = 1;
+			h.e_type = eType;
+			h.subtype = (u8)jsonInt(e, "subtype", 0);
+			h.xy.x = x;
+			h.xy.y = y;
+			addImages(c, imgData, pos + offsetof(DayNameHeader, owh), 7);
+			appendHeader(c, &h, sizeof(h));
+			break;
+		}
+		case ET_BATTERYFILL: {
+			BatteryFillHeader h;
+			memset(&h, 0, sizeof(h));
+			h.one = 1;
+			h.e_type = eType;
+			h.xy.x = x;
+			h.xy.y = y;
+			h.x1 = (u8)jsonInt(e, "x1", 0);
+			h.y1 = (u8)jsonInt(e, "y1", 0);
+			h.x2 = (u8)jsonInt(e, "x2", 0);
+			h.y2 = (u8)jsonInt(e, "y2", 0);
+			h.unknown = jsonU32(e, "unknown");
+			h.unknown2 = jsonU32(e, "unknown2");
+			// the three images are not contiguous in the header
+			const size_t owhPos[3] = { offsetof(BatteryFillHeader, owh), offsetof(BatteryFillHeader, owh1), offsetof(BatteryFillHeader, owh2) };
+			for(int i=0; i<3; i++) {
+				const cJSON * item = cJSON_GetArrayItem(imgData, i);
+				if(item == NULL) {
+					dprintf(0, "ERROR: battery_fill needs 3 images\n");
+					c->errors++;
+					break;
+				}
+				addImage(c, item, pos + owhPos[i]);
+			}
+			appendHeader(c, &h, sizeof(h));
+			break;
+		}
+		case ET_HEARTRATENUM:
+		case ET_STEPSNUM:
+		case ET_KCALNUM: {
+			// these three share a layout up to the xy, then differ in how many unknown bytes follow
+			u8 h[sizeof(HeartRateNumHeader)];
+			size_t size = (eType == ET_KCALNUM) ? sizeof(KCalNumHeader) : sizeof(HeartRateNumHeader);
+			memset(h, 0, sizeof(h));
+			h[0] = 1;
+			h[1] = eType;
+			h[2] = (u8)jsonInt(e, "digit_set", 0);
+			h[3] = (u8)jsonInt(e, "justification", 0);
+			set_u16(&h[4], x);
+			set_u16(&h[6], y);
+			jsonBytes(e, "unknown", &h[8], size - 8);
+			appendHeader(c, h, size);
+			break;
+		}
+		case ET_HANDS: {
+			HandsHeader h;
+			memset(&h, 0, sizeof(h));
+			h.one = 1;
+			h.e_type = eType;
+			h.subtype = (u8)jsonInt(e, "subtype", 0);
+			h.unknownXY.x = (u16)jsonInt(e, "unknown_x", 0);
+			h.unknownXY.y = (u16)jsonInt(e, "unknown_y", 0);
+			h.x = x;
+			h.y = y;
+			addImage(c, imgData, pos + offsetof(HandsHeader, offset));
+			appendHeader(c, &h, sizeof(h));
+			break;
+		}
+		case ET_DAYNUM:
+		case ET_MONTHNUM: {
+			DayNumHeader h;
+			memset(&h, 0, sizeof(h));
+			h.one = 1;
+			h.e_type = eType;
+			h.digitSet = (u8)jsonInt(e, "digit_set", 0);
+			h.justification = (u8)jsonInt(e, "justification", 0);
+			jsonXYs(e, h.xy, 2);
+			appendHeader(c, &h, sizeof(h));
+			break;
+		}
+		case ET_BARDISPLAY: {
+			// variable length: count OffsetWidthHeight entries
+			int count = cJSON_GetArraySize(imgData);
+			if(count > 255) {
+				dprintf(0, "ERROR: bar_display has %d images, at most 255 are allowed\n", count);
+				c->errors++;
+				count = 255;
+			}
+			size_t size = sizeof(BarDisplayHeader) + sizeof(OffsetWidthHeight) * count - sizeof(OffsetWidthHeight);
+			BarDisplayHeader * h = calloc(1, sizeof(BarDisplayHeader) + sizeof(OffsetWidthHeight) * count);
+			if(h == NULL) {
+				dprintf(0, "ERROR: Out of memory\n");
+				c->errors++;
+				break;
+			}
+			h->one = 1;
+			h->e_type = eType;
+			h->subtype = (u8)jsonInt(e, "subtype", 0);
+			h->count = (u8)count;
+			h->xy.x = x;
+			h->xy.y = y;
+			addImages(c, imgData, pos + offsetof(BarDisplayHeader, owh), count);
+			appendHeader(c, h, size);
+			free(h);
+			break;
+		}
+		case ET_WEATHER: {
+			WeatherHeader h;
+			memset(&h, 0, sizeof(h));
+			h.one = 1;
+			h.e_type = eType;
+			h.count = (u8)jsonInt(e, "count", cJSON_GetArraySize(imgData));
+			h.xy.x = x;
+			h.xy.y = y;
+			addImages(c, imgData, pos + offsetof(WeatherHeader, owh), h.count < 9 ? h.count : 9);
+			appendHeader(c, &h, sizeof(h));
+			break;
+		}
+		case ET_UNKNOWN1D: {
+			Unknown1D01 h = { 1, eType, (u8)jsonInt(e, "unknown", 0) };
+			appendHeader(c, &h, sizeof(h));
+			break;
+		}
+		case ET_DASH: {
+			DashHeader h;
+			memset(&h, 0, sizeof(h));
+			h.one = 1;
+			h.e_type = eType;
+			addImage(c, imgData, pos + offsetof(DashHeader, owh));
+			appendHeader(c, &h, sizeof(h));
+			break;
+		}
+	}
+}
+
+// FaceHeaderN, the digits, then the elements and their terminator
+static void packHeaders(PackCtx * c, const cJSON * root) {
+	const cJSON * digits = cJSON_GetObjectItemCaseSensitive(root, "digits");
+	const cJSON * elements = cJSON_GetObjectItemCaseSensitive(root, "elements");
+	int digitsCount = cJSON_GetArraySize(digits);
+
+	FaceHeaderN fh;
+	memset(&fh, 0, sizeof(fh));
+	fh.apiVer = (u16)jsonInt(root, "api_ver", 0);
+	fh.unknown = (u16)jsonInt(root, "unknown", 0xFFFF);
+	fh.dhOffset = digitsCount > 0 ? sizeof(FaceHeaderN) : 0;
+	addImage(c, cJSON_GetObjectItemCaseSensitive(root, "preview_img_data"), offsetof(FaceHeaderN, previewOffset));
+	appendHeader(c, &fh, sizeof(fh));
+
+	if(digitsCount > 0) {
+		u8 marker[2] = { 0x01, 0x01 };
+		appendHeader(c, marker, sizeof(marker));
+	}
+	for(int d=0; d<digitsCount; d++) {
+		const cJSON * dj = cJSON_GetArrayItem(digits, d);
+		DigitsHeader dh;
+		memset(&dh, 0, sizeof(dh));
+		dh.digitSet = (u8)jsonInt(dj, "digit_set", d);
+		dh.unknown = (u16)jsonInt(dj, "unknown", 0);
+		addImages(c, cJSON_GetObjectItemCaseSensitive(dj, "img_data"), c->headersSize + offsetof(DigitsHeader, owh), 10);
+		appendHeader(c, &dh, sizeof(dh));
+	}
+
+	// the elements start where the digits end
+	if(c->headersSize > 0xFFFF) {
+		dprintf(0, "ERROR: Too many digit sets (%d)\n", digitsCount);
+		c->errors++;
+	}
+	set_u16(&c->headers[offsetof(FaceHeaderN, bhOffset)], (u16)c->headersSize);
+
+	for(int n=0; n<cJSON_GetArraySize(elements); n++) {
+		packElement(c, cJSON_GetArrayItem(elements, n));
+	}
+	u8 end[2] = { 0, 0 };
+	appendHeader(c, end, sizeof(end));
+}
+
+//----------------------------------------------------------------------------
+//  IMAGES - loaded and compressed in parallel
+//----------------------------------------------------------------------------
+
+static bool hasExtension(const char * fileName, const char * ext) {
+	size_t n = strlen(fileName);
+	size_t e = strlen(ext);
+	return n > e && fileName[n-e-1] == '.' && strcmp(&fileName[n-e], ext) == 0;
+}
+
+// .bin is used as it is, .raw is ARGB8565, and .bmp or .qoi is anything newImgFromFile reads
+static int loadImage(const PackCtx * c, PackImage * img) {
+	if(img->width == 0 || img->height == 0) {
+		return 0;
+	}
+	char path[1024];
+	int len = snprintf(path, sizeof(path), "%s%s%s", c->folderName, DIR_SEPERATOR, img->fileName);
+	if(len < 0 || (size_t)len >= sizeof(path)) {
+		dprintf(0, "ERROR: Path too long for %s\n", img->fileName);
+		return 1;
+	}
+	u32 w = img->width;
+	u32 h = img->height;
+
+	if(hasExtension(path, "bin")) {
+		Bytes * b = newBytesFromFile(path);
+		if(b == NULL) {
+			dprintf(0, "ERROR: Failed to read %s\n", path);
+			return 1;
+		}
+		if(!rleNewFits(b->data, b->size, h)) {
+			dprintf(0, "ERROR: %s is not a %u row RLE_NEW image\n", path, h);
+			deleteBytes(b);
+			return 1;
+		}
+		b->size = rleNewImageSize(b->data, h);
+		img->rle = b;
+		return 0;
+	}
+
+	if(hasExtension(path, "raw")) {
+		Bytes * b = newBytesFromFile(path);
+		if(b == NULL) {
+			dprintf(0, "ERROR: Failed to read %s\n", path);
+			return 1;
+		}
+		if(b->size != (size_t)w * h * 3) {
+			dprintf(0, "ERROR: %s is %zu bytes, %u x %u ARGB8565 is %zu\n", path, b->size, w, h, (size_t)w * h * 3);
+			deleteBytes(b);
+			return 1;
+		}
+		img->rle = rleNewEncode(b->data, w, h, c->mode);
+		deleteBytes(b);
+		return (img->rle == NULL) ? 1 : 0;
+	}
+
+	if(hasExtension(path, "bmp") || hasExtension(path, "qoi")) {
+		Img * i = newImgFromFile(path);
+		if(i == NULL) {
+			dprintf(0, "ERROR: Failed to read %s\n", path);
+			return 1;
+		}
+		if(i->w != w || i->h != h) {
+			dprintf(0, "ERROR: %s is %u x %u, watchface.json says %u x %u\n", path, i->w, i->h, w, h);
+			deleteImg(i);
+			return 1;
+		}
+		if(i->format != IF_ARGB8565) {
+			i = convertImg(i, IF_ARGB8565);
+			if(i == NULL) {
+				return 1;
+			}
+		}
+		img->rle = rleNewEncode(i->data, w, h, c->mode);
+		deleteImg(i);
+		return (img->rle == NULL) ? 1 : 0;
+	}
+
+	dprintf(0, "ERROR: Don't know how to pack %s (use .bmp, .qoi, .raw or .bin)\n", path);
+	return 1;
+}
+
+static void loadImageTask(void * ctx, size_t idx) {
+	PackCtx * c = ctx;
+	c->images[idx].error = loadImage(c, &c->images[idx]);
+}
+
+//----------------------------------------------------------------------------
+//  PACKFACE
+//----------------------------------------------------------------------------
+
+// Read folderName/watchface.json and the images it names, and build a binary face.
+// Returns NULL if anything is missing or won't fit.
+Bytes * packFace(const char * folderName, RleMode mode) {
+	char path[1024];
+	int len = snprintf(path, sizeof(path), "%s%swatchface.json", folderName, DIR_SEPERATOR);
+	if(len < 0 || (size_t)len >= sizeof(path)) {
+		dprintf(0, "ERROR: Path too long for %s\n", folderName);
+		return NULL;
+	}
+	Bytes * text = newBytesFromFile(path);
+	if(text == NULL) {
+		dprintf(0, "ERROR: Failed to read %s\n", path);
+		return NULL;
+	}
+	// cJSON wants a terminated string
+	char * str = malloc(text->size + 1);
+	if(str == NULL) {
+		dprintf(0, "ERROR: Out of memory\n");
+		deleteBytes(text);
+		return NULL;
+	}
+	memcpy(str, text->data, text->size);
+	str[text->size] = '\0';
+	deleteBytes(text);
+	cJSON * root = cJSON_Parse(str);
+	free(str);
+	if(!cJSON_IsObject(root)) {
+		dprintf(0, "ERROR: Failed to parse %s\n", path);
+		cJSON_Delete(root);
+		return NULL;
+	}
+
+	PackCtx c;
+	memset(&c, 0, sizeof(c));
+	c.folderName = folderName;
+	c.mode = mode;
+	packHeaders(&c, root);
+
+	// load and compress every image at once, then lay them out in header order.
+	// Identical images are stored once, and share an offset.
+	Bytes * out = NULL;
+	HashStore * hs = NULL;
+	size_t shared = 0;
+	if(c.errors == 0) {
+		poolFor(defaultPool(), c.imageCount, loadImageTask, &c);
+		hs = newHashStore();
+		size_t total = c.headersSize;
+		for(size_t i=0; i<c.imageCount; i++) {
+			PackImage * img = &c.images[i];
+			c.errors += img->error;
+			img->same = i;
+			if(img->rle == NULL) {
+				continue;
+			}
+			if(hs != NULL) {
+				img->same = hashStoreAdd(hs, img->rle->data, img->rle->size, img->width | ((u64)img->height << 16), i);
+			}
+			if(img->same == i) {
+				total += img->rle->size;
+			} else {
+				shared++;
+			}
+		}
+		if(total > 0xFFFFFFFF) {
+			dprintf(0, "ERROR: Face too large (%zu bytes)\n", total);
+			c.errors++;
+		}
+		if(c.errors == 0) {
+			out = newBytes(total);
+			if(out == NULL) {
+				dprintf(0, "ERROR: Out of memory\n");
+			}
+		}
+	}
+	if(out != NULL) {
+		size_t pos = c.headersSize;
+		for(size_t i=0; i<c.imageCount; i++) {
+			PackImage * img = &c.images[i];
+			if(img->same != i) {
+				img->offset = c.images[img->same].offset;
+			} else {
+				img->offset = (u32)pos;
+				if(img->rle) {
+					memcpy(&out->data[pos], img->rle->data, img->rle->size);
+					pos += img->rle->size;
+				}
+			}
+			set_u32(&c.headers[img->fixup], img->offset);
+			set_u16(&c.headers[img->fixup + 4], img->width);
+			set_u16(&c.headers[img->fixup + 6], img->height);
+		}
+		memcpy(out->data, c.headers, c.headersSize);
+		dprintf(1, "Packed %zu images (%zu shared), %zu bytes.\n", c.imageCount, shared, out->size);
+	} else {
+		dprintf(0, "ERROR: %d problem(s) packing %s\n", c.errors, folderName);
+	}
+
+	deleteHashStore(hs);
+	for(size_t i=0; i<c.imageCount; i++) {
+		deleteBytes(c.images[i].rle);
+	}
+	free(c.images);
+	free(c.headers);
+	cJSON_Delete(root);
+	return out;
+}
@@ -0,0 +1,8 @@
+// pack.h
+// build a binary face from watchface.json and the image files it names
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+Bytes * packFace(const char * folderName, RleMode mode);
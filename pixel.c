@@ -0,0 +1,435 @@
+/*  pixel.c - pixel format conversion kernels
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "pixel.h"
+
+// SIMD kernels are only built for x86 with gcc or clang, everything else uses the scalar kernels
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_X86
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+//----------------------------------------------------------------------------
+//  KERNEL SELECTION
+//----------------------------------------------------------------------------
+
+static PixelIsa forcedIsa = PIXEL_ISA_AUTO;
+
+// Force a particular instruction set (e.g. for benchmarking). Falls back if the CPU doesn't support it.
+void setPixelIsa(PixelIsa isa) {
+	forcedIsa = isa;
+}
+
+// Best instruction set supported by this CPU
+static PixelIsa cpuIsa(void) {
+#ifdef PIXEL_X86
+	if(__builtin_cpu_supports("avx2")) {
+		return PIXEL_ISA_AVX2;
+	}
+	if(__builtin_cpu_supports("sse2")) {
+		return PIXEL_ISA_SSE2;
+	}
+#endif
+	return PIXEL_ISA_SCALAR;
+}
+
+// Instruction set the kernels will actually use
+PixelIsa pixelIsa(void) {
+	PixelIsa best = cpuIsa();
+	if(forcedIsa != PIXEL_ISA_AUTO && forcedIsa < best) {
+		return forcedIsa;
+	}
+	return best;
+}
+
+const char * pixelIsaStr(PixelIsa isa) {
+	switch(isa) {
+		case PIXEL_ISA_AUTO: return "auto";
+		case PIXEL_ISA_SCALAR: return "scalar";
+		case PIXEL_ISA_SSE2: return "sse2";
+		case PIXEL_ISA_AVX2: return "avx2";
+	}
+	return "err";
+}
+
+//----------------------------------------------------------------------------
+//  ARGB8565 TO ARGB8888
+//----------------------------------------------------------------------------
+
+// ARGB8565 is stored as alpha, then RGB565 high byte, then low byte.
+// Each channel is widened by replicating its top bits into the new low bits. Blue only gets its top
+// 2 bits replicated (not 3); this matches the output adawft has always produced, so keep it.
+
+static inline u32 pixel8565to8888(const u8 * p) {
+	u32 a = p[0];
+	u32 v = ((u32)p[1] << 8) | p[2];
+	u32 r5 = v >> 11;
+	u32 g6 = (v >> 5) & 0x3F;
+	u32 b5 = v & 0x1F;
+	u32 r = (r5 << 3) | (r5 >> 2);
+	u32 g = (g6 << 2) | (g6 >> 4);
+	u32 b = (b5 << 3) | (b5 >> 3);
+	return b | (g << 8) | (r << 16) | (a << 24);
+}
+
+static void argb8565to8888Scalar(u8 * dst, const u8 * src, size_t count) {
+	for(size_t i=0; i<count; i++) {
+		u32 px = pixel8565to8888(&src[i * 3]);
+		memcpy(&dst[i * 4], &px, 4);
+	}
+}
+
+#ifdef PIXEL_X86
+
+// The SIMD kernels work on 32-bit lanes holding (a | hi << 8 | lo << 16 | junk << 24), and do the same
+// arithmetic as pixel8565to8888:
+//   r5 = (w >> 11) & 0x1F      g6 = ((w >> 5) & 0x38) | ((w >> 21) & 0x07)      b5 = (w >> 16) & 0x1F
+
+TARGET_SSE2 static inline __m128i expand4SSE2(__m128i w) {
+	const __m128i m1F = _mm_set1_epi32(0x1F);
+	const __m128i m07 = _mm_set1_epi32(0x07);
+	const __m128i m38 = _mm_set1_epi32(0x38);
+	const __m128i mFF = _mm_set1_epi32(0xFF);
+	__m128i a  = _mm_and_si128(w, mFF);
+	__m128i r5 = _mm_and_si128(_mm_srli_epi32(w, 11), m1F);
+	__m128i g6 = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(w, 5), m38), _mm_and_si128(_mm_srli_epi32(w, 21), m07));
+	__m128i b5 = _mm_and_si128(_mm_srli_epi32(w, 16), m1F);
+	__m128i r  = _mm_or_si128(_mm_slli_epi32(r5, 3), _mm_srli_epi32(r5, 2));
+	__m128i g  = _mm_or_si128(_mm_slli_epi32(g6, 2), _mm_srli_epi32(g6, 4));
+	__m128i b  = _mm_or_si128(_mm_slli_epi32(b5, 3), _mm_srli_epi32(b5, 3));
+	return _mm_or_si128(_mm_or_si128(b, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(r, 16), _mm_slli_epi32(a, 24)));
+}
+
+// Spread 4 packed 3-byte pixels (from a 16 byte load) out to 4 32-bit lanes
+TARGET_SSE2 static inline __m128i spread4SSE2(__m128i v) {
+	__m128i lo = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+	__m128i hi = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+	return _mm_unpacklo_epi64(lo, hi);
+}
+
+TARGET_SSE2 static void argb8565to8888SSE2(u8 * dst, const u8 * src, size_t count) {
+	size_t i = 0;
+	// each load reads 16 bytes for 12 bytes of pixels, so stop while there is still slack
+	while(i + 6 <= count) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&src[i * 3]);
+		_mm_storeu_si128((__m128i *)&dst[i * 4], expand4SSE2(spread4SSE2(v)));
+		i += 4;
+	}
+	argb8565to8888Scalar(&dst[i * 4], &src[i * 3], count - i);
+}
+
+TARGET_AVX2 static void argb8565to8888AVX2(u8 * dst, const u8 * src, size_t count) {
+	const __m256i spread = _mm256_setr_epi8(
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m256i m1F = _mm256_set1_epi32(0x1F);
+	const __m256i m07 = _mm256_set1_epi32(0x07);
+	const __m256i m38 = _mm256_set1_epi32(0x38);
+	size_t i = 0;
+	// 8 pixels per step: pixels 0-3 in the low lane, 4-7 in the high lane. The high load reads 4 bytes past the pixels.
+	while(i + 10 <= count) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)&src[i * 3]);
+		__m128i hi = _mm_loadu_si128((const __m128i *)&src[i * 3 + 12]);
+		__m256i w = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), spread);
+		__m256i a  = _mm256_slli_epi32(w, 24);
+		__m256i r5 = _mm256_and_si256(_mm256_srli_epi32(w, 11), m1F);
+		__m256i g6 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(w, 5), m38), _mm256_and_si256(_mm256_srli_epi32(w, 21), m07));
+		__m256i b5 = _mm256_and_si256(_mm256_srli_epi32(w, 16), m1F);
+		__m256i r  = _mm256_or_si256(_mm256_slli_epi32(r5, 3), _mm256_srli_epi32(r5, 2));
+		__m256i g  = _mm256_or_si256(_mm256_slli_epi32(g6, 2), _mm256_srli_epi32(g6, 4));
+		__m256i b  = _mm256_or_si256(_mm256_slli_epi32(b5, 3), _mm256_srli_epi32(b5, 3));
+		__m256i out = _mm256_or_si256(_mm256_or_si256(b, _mm256_slli_epi32(g, 8)), _mm256_or_si256(_mm256_slli_epi32(r, 16), a));
+		_mm256_storeu_si256((__m256i *)&dst[i * 4], out);
+		i += 8;
+	}
+	argb8565to8888SSE2(&dst[i * 4], &src[i * 3], count - i);
+}
+
+#endif
+
+void argb8565to8888(u8 * dst, const u8 * src, size_t count) {
+#ifdef PIXEL_X86
+	switch(pixelIsa()) {
+		case PIXEL_ISA_AVX2:
+			argb8565to8888AVX2(dst, src, count);
+			return;
+		case PIXEL_ISA_SSE2:
+			argb8565to8888SSE2(dst, src, count);
+			return;
+		default:
+			break;
+	}
+#endif
+	argb8565to8888Scalar(dst, src, count);
+}
+
+//----------------------------------------------------------------------------
+//  ALPHA BLENDING
+//----------------------------------------------------------------------------
+
+// Source over destination, per channel: (s * a + d * (255 - a)) / 255, rounded to nearest.
+// Destination alpha is blended the same way with s = 255, so an opaque target stays opaque.
+// div255 is exact for x up to 255 * 255, and is cheap in 16-bit SIMD lanes.
+// Fully transparent source pixels leave the destination alone, and fully opaque ones are copied,
+// so runs of either skip the arithmetic.
+//
+// RGB565 targets are little-endian u16s. They are widened to 8 bits a channel to blend, and
+// truncated back afterwards.
+
+static inline u32 div255(u32 x) {
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+static inline void blendPixel8888(u8 * d, const u8 * s) {
+	u32 a = s[3];
+	if(a == 0) {
+		return;
+	}
+	if(a == 255) {
+		memcpy(d, s, 4);
+		return;
+	}
+	u32 ia = 255 - a;
+	d[0] = (u8)div255(s[0] * a + d[0] * ia);
+	d[1] = (u8)div255(s[1] * a + d[1] * ia);
+	d[2] = (u8)div255(s[2] * a + d[2] * ia);
+	d[3] = (u8)div255(255 * a + d[3] * ia);
+}
+
+static inline u16 pack565(u32 r, u32 g, u32 b) {
+	return (u16)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+static inline void blendPixel565(u8 * d, const u8 * s) {
+	u32 a = s[3];
+	if(a == 0) {
+		return;
+	}
+	u16 out;
+	if(a == 255) {
+		out = pack565(s[2], s[1], s[0]);
+	} else {
+		u32 v = d[0] | ((u32)d[1] << 8);
+		u32 r5 = v >> 11;
+		u32 g6 = (v >> 5) & 0x3F;
+		u32 b5 = v & 0x1F;
+		u32 ia = 255 - a;
+		u32 r = div255(s[2] * a + ((r5 << 3) | (r5 >> 2)) * ia);
+		u32 g = div255(s[1] * a + ((g6 << 2) | (g6 >> 4)) * ia);
+		u32 b = div255(s[0] * a + ((b5 << 3) | (b5 >> 2)) * ia);
+		out = pack565(r, g, b);
+	}
+	d[0] = (u8)(out & 0xFF);
+	d[1] = (u8)(out >> 8);
+}
+
+static void blend8888over8888Scalar(u8 * dst, const u8 * src, size_t count) {
+	for(size_t i=0; i<count; i++) {
+		blendPixel8888(&dst[i * 4], &src[i * 4]);
+	}
+}
+
+static void blend8888over565Scalar(u8 * dst, const u8 * src, size_t count) {
+	for(size_t i=0; i<count; i++) {
+		blendPixel565(&dst[i * 2], &src[i * 4]);
+	}
+}
+
+#ifdef PIXEL_X86
+
+// Blend 2 pixels held as 16-bit lanes (b g r a b g r a). s has its alpha lanes set to 255.
+TARGET_SSE2 static inline __m128i blend2SSE2(__m128i s, __m128i d, __m128i a) {
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i c255 = _mm_set1_epi16(255);
+	__m128i x = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, _mm_sub_epi16(c255, a))), c128);
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+TARGET_SSE2 static void blend8888over8888SSE2(u8 * dst, const u8 * src, size_t count) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+	size_t i = 0;
+	while(i + 4 <= count) {
+		__m128i s = _mm_loadu_si128((const __m128i *)&src[i * 4]);
+		__m128i sa = _mm_and_si128(s, alphaMask);
+		int transparent = _mm_movemask_epi8(_mm_cmpeq_epi32(sa, zero));
+		if(transparent == 0xFFFF) {
+			i += 4;
+			continue;
+		}
+		int opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(sa, alphaMask));
+		if(opaque == 0xFFFF) {
+			_mm_storeu_si128((__m128i *)&dst[i * 4], s);
+			i += 4;
+			continue;
+		}
+		__m128i d = _mm_loadu_si128((const __m128i *)&dst[i * 4]);
+		__m128i sc = _mm_or_si128(s, alphaMask);
+		__m128i slo = _mm_unpacklo_epi8(s, zero);
+		__m128i shi = _mm_unpackhi_epi8(s, zero);
+		__m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xFF), 0xFF);
+		__m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xFF), 0xFF);
+		__m128i lo = blend2SSE2(_mm_unpacklo_epi8(sc, zero), _mm_unpacklo_epi8(d, zero), alo);
+		__m128i hi = blend2SSE2(_mm_unpackhi_epi8(sc, zero), _mm_unpackhi_epi8(d, zero), ahi);
+		_mm_storeu_si128((__m128i *)&dst[i * 4], _mm_packus_epi16(lo, hi));
+		i += 4;
+	}
+	blend8888over8888Scalar(&dst[i * 4], &src[i * 4], count - i);
+}
+
+TARGET_AVX2 static void blend8888over8888AVX2(u8 * dst, const u8 * src, size_t count) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i alphaMask = _mm256_set1_epi32((int)0xFF000000);
+	const __m256i c128 = _mm256_set1_epi16(128);
+	const __m256i c255 = _mm256_set1_epi16(255);
+	// alpha byte of each pixel, copied to all four 16-bit lanes of that pixel
+	const __m256i alphaSpread = _mm256_setr_epi8(
+		3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1,
+		3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+	size_t i = 0;
+	while(i + 8 <= count) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)&src[i * 4]);
+		__m256i sa = _mm256_and_si256(s, alphaMask);
+		u32 transparent = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi32(sa, zero));
+		if(transparent == 0xFFFFFFFF) {
+			i += 8;
+			continue;
+		}
+		u32 opaque = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi32(sa, alphaMask));
+		if(opaque == 0xFFFFFFFF) {
+			_mm256_storeu_si256((__m256i *)&dst[i * 4], s);
+			i += 8;
+			continue;
+		}
+		__m256i d = _mm256_loadu_si256((const __m256i *)&dst[i * 4]);
+		__m256i sc = _mm256_or_si256(s, alphaMask);
+		__m256i parts[2];
+		for(int h=0; h<2; h++) {
+			__m256i sw = h ? _mm256_unpackhi_epi8(sc, zero) : _mm256_unpacklo_epi8(sc, zero);
+			__m256i dw = h ? _mm256_unpackhi_epi8(d, zero) : _mm256_unpacklo_epi8(d, zero);
+			__m256i aw = _mm256_shuffle_epi8(h ? _mm256_srli_si256(s, 8) : s, alphaSpread);
+			__m256i x = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(sw, aw), _mm256_mullo_epi16(dw, _mm256_sub_epi16(c255, aw))), c128);
+			parts[h] = _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+		}
+		_mm256_storeu_si256((__m256i *)&dst[i * 4], _mm256_packus_epi16(parts[0], parts[1]));
+		i += 8;
+	}
+	blend8888over8888SSE2(&dst[i * 4], &src[i * 4], count - i);
+}
+
+// 8 pixels onto RGB565: each channel in its own register of 8 16-bit lanes
+TARGET_SSE2 static void blend8888over565SSE2(u8 * dst, const u8 * src, size_t count) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mFF = _mm_set1_epi32(0xFF);
+	const __m128i m1F = _mm_set1_epi16(0x1F);
+	const __m128i m3F = _mm_set1_epi16(0x3F);
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i c255 = _mm_set1_epi16(255);
+	size_t i = 0;
+	while(i + 8 <= count) {
+		__m128i s0 = _mm_loadu_si128((const __m128i *)&src[i * 4]);
+		__m128i s1 = _mm_loadu_si128((const __m128i *)&src[i * 4 + 16]);
+		__m128i a = _mm_packs_epi32(_mm_srli_epi32(s0, 24), _mm_srli_epi32(s1, 24));
+		int transparent = _mm_movemask_epi8(_mm_cmpeq_epi16(a, zero));
+		if(transparent == 0xFFFF) {
+			i += 8;
+			continue;
+		}
+		__m128i sb = _mm_packs_epi32(_mm_and_si128(s0, mFF), _mm_and_si128(s1, mFF));
+		__m128i sg = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 8), mFF), _mm_and_si128(_mm_srli_epi32(s1, 8), mFF));
+		__m128i sr = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 16), mFF), _mm_and_si128(_mm_srli_epi32(s1, 16), mFF));
+		__m128i r = sr;
+		__m128i g = sg;
+		__m128i b = sb;
+		int opaque = _mm_movemask_epi8(_mm_cmpeq_epi16(a, c255));
+		if(opaque != 0xFFFF) {
+			// a transparent pixel in a mixed group comes out unchanged, as widening 565 is lossless
+			__m128i d = _mm_loadu_si128((const __m128i *)&dst[i * 2]);
+			__m128i r5 = _mm_srli_epi16(d, 11);
+			__m128i g6 = _mm_and_si128(_mm_srli_epi16(d, 5), m3F);
+			__m128i b5 = _mm_and_si128(d, m1F);
+			__m128i dr = _mm_or_si128(_mm_slli_epi16(r5, 3), _mm_srli_epi16(r5, 2));
+			__m128i dg = _mm_or_si128(_mm_slli_epi16(g6, 2), _mm_srli_epi16(g6, 4));
+			__m128i db = _mm_or_si128(_mm_slli_epi16(b5, 3), _mm_srli_epi16(b5, 2));
+			__m128i ia = _mm_sub_epi16(c255, a);
+			__m128i xr = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(sr, a), _mm_mullo_epi16(dr, ia)), c128);
+			__m128i xg = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(sg, a), _mm_mullo_epi16(dg, ia)), c128);
+			__m128i xb = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(sb, a), _mm_mullo_epi16(db, ia)), c128);
+			r = _mm_srli_epi16(_mm_add_epi16(xr, _mm_srli_epi16(xr, 8)), 8);
+			g = _mm_srli_epi16(_mm_add_epi16(xg, _mm_srli_epi16(xg, 8)), 8);
+			b = _mm_srli_epi16(_mm_add_epi16(xb, _mm_srli_epi16(xb, 8)), 8);
+		}
+		__m128i out = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(r, 3), 11), _mm_slli_epi16(_mm_srli_epi16(g, 2), 5)), _mm_srli_epi16(b, 3));
+		_mm_storeu_si128((__m128i *)&dst[i * 2], out);
+		i += 8;
+	}
+	blend8888over565Scalar(&dst[i * 2], &src[i * 4], count - i);
+}
+
+#endif
+
+// Blend count ARGB8888 pixels at src over count ARGB8888 pixels at dst
+void blend8888over8888(u8 * dst, const u8 * src, size_t count) {
+#ifdef PIXEL_X86
+	switch(pixelIsa()) {
+		case PIXEL_ISA_AVX2:
+			blend8888over8888AVX2(dst, src, count);
+			return;
+		case PIXEL_ISA_SSE2:
+			blend8888over8888SSE2(dst, src, count);
+			return;
+		default:
+			break;
+	}
+#endif
+	blend8888over8888Scalar(dst, src, count);
+}
+
+// Blend count ARGB8888 pixels at src over count RGB565 pixels at dst
+void blend8888over565(u8 * dst, const u8 * src, size_t count) {
+#ifdef PIXEL_X86
+	if(pixelIsa() >= PIXEL_ISA_SSE2) {
+		blend8888over565SSE2(dst, src, count);
+		return;
+	}
+#endif
+	blend8888over565Scalar(dst, src, count);
+}
+
+// ARGB8565 sources are widened a block at a time with argb8565to8888, then blended
+#define BLEND_BLOCK 256
+
+void blend8565over8888(u8 * dst, const u8 * src, size_t count) {
+	u8 buf[BLEND_BLOCK * 4];
+	for(size_t i=0; i<count; i+=BLEND_BLOCK) {
+		size_t n = (count - i < BLEND_BLOCK) ? count - i : BLEND_BLOCK;
+		argb8565to8888(buf, &src[i * 3], n);
+		blend8888over8888(&dst[i * 4], buf, n);
+	}
+}
+
+void blend8565over565(u8 * dst, const u8 * src, size_t count) {
+	u8 buf[BLEND_BLOCK * 4];
+	for(size_t i=0; i<count; i+=BLEND_BLOCK) {
+		size_t n = (count - i < BLEND_BLOCK) ? count - i : BLEND_BLOCK;
+		argb8565to8888(buf, &src[i * 3], n);
+		blend8888over565(&dst[i * 2], buf, n);
+	}
+}
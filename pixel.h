@@ -0,0 +1,36 @@
+// pixel.h
+// pixel format conversion kernels, with SIMD versions where available
+
+//----------------------------------------------------------------------------
+//  KERNEL SELECTION
+//----------------------------------------------------------------------------
+
+// Instruction set used by the kernels. AUTO picks the best the CPU supports.
+typedef enum _PixelIsa {
+	PIXEL_ISA_AUTO = 0,
+	PIXEL_ISA_SCALAR = 1,
+	PIXEL_ISA_SSE2 = 2,
+	PIXEL_ISA_AVX2 = 3,
+} PixelIsa;
+
+void setPixelIsa(PixelIsa isa);
+PixelIsa pixelIsa(void);
+const char * pixelIsaStr(PixelIsa isa);
+
+//----------------------------------------------------------------------------
+//  CONVERSION FUNCTIONS
+//----------------------------------------------------------------------------
+
+// Expand count ARGB8565 pixels (3 bytes each) at src to ARGB8888 (4 bytes each, b g r a) at dst
+void argb8565to8888(u8 * dst, const u8 * src, size_t count);
+
+//----------------------------------------------------------------------------
+//  BLENDING FUNCTIONS
+//----------------------------------------------------------------------------
+
+// Alpha blend count source pixels over count destination pixels, in place.
+// RGB565 destinations are 2 bytes per pixel, little-endian.
+void blend8888over8888(u8 * dst, const u8 * src, size_t count);
+void blend8888over565(u8 * dst, const u8 * src, size_t count);
+void blend8565over8888(u8 * dst, const u8 * src, size_t count);
+void blend8565over565(u8 * dst, const u8 * src, size_t count);
@@ -0,0 +1,240 @@
+/*  png.c - PNG writer
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Images are written as 8 bit RGBA, one IDAT chunk, no ancillary chunks. Rows are
+	decoded and filtered in parallel; each row gets whichever PNG filter leaves the
+	smallest sum of absolute differences, the usual heuristic. Level 0 skips filtering
+	as well as compression.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "pool.h"
+#include "rle.h"
+#include "deflate.h"
+#include "png.h"
+
+static int defaultLevel = DEFLATE_LEVEL_DEFAULT;
+
+// Set before any dumping starts
+void setDefaultPngLevel(int level) {
+	if(level < DEFLATE_LEVEL_MIN) {
+		level = DEFLATE_LEVEL_MIN;
+	}
+	if(level > DEFLATE_LEVEL_MAX) {
+		level = DEFLATE_LEVEL_MAX;
+	}
+	defaultLevel = level;
+}
+
+int defaultPngLevel(void) {
+	return defaultLevel;
+}
+
+//----------------------------------------------------------------------------
+//  CRC32 - as used by PNG and zip, a nibble at a time
+//----------------------------------------------------------------------------
+
+static const u32 CRC_NIBBLE[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+// Start with crc 0, and pass the result back in to continue
+u32 crc32(u32 crc, const u8 * data, size_t size) {
+	crc = ~crc;
+	for(size_t i=0; i<size; i++) {
+		crc ^= data[i];
+		crc = (crc >> 4) ^ CRC_NIBBLE[crc & 15];
+		crc = (crc >> 4) ^ CRC_NIBBLE[crc & 15];
+	}
+	return ~crc;
+}
+
+//----------------------------------------------------------------------------
+//  ROWS - decode to RGBA, then filter
+//----------------------------------------------------------------------------
+
+typedef struct _PngCtx {
+	const u8 * imgData;		// RLE_NEW, or NULL to take the rows from argb8888
+	size_t size;			// of imgData
+	const u8 * argb8888;
+	u32 width;
+	u32 height;
+	size_t stride;			// bytes per row of pixels
+	u8 * rgba;				// the whole image, unfiltered
+	u8 * filtered;			// filter byte then stride bytes, per row
+	bool filter;			// false: every row uses filter 0 (none)
+} PngCtx;
+
+static int decodeRowTask(void * ctx, size_t y) {
+	PngCtx * c = (PngCtx *)ctx;
+	u8 * row = &c->rgba[y * c->stride];
+	int r = 0;
+	if(c->imgData == NULL) {
+		memcpy(row, &c->argb8888[y * c->stride], c->stride);
+	} else {
+		size_t srcSize;
+		const u8 * src = rleNewRow(c->imgData, c->size, c->height, (u32)y, &srcSize);
+		if(src == NULL) {
+			memset(row, 0, c->stride);
+			r = 1;
+		} else {
+			r = rleNewDecodeRow8888(src, srcSize, row, c->width);
+		}
+	}
+	// BGRA to RGBA
+	for(size_t x=0; x<c->stride; x+=4) {
+		u8 b = row[x];
+		row[x] = row[x+2];
+		row[x+2] = b;
+	}
+	return r;
+}
+
+static u8 paeth(u8 a, u8 b, u8 c) {
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if(pa <= pb && pa <= pc) {
+		return a;
+	}
+	return (pb <= pc) ? b : c;
+}
+
+// Filter type t applied to byte i of a row. prev is NULL for the first row.
+static u8 filterByte(int t, const u8 * row, const u8 * prev, size_t i) {
+	u8 a = (i >= 4) ? row[i-4] : 0;
+	u8 b = prev ? prev[i] : 0;
+	u8 c = (prev && i >= 4) ? prev[i-4] : 0;
+	switch(t) {
+		case 1: return (u8)(row[i] - a);
+		case 2: return (u8)(row[i] - b);
+		case 3: return (u8)(row[i] - ((a + b) >> 1));
+		case 4: return (u8)(row[i] - paeth(a, b, c));
+	}
+	return row[i];
+}
+
+static void filterRowTask(void * ctx, size_t y) {
+	PngCtx * c = (PngCtx *)ctx;
+	const u8 * row = &c->rgba[y * c->stride];
+	const u8 * prev = (y > 0) ? row - c->stride : NULL;
+	u8 * out = &c->filtered[y * (c->stride + 1)];
+
+	int best = 0;
+	if(c->filter) {
+		u64 bestScore = UINT64_MAX;
+		for(int t=0; t<5; t++) {
+			u64 score = 0;
+			for(size_t i=0; i<c->stride && score<bestScore; i++) {
+				score += (u64)abs((i8)filterByte(t, row, prev, i));
+			}
+			if(score < bestScore) {
+				bestScore = score;
+				best = t;
+			}
+		}
+	}
+	out[0] = (u8)best;
+	for(size_t i=0; i<c->stride; i++) {
+		out[1+i] = filterByte(best, row, prev, i);
+	}
+}
+
+//----------------------------------------------------------------------------
+//  RLENEWTOPNG, PNGENCODE8888
+//----------------------------------------------------------------------------
+
+// Append a chunk: length, type, data, CRC of type and data
+static u8 * putChunk(u8 * p, const char * type, const u8 * data, u32 size) {
+	u8 * start = p;
+	p[0] = (u8)(size >> 24);
+	p[1] = (u8)(size >> 16);
+	p[2] = (u8)(size >> 8);
+	p[3] = (u8)size;
+	memcpy(&p[4], type, 4);
+	if(size > 0) {
+		memcpy(&p[8], data, size);
+	}
+	u32 crc = crc32(0, &start[4], size + 4);
+	p += 8 + size;
+	p[0] = (u8)(crc >> 24);
+	p[1] = (u8)(crc >> 16);
+	p[2] = (u8)(crc >> 8);
+	p[3] = (u8)crc;
+	return p + 4;
+}
+
+// A PNG file in memory, with the rows from imgData (size bytes) or argb8888
+static Bytes * encodePNG(const u8 * imgData, size_t size, const u8 * argb8888, u32 width, u32 height, int level) {
+	if(width == 0 || height == 0) {
+		printf("ERROR: A PNG can't be %u x %u\n", width, height);
+		return NULL;
+	}
+	PngCtx ctx = { imgData, size, argb8888, width, height, (size_t)width * 4, NULL, NULL, level > DEFLATE_LEVEL_MIN };
+	ctx.rgba = malloc(ctx.stride * height);
+	ctx.filtered = malloc((ctx.stride + 1) * height);
+	if(ctx.rgba == NULL || ctx.filtered == NULL) {
+		printf("ERROR: Out of memory\n");
+		free(ctx.rgba);
+		free(ctx.filtered);
+		return NULL;
+	}
+	size_t failed = poolForChecked(defaultPool(), height, decodeRowTask, &ctx);
+	poolFor(defaultPool(), height, filterRowTask, &ctx);
+	if(failed != 0) {
+		printf("WARNING: Some rows of RLE image did not decode cleanly\n");
+	}
+	Bytes * z = zlibCompress(ctx.filtered, (ctx.stride + 1) * height, level);
+	free(ctx.rgba);
+	free(ctx.filtered);
+	if(z == NULL) {
+		return NULL;
+	}
+
+	// signature, IHDR, IDAT, IEND
+	static const u8 SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	u8 ihdr[13] = {
+		(u8)(width >> 24), (u8)(width >> 16), (u8)(width >> 8), (u8)width,
+		(u8)(height >> 24), (u8)(height >> 16), (u8)(height >> 8), (u8)height,
+		8, 6, 0, 0, 0		// 8 bits, RGBA, deflate, standard filters, not interlaced
+	};
+	Bytes * b = newBytes(sizeof(SIGNATURE) + (12 + sizeof(ihdr)) + (12 + z->size) + 12);
+	if(b == NULL) {
+		printf("ERROR: Out of memory\n");
+		deleteBytes(z);
+		return NULL;
+	}
+	memcpy(b->data, SIGNATURE, sizeof(SIGNATURE));
+	u8 * p = &b->data[sizeof(SIGNATURE)];
+	p = putChunk(p, "IHDR", ihdr, sizeof(ihdr));
+	p = putChunk(p, "IDAT", z->data, (u32)z->size);
+	putChunk(p, "IEND", NULL, 0);
+	deleteBytes(z);
+	return b;
+}
+
+// Decode RLE_NEW image data (starting at the row table, size bytes in all) to a PNG file in memory
+Bytes * rleNewToPNG(const u8 * imgData, size_t size, u32 width, u32 height, int level) {
+	return encodePNG(imgData, size, NULL, width, height, level);
+}
+
+// An ARGB8888 image (bytes b, g, r, a), e.g. a rendered frame, as a PNG file in memory
+Bytes * pngEncode8888(const u8 * argb8888, u32 width, u32 height, int level) {
+	return encodePNG(NULL, 0, argb8888, width, height, level);
+}
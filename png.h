@@ -0,0 +1,14 @@
+// png.h
+// write images as PNG (8 bit RGBA), compressed with the built-in deflate
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+Bytes * rleNewToPNG(const u8 * imgData, size_t size, u32 width, u32 height, int level);
+Bytes * pngEncode8888(const u8 * argb8888, u32 width, u32 height, int level);
+u32 crc32(u32 crc, const u8 * data, size_t size);
+
+// Effort level (DEFLATE_LEVEL_MIN to DEFLATE_LEVEL_MAX) used when dumping PNG files
+void setDefaultPngLevel(int level);
+int defaultPngLevel(void);
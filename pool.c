@@ -0,0 +1,473 @@
+/*  pool.c - work-stealing thread pool
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+/*	Each worker has its own deque of tasks. A worker pushes and pops new tasks at the bottom of its own
+	deque (newest first, which keeps nested work close), and when it runs dry it steals from the top of
+	another worker's deque (oldest first, which takes the biggest pieces). Tasks submitted from outside
+	the pool go to a shared deque that everyone steals from.
+
+	Waiting for a group doesn't block a thread: it keeps running tasks until the group is done. That
+	makes it safe to use poolFor or poolWait from inside a task.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "types.h"
+#include "pool.h"
+#include "strutil.h"
+
+//----------------------------------------------------------------------------
+//  DEQUE
+//----------------------------------------------------------------------------
+
+typedef struct _TaskItem {
+	PoolTask fn;
+	void * arg;
+	PoolGroup * group;
+} TaskItem;
+
+// Tasks are in [top, bottom), indexes wrap around capacity
+typedef struct _Deque {
+	pthread_mutex_t lock;
+	TaskItem * items;
+	size_t capacity;
+	size_t top;
+	size_t bottom;
+} Deque;
+
+static void initDeque(Deque * d) {
+	pthread_mutex_init(&d->lock, NULL);
+	d->items = NULL;
+	d->capacity = 0;
+	d->top = 0;
+	d->bottom = 0;
+}
+
+static void freeDeque(Deque * d) {
+	free(d->items);
+	pthread_mutex_destroy(&d->lock);
+}
+
+// Owner end. Returns 1 if out of memory.
+static int pushBottom(Deque * d, TaskItem t) {
+	pthread_mutex_lock(&d->lock);
+	if(d->bottom - d->top == d->capacity) {
+		size_t newCapacity = d->capacity ? d->capacity * 2 : 64;
+		TaskItem * items = malloc(newCapacity * sizeof(TaskItem));
+		if(items == NULL) {
+			pthread_mutex_unlock(&d->lock);
+			return 1;
+		}
+		for(size_t i=d->top; i<d->bottom; i++) {
+			items[i - d->top] = d->items[i % d->capacity];
+		}
+		free(d->items);
+		d->items = items;
+		d->bottom -= d->top;
+		d->top = 0;
+		d->capacity = newCapacity;
+	}
+	d->items[d->bottom % d->capacity] = t;
+	d->bottom++;
+	pthread_mutex_unlock(&d->lock);
+	return 0;
+}
+
+// Owner end, newest task first
+static bool popBottom(Deque * d, TaskItem * t) {
+	bool found = false;
+	pthread_mutex_lock(&d->lock);
+	if(d->bottom > d->top) {
+		d->bottom--;
+		*t = d->items[d->bottom % d->capacity];
+		found = true;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return found;
+}
+
+// Thief end, oldest task first
+static bool stealTop(Deque * d, TaskItem * t) {
+	bool found = false;
+	pthread_mutex_lock(&d->lock);
+	if(d->bottom > d->top) {
+		*t = d->items[d->top % d->capacity];
+		d->top++;
+		found = true;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return found;
+}
+
+//----------------------------------------------------------------------------
+//  POOL STRUCT
+//----------------------------------------------------------------------------
+
+typedef struct _Worker {
+	struct _Pool * pool;
+	unsigned idx;
+	pthread_t thread;
+} Worker;
+
+struct _Pool {
+	unsigned threadCount;	// worker threads (not including callers)
+	unsigned started;		// worker threads actually running
+	Worker * workers;
+	Deque * deques;			// one per worker, plus one shared deque at [threadCount] for outside submitters
+	pthread_key_t self;		// a worker's Worker *, NULL for outside threads
+	pthread_mutex_t lock;	// protects everything below, and group counters
+	pthread_cond_t wake;	// signalled on new work, on group completion, and on quit
+	u32 epoch;				// incremented whenever work is pushed or a group completes
+	unsigned sleepers;
+	bool quit;
+};
+
+//----------------------------------------------------------------------------
+//  CPUCOUNT - number of online processors
+//----------------------------------------------------------------------------
+
+unsigned cpuCount(void) {
+#ifdef WINDOWS
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors > 0 ? (unsigned)si.dwNumberOfProcessors : 1;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned)n : 1;
+#endif
+}
+
+//----------------------------------------------------------------------------
+//  RUNNING TASKS
+//----------------------------------------------------------------------------
+
+// Find a task: own deque first, then steal from the others and the shared deque
+static bool findTask(Pool * p, Worker * w, TaskItem * t) {
+	unsigned dequeCount = p->threadCount + 1;
+	unsigned start = (w != NULL) ? w->idx : p->threadCount;
+	if(w != NULL && popBottom(&p->deques[w->idx], t)) {
+		return true;
+	}
+	for(unsigned i=1; i<=dequeCount; i++) {
+		if(stealTop(&p->deques[(start + i) % dequeCount], t)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void runTask(Pool * p, TaskItem * t) {
+	t->fn(t->arg);
+	pthread_mutex_lock(&p->lock);
+	t->group->pending--;
+	if(t->group->pending == 0) {
+		p->epoch++;
+		pthread_cond_broadcast(&p->wake);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void * workerMain(void * arg) {
+	Worker * w = (Worker *)arg;
+	Pool * p = w->pool;
+	pthread_setspecific(p->self, w);
+
+	for(;;) {
+		pthread_mutex_lock(&p->lock);
+		u32 epoch = p->epoch;
+		bool quit = p->quit;
+		pthread_mutex_unlock(&p->lock);
+		if(quit) {
+			break;
+		}
+
+		TaskItem t;
+		if(findTask(p, w, &t)) {
+			runTask(p, &t);
+			continue;
+		}
+
+		// nothing found: sleep, unless something was pushed while we were looking
+		pthread_mutex_lock(&p->lock);
+		if(p->epoch == epoch && !p->quit) {
+			p->sleepers++;
+			pthread_cond_wait(&p->wake, &p->lock);
+			p->sleepers--;
+		}
+		pthread_mutex_unlock(&p->lock);
+	}
+	return NULL;
+}
+
+//----------------------------------------------------------------------------
+//  NEWPOOL - create a pool. threads is the total including the caller, 0 for all cores.
+//----------------------------------------------------------------------------
+
+Pool * newPool(unsigned threads) {
+	if(threads == 0) {
+		threads = cpuCount();
+	}
+
+	Pool * p = (Pool *)malloc(sizeof(Pool));
+	if(p == NULL) {
+		dprintf(0, "ERROR: Out of memory (newPool).\n");
+		return NULL;
+	}
+	memset(p, 0, sizeof(Pool));
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->wake, NULL);
+	pthread_key_create(&p->self, NULL);
+
+	unsigned workerCount = threads - 1;
+	p->workers = (Worker *)malloc(sizeof(Worker) * (workerCount + 1));		// +1 so it's never malloc(0)
+	p->deques = (Deque *)malloc(sizeof(Deque) * (workerCount + 1));
+	if(p->workers == NULL || p->deques == NULL) {
+		dprintf(0, "ERROR: Out of memory (newPool).\n");
+		free(p->workers);
+		free(p->deques);
+		p->workers = NULL;
+		p->deques = NULL;
+		return deletePool(p);
+	}
+	for(unsigned i=0; i<=workerCount; i++) {
+		initDeque(&p->deques[i]);
+	}
+
+	// threadCount must be final before any worker starts looking at deques, so start them all under the lock
+	pthread_mutex_lock(&p->lock);
+	p->threadCount = workerCount;
+	for(unsigned i=0; i<workerCount; i++) {
+		p->workers[i].pool = p;
+		p->workers[i].idx = i;
+		if(pthread_create(&p->workers[i].thread, NULL, workerMain, &p->workers[i]) != 0) {
+			break;
+		}
+		p->started++;
+	}
+	if(p->started < workerCount) {
+		// the shared deque stays at the end, the unused worker deques just stay empty
+		dprintf(0, "WARNING: Only able to start %u worker threads.\n", p->started);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return p;
+}
+
+//----------------------------------------------------------------------------
+//  DELETEPOOL - stop the workers and free the pool. Any queued tasks must already be waited for.
+//----------------------------------------------------------------------------
+
+Pool * deletePool(Pool * p) {
+	if(p != NULL) {
+		pthread_mutex_lock(&p->lock);
+		p->quit = true;
+		pthread_cond_broadcast(&p->wake);
+		pthread_mutex_unlock(&p->lock);
+		for(unsigned i=0; i<p->started; i++) {
+			pthread_join(p->workers[i].thread, NULL);
+		}
+		if(p->deques != NULL) {
+			for(unsigned i=0; i<=p->threadCount; i++) {
+				freeDeque(&p->deques[i]);
+			}
+		}
+		free(p->workers);
+		free(p->deques);
+		pthread_key_delete(p->self);
+		pthread_cond_destroy(&p->wake);
+		pthread_mutex_destroy(&p->lock);
+		free(p);
+		p = NULL;
+	}
+	return p;
+}
+
+//----------------------------------------------------------------------------
+//  POOLSUBMIT - queue a task under a group
+//----------------------------------------------------------------------------
+
+void poolSubmit(Pool * p, PoolGroup * g, PoolTask fn, void * arg) {
+	if(p == NULL || p->threadCount == 0) {
+		fn(arg);		// nobody to hand it to
+		return;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	g->pending++;
+	pthread_mutex_unlock(&p->lock);
+
+	Worker * w = (Worker *)pthread_getspecific(p->self);
+	Deque * d = &p->deques[(w != NULL) ? w->idx : p->threadCount];
+	TaskItem t = { fn, arg, g };
+	if(pushBottom(d, t) != 0) {
+		// out of memory for the queue, just do it now
+		runTask(p, &t);
+		return;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->epoch++;
+	if(p->sleepers > 0) {
+		pthread_cond_signal(&p->wake);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+//----------------------------------------------------------------------------
+//  POOLWAIT - run tasks until every task in the group has finished
+//----------------------------------------------------------------------------
+
+void poolWait(Pool * p, PoolGroup * g) {
+	if(p == NULL || p->threadCount == 0) {
+		return;		// tasks were run as they were submitted
+	}
+
+	Worker * w = (Worker *)pthread_getspecific(p->self);
+	for(;;) {
+		pthread_mutex_lock(&p->lock);
+		u32 epoch = p->epoch;
+		bool done = (g->pending == 0);
+		pthread_mutex_unlock(&p->lock);
+		if(done) {
+			return;
+		}
+
+		TaskItem t;
+		if(findTask(p, w, &t)) {
+			runTask(p, &t);
+			continue;
+		}
+
+		// the group's remaining tasks are running elsewhere: sleep until something changes
+		pthread_mutex_lock(&p->lock);
+		if(p->epoch == epoch && g->pending != 0) {
+			p->sleepers++;
+			pthread_cond_wait(&p->wake, &p->lock);
+			p->sleepers--;
+		}
+		pthread_mutex_unlock(&p->lock);
+	}
+}
+
+//----------------------------------------------------------------------------
+//  POOLFOR - run fn(ctx, i) for every i in [0, count), return when all are done
+//----------------------------------------------------------------------------
+
+#define POOL_FOR_MAX_CHUNKS 256
+
+// Each chunk counts its own failures, so no two threads ever write the same count
+typedef struct _ForChunk {
+	PoolFunc fn;			// one of fn and check
+	PoolCheckFunc check;
+	void * ctx;
+	size_t first;
+	size_t last;
+	size_t failed;
+} ForChunk;
+
+static void forChunkTask(void * arg) {
+	ForChunk * c = (ForChunk *)arg;
+	for(size_t i=c->first; i<c->last; i++) {
+		if(c->check != NULL) {
+			c->failed += (c->check(c->ctx, i) != 0) ? 1 : 0;
+		} else {
+			c->fn(c->ctx, i);
+		}
+	}
+}
+
+// Returns the number of failures, if check is used
+static size_t forChunks(Pool * p, size_t count, PoolFunc fn, PoolCheckFunc check, void * ctx) {
+	if(p == NULL || p->threadCount == 0 || count <= 1) {
+		ForChunk all = { fn, check, ctx, 0, count, 0 };
+		forChunkTask(&all);
+		return all.failed;
+	}
+
+	// Several pieces per thread, so stealing can even out the load
+	size_t chunkCount = (size_t)(p->threadCount + 1) * 4;
+	if(chunkCount > count) {
+		chunkCount = count;
+	}
+	if(chunkCount > POOL_FOR_MAX_CHUNKS) {
+		chunkCount = POOL_FOR_MAX_CHUNKS;
+	}
+
+	ForChunk chunks[POOL_FOR_MAX_CHUNKS];
+	PoolGroup g = POOL_GROUP_INIT;
+	for(size_t i=0; i<chunkCount; i++) {
+		chunks[i].fn = fn;
+		chunks[i].check = check;
+		chunks[i].ctx = ctx;
+		chunks[i].first = count * i / chunkCount;
+		chunks[i].last = count * (i + 1) / chunkCount;
+		chunks[i].failed = 0;
+		poolSubmit(p, &g, forChunkTask, &chunks[i]);
+	}
+	poolWait(p, &g);
+
+	// poolWait has synchronised with every chunk, so their counts can be read now
+	size_t failed = 0;
+	for(size_t i=0; i<chunkCount; i++) {
+		failed += chunks[i].failed;
+	}
+	return failed;
+}
+
+void poolFor(Pool * p, size_t count, PoolFunc fn, void * ctx) {
+	forChunks(p, count, fn, NULL, ctx);
+}
+
+// As poolFor, for a loop body that can fail. Returns the number of indexes it failed for.
+size_t poolForChecked(Pool * p, size_t count, PoolCheckFunc fn, void * ctx) {
+	return forChunks(p, count, NULL, fn, ctx);
+}
+
+//----------------------------------------------------------------------------
+//  DEFAULT POOL
+//----------------------------------------------------------------------------
+
+static pthread_mutex_t defaultPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static Pool * defaultPoolPtr = NULL;
+static unsigned defaultPoolThreads = 0;		// 0 for all cores
+
+// Set the number of threads for the default pool. Takes effect when it is next created.
+void setDefaultPoolThreads(unsigned threads) {
+	pthread_mutex_lock(&defaultPoolLock);
+	defaultPoolThreads = threads;
+	pthread_mutex_unlock(&defaultPoolLock);
+}
+
+Pool * defaultPool(void) {
+	pthread_mutex_lock(&defaultPoolLock);
+	if(defaultPoolPtr == NULL) {
+		defaultPoolPtr = newPool(defaultPoolThreads);
+	}
+	Pool * p = defaultPoolPtr;
+	pthread_mutex_unlock(&defaultPoolLock);
+	return p;
+}
+
+void deleteDefaultPool(void) {
+	pthread_mutex_lock(&defaultPoolLock);
+	defaultPoolPtr = deletePool(defaultPoolPtr);
+	pthread_mutex_unlock(&defaultPoolLock);
+}
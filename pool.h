@@ -0,0 +1,44 @@
+// pool.h
+// a small work-stealing thread pool, for loops and independent jobs
+
+//----------------------------------------------------------------------------
+//  EXPORTED TYPES
+//----------------------------------------------------------------------------
+
+// Loop body. Called once for each index in [0, count).
+typedef void (*PoolFunc)(void * ctx, size_t idx);
+
+// Loop body that can fail. Returns 0 on success.
+typedef int (*PoolCheckFunc)(void * ctx, size_t idx);
+
+// A job submitted on its own
+typedef void (*PoolTask)(void * arg);
+
+// Counts the unfinished jobs submitted under it, so they can be waited for together
+typedef struct _PoolGroup {
+	size_t pending;
+} PoolGroup;
+
+#define POOL_GROUP_INIT { 0 }
+
+// Most threads a pool may be asked for
+#define POOL_MAX_THREADS 1024
+
+typedef struct _Pool Pool;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+unsigned cpuCount(void);
+Pool * newPool(unsigned threads);
+Pool * deletePool(Pool * p);
+void poolFor(Pool * p, size_t count, PoolFunc fn, void * ctx);
+size_t poolForChecked(Pool * p, size_t count, PoolCheckFunc fn, void * ctx);
+void poolSubmit(Pool * p, PoolGroup * g, PoolTask fn, void * arg);
+void poolWait(Pool * p, PoolGroup * g);
+
+// The shared pool used by the decoders. Created on first use.
+Pool * defaultPool(void);
+void setDefaultPoolThreads(unsigned threads);
+void deleteDefaultPool(void);
@@ -0,0 +1,597 @@
+/*  process.c - dump and render one watch face
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	The face is indexed without decoding anything. Then its images are dumped in parallel
+	while watchface.json is streamed out in header order, and the face is rendered if asked.
+	Used for each face on the command line, and for each dump request the server answers.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "types.h"
+#include "face_new.h"
+#include "adawft.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "bmpstream.h"
+#include "cache.h"
+#include "output.h"
+#include "dump.h"
+#include "face.h"
+#include "render.h"
+#include "jsonw.h"
+#include "process.h"
+#include "strutil.h"
+
+//----------------------------------------------------------------------------
+//  PRINT FACE IMAGE ARRAY
+//----------------------------------------------------------------------------
+static void printImages(const FaceImage * img, size_t count, const char * name) {
+	for(size_t i=0; i<count; i++) {
+		dprintf(3, "%s[%zu]    0x%08X, %3u, %3u\n", name, i, img[i].offset, img[i].width, img[i].height);
+	}
+}
+
+// Queue one image for dumping. Images that run off the end of the file are skipped, and count as failures.
+static int queueImage(DumpQueue * dq, const char * dumpFileName, const FaceIndex * fi, const FaceImage * img, Format format) {
+	if(img->size == 0 && img->height != 0) {
+		dprintf(0, "ERROR: Image data for %s is outside the file, skipped.\n", dumpFileName);
+		return 1;
+	}
+	dumpQueueImage(dq, dumpFileName, (u8 *)&fi->data[img->offset], img->size, img->width, img->height, format, NULL);
+	return 0;
+}
+
+// Describe an image in the JSON: { "w", "h", "file_name" }
+static void jsonwImage(JsonWriter * jw, const char * key, const FaceImage * img, const char * fileName) {
+	jsonwBeginObject(jw, key);
+	jsonwInt(jw, "w", img->width);
+	jsonwInt(jw, "h", img->height);
+	jsonwString(jw, "file_name", fileName);
+	jsonwEndObject(jw);
+}
+
+// Unknown header bytes as a JSON array of ints
+static void jsonwBytes(JsonWriter * jw, const char * key, const u8 * bytes, size_t count) {
+	int arr[32];
+	for(size_t i=0; i<count && i<32; i++) {
+		arr[i] = bytes[i];
+	}
+	jsonwIntArray(jw, key, arr, count < 32 ? count : 32);
+}
+
+//----------------------------------------------------------------------------
+//  RENDERTOFILE - render a frame and save it as a BMP
+//----------------------------------------------------------------------------
+static int renderToFile(const FaceIndex * fi, const RenderState * rs, const char * renderFileName) {
+	Img * frame = renderFace(fi, rs);
+	if(frame == NULL) {
+		dprintf(0, "ERROR: Failed to render frame.\n");
+		return 1;
+	}
+	int r = imgStreamBMP(renderFileName, frame);
+	frame = deleteImg(frame);
+	if(r != 0) {
+		dprintf(0, "ERROR: Failed to save rendered frame %s\n", renderFileName);
+		return 1;
+	}
+	dprintf(1, "Rendered %s\n", renderFileName);
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//  RENDERANIMATION - render a run of frames, as numbered BMPs or raw video
+//----------------------------------------------------------------------------
+// Frame i is rendered at renderTime + i * frameStep. Each frame only redraws what changed since the last.
+// Frames are named after renderFileName with any ".bmp" removed: NAME_0000.bmp, ... or NAME.bgra for video,
+// which is headerless ARGB8888 (bytes b, g, r, a), top row first.
+static int renderAnimation(const FaceIndex * fi, const ProcessOptions * opt, const char * renderFileName) {
+	char base[1024];
+	snprintf(base, sizeof(base), "%s", renderFileName);
+	size_t len = strlen(base);
+	if(len > 4 && streq(&base[len - 4], ".bmp")) {
+		base[len - 4] = '\0';
+	}
+	char fileName[1100];
+
+	RenderAnim * anim = newRenderAnim(fi);
+	if(anim == NULL) {
+		dprintf(0, "ERROR: Failed to render frame.\n");
+		return 1;
+	}
+	FILE * video = NULL;
+	if(opt->video) {
+		snprintf(fileName, sizeof(fileName), "%s.bgra", base);
+		video = outputArchiving() ? tmpfile() : fopen(fileName, "wb");		// archive entries are added whole
+		if(video == NULL) {
+			dprintf(0, "ERROR: Can't open %s for writing.\n", fileName);
+			anim = deleteRenderAnim(anim);
+			return 1;
+		}
+	}
+
+	int errors = 0;
+	size_t redrawn = 0;
+	RenderState rs = opt->renderState;
+	for(unsigned i=0; i<opt->frames && errors == 0; i++) {
+		renderStateSetTime(&rs, opt->renderTime + (time_t)i * opt->frameStep);
+		renderAnimFrame(anim, &rs);
+		for(size_t r=0; r<anim->dirtyCount; r++) {
+			redrawn += (size_t)(anim->dirty[r].x1 - anim->dirty[r].x0) * (anim->dirty[r].y1 - anim->dirty[r].y0);
+		}
+		if(video != NULL) {
+			if(fwrite(anim->frame->data, anim->frame->size, 1, video) != 1) {
+				dprintf(0, "ERROR: Failed to write frame %u to %s\n", i, fileName);
+				errors++;
+			}
+			continue;
+		}
+		snprintf(fileName, sizeof(fileName), "%s_%04u.bmp", base, i);
+		if(imgStreamBMP(fileName, anim->frame) != 0) {
+			dprintf(0, "ERROR: Failed to save rendered frame %s\n", fileName);
+			errors++;
+		}
+	}
+	if(video != NULL && outputArchiving() && errors == 0 && outputFileFromStream(fileName, video) != 0) {
+		dprintf(0, "ERROR: Failed to write %s\n", fileName);
+		errors++;
+	}
+	if(video != NULL && fclose(video) != 0) {
+		dprintf(0, "ERROR: Failed to write %s\n", fileName);
+		errors++;
+	}
+
+	size_t total = (size_t)anim->frame->w * anim->frame->h * opt->frames;
+	dprintf(1, "Rendered %u frames of %ux%u to %s%s, redrawing %.1f%% of the pixels\n", opt->frames, anim->frame->w, anim->frame->h,
+		base, opt->video ? ".bgra" : "_NNNN.bmp", total ? 100.0 * (double)redrawn / (double)total : 0.0);
+	anim = deleteRenderAnim(anim);
+	return errors ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+//  PARSETIME - read a time from the command line
+//----------------------------------------------------------------------------
+// Accepts seconds since the epoch, "YYYY-MM-DD HH:MM[:SS]" (or with a 'T'), or "HH:MM[:SS]" for today. Local time.
+int parseTime(const char * str, time_t * t) {
+	time_t nowTime = time(NULL);
+	struct tm tm = *localtime(&nowTime);
+	int year, month, day, hour, minute, second = 0;
+	char sep;
+	if(sscanf(str, "%d-%d-%d%c%d:%d:%d", &year, &month, &day, &sep, &hour, &minute, &second) >= 6 && (sep == ' ' || sep == 'T')) {
+		tm.tm_year = year - 1900;
+		tm.tm_mon = month - 1;
+		tm.tm_mday = day;
+	} else if(sscanf(str, "%d:%d:%d", &hour, &minute, &second) >= 2) {
+		// today
+	} else if(isNum((char *)str)) {
+		*t = (time_t)strtoll(str, NULL, 10);
+		return 0;
+	} else {
+		return 1;
+	}
+	tm.tm_hour = hour;
+	tm.tm_min = minute;
+	tm.tm_sec = second;
+	tm.tm_isdst = -1;
+	*t = mktime(&tm);
+	return (*t == (time_t)-1) ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+//  PROCESSFACE - read one watch face file, and dump it if requested
+//----------------------------------------------------------------------------
+int processFace(const char * fileName, const char * folderName, const ProcessOptions * opt) {
+	// Map the binary input file. This is a read-only view, the parser never writes to it.
+	Bytes * bytes = mapBytesFromFile(fileName);
+	if(bytes == NULL) {
+		dprintf(0, "ERROR: Failed to read file into memory.\n");
+		return 1;
+	}
+	int r = processFaceBytes(bytes, folderName, opt);
+	deleteBytes(bytes);
+	return r;
+}
+
+// The same, for a face already in memory
+int processFaceBytes(const Bytes * bytes, const char * folderName, const ProcessOptions * opt) {
+	Format format = opt->format;
+	bool dump = opt->dump;
+
+	// Check file size
+	if(bytes->size < sizeof(FaceHeaderN)) {
+		dprintf(0, "ERROR: File is less than the header size (%zu bytes)!\n", sizeof(FaceHeaderN));
+		return 1;
+	}
+
+	// Index the headers. Nothing is decoded yet.
+	FaceIndex * fi = newFaceIndex(bytes->data, bytes->size);
+	if(fi == NULL) {
+		dprintf(0, "ERROR: Failed to index watch face.\n");
+		return 1;
+	}
+	const FaceHeaderN * h = (const FaceHeaderN *)fi->data;
+
+	// Print header info	
+	dprintf(2, "apiVer          %u\n", h->apiVer);
+	dprintf(2, "unknown         0x%04X\n", h->unknown);
+	dprintf(2, "previewOffset   0x%04X\n", h->previewOffset);
+	dprintf(2, "previewWidth    %u\n", h->previewWidth);
+	dprintf(2, "previewHeight   %u\n", h->previewHeight);
+	dprintf(2, "dhOffset        0x%04X\n", h->dhOffset);
+	dprintf(2, "bhOffset        0x%04X\n", h->bhOffset);
+	
+	// Create a buffer for storing the dump filenames
+	char dfnBuf[1024];
+	char fnBuf[64];
+	snprintf(dfnBuf, sizeof(dfnBuf), "%s%s", folderName, DIR_SEPERATOR);
+	size_t baseSize = strlen(dfnBuf);
+	if(baseSize + 64 >= sizeof(dfnBuf)) {
+		dprintf(0, "ERROR: dfnBuf too small!\n");
+		deleteFaceIndex(fi);
+		return 1;
+	}
+
+	// Images are dumped in parallel, while the JSON is streamed out in header order
+	int failed = 0;
+	DumpQueue * dq = NULL;
+	FILE * jsonFile = NULL;
+	JsonWriter jw;
+	if(dump) {
+		sprintf(&dfnBuf[baseSize], "watchface.json");
+		jsonFile = outputArchiving() ? tmpfile() : fopen(dfnBuf, "wb");		// archive entries are added whole
+		dq = newDumpQueue();
+		if(jsonFile == NULL || dq == NULL) {
+			dprintf(0, "ERROR: Failed to create %s\n", dfnBuf);
+			if(jsonFile != NULL) {
+				fclose(jsonFile);
+			}
+			dq = deleteDumpQueue(dq);
+			deleteFaceIndex(fi);
+			return 1;
+		}
+		dumpQueueSetDedupe(dq, opt->link);
+		dumpQueueSetCache(dq, opt->cache);
+		jsonwInit(&jw, jsonFile);
+		jsonwBeginObject(&jw, NULL);
+		jsonwString(&jw, "type_str", "extrathunder watchface");
+		jsonwInt(&jw, "rev", 0);
+		jsonwInt(&jw, "tpls", 0);
+		jsonwInt(&jw, "api_ver", fi->apiVer);
+		jsonwInt(&jw, "unknown", fi->unknown);
+
+		// Save the preview image
+		sprintf(fnBuf, "preview.%s", dumpFormatStr(format));
+		sprintf(&dfnBuf[baseSize], "%s", fnBuf);
+		failed += queueImage(dq, dfnBuf, fi, fi->preview, format);
+		jsonwImage(&jw, "preview_img_data", fi->preview, fnBuf);
+	}
+
+	u16 imageCounter = 0;			// A counter to count images
+	char sbuf[32];					// Buffer for temporary string data
+
+	// First the digits. They come before the background header
+
+	if(h->dhOffset != 0 && fi->digitsMarker != 0x0101) {
+		dprintf(0, "WARNING: Unknown start to digits section 0x%04X\n", fi->digitsMarker);
+	}
+	if(dump) {
+		jsonwBeginArray(&jw, "digits");
+	}
+	for(size_t d=0; d<fi->digitsCount; d++) {
+		const FaceDigits * dh = &fi->digits[d];
+		dprintf(2, "@ 0x%08zX  DigitsHeader (%u)\n", dh->headerOffset, dh->digitSet);
+		sprintf(sbuf, "digit[%u].owh", dh->digitSet);
+		printImages(dh->images, 10, sbuf);					// print all the details
+		if(dump) {
+			jsonwBeginObject(&jw, NULL);
+			jsonwInt(&jw, "digit_set", dh->digitSet);
+			jsonwBeginArray(&jw, "img_data");
+			for(size_t i=0; i<10; i++) {
+				sprintf(fnBuf, "digit_%u_%zu.%s", dh->digitSet, i, dumpFormatStr(format));
+				sprintf(&dfnBuf[baseSize], "%s", fnBuf);
+				failed += queueImage(dq, dfnBuf, fi, &dh->images[i], format);
+				jsonwImage(&jw, NULL, &dh->images[i], fnBuf);
+			}
+			jsonwEndArray(&jw);
+			jsonwInt(&jw, "unknown", dh->unknown);
+			jsonwEndObject(&jw);
+		}
+	}
+	if(dump) {
+		jsonwEndArray(&jw);
+	}
+
+	// Now the rest of the headers
+
+	if(dump) {
+		jsonwBeginArray(&jw, "elements");
+	}
+	for(size_t n=0; n<fi->elementCount; n++) {
+		const FaceElement * e = &fi->elements[n];
+		size_t offset = e->headerOffset;
+		switch(e->eType) {
+			case ET_IMAGE:
+				// ImageHeader for images (including the background)
+				if(offset == h->bhOffset) {
+					dprintf(2, "@ 0x%08zX  ImageHeader (Background)\n", offset);
+				} else {
+					dprintf(2, "@ 0x%08zX  ImageHeader\n", offset);
+				}
+				sprintf(fnBuf, "image_%u.%s", imageCounter++, dumpFormatStr(format));
+				dprintf(3, "imageh.one     0x%02X\n", e->header[0]);
+				dprintf(3, "imageh.xy      %3u, %3u\n", e->xy[0].x, e->xy[0].y);
+				dprintf(3, "imageh.owh     0x%08X, %3u, %3u\n", e->images[0].offset, e->images[0].width, e->images[0].height);
+				if(dump) {
+					sprintf(&dfnBuf[baseSize], "%s", fnBuf);
+					failed += queueImage(dq, dfnBuf, fi, &e->images[0], format);
+					jsonwBeginObject(&jw, NULL);
+					jsonwString(&jw, "e_type", "image");
+					jsonwInt(&jw, "x", e->xy[0].x);
+					jsonwInt(&jw, "y", e->xy[0].y);
+					jsonwImage(&jw, "img_data", &e->images[0], fnBuf);
+					jsonwEndObject(&jw);
+				}
+				break;
+			case ET_TIME:
+				// TimeHeader
+				dprintf(2, "@ 0x%08zX  TimeHeader\n", offset);
+				dprintf(3, "                digitSet: %u %u %u %u\n", e->digitSets[0], e->digitSets[1], e->digitSets[2], e->digitSets[3]);
+				if(dump) {
+					const TimeHeader * time = (const TimeHeader *)e->header;
+					jsonwBeginObject(&jw, NULL);
+					jsonwString(&jw, "e_type", "time_num");
+					int iArr[4] = { e->digitSets[0], e->digitSets[1], e->digitSets[2], e->digitSets[3] };
+					jsonwIntArray(&jw, "digit_sets", iArr, 4);
+					jsonwBeginArray(&jw, "xys");
+					for(int i=0; i<4; i++) {
+						jsonwBeginObject(&jw, NULL);
+						jsonwInt(&jw, "x", e->xy[i].x);
+						jsonwInt(&jw, "y", e->xy[i].y);
+						jsonwEndObject(&jw);
+					}
+					jsonwEndArray(&jw);
+					int unkArr[12];
+					for(int i=0; i<12; i++) {
+						unkArr[i] = time->unknown[i];
+					}
+					jsonwIntArray(&jw, "unknown", unkArr, 12);
+					jsonwEndObject(&jw);
+				}
+				break;
+			case ET_DAYNAME:
+				// DayNameHeader
+				dprintf(2, "@ 0x%08zX  DayNameHeader\n", offset);
+				if(dump) {
+					jsonwBeginObject(&jw, NULL);
+					jsonwString(&jw, "e_type", elementTypeStr(e->eType));
+					jsonwInt(&jw, "subtype", e->subtype);
+					jsonwInt(&jw, "x", e->xy[0].x);
+					jsonwInt(&jw, "y", e->xy[0].y);
+					jsonwBeginArray(&jw, "img_data");
+					for(size_t i=0; i<7; i++) {
+						sprintf(fnBuf, "dayname_%u_%zu.%s", e->subtype, i, dumpFormatStr(format));
+						sprintf(&dfnBuf[baseSize], "%s", fnBuf);
+						failed += queueImage(dq, dfnBuf, fi, &e->images[i], format);
+						jsonwImage(&jw, NULL, &e->images[i], fnBuf);
+					}
+					jsonwEndArray(&jw);
+					jsonwEndObject(&jw);
+				}
+				break;
+			case ET_BATTERYFILL:
+				// BatteryFillHeader
+				dprintf(2, "@ 0x%08zX  BatteryFillHeader\n", offset);
+				if(dump) {
+					const BatteryFillHeader * bf = (const BatteryFillHeader *)e->header;
+					jsonwBeginObject(&jw, NULL);
+					jsonwString(&jw, "e_type", elementTypeStr(e->eType));
+					jsonwInt(&jw, "x", e->xy[0].x);
+					jsonwInt(&jw, "y", e->xy[0].y);
+					jsonwBeginArray(&jw, "img_data");
+					for(size_t i=0; i<3; i++) {
+						sprintf(fnBuf, "batteryfill_%zu_.%s", i, dumpFormatStr(format));
+						sprintf(&dfnBuf[baseSize], "%s", fnBuf);
+						failed += queueImage(dq, dfnBuf, fi, &e->images[i], format);
+						jsonwImage(&jw, NULL, &e->images[i], fnBuf);
+					}
+					jsonwEndArray(&jw);
+					jsonwInt(&jw, "x1", bf->x1);
+					jsonwInt(&jw, "y1", bf->y1);
+					jsonwInt(&jw, "x2", bf->x2);
+					jsonwInt(&jw, "y2", bf->y2);
+					jsonwInt(&jw, "unknown", (long)bf->unknown);
+					jsonwInt(&jw, "unknown2", (long)bf->unknown2);
+					jsonwEndObject(&jw);
+				}
+				break;
+			case ET_HEARTRATENUM:
+			case ET_STEPSNUM:
+			case ET_KCALNUM:
+				// HeartRateNumHeader, StepsNumHeader, KCalNumHeader
+				if(e->eType == ET_HEARTRATENUM) {
+					dprintf(2, "@ 0x%08zX  HeartRateNumHeader\n", offset);
+				} else if(e->eType == ET_STEPSNUM) {
+					dprintf(2, "@ 0x%08zX  StepsNumHeader\n", offset);
+				} else {
+					dprintf(2, "@ 0x%08zX  KCalNumHeader\n", offset);
+				}
+				if(e->eType != ET_KCALNUM) {
+					dprintf(3, "                digitSet: %u, justification: %u\n", e->digitSet, e->justification);
+				}
+				if(dump) {
+					jsonwBeginObject(&jw, NULL);
+					jsonwString(&jw, "e_type", elementTypeStr(e->eType));
+					jsonwInt(&jw, "digit_set", e->digitSet);
+					jsonwInt(&jw, "justification", e->justification);
+					jsonwInt(&jw, "x", e->xy[0].x);
+					jsonwInt(&jw, "y", e->xy[0].y);
+					jsonwBytes(&jw, "unknown", &e->header[8], e->headerSize - 8);
+					jsonwEndObject(&jw);
+				}
+				break;
+			case ET_HANDS:
+				// HandsHeader
+				dprintf(2, "@ 0x%08zX  HandsHeader\n", offset);
+				if(dump) {
+					sprintf(fnBuf, "hand_%u.%s", e->subtype, dumpFormatStr(format));
+					sprintf(&dfnBuf[baseSize], "%s", fnBuf);
+					failed += queueImage(dq, dfnBuf, fi, &e->images[0], format);
+					jsonwBeginObject(&jw, NULL);
+					jsonwString(&jw, "e_type", elementTypeStr(e->eType));
+					jsonwInt(&jw, "subtype", e->subtype);
+					jsonwInt(&jw, "x", e->xy[0].x);
+					jsonwInt(&jw, "y", e->xy[0].y);
+					jsonwInt(&jw, "unknown_x", e->xy[1].x);
+					jsonwInt(&jw, "unknown_y", e->xy[1].y);
+					jsonwImage(&jw, "img_data", &e->images[0], fnBuf);
+					jsonwEndObject(&jw);
+				}
+				break;
+			case ET_DAYNUM:
+			case ET_MONTHNUM:
+				// DayNumHeader, MonthNumHeader
+				if(e->eType == ET_DAYNUM) {
+					dprintf(2, "@ 0x%08zX  DayNumHeader\n", offset);
+				} else {
+					dprintf(2, "@ 0x%08zX  MonthNumHeader\n", offset);
+				}
+				dprintf(3, "                digitSet: %u, justification: %u\n", e->digitSet, e->justification);
+				if(dump) {
+					jsonwBeginObject(&jw, NULL);
+					jsonwString(&jw, "e_type", elementTypeStr(e->eType));
+					jsonwInt(&jw, "digit_set", e->digitSet);
+					jsonwInt(&jw, "justification", e->justification);
+					jsonwBeginArray(&jw, "xys");
+					for(int i=0; i<2; i++) {
+						jsonwBeginObject(&jw, NULL);
+						jsonwInt(&jw, "x", e->xy[i].x);
+						jsonwInt(&jw, "y", e->xy[i].y);
+						jsonwEndObject(&jw);
+					}
+					jsonwEndArray(&jw);
+					jsonwEndObject(&jw);
+				}
+				break;
+			case ET_BARDISPLAY:
+				// BarDisplayHeader
+				dprintf(2, "@ 0x%08zX  BarDisplayHeader. subtype: %u. count: %zu.\n", offset, e->subtype, e->imageCount);
+				if(dump) {
+					jsonwBeginObject(&jw, NULL);
+					jsonwString(&jw, "e_type", elementTypeStr(e->eType));
+					jsonwInt(&jw, "subtype", e->subtype);
+					jsonwInt(&jw, "x", e->xy[0].x);
+					jsonwInt(&jw, "y", e->xy[0].y);
+					jsonwBeginArray(&jw, "img_data");
+					for(size_t i=0; i<e->imageCount; i++) {
+						sprintf(fnBuf, "bardisplay_%u_%zu.%s", e->subtype, i, dumpFormatStr(format));
+						sprintf(&dfnBuf[baseSize], "%s", fnBuf);
+						failed += queueImage(dq, dfnBuf, fi, &e->images[i], format);
+						jsonwImage(&jw, NULL, &e->images[i], fnBuf);
+					}
+					jsonwEndArray(&jw);
+					jsonwEndObject(&jw);
+				}
+				break;
+			case ET_WEATHER:
+				// WeatherHeader
+				dprintf(2, "@ 0x%08zX  WeatherHeader. count: %u.\n", offset, e->header[2]);
+				if(dump) {
+					jsonwBeginObject(&jw, NULL);
+					jsonwString(&jw, "e_type", elementTypeStr(e->eType));
+					jsonwInt(&jw, "count", e->header[2]);
+					jsonwInt(&jw, "x", e->xy[0].x);
+					jsonwInt(&jw, "y", e->xy[0].y);
+					jsonwBeginArray(&jw, "img_data");
+					for(size_t i=0; i<e->imageCount; i++) {
+						sprintf(fnBuf, "weather_%u_%zu.%s", e->header[2], i, dumpFormatStr(format));
+						sprintf(&dfnBuf[baseSize], "%s", fnBuf);
+						failed += queueImage(dq, dfnBuf, fi, &e->images[i], format);
+						jsonwImage(&jw, NULL, &e->images[i], fnBuf);
+					}
+					jsonwEndArray(&jw);
+					jsonwEndObject(&jw);
+				}
+				break;
+			case ET_UNKNOWN1D:
+				dprintf(1, "@ 0x%08zX  Unknown1D01Header. unknown: %u.\n", offset, e->header[2]);
+				if(dump) {
+					jsonwBeginObject(&jw, NULL);
+					jsonwString(&jw, "e_type", elementTypeStr(e->eType));
+					jsonwInt(&jw, "unknown", e->header[2]);
+					jsonwEndObject(&jw);
+				}
+				break;
+			case ET_DASH:
+				dprintf(1, "@ 0x%08zX  DashHeader.\n", offset);
+				if(dump) {
+					sprintf(fnBuf, "dash.%s", dumpFormatStr(format));
+					sprintf(&dfnBuf[baseSize], "%s", fnBuf);
+					failed += queueImage(dq, dfnBuf, fi, &e->images[0], format);
+					jsonwBeginObject(&jw, NULL);
+					jsonwString(&jw, "e_type", elementTypeStr(e->eType));
+					jsonwImage(&jw, "img_data", &e->images[0], fnBuf);
+					jsonwEndObject(&jw);
+				}
+				break;
+		}
+	}
+	if(fi->truncated) {
+		if(fi->endOffset + 2 <= fi->size) {
+			dprintf(0, "@ 0x%08zX  UNKNOWN TYPE 0x%02X (one=0x%02X)\n", fi->endOffset, fi->data[fi->endOffset+1], fi->data[fi->endOffset]);
+			dprintf(0, "ERROR: Unknown e_type found. Stopping early.\n");
+		} else {
+			dprintf(0, "ERROR: Headers run past the end of the file. Stopping early.\n");
+		}
+	} else {
+		dprintf(2, "@ 0x%08zX  00 (End of headers)\n", fi->endOffset - 2);
+	}
+
+	// if we are dumping, close off the json file, then wait for the images
+	if(dump) {
+		jsonwEndArray(&jw);
+		jsonwEndObject(&jw);
+		sprintf(&dfnBuf[baseSize], "watchface.json");
+		bool jsonOk = (jsonwFinish(&jw) == 0);
+		dumpQueueFinish(dq);		// images go into an archive as they finish, so the json goes in after them
+		if(!jsonOk || (outputArchiving() && outputFileFromStream(dfnBuf, jsonFile) != 0)) {
+			dprintf(0, "ERROR: Failed to write %s\n", dfnBuf);
+			failed++;
+		}
+		fclose(jsonFile);
+
+		for(size_t i=0; i<dumpQueueCount(dq); i++) {
+			if(dumpQueueResult(dq, i, NULL) != 0) {
+				failed++;
+			}
+		}
+		if(failed > 0) {
+			dprintf(0, "WARNING: %d file(s) failed to dump.\n", failed);
+		}
+	}
+
+	// render a frame, if requested
+	if(opt->render) {
+		snprintf(&dfnBuf[baseSize], sizeof(dfnBuf) - baseSize, "%s", opt->renderName);
+		int rv = (opt->frames > 1) ? renderAnimation(fi, opt, dfnBuf) : renderToFile(fi, &opt->renderState, dfnBuf);
+		if(rv != 0) {
+			failed++;
+		}
+	}
+
+	// clean up
+	dq = deleteDumpQueue(dq);
+	fi = deleteFaceIndex(fi);
+
+	return (failed > 0) ? 1 : 0;
+}
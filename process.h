@@ -0,0 +1,27 @@
+// process.h
+// dump and render one watch face
+
+//----------------------------------------------------------------------------
+//  PROCESS OPTIONS - what to do with each face
+//----------------------------------------------------------------------------
+typedef struct _ProcessOptions {
+	Format format;				// format of dumped images
+	bool dump;					// dump images and watchface.json
+	bool link;					// hard link identical images instead of dumping them again
+	ImageCache * cache;			// converted images kept across runs, or NULL
+	bool render;				// render a preview frame
+	const char * renderName;	// file name of the rendered frame, inside the output folder
+	RenderState renderState;	// time and sensor values to render with
+	time_t renderTime;			// time of the first (or only) rendered frame
+	unsigned frames;			// frames to render, more than 1 for an animation
+	int frameStep;				// seconds between frames
+	bool video;					// write an animation as one raw video file, not a BMP per frame
+} ProcessOptions;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+int parseTime(const char * str, time_t * t);
+int processFace(const char * fileName, const char * folderName, const ProcessOptions * opt);
+int processFaceBytes(const Bytes * bytes, const char * folderName, const ProcessOptions * opt);
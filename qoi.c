@@ -0,0 +1,296 @@
+/*  qoi.c - QOI image encoder and decoder
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	QOI is lossless and keeps alpha like PNG, but needs only one pass with a 64 entry
+	table of recent colours, so it encodes and decodes at close to memory speed. Pixels
+	are stored as RGBA; our ARGB8888 is b, g, r, a in memory, so channels are swapped on
+	the way in and out. Files are written with 4 channels and the sRGB colorspace.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "pool.h"
+#include "rle.h"
+#include "qoi.h"
+
+#define QOI_OP_INDEX	0x00		// 00xxxxxx
+#define QOI_OP_DIFF		0x40		// 01xxxxxx
+#define QOI_OP_LUMA		0x80		// 10xxxxxx
+#define QOI_OP_RUN		0xC0		// 11xxxxxx
+#define QOI_OP_RGB		0xFE
+#define QOI_OP_RGBA		0xFF
+#define QOI_MASK_2		0xC0
+#define QOI_MAX_RUN		62			// 63 and 64 would clash with QOI_OP_RGB and QOI_OP_RGBA
+
+static const u8 QOI_END[QOI_END_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+typedef struct _QoiPixel {
+	u8 r, g, b, a;
+} QoiPixel;
+
+static int qoiHash(QoiPixel p) {
+	return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) & 63;
+}
+
+static bool qoiSame(QoiPixel p, QoiPixel q) {
+	return p.r == q.r && p.g == q.g && p.b == q.b && p.a == q.a;
+}
+
+static u32 get_u32be(const u8 * p) {
+	return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+}
+
+static u8 * put_u32be(u8 * p, u32 v) {
+	p[0] = (u8)(v >> 24);
+	p[1] = (u8)(v >> 16);
+	p[2] = (u8)(v >> 8);
+	p[3] = (u8)v;
+	return p + 4;
+}
+
+//----------------------------------------------------------------------------
+//  HEADER
+//----------------------------------------------------------------------------
+
+bool isQOI(const u8 * data, size_t size) {
+	return size >= 4 && memcmp(data, "qoif", 4) == 0;
+}
+
+// Check the header and get the size. Returns 0 on success.
+int qoiReadHeader(const u8 * data, size_t size, u32 * width, u32 * height) {
+	if(size < QOI_HEADER_SIZE + QOI_END_SIZE || !isQOI(data, size)) {
+		printf("ERROR: Not a QOI file.\n");
+		return 1;
+	}
+	u32 w = get_u32be(&data[4]);
+	u32 h = get_u32be(&data[8]);
+	u8 channels = data[12];
+	u8 colorspace = data[13];
+	if(w == 0 || h == 0 || (u64)w * h > QOI_MAX_PIXELS) {
+		printf("ERROR: QOI size %u x %u is not supported.\n", w, h);
+		return 1;
+	}
+	if((channels != 3 && channels != 4) || colorspace > 1) {
+		printf("ERROR: QOI header is invalid.\n");
+		return 1;
+	}
+	*width = w;
+	*height = h;
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//  ENCODE
+//----------------------------------------------------------------------------
+
+// Encode width * height ARGB8888 pixels as a complete QOI file
+Bytes * qoiEncode8888(const u8 * argb8888, u32 width, u32 height) {
+	if(width == 0 || height == 0 || (u64)width * height > QOI_MAX_PIXELS) {
+		printf("ERROR: A QOI can't be %u x %u\n", width, height);
+		return NULL;
+	}
+	size_t count = (size_t)width * height;
+	// worst case is QOI_OP_RGBA for every pixel
+	Bytes * b = newBytes(QOI_HEADER_SIZE + count * 5 + QOI_END_SIZE);
+	if(b == NULL) {
+		printf("ERROR: Out of memory\n");
+		return NULL;
+	}
+
+	u8 * p = b->data;
+	memcpy(p, "qoif", 4);
+	p = put_u32be(&p[4], width);
+	p = put_u32be(p, height);
+	*p++ = 4;		// RGBA
+	*p++ = 0;		// sRGB with linear alpha
+
+	QoiPixel index[64];
+	memset(index, 0, sizeof(index));
+	QoiPixel prev = { 0, 0, 0, 255 };
+	unsigned run = 0;
+
+	for(size_t i=0; i<count; i++) {
+		const u8 * s = &argb8888[i * 4];
+		QoiPixel px = { s[2], s[1], s[0], s[3] };
+
+		if(qoiSame(px, prev)) {
+			run++;
+			if(run == QOI_MAX_RUN || i == count - 1) {
+				*p++ = (u8)(QOI_OP_RUN | (run - 1));
+				run = 0;
+			}
+			continue;
+		}
+		if(run > 0) {
+			*p++ = (u8)(QOI_OP_RUN | (run - 1));
+			run = 0;
+		}
+
+		int h = qoiHash(px);
+		if(qoiSame(index[h], px)) {
+			*p++ = (u8)(QOI_OP_INDEX | h);
+		} else {
+			index[h] = px;
+			if(px.a == prev.a) {
+				i8 dr = (i8)(px.r - prev.r);
+				i8 dg = (i8)(px.g - prev.g);
+				i8 db = (i8)(px.b - prev.b);
+				i8 dgr = (i8)(dr - dg);
+				i8 dgb = (i8)(db - dg);
+				if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+					*p++ = (u8)(QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+				} else if(dg >= -32 && dg <= 31 && dgr >= -8 && dgr <= 7 && dgb >= -8 && dgb <= 7) {
+					*p++ = (u8)(QOI_OP_LUMA | (dg + 32));
+					*p++ = (u8)(((dgr + 8) << 4) | (dgb + 8));
+				} else {
+					*p++ = QOI_OP_RGB;
+					*p++ = px.r;
+					*p++ = px.g;
+					*p++ = px.b;
+				}
+			} else {
+				*p++ = QOI_OP_RGBA;
+				*p++ = px.r;
+				*p++ = px.g;
+				*p++ = px.b;
+				*p++ = px.a;
+			}
+		}
+		prev = px;
+	}
+
+	memcpy(p, QOI_END, QOI_END_SIZE);
+	p += QOI_END_SIZE;
+	b->size = (size_t)(p - b->data);		// the rest of the allocation is just unused
+	return b;
+}
+
+//----------------------------------------------------------------------------
+//  DECODE
+//----------------------------------------------------------------------------
+
+// Decode a complete QOI file into width * height ARGB8888 pixels. The size must match the header.
+// Returns 0 on success.
+int qoiDecode8888(const u8 * data, size_t size, u8 * argb8888, u32 width, u32 height) {
+	u32 w, h;
+	if(qoiReadHeader(data, size, &w, &h) != 0) {
+		return 1;
+	}
+	if(w != width || h != height) {
+		printf("ERROR: QOI is %u x %u, expected %u x %u\n", w, h, width, height);
+		return 1;
+	}
+
+	size_t count = (size_t)width * height;
+	size_t pos = QOI_HEADER_SIZE;
+	size_t end = size - QOI_END_SIZE;		// ops never run into the end marker
+	QoiPixel index[64];
+	memset(index, 0, sizeof(index));
+	QoiPixel px = { 0, 0, 0, 255 };
+	unsigned run = 0;
+
+	for(size_t i=0; i<count; i++) {
+		if(run > 0) {
+			run--;
+		} else {
+			if(pos >= end) {
+				printf("ERROR: QOI data is truncated.\n");
+				return 1;
+			}
+			u8 op = data[pos++];
+			if(op == QOI_OP_RGB || op == QOI_OP_RGBA) {
+				size_t n = (op == QOI_OP_RGB) ? 3 : 4;
+				if(pos + n > end) {
+					printf("ERROR: QOI data is truncated.\n");
+					return 1;
+				}
+				px.r = data[pos];
+				px.g = data[pos+1];
+				px.b = data[pos+2];
+				if(op == QOI_OP_RGBA) {
+					px.a = data[pos+3];
+				}
+				pos += n;
+			} else if((op & QOI_MASK_2) == QOI_OP_INDEX) {
+				px = index[op];
+			} else if((op & QOI_MASK_2) == QOI_OP_DIFF) {
+				px.r = (u8)(px.r + ((op >> 4) & 3) - 2);
+				px.g = (u8)(px.g + ((op >> 2) & 3) - 2);
+				px.b = (u8)(px.b + (op & 3) - 2);
+			} else if((op & QOI_MASK_2) == QOI_OP_LUMA) {
+				if(pos >= end) {
+					printf("ERROR: QOI data is truncated.\n");
+					return 1;
+				}
+				u8 b2 = data[pos++];
+				int dg = (op & 0x3F) - 32;
+				px.r = (u8)(px.r + dg - 8 + ((b2 >> 4) & 0x0F));
+				px.g = (u8)(px.g + dg);
+				px.b = (u8)(px.b + dg - 8 + (b2 & 0x0F));
+			} else { // QOI_OP_RUN
+				run = op & 0x3F;
+			}
+			index[qoiHash(px)] = px;
+		}
+		u8 * d = &argb8888[i * 4];
+		d[0] = px.b;
+		d[1] = px.g;
+		d[2] = px.r;
+		d[3] = px.a;
+	}
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//  RLENEWTOQOI
+//----------------------------------------------------------------------------
+
+typedef struct _RleToQOICtx {
+	const u8 * imgData;
+	size_t size;
+	u8 * pixels;
+	u32 width;
+	u32 height;
+} RleToQOICtx;
+
+static int rleToQOIRowTask(void * ctx, size_t y) {
+	RleToQOICtx * c = (RleToQOICtx *)ctx;
+	u8 * dst = &c->pixels[y * c->width * 4];
+	size_t srcSize;
+	const u8 * src = rleNewRow(c->imgData, c->size, c->height, (u32)y, &srcSize);
+	if(src == NULL) {
+		memset(dst, 0, (size_t)c->width * 4);
+		return 1;
+	}
+	return rleNewDecodeRow8888(src, srcSize, dst, c->width);
+}
+
+// Decode RLE_NEW image data (starting at the row table, size bytes in all) to a QOI file in memory.
+// Rows are decoded in parallel; the encode itself is one pass.
+Bytes * rleNewToQOI(const u8 * imgData, size_t size, u32 width, u32 height) {
+	u8 * pixels = malloc((size_t)width * height * 4);
+	if(pixels == NULL) {
+		printf("ERROR: Out of memory\n");
+		return NULL;
+	}
+	RleToQOICtx ctx = { imgData, size, pixels, width, height };
+	if(poolForChecked(defaultPool(), height, rleToQOIRowTask, &ctx) != 0) {
+		printf("WARNING: Some rows of RLE image did not decode cleanly\n");
+	}
+	Bytes * b = qoiEncode8888(pixels, width, height);
+	free(pixels);
+	return b;
+}
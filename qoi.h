@@ -0,0 +1,20 @@
+// qoi.h
+// "Quite OK Image" format (qoiformat.org), encoded from and decoded to ARGB8888
+
+//----------------------------------------------------------------------------
+//  QOI LAYOUT
+//----------------------------------------------------------------------------
+
+#define QOI_HEADER_SIZE 14				// "qoif", u32 width, u32 height (big-endian), channels, colorspace
+#define QOI_END_SIZE 8					// seven 0x00 bytes then 0x01
+#define QOI_MAX_PIXELS 400000000		// as in the reference decoder
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+bool isQOI(const u8 * data, size_t size);
+int qoiReadHeader(const u8 * data, size_t size, u32 * width, u32 * height);
+Bytes * qoiEncode8888(const u8 * argb8888, u32 width, u32 height);
+int qoiDecode8888(const u8 * data, size_t size, u8 * argb8888, u32 width, u32 height);
+Bytes * rleNewToQOI(const u8 * imgData, size_t size, u32 width, u32 height);
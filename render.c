@@ -0,0 +1,596 @@
+/*  render.c - composite a watch face for a given time and sensor state
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Elements are drawn in header order (the background comes first) into an ARGB8888
+	frame, alpha blending each image over what is already there. Images are decoded a
+	row at a time, and only the rows and columns inside the clip rectangle are touched.
+
+	Several header fields are still guesses (see face_new.h). Where the renderer depends
+	on one, the guess is noted next to the code that uses it.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "types.h"
+#include "face_new.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "pixel.h"
+#include "rle.h"
+#include "face.h"
+#include "render.h"
+#include "hand.h"
+
+//----------------------------------------------------------------------------
+//  RENDER STATE
+//----------------------------------------------------------------------------
+
+// Set the date and time fields from t, in local time
+void renderStateSetTime(RenderState * s, time_t t) {
+	struct tm * tm = localtime(&t);
+	if(tm != NULL) {
+		s->hour = tm->tm_hour;
+		s->minute = tm->tm_min;
+		s->second = tm->tm_sec;
+		s->day = tm->tm_mday;
+		s->month = tm->tm_mon + 1;
+		s->weekday = tm->tm_wday;
+	}
+}
+
+// The current time, with typical sensor values for a preview
+void renderStateInit(RenderState * s) {
+	memset(s, 0, sizeof(RenderState));
+	renderStateSetTime(s, time(NULL));
+	s->steps = 6789;
+	s->heartRate = 72;
+	s->battery = 80;
+	s->kcal = 234;
+	s->weather = 0;
+}
+
+//----------------------------------------------------------------------------
+//  PIXEL AND IMAGE DRAWING
+//----------------------------------------------------------------------------
+
+static int imax(int a, int b) {
+	return a > b ? a : b;
+}
+
+static int imin(int a, int b) {
+	return a < b ? a : b;
+}
+
+static RenderRect intersectRect(RenderRect a, RenderRect b) {
+	RenderRect r = { imax(a.x0, b.x0), imax(a.y0, b.y0), imin(a.x1, b.x1), imin(a.y1, b.y1) };
+	return r;
+}
+
+// Draw an image with its top left corner at x, y
+static int drawImage(Img * frame, RenderRect clip, const FaceIndex * fi, const FaceImage * img, int x, int y) {
+	if(img->size == 0) {
+		return (img->height == 0) ? 0 : 1;		// empty is fine, out of bounds isn't
+	}
+	RenderRect r = { x, y, x + img->width, y + img->height };
+	r = intersectRect(r, clip);
+	if(r.x0 >= r.x1 || r.y0 >= r.y1) {
+		return 0;
+	}
+
+	// blend straight from the compressed rows, no decoded copy
+	const u8 * imgData = &fi->data[img->offset];
+	int errors = 0;
+	for(int fy=r.y0; fy<r.y1; fy++) {
+		size_t rowSize;
+		const u8 * src = rleNewRow(imgData, img->size, img->height, (u32)(fy - y), &rowSize);
+		if(src == NULL) {
+			errors++;
+			continue;
+		}
+		u8 * d = &frame->data[((size_t)fy * frame->w + r.x0) * 4];
+		if(rleNewBlendRow8888(src, rowSize, d, img->width, (u32)(r.x0 - x), (u32)(r.x1 - x)) != 0) {
+			errors++;
+		}
+	}
+	return errors ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+//  NUMBERS
+//----------------------------------------------------------------------------
+
+static const FaceDigits * findDigits(const FaceIndex * fi, u8 digitSet) {
+	for(size_t i=0; i<fi->digitsCount; i++) {
+		if(fi->digits[i].digitSet == digitSet) {
+			return &fi->digits[i];
+		}
+	}
+	return NULL;
+}
+
+// Format value into str (16 bytes) and return the x of its first digit. width, if not NULL, gets the total width.
+static int numberLayout(const FaceDigits * digits, u8 justification, int value, int x, char * str, int * width) {
+	snprintf(str, 16, "%d", value < 0 ? 0 : value);
+	int w = 0;
+	for(const char * c = str; *c; c++) {
+		w += digits->images[*c - '0'].width;
+	}
+	if(width != NULL) {
+		*width = w;
+	}
+	if(justification == 1) {
+		return x - w / 2;
+	} else if(justification == 2) {
+		return x - w;
+	}
+	return x;
+}
+
+// Draw value in a digit set. Justification is a guess: 0 = x is the left edge, 1 = centred on x, 2 = x is the right edge.
+static int drawNumber(Img * frame, RenderRect clip, const FaceIndex * fi, u8 digitSet, u8 justification, int value, int x, int y) {
+	const FaceDigits * digits = findDigits(fi, digitSet);
+	if(digits == NULL) {
+		return 1;
+	}
+	char str[16];
+	x = numberLayout(digits, justification, value, x, str, NULL);
+
+	int errors = 0;
+	for(const char * c = str; *c; c++) {
+		const FaceImage * img = &digits->images[*c - '0'];
+		errors += drawImage(frame, clip, fi, img, x, y);
+		x += img->width;
+	}
+	return errors;
+}
+
+// Draw a single digit at a fixed position
+static int drawDigit(Img * frame, RenderRect clip, const FaceIndex * fi, u8 digitSet, int digit, XY xy) {
+	const FaceDigits * digits = findDigits(fi, digitSet);
+	if(digits == NULL) {
+		return 1;
+	}
+	return drawImage(frame, clip, fi, &digits->images[digit % 10], xy.x, xy.y);
+}
+
+//----------------------------------------------------------------------------
+//  HANDS
+//----------------------------------------------------------------------------
+
+// Clockwise angle of a hand, HAND_TURN to a full turn. Subtype 0 = hour, 1 = minute, 2 = second.
+static u32 handAngle(u8 subtype, const RenderState * s) {
+	switch(subtype) {
+		case 0: return (u32)(((s->hour % 12) * 3600 + s->minute * 60 + s->second) * (int64_t)HAND_TURN / (12 * 3600));
+		case 1: return (u32)((s->minute * 60 + s->second) * (int64_t)HAND_TURN / 3600);
+		case 2: return (u32)(s->second * (int64_t)HAND_TURN / 60);
+	}
+	return 0;
+}
+
+// Hand images point to 12 o'clock. The pivot within the image is taken from unknownXY when it lies inside the
+// image (a guess), otherwise the bottom centre is used. The pivot is placed at the header's x, y.
+// Returns 1 if the image is too big for a 16.16 pivot.
+static int handPivot(const FaceElement * e, const FaceImage * img, i32 * px, i32 * py) {
+	if(img->width > 0x7FFF || img->height > 0x7FFF) {
+		return 1;
+	}
+	*px = (i32)img->width * (HAND_ONE / 2);
+	*py = (i32)img->height * HAND_ONE;
+	XY pivot = e->xy[1];
+	if((pivot.x != 0 || pivot.y != 0) && pivot.x < img->width && pivot.y < img->height) {
+		*px = (i32)pivot.x * HAND_ONE;
+		*py = (i32)pivot.y * HAND_ONE;
+	}
+	return 0;
+}
+
+static int drawHand(Img * frame, RenderRect clip, const FaceIndex * fi, const FaceElement * e, const RenderState * s) {
+	const FaceImage * img = &e->images[0];
+	if(img->size == 0) {
+		return (img->height == 0) ? 0 : 1;
+	}
+	i32 px, py;
+	if(handPivot(e, img, &px, &py) != 0) {
+		return 1;
+	}
+	// don't decode a hand that lies outside the clip
+	RenderRect box;
+	handBounds(img->width, img->height, px, py, e->xy[0].x, e->xy[0].y, handAngle(e->subtype, s), &box);
+	box = intersectRect(box, clip);
+	if(box.x0 >= box.x1 || box.y0 >= box.y1) {
+		return 0;
+	}
+
+	HandSprite * h = newHandSprite(&fi->data[img->offset], img->size, img->width, img->height);
+	if(h == NULL) {
+		return 1;
+	}
+	handDraw(frame, &clip, h, px, py, e->xy[0].x, e->xy[0].y, handAngle(e->subtype, s));
+	int errors = h->errors;
+	h = deleteHandSprite(h);
+	return errors ? 1 : 0;
+}
+
+//----------------------------------------------------------------------------
+//  ELEMENTS
+//----------------------------------------------------------------------------
+
+// Pick one of count images for value in [lo, hi]
+static size_t rangeIndex(int value, int lo, int hi, size_t count) {
+	if(count == 0 || value <= lo) {
+		return 0;
+	}
+	if(value >= hi) {
+		return count - 1;
+	}
+	return (size_t)((long)(value - lo) * (long)count / (hi - lo + 1));
+}
+
+// Bar display subtype is its data source: 0 = steps, 2 = kcal, 5 = heart rate, 6 = battery
+static size_t barIndex(const FaceElement * e, const RenderState * s) {
+	switch(e->subtype) {
+		case 0: return rangeIndex(s->steps, 0, RENDER_STEPS_GOAL, e->imageCount);
+		case 2: return rangeIndex(s->kcal, 0, RENDER_KCAL_GOAL, e->imageCount);
+		case 5: return rangeIndex(s->heartRate, RENDER_HR_MIN, RENDER_HR_MAX, e->imageCount);
+		case 6: return rangeIndex(s->battery, 0, 100, e->imageCount);
+	}
+	return 0;
+}
+
+// The battery image, then the last image (a guess: 'full') cropped to the fill region in proportion to the charge
+static int drawBatteryFill(Img * frame, RenderRect clip, const FaceIndex * fi, const FaceElement * e, const RenderState * s) {
+	int x = e->xy[0].x;
+	int y = e->xy[0].y;
+	int errors = drawImage(frame, clip, fi, &e->images[0], x, y);
+
+	int battery = imax(0, imin(100, s->battery));
+	int fx0 = x + e->fill[0];
+	int fx1 = x + e->fill[2];
+	RenderRect fill = { fx0, y + e->fill[1], fx0 + (fx1 - fx0) * battery / 100, y + e->fill[3] };
+	errors += drawImage(frame, intersectRect(fill, clip), fi, &e->images[2], fx0, y + e->fill[1]);
+	return errors;
+}
+
+static int drawElement(Img * frame, RenderRect clip, const FaceIndex * fi, const FaceElement * e, const RenderState * s) {
+	switch(e->eType) {
+		case ET_IMAGE:
+			return drawImage(frame, clip, fi, &e->images[0], e->xy[0].x, e->xy[0].y);
+		case ET_TIME: {
+			int digits[4] = { s->hour / 10, s->hour % 10, s->minute / 10, s->minute % 10 };
+			int errors = 0;
+			for(int i=0; i<4; i++) {
+				errors += drawDigit(frame, clip, fi, e->digitSets[i], digits[i], e->xy[i]);
+			}
+			return errors;
+		}
+		case ET_DAYNAME:
+			return drawImage(frame, clip, fi, &e->images[s->weekday % 7], e->xy[0].x, e->xy[0].y);
+		case ET_BATTERYFILL:
+			return drawBatteryFill(frame, clip, fi, e, s);
+		case ET_HEARTRATENUM:
+			return drawNumber(frame, clip, fi, e->digitSet, e->justification, s->heartRate, e->xy[0].x, e->xy[0].y);
+		case ET_STEPSNUM:
+			return drawNumber(frame, clip, fi, e->digitSet, e->justification, s->steps, e->xy[0].x, e->xy[0].y);
+		case ET_KCALNUM:
+			return drawNumber(frame, clip, fi, e->digitSet, e->justification, s->kcal, e->xy[0].x, e->xy[0].y);
+		case ET_HANDS:
+			return drawHand(frame, clip, fi, e, s);
+		case ET_DAYNUM:
+			return drawDigit(frame, clip, fi, e->digitSet, s->day / 10, e->xy[0])
+				+ drawDigit(frame, clip, fi, e->digitSet, s->day % 10, e->xy[1]);
+		case ET_MONTHNUM:
+			return drawDigit(frame, clip, fi, e->digitSet, s->month / 10, e->xy[0])
+				+ drawDigit(frame, clip, fi, e->digitSet, s->month % 10, e->xy[1]);
+		case ET_BARDISPLAY:
+			if(e->imageCount == 0) {
+				return 0;
+			}
+			return drawImage(frame, clip, fi, &e->images[barIndex(e, s)], e->xy[0].x, e->xy[0].y);
+		case ET_WEATHER:
+			if(s->weather < 0 || (size_t)s->weather >= e->imageCount) {
+				return 0;
+			}
+			return drawImage(frame, clip, fi, &e->images[s->weather], e->xy[0].x, e->xy[0].y);
+	}
+	// the dash has no position of its own, and 0x1D draws nothing we know of
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//  RENDERFACE
+//----------------------------------------------------------------------------
+
+// Screen size: the background image, which is the first header. Falls back to the GTS3 screen
+// if there is no background, or it is damaged or too big.
+void renderFaceSize(const FaceIndex * fi, u32 * width, u32 * height) {
+	*width = 240;
+	*height = 296;
+	if(fi->elementCount > 0 && fi->elements[0].eType == ET_IMAGE) {
+		const FaceImage * bg = &fi->elements[0].images[0];
+		if(bg->size != 0 && bg->width > 0 && bg->height > 0 && bg->width <= RENDER_MAX_SCREEN && bg->height <= RENDER_MAX_SCREEN) {
+			*width = bg->width;
+			*height = bg->height;
+		}
+	}
+}
+
+// Draw every element that touches clip (NULL for the whole frame) into an ARGB8888 frame.
+// Returns the number of images that couldn't be drawn.
+int renderFaceInto(Img * frame, const RenderRect * clip, const FaceIndex * fi, const RenderState * s) {
+	RenderRect r = { 0, 0, (int)frame->w, (int)frame->h };
+	if(clip != NULL) {
+		r = intersectRect(r, *clip);
+	}
+	int errors = 0;
+	for(size_t i=0; i<fi->elementCount; i++) {
+		errors += drawElement(frame, r, fi, &fi->elements[i], s);
+	}
+	return errors;
+}
+
+// Fill r (already inside the frame) with opaque black
+static void clearRect(Img * frame, RenderRect r) {
+	for(int y=r.y0; y<r.y1; y++) {
+		u8 * p = &frame->data[((size_t)y * frame->w + r.x0) * 4];
+		for(int x=r.x0; x<r.x1; x++, p+=4) {
+			p[0] = 0;
+			p[1] = 0;
+			p[2] = 0;
+			p[3] = 0xFF;
+		}
+	}
+}
+
+// An opaque black ARGB8888 frame the size of the face, or NULL if out of memory
+static Img * newFrame(const FaceIndex * fi) {
+	u32 w, h;
+	renderFaceSize(fi, &w, &h);
+	size_t size = (size_t)w * h * 4;
+	if(size > UINT32_MAX) {
+		return NULL;
+	}
+	Img * frame = malloc(sizeof(Img));
+	if(frame == NULL) {
+		return NULL;
+	}
+	frame->w = w;
+	frame->h = h;
+	frame->format = IF_ARGB8888;
+	frame->size = (u32)size;
+	frame->data = malloc(frame->size);
+	if(frame->data == NULL) {
+		free(frame);
+		return NULL;
+	}
+	RenderRect all = { 0, 0, (int)w, (int)h };
+	clearRect(frame, all);
+	return frame;
+}
+
+// Render the whole face onto opaque black. Returns an ARGB8888 Img, or NULL if out of memory.
+Img * renderFace(const FaceIndex * fi, const RenderState * s) {
+	Img * frame = newFrame(fi);
+	if(frame == NULL) {
+		return NULL;
+	}
+	renderFaceInto(frame, NULL, fi, s);
+	return frame;
+}
+
+//----------------------------------------------------------------------------
+//  ANIMATION - successive frames, redrawing only what changed
+//----------------------------------------------------------------------------
+
+// Everything an element's appearance depends on, as a number. An element is redrawn when this changes.
+static u32 elementKey(const FaceElement * e, const RenderState * s) {
+	switch(e->eType) {
+		case ET_TIME: return (u32)(s->hour * 100 + s->minute);
+		case ET_DAYNAME: return (u32)(s->weekday % 7);
+		case ET_BATTERYFILL: return (u32)imax(0, imin(100, s->battery));
+		case ET_HEARTRATENUM: return (u32)s->heartRate;
+		case ET_STEPSNUM: return (u32)s->steps;
+		case ET_KCALNUM: return (u32)s->kcal;
+		case ET_HANDS: return handAngle(e->subtype, s);
+		case ET_DAYNUM: return (u32)s->day;
+		case ET_MONTHNUM: return (u32)s->month;
+		case ET_BARDISPLAY: return (u32)barIndex(e, s);
+		case ET_WEATHER: return (u32)s->weather;
+	}
+	return 0;
+}
+
+static RenderRect unionRect(RenderRect a, RenderRect b) {
+	if(a.x0 >= a.x1 || a.y0 >= a.y1) {
+		return b;
+	}
+	if(b.x0 >= b.x1 || b.y0 >= b.y1) {
+		return a;
+	}
+	RenderRect r = { imin(a.x0, b.x0), imin(a.y0, b.y0), imax(a.x1, b.x1), imax(a.y1, b.y1) };
+	return r;
+}
+
+static RenderRect imageRect(const FaceImage * img, int x, int y) {
+	RenderRect r = { x, y, x + img->width, y + img->height };
+	return r;
+}
+
+static RenderRect digitRect(const FaceIndex * fi, u8 digitSet, int digit, XY xy) {
+	RenderRect r = { 0, 0, 0, 0 };
+	const FaceDigits * digits = findDigits(fi, digitSet);
+	if(digits != NULL) {
+		r = imageRect(&digits->images[digit % 10], xy.x, xy.y);
+	}
+	return r;
+}
+
+static RenderRect numberRect(const FaceIndex * fi, u8 digitSet, u8 justification, int value, XY xy) {
+	RenderRect r = { 0, 0, 0, 0 };
+	const FaceDigits * digits = findDigits(fi, digitSet);
+	if(digits == NULL) {
+		return r;
+	}
+	char str[16];
+	int width;
+	int x = numberLayout(digits, justification, value, xy.x, str, &width);
+	int height = 0;
+	for(const char * c = str; *c; c++) {
+		height = imax(height, digits->images[*c - '0'].height);
+	}
+	r = (RenderRect){ x, xy.y, x + width, xy.y + height };
+	return r;
+}
+
+// Where drawElement draws for state s, worked out from the headers alone (nothing is decoded)
+static RenderRect elementRect(const FaceIndex * fi, const FaceElement * e, const RenderState * s) {
+	RenderRect r = { 0, 0, 0, 0 };
+	switch(e->eType) {
+		case ET_IMAGE:
+			return imageRect(&e->images[0], e->xy[0].x, e->xy[0].y);
+		case ET_TIME: {
+			int digits[4] = { s->hour / 10, s->hour % 10, s->minute / 10, s->minute % 10 };
+			for(int i=0; i<4; i++) {
+				r = unionRect(r, digitRect(fi, e->digitSets[i], digits[i], e->xy[i]));
+			}
+			return r;
+		}
+		case ET_DAYNAME:
+			return imageRect(&e->images[s->weekday % 7], e->xy[0].x, e->xy[0].y);
+		case ET_BATTERYFILL:
+			r = imageRect(&e->images[0], e->xy[0].x, e->xy[0].y);
+			return unionRect(r, imageRect(&e->images[2], e->xy[0].x + e->fill[0], e->xy[0].y + e->fill[1]));
+		case ET_HEARTRATENUM:
+			return numberRect(fi, e->digitSet, e->justification, s->heartRate, e->xy[0]);
+		case ET_STEPSNUM:
+			return numberRect(fi, e->digitSet, e->justification, s->steps, e->xy[0]);
+		case ET_KCALNUM:
+			return numberRect(fi, e->digitSet, e->justification, s->kcal, e->xy[0]);
+		case ET_HANDS: {
+			i32 px, py;
+			if(handPivot(e, &e->images[0], &px, &py) == 0) {
+				handBounds(e->images[0].width, e->images[0].height, px, py, e->xy[0].x, e->xy[0].y, handAngle(e->subtype, s), &r);
+			}
+			return r;
+		}
+		case ET_DAYNUM:
+			return unionRect(digitRect(fi, e->digitSet, s->day / 10, e->xy[0]), digitRect(fi, e->digitSet, s->day % 10, e->xy[1]));
+		case ET_MONTHNUM:
+			return unionRect(digitRect(fi, e->digitSet, s->month / 10, e->xy[0]), digitRect(fi, e->digitSet, s->month % 10, e->xy[1]));
+		case ET_BARDISPLAY:
+			if(e->imageCount == 0) {
+				return r;
+			}
+			return imageRect(&e->images[barIndex(e, s)], e->xy[0].x, e->xy[0].y);
+		case ET_WEATHER:
+			if(s->weather < 0 || (size_t)s->weather >= e->imageCount) {
+				return r;
+			}
+			return imageRect(&e->images[s->weather], e->xy[0].x, e->xy[0].y);
+	}
+	return r;
+}
+
+// Add r to the dirty list, merging it with any rectangle it overlaps. When the list is full, r is merged
+// with whichever rectangle grows the least.
+static void addDirty(RenderAnim * a, RenderRect r) {
+	RenderRect all = { 0, 0, (int)a->frame->w, (int)a->frame->h };
+	r = intersectRect(r, all);
+	if(r.x0 >= r.x1 || r.y0 >= r.y1) {
+		return;
+	}
+	for(size_t i=0; i<a->dirtyCount; i++) {
+		RenderRect o = intersectRect(r, a->dirty[i]);
+		if(o.x0 < o.x1 && o.y0 < o.y1) {
+			r = unionRect(r, a->dirty[i]);
+			a->dirty[i] = a->dirty[--a->dirtyCount];
+			addDirty(a, r);
+			return;
+		}
+	}
+	if(a->dirtyCount == RENDER_MAX_DIRTY) {
+		size_t best = 0;
+		long bestGrowth = -1;
+		for(size_t i=0; i<a->dirtyCount; i++) {
+			RenderRect u = unionRect(r, a->dirty[i]);
+			long growth = (long)(u.x1 - u.x0) * (u.y1 - u.y0) - (long)(a->dirty[i].x1 - a->dirty[i].x0) * (a->dirty[i].y1 - a->dirty[i].y0);
+			if(bestGrowth < 0 || growth < bestGrowth) {
+				best = i;
+				bestGrowth = growth;
+			}
+		}
+		r = unionRect(r, a->dirty[best]);
+		a->dirty[best] = a->dirty[--a->dirtyCount];
+		addDirty(a, r);
+		return;
+	}
+	a->dirty[a->dirtyCount++] = r;
+}
+
+// Returns NULL if out of memory
+RenderAnim * newRenderAnim(const FaceIndex * fi) {
+	RenderAnim * a = calloc(1, sizeof(RenderAnim));
+	if(a == NULL) {
+		return NULL;
+	}
+	a->fi = fi;
+	a->frame = newFrame(fi);
+	a->keys = malloc((fi->elementCount + 1) * sizeof(u32));
+	a->rects = malloc((fi->elementCount + 1) * sizeof(RenderRect));
+	if(a->frame == NULL || a->keys == NULL || a->rects == NULL) {
+		return deleteRenderAnim(a);
+	}
+	return a;
+}
+
+RenderAnim * deleteRenderAnim(RenderAnim * a) {
+	if(a != NULL) {
+		deleteImg(a->frame);
+		free(a->keys);
+		free(a->rects);
+		free(a);
+	}
+	return NULL;
+}
+
+// Bring a->frame up to date for state s. The first call draws everything. After that, each element whose
+// key changed marks where it was and where it now is as dirty, and only the dirty rectangles are cleared
+// and redrawn (with every element that touches them, so overlaps come out right).
+// a->dirty lists what was redrawn. Returns the number of images that couldn't be drawn.
+int renderAnimFrame(RenderAnim * a, const RenderState * s) {
+	const FaceIndex * fi = a->fi;
+	a->dirtyCount = 0;
+	for(size_t i=0; i<fi->elementCount; i++) {
+		const FaceElement * e = &fi->elements[i];
+		u32 key = elementKey(e, s);
+		if(!a->started || key != a->keys[i]) {
+			RenderRect r = elementRect(fi, e, s);
+			addDirty(a, a->started ? unionRect(r, a->rects[i]) : r);
+			a->keys[i] = key;
+			a->rects[i] = r;
+		}
+	}
+	if(!a->started) {
+		RenderRect all = { 0, 0, (int)a->frame->w, (int)a->frame->h };
+		a->dirtyCount = 0;
+		addDirty(a, all);
+		a->started = true;
+	}
+
+	int errors = 0;
+	for(size_t i=0; i<a->dirtyCount; i++) {
+		clearRect(a->frame, a->dirty[i]);
+		errors += renderFaceInto(a->frame, &a->dirty[i], fi, s);
+	}
+	return errors;
+}
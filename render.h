@@ -0,0 +1,67 @@
+// render.h
+// composite a whole watch face for a given time and sensor state
+
+//----------------------------------------------------------------------------
+//  RENDER STATE
+//----------------------------------------------------------------------------
+
+// Value ranges used to pick an image for bar displays
+#define RENDER_STEPS_GOAL 10000
+#define RENDER_KCAL_GOAL 500
+#define RENDER_HR_MIN 40
+#define RENDER_HR_MAX 200
+
+// Largest screen rendered, each way. A bigger background is taken as damaged.
+#define RENDER_MAX_SCREEN 2048
+
+typedef struct _RenderState {
+	int hour;				// 0-23
+	int minute;
+	int second;
+	int day;				// day of the month, 1-31
+	int month;				// 1-12
+	int weekday;			// 0 = Sunday
+	int steps;
+	int heartRate;
+	int battery;			// percent
+	int kcal;
+	int weather;			// index of the weather icon
+} RenderState;
+
+// Clip rectangle. x1 and y1 are exclusive.
+typedef struct _RenderRect {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+} RenderRect;
+
+//----------------------------------------------------------------------------
+//  ANIMATION
+//----------------------------------------------------------------------------
+
+#define RENDER_MAX_DIRTY 8		// dirty rectangles per frame, beyond this they are merged
+
+// Renders successive frames of one face into the same Img, redrawing only what changed
+typedef struct _RenderAnim {
+	const FaceIndex * fi;
+	Img * frame;				// ARGB8888, the latest frame
+	bool started;				// false until the first frame has been drawn
+	u32 * keys;					// per element: what it showed in the latest frame
+	RenderRect * rects;			// per element: where it drew in the latest frame
+	size_t dirtyCount;			// rectangles redrawn for the latest frame
+	RenderRect dirty[RENDER_MAX_DIRTY];
+} RenderAnim;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+void renderStateInit(RenderState * s);
+void renderStateSetTime(RenderState * s, time_t t);
+void renderFaceSize(const FaceIndex * fi, u32 * width, u32 * height);
+Img * renderFace(const FaceIndex * fi, const RenderState * s);
+int renderFaceInto(Img * frame, const RenderRect * clip, const FaceIndex * fi, const RenderState * s);
+RenderAnim * newRenderAnim(const FaceIndex * fi);
+RenderAnim * deleteRenderAnim(RenderAnim * a);
+int renderAnimFrame(RenderAnim * a, const RenderState * s);
@@ -0,0 +1,475 @@
+/*  rle.c - RLE_NEW row table and decoder
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "pool.h"
+#include "pixel.h"
+#include "rle.h"
+#include "strutil.h"
+
+//----------------------------------------------------------------------------
+//  ROW TABLE
+//----------------------------------------------------------------------------
+
+// offset of row y, from the start of the image data (including the table)
+size_t rleNewRowOffset(const u8 * imgData, u32 y) {
+	const u8 * entry = &imgData[y * RLE_NEW_ROW_ENTRY_SIZE];
+	return get_u16(entry) + ((size_t)(get_u16(&entry[2]) & 0x001F) << 16);		// extra 5 bits
+}
+
+// size of row y in bytes
+size_t rleNewRowSize(const u8 * imgData, u32 y) {
+	return get_u16(&imgData[y * RLE_NEW_ROW_ENTRY_SIZE + 2]) >> 5;
+}
+
+// size of the whole image, including the table: up to the end of the row that ends last
+size_t rleNewImageSize(const u8 * imgData, u32 height) {
+	size_t size = 0;
+	for(u32 y=0; y<height; y++) {
+		size_t end = rleNewRowOffset(imgData, y) + rleNewRowSize(imgData, y);
+		if(end > size) {
+			size = end;
+		}
+	}
+	return size;
+}
+
+// The commands of row y of an image of height rows in the size bytes at imgData, and their size in
+// *rowSize. NULL if the row, or its entry in the row table, isn't inside those bytes after the table.
+const u8 * rleNewRow(const u8 * imgData, size_t size, u32 height, u32 y, size_t * rowSize) {
+	if(y >= height || size / RLE_NEW_ROW_ENTRY_SIZE < height) {
+		return NULL;
+	}
+	size_t offset = rleNewRowOffset(imgData, y);
+	size_t s = rleNewRowSize(imgData, y);
+	if(offset < (size_t)height * RLE_NEW_ROW_ENTRY_SIZE || offset > size || s > size - offset) {
+		return NULL;
+	}
+	*rowSize = s;
+	return &imgData[offset];
+}
+
+// Whether the row table and every row lie inside the size bytes at imgData, with each row after the table.
+// Check this before trusting the row table of an image from outside.
+bool rleNewFits(const u8 * imgData, size_t size, u32 height) {
+	size_t rowSize;
+	for(u32 y=0; y<height; y++) {
+		if(rleNewRow(imgData, size, height, y, &rowSize) == NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------
+//  RLENEWDECODEROW - decode one row to ARGB8565
+//----------------------------------------------------------------------------
+
+// Decode srcSize bytes of commands into width pixels at dst. Never writes past width pixels.
+// Returns 0 on success, 1 if the row didn't decode to exactly width pixels.
+int rleNewDecodeRow(const u8 * src, size_t srcSize, u8 * dst, u32 width) {
+	size_t bytesIn = 0;
+	size_t bytesOut = 0;
+	const size_t rowBytes = (size_t)width * 3;
+
+	while(bytesIn < srcSize) {
+		u8 cmd = src[bytesIn];
+		bytesIn++;
+		if((cmd & 0x80) != 0) { // Repeat the pixel
+			size_t count = (cmd & 0x7F);
+			if(bytesIn + 3 > srcSize || bytesOut + count * 3 > rowBytes) {
+				break;
+			}
+			const u8 * p = &src[bytesIn];
+			bytesIn += 3;
+			for(size_t j=0; j<count; j++) {
+				dst[bytesOut]   = p[0];
+				dst[bytesOut+1] = p[1];
+				dst[bytesOut+2] = p[2];
+				bytesOut += 3;
+			}
+		} else { // Normal pixel data
+			size_t count = cmd * 3;
+			if(bytesIn + count > srcSize || bytesOut + count > rowBytes) {
+				break;
+			}
+			memcpy(&dst[bytesOut], &src[bytesIn], count);
+			bytesOut += count;
+			bytesIn += count;
+		}
+	}
+
+	if(bytesOut != rowBytes) {
+		memset(&dst[bytesOut], 0, rowBytes - bytesOut);
+		return 1;
+	}
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//  RLENEWDECODEROW8888 - decode one row straight to ARGB8888
+//----------------------------------------------------------------------------
+
+// Same as rleNewDecodeRow, but writes width 4-byte ARGB8888 pixels. Repeated pixels are expanded once
+// and then filled, literal pixels are expanded in bulk.
+int rleNewDecodeRow8888(const u8 * src, size_t srcSize, u8 * dst, u32 width) {
+	size_t bytesIn = 0;
+	size_t pixelsOut = 0;
+
+	while(bytesIn < srcSize) {
+		u8 cmd = src[bytesIn];
+		bytesIn++;
+		if((cmd & 0x80) != 0) { // Repeat the pixel
+			size_t count = (cmd & 0x7F);
+			if(bytesIn + 3 > srcSize || pixelsOut + count > width) {
+				break;
+			}
+			u8 px[4];
+			argb8565to8888(px, &src[bytesIn], 1);
+			bytesIn += 3;
+			for(size_t j=0; j<count; j++) {
+				memcpy(&dst[pixelsOut * 4], px, 4);
+				pixelsOut++;
+			}
+		} else { // Normal pixel data
+			size_t count = cmd;
+			if(bytesIn + count * 3 > srcSize || pixelsOut + count > width) {
+				break;
+			}
+			argb8565to8888(&dst[pixelsOut * 4], &src[bytesIn], count);
+			pixelsOut += count;
+			bytesIn += count * 3;
+		}
+	}
+
+	if(pixelsOut != width) {
+		memset(&dst[pixelsOut * 4], 0, (width - pixelsOut) * 4);
+		return 1;
+	}
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//  RLENEWBLENDROW8888 - composite one row straight from its commands
+//----------------------------------------------------------------------------
+
+// Blend repeated pixel px (ARGB8565) over count ARGB8888 pixels at dst
+static void blendRun8888(u8 * dst, const u8 * px, size_t count) {
+	if(px[0] == 0) {		// transparent: nothing to do
+		return;
+	}
+	u8 run[RLE_NEW_MAX_RUN * 4];
+	argb8565to8888(run, px, 1);
+	if(px[0] == 0xFF) {		// opaque: fill
+		for(size_t j=0; j<count; j++) {
+			memcpy(&dst[j * 4], run, 4);
+		}
+		return;
+	}
+	for(size_t j=1; j<count; j++) {
+		memcpy(&run[j * 4], run, 4);
+	}
+	blend8888over8888(dst, run, count);
+}
+
+// Blend columns x0 to x1 (exclusive) of a row of srcSize bytes of commands over ARGB8888 pixels at dst.
+// dst is the pixel for column x0. Repeated pixels are handled without expanding them, so transparent
+// runs cost nothing, and only literal pixels go through the blend kernel.
+// Returns 0 on success, 1 if the commands ran out or were malformed before reaching x1. Columns before
+// the fault have already been blended.
+int rleNewBlendRow8888(const u8 * src, size_t srcSize, u8 * dst, u32 width, u32 x0, u32 x1) {
+	size_t bytesIn = 0;
+	size_t x = 0;
+	if(x1 > width) {
+		x1 = width;
+	}
+
+	while(bytesIn < srcSize && x < x1) {
+		u8 cmd = src[bytesIn];
+		bytesIn++;
+		size_t count = (cmd & 0x7F);
+		size_t dataSize = ((cmd & 0x80) != 0) ? 3 : count * 3;
+		if(bytesIn + dataSize > srcSize || x + count > width) {
+			break;
+		}
+		size_t from = (x > x0) ? x : x0;
+		size_t to = (x + count < x1) ? x + count : x1;
+		if(from < to) {
+			u8 * d = &dst[(from - x0) * 4];
+			if((cmd & 0x80) != 0) { // Repeat the pixel
+				blendRun8888(d, &src[bytesIn], to - from);
+			} else { // Normal pixel data
+				blend8565over8888(d, &src[bytesIn + (from - x) * 3], to - from);
+			}
+		}
+		x += count;
+		bytesIn += dataSize;
+	}
+
+	return (x >= x1) ? 0 : 1;
+}
+
+//----------------------------------------------------------------------------
+//  RLENEWDECODE - decode a whole image, rows in parallel
+//----------------------------------------------------------------------------
+
+typedef struct _DecodeCtx {
+	const u8 * imgData;
+	size_t size;
+	u8 * dst;
+	u32 width;
+	u32 height;
+} DecodeCtx;
+
+static int decodeRowTask(void * ctx, size_t y) {
+	DecodeCtx * c = (DecodeCtx *)ctx;
+	u8 * dst = &c->dst[y * c->width * 3];
+	size_t srcSize;
+	const u8 * src = rleNewRow(c->imgData, c->size, c->height, (u32)y, &srcSize);
+	if(src == NULL) {
+		memset(dst, 0, (size_t)c->width * 3);
+		return 1;
+	}
+	return rleNewDecodeRow(src, srcSize, dst, c->width);
+}
+
+// Decode RLE_NEW image data (starting at the row table, size bytes in all) into a new IF_ARGB8565 Img.
+// Rows outside the data are left transparent, with a warning. Delete with deleteImg.
+// Returns NULL if out of memory, or if the image is too big for an Img.
+Img * rleNewDecode(const u8 * imgData, size_t size, u32 width, u32 height) {
+	size_t imgSize = (size_t)width * height * 3;
+	if(imgSize > UINT32_MAX) {
+		dprintf(0, "ERROR: Image of %u x %u is too big\n", width, height);
+		return NULL;
+	}
+	Img * img = malloc(sizeof(Img));
+	if(img == NULL) {
+		printf("ERROR: Out of memory\n");
+		return NULL;
+	}
+	img->w = width;
+	img->h = height;
+	img->format = IF_ARGB8565;
+	img->size = (u32)imgSize;
+	img->data = malloc(img->size);
+	if(img->data == NULL) {
+		printf("ERROR: Out of memory\n");
+		return deleteImg(img);
+	}
+
+	DecodeCtx ctx = { imgData, size, img->data, width, height };
+	if(poolForChecked(defaultPool(), height, decodeRowTask, &ctx) != 0) {
+		dprintf(0, "WARNING: Some rows of RLE image did not decode cleanly\n");
+	}
+
+	return img;
+}
+
+//----------------------------------------------------------------------------
+//  RLENEWENCODEROW - compress one row of ARGB8565 pixels
+//----------------------------------------------------------------------------
+
+// Largest possible encoded row: all literals
+size_t rleNewRowBound(u32 width) {
+	return (size_t)width * 3 + (width + RLE_NEW_MAX_RUN - 1) / RLE_NEW_MAX_RUN;
+}
+
+// number of pixels from x that are the same as pixel x, up to RLE_NEW_MAX_RUN
+static size_t runLength(const u8 * src, size_t x, size_t width) {
+	const u8 * p = &src[x * 3];
+	size_t n = 1;
+	while(x + n < width && n < RLE_NEW_MAX_RUN && memcmp(p, &src[(x + n) * 3], 3) == 0) {
+		n++;
+	}
+	return n;
+}
+
+static size_t emitRepeat(u8 * dst, const u8 * px, size_t count) {
+	dst[0] = (u8)(0x80 | count);
+	memcpy(&dst[1], px, 3);
+	return 4;
+}
+
+static size_t emitLiteral(u8 * dst, const u8 * px, size_t count) {
+	dst[0] = (u8)count;
+	memcpy(&dst[1], px, count * 3);
+	return 1 + count * 3;
+}
+
+// Greedy: every run of 2 or more becomes a repeat. Two pixels as a repeat cost 4 bytes against 6 as
+// literals, and splitting a literal adds at most one 1 byte header, so taking a run never costs more
+// than leaving it in a literal. The result isn't always the smallest though: when a run is longer than
+// RLE_NEW_MAX_RUN its leftover pixels may need a literal of their own, where RLE_BEST can instead move
+// the head of the run onto the end of the literal before it, saving a byte.
+static size_t encodeRowFast(const u8 * src, size_t width, u8 * dst) {
+	size_t out = 0;
+	size_t litStart = 0;
+	size_t x = 0;
+	while(x < width) {
+		size_t run = runLength(src, x, width);
+		if(run >= 2) {
+			if(x > litStart) {
+				out += emitLiteral(&dst[out], &src[litStart * 3], x - litStart);
+			}
+			out += emitRepeat(&dst[out], &src[x * 3], run);
+			x += run;
+			litStart = x;
+		} else {
+			x++;
+			if(x - litStart == RLE_NEW_MAX_RUN) {
+				out += emitLiteral(&dst[out], &src[litStart * 3], x - litStart);
+				litStart = x;
+			}
+		}
+	}
+	if(x > litStart) {
+		out += emitLiteral(&dst[out], &src[litStart * 3], x - litStart);
+	}
+	return out;
+}
+
+// Dynamic programming over the row: cost[x] is the fewest bytes that can encode pixels x to the end.
+// A repeat of k pixels costs 4 bytes, a literal of k pixels costs 1 + 3k bytes.
+static size_t encodeRowBest(const u8 * src, size_t width, u8 * dst) {
+	u32 * cost = malloc((width + 1) * sizeof(u32));
+	u8 * take = malloc(width + 1);				// pixels covered by the best command at x, 0x80 set for a repeat
+	if(cost == NULL || take == NULL) {
+		free(cost);
+		free(take);
+		return encodeRowFast(src, width, dst);
+	}
+
+	cost[width] = 0;
+	for(size_t x=width; x-- > 0; ) {
+		size_t run = runLength(src, x, width);
+		u32 best = 0xFFFFFFFF;
+		u8 bestTake = 0;
+		for(size_t k=1; k<=run; k++) {
+			u32 c = 4 + cost[x + k];
+			if(c < best) {
+				best = c;
+				bestTake = (u8)(0x80 | k);
+			}
+		}
+		size_t maxLit = width - x;
+		if(maxLit > RLE_NEW_MAX_RUN) {
+			maxLit = RLE_NEW_MAX_RUN;
+		}
+		for(size_t k=1; k<=maxLit; k++) {
+			u32 c = 1 + 3 * (u32)k + cost[x + k];
+			if(c < best) {
+				best = c;
+				bestTake = (u8)k;
+			}
+		}
+		cost[x] = best;
+		take[x] = bestTake;
+	}
+
+	size_t out = 0;
+	for(size_t x=0; x<width; ) {
+		size_t k = take[x] & 0x7F;
+		if(take[x] & 0x80) {
+			out += emitRepeat(&dst[out], &src[x * 3], k);
+		} else {
+			out += emitLiteral(&dst[out], &src[x * 3], k);
+		}
+		x += k;
+	}
+
+	free(cost);
+	free(take);
+	return out;
+}
+
+// Compress width ARGB8565 pixels into dst, which must hold rleNewRowBound(width) bytes. Returns bytes written.
+size_t rleNewEncodeRow(const u8 * src, u32 width, u8 * dst, RleMode mode) {
+	if(mode == RLE_BEST) {
+		return encodeRowBest(src, width, dst);
+	}
+	return encodeRowFast(src, width, dst);
+}
+
+//----------------------------------------------------------------------------
+//  RLENEWENCODE - compress a whole image, rows in parallel, and build the row table
+//----------------------------------------------------------------------------
+
+typedef struct _EncodeCtx {
+	const u8 * src;
+	u32 width;
+	RleMode mode;
+	u8 * rows;				// rowBound bytes for each row
+	size_t rowBound;
+	size_t * rowSizes;
+} EncodeCtx;
+
+static void encodeRowTask(void * ctx, size_t y) {
+	EncodeCtx * c = (EncodeCtx *)ctx;
+	c->rowSizes[y] = rleNewEncodeRow(&c->src[y * c->width * 3], c->width, &c->rows[y * c->rowBound], c->mode);
+}
+
+// Compress ARGB8565 pixel data to RLE_NEW, as stored in a face file: the row table followed by the rows.
+// Returns NULL if the image can't be represented (a row or the image too big for the table). Delete with deleteBytes.
+Bytes * rleNewEncode(const u8 * argb8565, u32 width, u32 height, RleMode mode) {
+	size_t rowBound = rleNewRowBound(width);
+	u8 * rows = malloc(rowBound * height + 1);
+	size_t * rowSizes = malloc(sizeof(size_t) * height + 1);
+	if(rows == NULL || rowSizes == NULL) {
+		printf("ERROR: Out of memory\n");
+		free(rows);
+		free(rowSizes);
+		return NULL;
+	}
+
+	EncodeCtx ctx = { argb8565, width, mode, rows, rowBound, rowSizes };
+	poolFor(defaultPool(), height, encodeRowTask, &ctx);
+
+	// lay out the rows after the table
+	size_t tableSize = (size_t)height * RLE_NEW_ROW_ENTRY_SIZE;
+	size_t totalSize = tableSize;
+	for(u32 y=0; y<height; y++) {
+		if(rowSizes[y] > RLE_NEW_MAX_ROW_SIZE || totalSize > RLE_NEW_MAX_OFFSET) {
+			printf("ERROR: Image too large for RLE_NEW (row %u)\n", y);
+			free(rows);
+			free(rowSizes);
+			return NULL;
+		}
+		totalSize += rowSizes[y];
+	}
+
+	Bytes * b = newBytes(totalSize);
+	if(b == NULL) {
+		printf("ERROR: Out of memory\n");
+		free(rows);
+		free(rowSizes);
+		return NULL;
+	}
+
+	size_t offset = tableSize;
+	for(u32 y=0; y<height; y++) {
+		u8 * entry = &b->data[y * RLE_NEW_ROW_ENTRY_SIZE];
+		set_u16(entry, (u16)(offset & 0xFFFF));
+		set_u16(&entry[2], (u16)(((offset >> 16) & 0x001F) | (rowSizes[y] << 5)));
+		memcpy(&b->data[offset], &rows[y * rowBound], rowSizes[y]);
+		offset += rowSizes[y];
+	}
+
+	free(rows);
+	free(rowSizes);
+	return b;
+}
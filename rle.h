@@ -0,0 +1,40 @@
+// rle.h
+// RLE_NEW image data: per-row offset table and row decoder
+
+//----------------------------------------------------------------------------
+//  RLE_NEW LAYOUT
+//----------------------------------------------------------------------------
+
+// An RLE_NEW image starts with a table of 4 bytes per row:
+//   u16 offset (low 16 bits), u16 (bits 0-4: offset bits 16-20, bits 5-15: row size in bytes)
+// Offsets are from the start of the table. Each row is a stream of commands:
+//   0x80|count, then 3 bytes of ARGB8565 pixel repeated count times
+//   count (<0x80), then count*3 bytes of ARGB8565 pixels
+
+#define RLE_NEW_ROW_ENTRY_SIZE 4
+#define RLE_NEW_MAX_RUN 127				// most pixels one command can cover
+#define RLE_NEW_MAX_ROW_SIZE 0x7FF		// row size has 11 bits
+#define RLE_NEW_MAX_OFFSET 0x1FFFFF		// row offset has 21 bits
+
+// Compression effort
+typedef enum _RleMode {
+	RLE_FAST = 0,		// greedy: any repeated pixel becomes a run
+	RLE_BEST = 1,		// smallest possible output for each row
+} RleMode;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+size_t rleNewRowOffset(const u8 * imgData, u32 y);
+size_t rleNewRowSize(const u8 * imgData, u32 y);
+size_t rleNewImageSize(const u8 * imgData, u32 height);
+const u8 * rleNewRow(const u8 * imgData, size_t size, u32 height, u32 y, size_t * rowSize);
+bool rleNewFits(const u8 * imgData, size_t size, u32 height);
+int rleNewDecodeRow(const u8 * src, size_t srcSize, u8 * dst, u32 width);
+int rleNewDecodeRow8888(const u8 * src, size_t srcSize, u8 * dst, u32 width);
+int rleNewBlendRow8888(const u8 * src, size_t srcSize, u8 * dst, u32 width, u32 x0, u32 x1);
+Img * rleNewDecode(const u8 * imgData, size_t size, u32 width, u32 height);
+size_t rleNewRowBound(u32 width);
+size_t rleNewEncodeRow(const u8 * src, u32 width, u8 * dst, RleMode mode);
+Bytes * rleNewEncode(const u8 * argb8565, u32 width, u32 height, RleMode mode);
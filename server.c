@@ -0,0 +1,847 @@
+/*  server.c - answer requests over a Unix domain socket
+
+	Alternate Da Watch Face Tool (adawft)
+	adawft: Watch Face Tool for 'new' MO YOUNG / DA FIT binary watch face files.
+
+	A long-lived process for services that would otherwise run adawft once per face, paying
+	for process start up, the thread pool and reading and writing files every time. Faces
+	and images arrive in the request and results go back in the reply, without touching
+	the disk, apart from the image cache if one is used.
+
+	Each connection has a thread that reads whole requests. Requests are then carried out
+	one at a time, as the output layer has one archive for the whole process, and each
+	request is already spread over the thread pool. See server.h for the protocol.
+
+	Not available on Windows, which has no Unix domain sockets in its C library.
+
+	Copyright 2024 David Atkinson
+	Author: David Atkinson <dav!id47k@d47.co> (remove the '!')
+	License: GNU General Public License version 2 or any later version (GPL-2.0-or-later)
+*/
+
+#ifndef WINDOWS
+#define _POSIX_C_SOURCE 200809L		// for open_memstream, sigaction, clock_gettime
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifndef WINDOWS
+
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "types.h"
+#include "face_new.h"
+#include "adawft.h"
+#include "bytes.h"
+#include "bmp.h"
+#include "rle.h"
+#include "cache.h"
+#include "png.h"
+#include "qoi.h"
+#include "output.h"
+#include "archive.h"
+#include "dump.h"
+#include "face.h"
+#include "render.h"
+#include "jsonw.h"
+#include "process.h"
+#include "server.h"
+#include "strutil.h"
+
+#define SERVE_DUMP_ROOT "face"		// folder the dumped files are named inside, then left out of the tar
+
+struct _Server {
+	char * socketPath;
+	ServeOptions opt;
+	int listenFd;
+	int wakeFds[2];					// a byte written to [1] stops serverRun
+	pthread_mutex_t work;			// held while a request is carried out
+	pthread_mutex_t lock;			// for everything below
+	pthread_cond_t idle;			// signalled as each connection ends
+	int conns[SERVE_MAX_CONNECTIONS];	// open connections, -1 for none
+	size_t connCount;
+	size_t requests;
+	size_t failures;
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+//----------------------------------------------------------------------------
+//  SOCKET I/O
+//----------------------------------------------------------------------------
+
+// Read exactly size bytes. Returns 0 on success, 1 on error, or -1 if the connection was closed
+// before the first byte.
+static int recvAll(int fd, u8 * buf, size_t size) {
+	size_t done = 0;
+	while(done < size) {
+		ssize_t n = recv(fd, &buf[done], size - done, 0);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			return (n == 0 && done == 0) ? -1 : 1;
+		}
+		done += (size_t)n;
+	}
+	return 0;
+}
+
+// Send all the pieces. A closed connection is an error, not a SIGPIPE. Returns 0 on success.
+static int sendPieces(int fd, const OutPiece * pieces, int count) {
+	struct iovec iov[4];
+	int n = 0;
+	for(int i=0; i<count && n<4; i++) {
+		if(pieces[i].size > 0) {
+			iov[n].iov_base = (void *)pieces[i].data;
+			iov[n].iov_len = pieces[i].size;
+			n++;
+		}
+	}
+	struct iovec * v = iov;
+	while(n > 0) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = v;
+		msg.msg_iovlen = (size_t)n;
+		ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if(sent < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return 1;
+		}
+		// step over whatever was sent, which may end part way through a piece
+		size_t done = (size_t)sent;
+		while(n > 0 && done >= v->iov_len) {
+			done -= v->iov_len;
+			v++;
+			n--;
+		}
+		if(n > 0) {
+			v->iov_base = (u8 *)v->iov_base + done;
+			v->iov_len -= done;
+		}
+	}
+	return 0;
+}
+
+static int sendMessage(int fd, u32 magic, u32 word1, const char * args, const u8 * data, size_t size) {
+	size_t argsSize = args ? strlen(args) : 0;
+	if(size > UINT32_MAX || argsSize > UINT32_MAX) {
+		return 1;
+	}
+	u8 header[SERVE_HEADER_SIZE];
+	set_u32(&header[0], magic);
+	set_u32(&header[4], word1);
+	if(magic == SERVE_REQUEST_MAGIC) {
+		set_u32(&header[8], (u32)argsSize);
+		set_u32(&header[12], (u32)size);
+	} else {
+		set_u32(&header[8], (u32)size);
+		set_u32(&header[12], 0);
+	}
+	OutPiece pieces[3] = { { header, sizeof(header) }, { args, argsSize }, { data, size } };
+	return sendPieces(fd, pieces, 3);
+}
+
+//----------------------------------------------------------------------------
+//  REQUEST ARGS
+//----------------------------------------------------------------------------
+
+typedef struct _ServeArgs {
+	Format format;
+	RenderState renderState;
+	u32 width;				// of RLE_NEW data to convert, or 0
+	u32 height;
+	u32 image;				// which image of the face
+} ServeArgs;
+
+static int formatFromStr(const char * str, Format * f) {
+	for(int i=FMT_BIN; i<=FMT_QOI; i++) {
+		if(streq(str, dumpFormatStr((Format)i))) {
+			*f = (Format)i;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Read "key=value" lines. Returns 0 on success, or 1 with a message in err.
+static int parseArgs(char * text, ServeArgs * a, char * err, size_t errSize) {
+	a->format = FMT_BMP;
+	renderStateInit(&a->renderState);
+	a->width = 0;
+	a->height = 0;
+	a->image = 0;
+
+	char * save = NULL;
+	for(char * line = strtok_r(text, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+		char * value = strchr(line, '=');
+		if(value == NULL) {
+			snprintf(err, errSize, "Argument without a value: %s", line);
+			return 1;
+		}
+		*value++ = '\0';
+		int n = atoi(value);
+		time_t t;
+		if(streq(line, "format")) {
+			if(formatFromStr(value, &a->format) != 0) {
+				snprintf(err, errSize, "Unknown format: %s", value);
+				return 1;
+			}
+		} else if(streq(line, "time")) {
+			if(parseTime(value, &t) != 0) {
+				snprintf(err, errSize, "Can't read time: %s", value);
+				return 1;
+			}
+			renderStateSetTime(&a->renderState, t);
+		} else if(streq(line, "steps")) {
+			a->renderState.steps = n;
+		} else if(streq(line, "hr")) {
+			a->renderState.heartRate = n;
+		} else if(streq(line, "battery")) {
+			a->renderState.battery = n;
+		} else if(streq(line, "kcal")) {
+			a->renderState.kcal = n;
+		} else if(streq(line, "weather")) {
+			a->renderState.weather = n;
+		} else if(streq(line, "width") || streq(line, "height")) {
+			// face images are at most 0xFFFF each way, and the decoders rely on it
+			unsigned v;
+			if(!readUnsigned(value, 0xFFFF, &v) || v == 0) {
+				snprintf(err, errSize, "Bad %s: %s (1 to 65535)", line, value);
+				return 1;
+			}
+			if(streq(line, "width")) {
+				a->width = v;
+			} else {
+				a->height = v;
+			}
+		} else if(streq(line, "image")) {
+			a->image = (u32)n;
+		} else {
+			snprintf(err, errSize, "Unknown argument: %s", line);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+//  OPERATIONS - each returns the reply data, or NULL with a message in err
+//----------------------------------------------------------------------------
+
+static FaceIndex * indexFace(const Bytes * face, char * err, size_t errSize) {
+	FaceIndex * fi = NULL;
+	if(face->size >= sizeof(FaceHeaderN)) {
+		fi = newFaceIndex(face->data, face->size);
+	}
+	if(fi == NULL) {
+		snprintf(err, errSize, "Not a watch face");
+	}
+	return fi;
+}
+
+static void jsonwSize(JsonWriter * jw, const char * key, const FaceImage * img) {
+	jsonwBeginObject(jw, key);
+	jsonwInt(jw, "w", img->width);
+	jsonwInt(jw, "h", img->height);
+	jsonwEndObject(jw);
+}
+
+static Bytes * opIndex(const Bytes * face, char * err, size_t errSize) {
+	FaceIndex * fi = indexFace(face, err, errSize);
+	if(fi == NULL) {
+		return NULL;
+	}
+	char * text = NULL;
+	size_t textSize = 0;
+	FILE * f = open_memstream(&text, &textSize);
+	if(f == NULL) {
+		snprintf(err, errSize, "Out of memory");
+		deleteFaceIndex(fi);
+		return NULL;
+	}
+
+	JsonWriter jw;
+	jsonwInit(&jw, f);
+	jsonwBeginObject(&jw, NULL);
+	jsonwInt(&jw, "api_ver", fi->apiVer);
+	jsonwInt(&jw, "size", (long)fi->size);
+	jsonwBool(&jw, "truncated", fi->truncated);
+	jsonwInt(&jw, "image_count", (long)fi->imageCount);
+	jsonwSize(&jw, "preview", fi->preview);
+	jsonwBeginArray(&jw, "digits");
+	for(size_t d=0; d<fi->digitsCount; d++) {
+		jsonwBeginObject(&jw, NULL);
+		jsonwInt(&jw, "digit_set", fi->digits[d].digitSet);
+		jsonwSize(&jw, "size", &fi->digits[d].images[0]);
+		jsonwEndObject(&jw);
+	}
+	jsonwEndArray(&jw);
+	jsonwBeginArray(&jw, "elements");
+	for(size_t n=0; n<fi->elementCount; n++) {
+		const FaceElement * e = &fi->elements[n];
+		jsonwBeginObject(&jw, NULL);
+		jsonwString(&jw, "e_type", elementTypeStr(e->eType));
+		jsonwInt(&jw, "subtype", e->subtype);
+		jsonwInt(&jw, "x", e->xy[0].x);
+		jsonwInt(&jw, "y", e->xy[0].y);
+		jsonwInt(&jw, "image_count", (long)e->imageCount);
+		jsonwEndObject(&jw);
+	}
+	jsonwEndArray(&jw);
+	jsonwEndObject(&jw);
+	int r = jsonwFinish(&jw);
+	r |= fclose(f);
+	deleteFaceIndex(fi);
+
+	Bytes * b = (r == 0) ? newBytesFromMemory((const u8 *)text, textSize) : NULL;
+	free(text);
+	if(b == NULL) {
+		snprintf(err, errSize, "Failed to index the face");
+	}
+	return b;
+}
+
+// The whole dump, as --archive would write it, without the dump folder
+static Bytes * opDump(Server * s, const Bytes * face, const ServeArgs * a, char * err, size_t errSize) {
+	ProcessOptions opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.format = a->format;
+	opt.dump = true;
+	opt.link = s->opt.link;
+	opt.cache = s->opt.cache;
+	opt.renderName = "render.bmp";
+	opt.renderState = a->renderState;
+	opt.frames = 1;
+	opt.frameStep = 1;
+
+	Archive * archive = newArchiveMemory();
+	if(archive == NULL) {
+		snprintf(err, errSize, "Out of memory");
+		return NULL;
+	}
+	setOutputArchive(archive, SERVE_DUMP_ROOT);
+	int r = processFaceBytes(face, SERVE_DUMP_ROOT, &opt);
+	setOutputArchive(NULL, NULL);
+	if(archiveFinish(archive) != 0) {
+		r = 1;
+	}
+	Bytes * b = (r == 0) ? archiveTakeBytes(archive) : NULL;
+	archive = deleteArchive(archive);
+	if(b == NULL) {
+		snprintf(err, errSize, "Failed to dump the face");
+	}
+	return b;
+}
+
+// An image file of an ARGB8888 Img. raw is ARGB8565 and bin is RLE_NEW, as in a face.
+static Bytes * encodeImg(const Img * img, Format format) {
+	if(format == FMT_BMP) {
+		return imgToBMP(img);
+	} else if(format == FMT_PNG) {
+		return pngEncode8888(img->data, img->w, img->h, defaultPngLevel());
+	} else if(format == FMT_QOI) {
+		return qoiEncode8888(img->data, img->w, img->h);
+	}
+	Img * i565 = cloneImg(img);
+	if(i565 != NULL) {
+		i565 = convertImg(i565, IF_ARGB8565);
+	}
+	if(i565 == NULL) {
+		return NULL;
+	}
+	Bytes * b = (format == FMT_RAW) ? newBytesFromMemory(i565->data, i565->size) : rleNewEncode(i565->data, i565->w, i565->h, RLE_BEST);
+	deleteImg(i565);
+	return b;
+}
+
+static Bytes * opRender(const Bytes * face, const ServeArgs * a, char * err, size_t errSize) {
+	FaceIndex * fi = indexFace(face, err, errSize);
+	if(fi == NULL) {
+		return NULL;
+	}
+	Img * frame = renderFace(fi, &a->renderState);
+	Bytes * b = (frame != NULL) ? encodeImg(frame, a->format) : NULL;
+	deleteImg(frame);
+	deleteFaceIndex(fi);
+	if(b == NULL) {
+		snprintf(err, errSize, "Failed to render the face");
+	}
+	return b;
+}
+
+static Bytes * opConvert(Server * s, const Bytes * data, const ServeArgs * a, char * err, size_t errSize) {
+	if(a->width != 0 || a->height != 0) {
+		// RLE_NEW goes the same way as a dumped image, through the cache
+		if(a->width == 0 || a->height == 0 || !rleNewFits(data->data, data->size, a->height)) {
+			snprintf(err, errSize, "Not RLE_NEW data of %u x %u", a->width, a->height);
+			return NULL;
+		}
+		Bytes * b = dumpImageBytes(s->opt.cache, data->data, data->size, a->width, a->height, a->format, NULL);
+		if(b == NULL) {
+			snprintf(err, errSize, "Failed to convert the image");
+		}
+		return b;
+	}
+
+	Img * img = newImgFromBytes(data);
+	if(img == NULL) {
+		snprintf(err, errSize, "Not a BMP or QOI file");
+		return NULL;
+	}
+	if(img->format != IF_ARGB8888) {
+		img = convertImg(img, IF_ARGB8888);
+	}
+	Bytes * b = (img != NULL) ? encodeImg(img, a->format) : NULL;
+	deleteImg(img);
+	if(b == NULL) {
+		snprintf(err, errSize, "Failed to convert the image");
+	}
+	return b;
+}
+
+// One image of a face, as dumped, for thumbnails. The others are never decoded.
+static Bytes * opImage(Server * s, const Bytes * face, const ServeArgs * a, char * err, size_t errSize) {
+	FaceIndex * fi = indexFace(face, err, errSize);
+	if(fi == NULL) {
+		return NULL;
+	}
+	Bytes * b = NULL;
+	if(a->image >= fi->imageCount) {
+		snprintf(err, errSize, "No image %u, the face has %zu", a->image, fi->imageCount);
+	} else {
+		const FaceImage * img = &fi->images[a->image];
+		if(img->size != 0) {
+			b = dumpImageBytes(s->opt.cache, (u8 *)&fi->data[img->offset], img->size, img->width, img->height, a->format, NULL);
+		}
+		if(b == NULL) {
+			snprintf(err, errSize, "Failed to convert image %u", a->image);
+		}
+	}
+	deleteFaceIndex(fi);
+	return b;
+}
+
+// Carry out one request. Returns the reply data, or NULL with a message in err.
+static Bytes * handleRequest(Server * s, u32 op, char * args, const Bytes * data, char * err, size_t errSize) {
+	ServeArgs a;
+	if(parseArgs(args, &a, err, errSize) != 0) {
+		return NULL;
+	}
+	switch(op) {
+		case SERVE_INDEX: return opIndex(data, err, errSize);
+		case SERVE_DUMP: return opDump(s, data, &a, err, errSize);
+		case SERVE_RENDER: return opRender(data, &a, err, errSize);
+		case SERVE_CONVERT: return opConvert(s, data, &a, err, errSize);
+		case SERVE_IMAGE: return opImage(s, data, &a, err, errSize);
+	}
+	snprintf(err, errSize, "Unknown request %u", op);
+	return NULL;
+}
+
+//----------------------------------------------------------------------------
+//  CONNECTIONS
+//----------------------------------------------------------------------------
+
+typedef struct _Connection {
+	Server * server;
+	int fd;
+} Connection;
+
+// Read and answer requests until the client closes the connection, or breaks the protocol
+static void * connectionThread(void * arg) {
+	Connection * c = (Connection *)arg;
+	Server * s = c->server;
+	int fd = c->fd;
+	free(c);
+
+	for(;;) {
+		u8 header[SERVE_HEADER_SIZE];
+		if(recvAll(fd, header, sizeof(header)) != 0) {
+			break;
+		}
+		u32 op = get_u32(&header[4]);
+		u32 argsSize = get_u32(&header[8]);
+		u32 dataSize = get_u32(&header[12]);
+		if(get_u32(&header[0]) != SERVE_REQUEST_MAGIC || argsSize > SERVE_MAX_REQUEST || dataSize > SERVE_MAX_REQUEST - argsSize) {
+			const char * msg = "Bad request";
+			sendMessage(fd, SERVE_REPLY_MAGIC, SERVE_FAILED, NULL, (const u8 *)msg, strlen(msg));
+			break;
+		}
+		char * args = malloc((size_t)argsSize + 1);
+		Bytes * data = newBytes(dataSize);
+		if(args == NULL || data == NULL || recvAll(fd, (u8 *)args, argsSize) != 0 || recvAll(fd, data->data, dataSize) != 0) {
+			free(args);
+			deleteBytes(data);
+			break;
+		}
+		args[argsSize] = '\0';
+
+		char err[256];
+		pthread_mutex_lock(&s->work);
+		double start = now();
+		Bytes * reply = handleRequest(s, op, args, data, err, sizeof(err));
+		double seconds = now() - start;
+		pthread_mutex_unlock(&s->work);
+
+		pthread_mutex_lock(&s->lock);
+		size_t n = ++s->requests;
+		if(reply == NULL) {
+			s->failures++;
+		}
+		pthread_mutex_unlock(&s->lock);
+		dprintf(1, "Request %zu: %s, %u bytes in, %zu bytes out, %.1f ms%s%s\n", n, serveOpStr((ServeOp)op), dataSize,
+			reply ? reply->size : 0, seconds * 1e3, reply ? "" : ". FAILED: ", reply ? "" : err);
+		fflush(stdout);		// a log, even when stdout is a file
+
+		int r = (reply != NULL) ? sendMessage(fd, SERVE_REPLY_MAGIC, SERVE_OK, NULL, reply->data, reply->size)
+			: sendMessage(fd, SERVE_REPLY_MAGIC, SERVE_FAILED, NULL, (const u8 *)err, strlen(err));
+		free(args);
+		deleteBytes(data);
+		deleteBytes(reply);
+		if(r != 0) {
+			break;
+		}
+	}
+
+	// forget the connection before closing it, so serverRun never shuts down a reused descriptor
+	pthread_mutex_lock(&s->lock);
+	for(int i=0; i<SERVE_MAX_CONNECTIONS; i++) {
+		if(s->conns[i] == fd) {
+			s->conns[i] = -1;
+		}
+	}
+	s->connCount--;
+	pthread_cond_broadcast(&s->idle);
+	pthread_mutex_unlock(&s->lock);
+	close(fd);
+	return NULL;
+}
+
+// Start a thread for a new connection. Closes fd if it can't.
+static void startConnection(Server * s, int fd) {
+	pthread_mutex_lock(&s->lock);
+	int slot = -1;
+	for(int i=0; i<SERVE_MAX_CONNECTIONS && slot < 0; i++) {
+		if(s->conns[i] < 0) {
+			slot = i;
+		}
+	}
+	Connection * c = (slot >= 0) ? malloc(sizeof(Connection)) : NULL;
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if(c != NULL) {
+		c->server = s;
+		c->fd = fd;
+		s->conns[slot] = fd;
+		s->connCount++;
+		if(pthread_create(&thread, &attr, connectionThread, c) != 0) {
+			s->conns[slot] = -1;
+			s->connCount--;
+			free(c);
+			c = NULL;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	pthread_mutex_unlock(&s->lock);
+	if(c == NULL) {
+		dprintf(0, "WARNING: Too many connections, one refused.\n");
+		close(fd);
+	}
+}
+
+//----------------------------------------------------------------------------
+//  NEW / DELETE
+//----------------------------------------------------------------------------
+
+static bool socketAddress(const char * socketPath, struct sockaddr_un * addr) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if(strlen(socketPath) >= sizeof(addr->sun_path)) {
+		dprintf(0, "ERROR: Socket path too long: %s\n", socketPath);
+		return false;
+	}
+	strcpy(addr->sun_path, socketPath);
+	return true;
+}
+
+// Listen on socketPath. A socket left there by a server that is no longer running is replaced.
+// Returns NULL on failure.
+Server * newServer(const char * socketPath, const ServeOptions * opt) {
+	struct sockaddr_un addr;
+	if(!socketAddress(socketPath, &addr)) {
+		return NULL;
+	}
+	struct stat st;
+	if(stat(socketPath, &st) == 0) {
+		int fd = S_ISSOCK(st.st_mode) ? serveConnect(socketPath) : -1;
+		if(fd >= 0 || !S_ISSOCK(st.st_mode)) {
+			dprintf(0, "ERROR: %s is already in use.\n", socketPath);
+			if(fd >= 0) {
+				close(fd);
+			}
+			return NULL;
+		}
+		unlink(socketPath);
+	}
+
+	Server * s = calloc(1, sizeof(Server));
+	char * path = malloc(strlen(socketPath) + 1);
+	if(s == NULL || path == NULL) {
+		dprintf(0, "ERROR: Out of memory\n");
+		free(s);
+		free(path);
+		return NULL;
+	}
+	strcpy(path, socketPath);
+	s->socketPath = path;
+	s->opt = *opt;
+	s->wakeFds[0] = s->wakeFds[1] = -1;
+	for(int i=0; i<SERVE_MAX_CONNECTIONS; i++) {
+		s->conns[i] = -1;
+	}
+	pthread_mutex_init(&s->work, NULL);
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->idle, NULL);
+
+	s->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(s->listenFd < 0 || bind(s->listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		dprintf(0, "ERROR: Can't listen on %s\n", socketPath);
+		return deleteServer(s);
+	}
+	if(listen(s->listenFd, SOMAXCONN) != 0 || pipe(s->wakeFds) != 0) {
+		dprintf(0, "ERROR: Can't listen on %s\n", socketPath);
+		unlink(socketPath);
+		return deleteServer(s);
+	}
+	return s;
+}
+
+// Only once serverRun has returned
+Server * deleteServer(Server * s) {
+	if(s != NULL) {
+		if(s->listenFd >= 0) {
+			close(s->listenFd);
+		}
+		if(s->wakeFds[0] >= 0) {
+			close(s->wakeFds[0]);
+			close(s->wakeFds[1]);
+		}
+		pthread_cond_destroy(&s->idle);
+		pthread_mutex_destroy(&s->lock);
+		pthread_mutex_destroy(&s->work);
+		free(s->socketPath);
+		free(s);
+	}
+	return NULL;
+}
+
+//----------------------------------------------------------------------------
+//  RUN / STOP
+//----------------------------------------------------------------------------
+
+// Accept connections until serverStop is called. Then stop listening, remove the socket, and wait
+// for the requests in progress. Returns 0 on success, 1 if accepting connections failed.
+int serverRun(Server * s) {
+	dprintf(1, "Listening on %s\n", s->socketPath);
+	fflush(stdout);
+	int rval = 0;
+	for(;;) {
+		struct pollfd fds[2] = { { s->listenFd, POLLIN, 0 }, { s->wakeFds[0], POLLIN, 0 } };
+		if(poll(fds, 2, -1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			rval = 1;
+			break;
+		}
+		if(fds[1].revents != 0) {
+			break;
+		}
+		if(fds[0].revents == 0) {
+			continue;
+		}
+		int fd = accept(s->listenFd, NULL, NULL);
+		if(fd < 0) {
+			if(errno == EINTR || errno == ECONNABORTED || errno == EAGAIN) {
+				continue;
+			}
+			dprintf(0, "ERROR: Failed to accept a connection.\n");
+			rval = 1;
+			break;
+		}
+		startConnection(s, fd);
+	}
+
+	close(s->listenFd);
+	s->listenFd = -1;
+	unlink(s->socketPath);
+
+	// connections waiting for their next request end now; one being answered ends after its reply
+	pthread_mutex_lock(&s->lock);
+	for(int i=0; i<SERVE_MAX_CONNECTIONS; i++) {
+		if(s->conns[i] >= 0) {
+			shutdown(s->conns[i], SHUT_RD);
+		}
+	}
+	while(s->connCount > 0) {
+		pthread_cond_wait(&s->idle, &s->lock);
+	}
+	dprintf(1, "Server: %zu request(s), %zu failed.\n", s->requests, s->failures);
+	pthread_mutex_unlock(&s->lock);
+	return rval;
+}
+
+// Make serverRun return. Safe to call from any thread.
+void serverStop(Server * s) {
+	u8 b = 0;
+	while(write(s->wakeFds[1], &b, 1) < 0 && errno == EINTR) {
+	}
+}
+
+static int signalWakeFd = -1;
+
+static void stopSignalHandler(int sig) {
+	(void)sig;
+	u8 b = 0;
+	if(write(signalWakeFd, &b, 1) < 0) {
+		// nothing more can be done in a signal handler
+	}
+}
+
+// Stop s cleanly on SIGINT or SIGTERM, rather than leaving the socket behind
+void serverStopOnSignals(Server * s) {
+	signalWakeFd = s->wakeFds[1];
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stopSignalHandler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+//----------------------------------------------------------------------------
+//  CLIENT
+//----------------------------------------------------------------------------
+
+// Connect to a server. Returns the socket, or -1 on failure.
+int serveConnect(const char * socketPath) {
+	struct sockaddr_un addr;
+	if(!socketAddress(socketPath, &addr)) {
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+// Send one request and wait for its reply. args may be NULL. Returns the ServeStatus, with the reply
+// data (the result, or an error message) in *reply, or -1 with *reply NULL if the connection failed.
+int serveCall(int fd, ServeOp op, const char * args, const u8 * data, size_t size, Bytes ** reply) {
+	*reply = NULL;
+	if(sendMessage(fd, SERVE_REQUEST_MAGIC, (u32)op, args, data, size) != 0) {
+		return -1;
+	}
+	u8 header[SERVE_HEADER_SIZE];
+	if(recvAll(fd, header, sizeof(header)) != 0 || get_u32(&header[0]) != SERVE_REPLY_MAGIC) {
+		return -1;
+	}
+	Bytes * b = newBytes(get_u32(&header[8]));
+	if(b == NULL || recvAll(fd, b->data, b->size) != 0) {
+		deleteBytes(b);
+		return -1;
+	}
+	*reply = b;
+	return (get_u32(&header[4]) == SERVE_OK) ? SERVE_OK : SERVE_FAILED;
+}
+
+// Send fileName to the server, and write the result to out, which is closed. Returns 0 on success.
+int serveClient(const char * socketPath, ServeOp op, const char * args, const char * fileName, OutFile * out) {
+	Bytes * data = mapBytesFromFile(fileName);
+	if(data == NULL) {
+		dprintf(0, "ERROR: Failed to read %s\n", fileName);
+		outputClose(out, false);
+		return 1;
+	}
+	int fd = serveConnect(socketPath);
+	if(fd < 0) {
+		dprintf(0, "ERROR: Can't connect to %s\n", socketPath);
+		deleteBytes(data);
+		outputClose(out, false);
+		return 1;
+	}
+	Bytes * reply = NULL;
+	int status = serveCall(fd, op, args, data->data, data->size, &reply);
+	close(fd);
+	deleteBytes(data);
+
+	bool ok = (status == SERVE_OK);
+	if(status < 0) {
+		dprintf(0, "ERROR: No reply from %s\n", socketPath);
+	} else if(!ok) {
+		dprintf(0, "ERROR: %.*s\n", (int)reply->size, (const char *)reply->data);
+	} else {
+		OutPiece piece = { reply->data, reply->size };
+		ok = (outputWrite(out, &piece, 1) == 0);
+		if(!ok) {
+			dprintf(0, "ERROR: Failed to write the reply.\n");
+		}
+	}
+	deleteBytes(reply);
+	if(outputClose(out, ok) != 0) {
+		ok = false;
+	}
+	return ok ? 0 : 1;
+}
+
+//----------------------------------------------------------------------------
+//  OP NAMES
+//----------------------------------------------------------------------------
+
+const char * serveOpStr(ServeOp op) {
+	switch(op) {
+		case SERVE_INDEX: return "index";
+		case SERVE_DUMP: return "dump";
+		case SERVE_RENDER: return "render";
+		case SERVE_CONVERT: return "convert";
+		case SERVE_IMAGE: return "image";
+	}
+	return "unknown";
+}
+
+// The op named str, or -1 if there isn't one
+int serveOpFromStr(const char * str) {
+	for(int op=SERVE_INDEX; op<=SERVE_IMAGE; op++) {
+		if(streq(str, serveOpStr((ServeOp)op))) {
+			return op;
+		}
+	}
+	return -1;
+}
+
+#endif
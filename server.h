@@ -0,0 +1,65 @@
+// server.h
+// a long-lived process answering requests over a Unix domain socket, and a client for it
+
+//----------------------------------------------------------------------------
+//  PROTOCOL
+//----------------------------------------------------------------------------
+
+// Every request and reply starts with a header of four little-endian u32s:
+//   request: SERVE_REQUEST_MAGIC, op, args size, data size; then the args, then the data
+//   reply:   SERVE_REPLY_MAGIC, status, data size, 0; then the data
+// A connection can carry any number of requests, each answered before the next is read.
+#define SERVE_REQUEST_MAGIC 0x51574441		// "ADWQ"
+#define SERVE_REPLY_MAGIC 0x52574441		// "ADWR"
+#define SERVE_HEADER_SIZE 16
+#define SERVE_MAX_REQUEST (64 * 1024 * 1024)	// args and data together
+#define SERVE_MAX_CONNECTIONS 64
+
+// Args are text, one "key=value" per line:
+//   format=bin|raw|bmp|png|qoi            dump, render and convert. Defaults to bmp.
+//   time=TIME steps=N hr=N battery=N kcal=N weather=N     render, as on the command line
+//   width=N height=N                      convert: the data is RLE_NEW, as dumped with --bin
+//   image=N                               image: 0 for the preview, then in header order. Defaults to 0.
+typedef enum _ServeOp {
+	SERVE_INDEX = 1,		// data: a face. Reply: JSON listing its elements and images.
+	SERVE_DUMP = 2,			// data: a face. Reply: a tar of watchface.json and the images, as --archive makes.
+	SERVE_RENDER = 3,		// data: a face. Reply: one image of the rendered face.
+	SERVE_CONVERT = 4,		// data: a BMP or QOI file, or RLE_NEW data. Reply: the image in the format asked for.
+	SERVE_IMAGE = 5,		// data: a face. Reply: one of its images, as dumped. Only that image is decoded.
+} ServeOp;
+
+typedef enum _ServeStatus {
+	SERVE_OK = 0,			// the reply data is the result
+	SERVE_FAILED = 1,		// the reply data is an error message
+} ServeStatus;
+
+//----------------------------------------------------------------------------
+//  SERVER
+//----------------------------------------------------------------------------
+
+typedef struct _ServeOptions {
+	ImageCache * cache;		// shared by every request, or NULL
+	bool link;				// store identical images once in dumps
+} ServeOptions;
+
+// Each connection gets a thread, but requests are carried out one at a time, each using the
+// whole thread pool, which stays warm between requests.
+typedef struct _Server Server;
+
+//----------------------------------------------------------------------------
+//  EXPORTED FUNCTIONS
+//----------------------------------------------------------------------------
+
+// Server
+Server * newServer(const char * socketPath, const ServeOptions * opt);
+Server * deleteServer(Server * s);
+int serverRun(Server * s);
+void serverStop(Server * s);
+void serverStopOnSignals(Server * s);
+
+// Client
+int serveConnect(const char * socketPath);
+int serveCall(int fd, ServeOp op, const char * args, const u8 * data, size_t size, Bytes ** reply);
+int serveClient(const char * socketPath, ServeOp op, const char * args, const char * fileName, OutFile * out);
+const char * serveOpStr(ServeOp op);
+int serveOpFromStr(const char * str);
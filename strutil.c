@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <assert.h>
 #include "types.h"
 #include "strutil.h"
@@ -98,6 +100,22 @@ uint32_t readNum(char * s) {
     return total;
 }
 
+// read a whole decimal unsigned integer, no more than max
+// return false, leaving value alone, if s is anything else
+bool readUnsigned(const char * s, unsigned max, unsigned * value) {
+	if(s[0] < '0' || s[0] > '9') {
+		return false;
+	}
+	char * end;
+	errno = 0;
+	unsigned long n = strtoul(s, &end, 10);
+	if(errno != 0 || *end != 0 || n > max) {
+		return false;
+	}
+	*value = (unsigned)n;
+	return true;
+}
+
 // Append src to end of dst string.
 // Probably not compatible with other strlcat, but should be safe.
 // dstSize is total size of dst buffer. Returns new length of dst. 
@@ -10,6 +10,7 @@ typedef struct _TokensIdx {
 void getTokensIdx(char * s, TokensIdx * t);
 int isNum(char * s);
 uint32_t readNum(char * s);
+bool readUnsigned(const char * s, unsigned max, unsigned * value);
 size_t d_strlcat(char * dst, const char * src, size_t dstSize);
 
 //----------------------------------------------------------------------------
@@ -10,6 +10,13 @@ void set_u16(u8 * p, u16 v) {
     p[1] = v>>8;
 }
 
+void set_u32(u8 * p, u32 v) {
+    p[0] = v&0xFF;
+    p[1] = (v>>8)&0xFF;
+    p[2] = (v>>16)&0xFF;
+    p[3] = v>>24;
+}
+
 // return 0 for big endian, 1 for little endian.
 int systemIsLittleEndian() {				
     volatile uint32_t i=0x01234567;
@@ -8,6 +8,8 @@ typedef int16_t i16;
 typedef uint16_t u16;
 typedef int32_t i32;
 typedef uint32_t u32;
+typedef int64_t i64;
+typedef uint64_t u64;
 
 //----------------------------------------------------------------------------
 //  BASIC BYTE-ORDER MACROS
@@ -25,5 +27,8 @@ typedef uint32_t u32;
 // sets a LE u16, without care for alignment or system byte order
 void set_u16(u8 * p, u16 v);
 
+// sets a LE u32, without care for alignment or system byte order
+void set_u32(u8 * p, u32 v);
+
 // return 0 for big endian, 1 for little endian.
 int systemIsLittleEndian();